@@ -4,8 +4,10 @@
 #  FFTW3_INCLUDE_DIR, where to find FFTW3lib.h, etc.
 #  FFTW3_LIBRARIES, the libraries needed to use FFTW3.
 #  JFFTW3_FOUND, If false, do not try to use FFTW3.
+#  FFTW3_THREADS_FOUND, If true, FFTW3_LIBRARIES also contains fftw3_threads.
 # also defined, but not for general use are
 #  FFTW3_LIBRARY, where to find the FFTW3 library.
+#  FFTW3_THREADS_LIBRARY, where to find the fftw3_threads library.
 
 FIND_PATH(FFTW3_INCLUDE_DIR fftw3.h)
 
@@ -19,6 +21,14 @@ FIND_PACKAGE_HANDLE_STANDARD_ARGS(FFTW3 DEFAULT_MSG FFTW3_LIBRARY FFTW3_INCLUDE_
 
 IF(FFTW3_FOUND)
   SET(FFTW3_LIBRARIES ${FFTW3_LIBRARY})
+
+  # the multi-threaded planner is an optional, separate library next to the main one
+  GET_FILENAME_COMPONENT(FFTW3_LIBRARY_DIR ${FFTW3_LIBRARY} PATH)
+  FIND_LIBRARY(FFTW3_THREADS_LIBRARY NAMES fftw3_threads HINTS ${FFTW3_LIBRARY_DIR})
+  IF(FFTW3_THREADS_LIBRARY)
+    SET(FFTW3_THREADS_FOUND TRUE)
+    SET(FFTW3_LIBRARIES ${FFTW3_THREADS_LIBRARY} ${FFTW3_LIBRARY})
+  ENDIF(FFTW3_THREADS_LIBRARY)
 ENDIF(FFTW3_FOUND)
 
 # Deprecated declarations.
@@ -4,8 +4,10 @@
 #  FFTW3F_INCLUDE_DIR, where to find fftw3.h, etc.
 #  FFTW3F_LIBRARIES, the libraries needed to use single-precision FFTW3.
 #  JFFTW3_FOUND, If false, do not try to use FFTW3.
+#  FFTW3F_THREADS_FOUND, If true, FFTW3F_LIBRARIES also contains fftw3f_threads.
 # also defined, but not for general use are
 #  FFTW3F_LIBRARY, where to find the single-precision FFTW3 library.
+#  FFTW3F_THREADS_LIBRARY, where to find the fftw3f_threads library.
 
 FIND_PATH(FFTW3F_INCLUDE_DIR fftw3.h)
 
@@ -19,6 +21,14 @@ FIND_PACKAGE_HANDLE_STANDARD_ARGS(FFTW3F DEFAULT_MSG FFTW3F_LIBRARY FFTW3F_INCLU
 
 IF(FFTW3F_FOUND)
   SET(FFTW3F_LIBRARIES ${FFTW3F_LIBRARY})
+
+  # the multi-threaded planner is an optional, separate library next to the main one
+  GET_FILENAME_COMPONENT(FFTW3F_LIBRARY_DIR ${FFTW3F_LIBRARY} PATH)
+  FIND_LIBRARY(FFTW3F_THREADS_LIBRARY NAMES fftw3f_threads HINTS ${FFTW3F_LIBRARY_DIR})
+  IF(FFTW3F_THREADS_LIBRARY)
+    SET(FFTW3F_THREADS_FOUND TRUE)
+    SET(FFTW3F_LIBRARIES ${FFTW3F_THREADS_LIBRARY} ${FFTW3F_LIBRARY})
+  ENDIF(FFTW3F_THREADS_LIBRARY)
 ENDIF(FFTW3F_FOUND)
 
 # Deprecated declarations.
@@ -26,7 +26,9 @@ void convolveImpl(const Overlaps<DataArray>& overlaps, OutputBlocksIterator outp
     MultiCoordinateIterator<N> end = it.getEndIterator();
     for( ; it != end; ++it)
     {
-        OutputBlock output_block = output_blocks_begin[*it];
+        // the iterator holds the reference to the chunk of output_block
+        OutputBlocksIterator output_blocks_it = output_blocks_begin + *it;
+        OutputBlock output_block = *output_blocks_it;
         OverlappingBlock<DataArray> data_block = overlaps[*it];
         separableConvolveMultiArray(data_block.block, output_block, kit, data_block.inner_bounds.first, data_block.inner_bounds.second);
     }
@@ -37,6 +37,8 @@
 #define VIGRA_BLOCKWISE_LABELING_HXX
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include "threadpool.hxx"
 #include "counting_iterator.hxx"
@@ -108,12 +110,14 @@ public:
 namespace blockwise_labeling_detail
 {
 
+    // Collects the pairs of (global) labels that have to be merged
+    // along the border between two blocks.
 template <class Equal, class Label>
 struct BorderVisitor
 {
     Label u_label_offset;
     Label v_label_offset;
-    UnionFindArray<Label>* global_unions;
+    std::vector<std::pair<Label, Label> >* merges;
     Equal* equal;
 
     template <class Data, class Shape>
@@ -121,7 +125,10 @@ struct BorderVisitor
     {
         if(labeling_equality::callEqual(*equal, u_data, v_data, diff))
         {
-            global_unions->makeUnion(u_label + u_label_offset, v_label + v_label_offset);
+            std::pair<Label, Label> merge(u_label + u_label_offset, v_label + v_label_offset);
+            // neighboring border pixels mostly belong to the same pair of regions
+            if(merges->empty() || merges->back() != merge)
+                merges->push_back(merge);
         }
     }
 };
@@ -160,10 +167,6 @@ blockwiseLabeling(DataBlocksIterator data_blocks_begin, DataBlocksIterator data_
     // mapping stage: label each block and save number of labels assigned in blocks before the current block in label_offsets
     Label unmerged_label_number;
     {
-        DataBlocksIterator data_blocks_it = data_blocks_begin;
-        LabelBlocksIterator label_blocks_it = label_blocks_begin;
-        typename MultiArray<Dimensions, Label>::iterator offsets_it = label_offsets.begin();
-        Label current_offset = 0;
         // a la OPENMP_PRAGMA FOR
 
         auto d = std::distance(data_blocks_begin, data_blocks_end);
@@ -175,7 +178,11 @@ blockwiseLabeling(DataBlocksIterator data_blocks_begin, DataBlocksIterator data_
 
         parallel_foreach(options.getNumThreads(), d,
             [&](const int /*threadId*/, const uint64_t i){
-                Label resVal = labelMultiArray(data_blocks_it[i], label_blocks_it[i],
+                // keep the iterators alive while their blocks are in use:
+                // for ChunkIterators, they hold the reference to the chunk
+                DataBlocksIterator data_blocks_it = data_blocks_begin + i;
+                LabelBlocksIterator label_blocks_it = label_blocks_begin + i;
+                Label resVal = labelMultiArray(*data_blocks_it, *label_blocks_it,
                                                options, equal);
                 if(has_background) // FIXME: reversed condition?
                     ++resVal;
@@ -183,11 +190,9 @@ blockwiseLabeling(DataBlocksIterator data_blocks_begin, DataBlocksIterator data_
             }
         );
 
-        for(int i=0; i<d;++i){
-            offsets_it[i] = current_offset;
-            current_offset+=nSeg[i];
-        }
-
+        Label current_offset = parallel_exclusive_scan(options.getNumThreads(),
+                                                       nSeg.begin(), nSeg.end(),
+                                                       label_offsets.data(), Label(0));
 
         unmerged_label_number = current_offset;
         if(!has_background)
@@ -195,105 +200,112 @@ blockwiseLabeling(DataBlocksIterator data_blocks_begin, DataBlocksIterator data_
     }
 
     // reduce stage: merge adjacent labels if the region overlaps
-    UnionFindArray<Label> global_unions(unmerged_label_number);
+    // (the union-find array may be updated by all threads concurrently)
+    ConcurrentUnionFindArray<Label> global_unions(unmerged_label_number);
     if(has_background)
     {
         // merge all labels that refer to background
-        for(typename MultiArray<Dimensions, Label>::iterator offsets_it = label_offsets.begin();
-                offsets_it != label_offsets.end();
-                ++offsets_it)
-        {
-            global_unions.makeUnion(0, *offsets_it);
-        }
+        parallel_foreach(options.getNumThreads(), label_offsets.size(),
+            [&](const int /*threadId*/, const uint64_t i){
+                global_unions.makeUnion(0, label_offsets.data()[i]);
+            }
+        );
     }
 
     typedef GridGraph<Dimensions, undirected_tag> Graph;
     typedef typename Graph::edge_iterator EdgeIterator;
     Graph blocks_graph(blocks_shape, options.getNeighborhood());
+    std::vector<std::pair<Shape, Shape> > block_pairs;
     for(EdgeIterator it = blocks_graph.get_edge_iterator(); it != blocks_graph.get_edge_end_iterator(); ++it)
-    {
-        Shape u = blocks_graph.u(*it);
-        Shape v = blocks_graph.v(*it);
-        Shape difference = v - u;
-
-        BorderVisitor<Equal, Label> border_visitor;
-        border_visitor.u_label_offset = label_offsets[u];
-        border_visitor.v_label_offset = label_offsets[v];
-        border_visitor.global_unions = &global_unions;
-        border_visitor.equal = &equal;
-        visitBorder(data_blocks_begin[u], label_blocks_begin[u],
-                    data_blocks_begin[v], label_blocks_begin[v],
-                    difference, options.getNeighborhood(), border_visitor);
-    }
+        block_pairs.push_back(std::make_pair(blocks_graph.u(*it), blocks_graph.v(*it)));
+
+    // visit the block borders in parallel and collect the label pairs to be merged,
+    // the union-find operations are then only needed once per distinct pair
+    parallel_foreach(options.getNumThreads(), block_pairs.size(),
+        [&](const int /*threadId*/, const uint64_t k){
+            Shape u = block_pairs[k].first;
+            Shape v = block_pairs[k].second;
+
+            std::vector<std::pair<Label, Label> > merges;
+            BorderVisitor<Equal, Label> border_visitor;
+            border_visitor.u_label_offset = label_offsets[u];
+            border_visitor.v_label_offset = label_offsets[v];
+            border_visitor.merges = &merges;
+            border_visitor.equal = &equal;
+            DataBlocksIterator data_u = data_blocks_begin + u,
+                               data_v = data_blocks_begin + v;
+            LabelBlocksIterator labels_u = label_blocks_begin + u,
+                                labels_v = label_blocks_begin + v;
+            visitBorder(*data_u, *labels_u, *data_v, *labels_v,
+                        v - u, options.getNeighborhood(), border_visitor);
+
+            std::sort(merges.begin(), merges.end());
+            merges.erase(std::unique(merges.begin(), merges.end()), merges.end());
+            for(std::size_t i = 0; i < merges.size(); ++i)
+                global_unions.makeUnion(merges[i].first, merges[i].second);
+        }
+    );
+
+    // resolve the global labels once, so that the mapping can be filled in parallel
+    Label last_label = global_unions.makeContiguous(options.getNumThreads());
+    std::vector<Label> global_labels(unmerged_label_number);
+    parallel_foreach(options.getNumThreads(), unmerged_label_number,
+        [&](const int /*threadId*/, const uint64_t current_label){
+            global_labels[current_label] = global_unions.findLabel((Label)current_label);
+        }
+    );
 
     // fill mapping (local labels) -> (global labels)
-    Label last_label = global_unions.makeContiguous();
-    {
-        typename MultiArray<Dimensions, Label>::iterator offsets_it = label_offsets.begin();
-        Label offset = *offsets_it;
-        ++offsets_it;
-        typename Mapping::iterator mapping_it = mapping.begin();
-        for( ; offsets_it != label_offsets.end(); ++offsets_it, ++mapping_it)
-        {
-            mapping_it->clear();
-            Label next_offset = *offsets_it;
+    typename Mapping::iterator mapping_begin = mapping.begin();
+    parallel_foreach(options.getNumThreads(), label_offsets.size(),
+        [&](const int /*threadId*/, const uint64_t i){
+            Label offset = label_offsets.data()[i];
+            // for the last block, use the total label count instead of the next offset
+            Label next_offset = i + 1 < (uint64_t)label_offsets.size()
+                                    ? label_offsets.data()[i + 1]
+                                    : (has_background ? unmerged_label_number : unmerged_label_number - 1);
+            std::vector<Label> & block_mapping = mapping_begin[i];
+            block_mapping.clear();
             if(has_background)
             {
                 for(Label current_label = offset; current_label != next_offset; ++current_label)
-                {
-                    mapping_it->push_back(global_unions.findLabel(current_label));
-                }
+                    block_mapping.push_back(global_labels[current_label]);
             }
             else
             {
-                mapping_it->push_back(0); // local labels start at 1
+                block_mapping.push_back(0); // local labels start at 1
                 for(Label current_label = offset + 1; current_label != next_offset + 1; ++current_label)
-                {
-                    mapping_it->push_back(global_unions.findLabel(current_label));
-                }
-            }
-
-            offset = next_offset;
-        }
-        // last block:
-        // instead of next_offset, use last_label+1
-        mapping_it->clear();
-        if(has_background)
-        {
-            for(Label current_label = offset; current_label != unmerged_label_number; ++current_label)
-            {
-                mapping_it->push_back(global_unions.findLabel(current_label));
-            }
-        }
-        else
-        {
-            mapping_it->push_back(0);
-            for(Label current_label = offset + 1; current_label != unmerged_label_number; ++current_label)
-            {
-                mapping_it->push_back(global_unions.findLabel(current_label));
+                    block_mapping.push_back(global_labels[current_label]);
             }
         }
-    }
+    );
     return last_label;
 }
 
 
 template <class LabelBlocksIterator, class MappingIterator>
 void toGlobalLabels(LabelBlocksIterator label_blocks_begin, LabelBlocksIterator label_blocks_end,
-                    MappingIterator mapping_begin, MappingIterator mapping_end)
+                    MappingIterator mapping_begin, MappingIterator mapping_end,
+                    int numThreads = 1)
 {
     typedef typename LabelBlocksIterator::value_type LabelBlock;
-    for( ; label_blocks_begin != label_blocks_end; ++label_blocks_begin, ++mapping_begin)
-    {
-        vigra_assert(mapping_begin != mapping_end, "");
-        for(typename LabelBlock::iterator labels_it = label_blocks_begin->begin();
-            labels_it != label_blocks_begin->end();
-            ++labels_it)
-        {
-            vigra_assert(*labels_it < mapping_begin->size(), "");
-            *labels_it = (*mapping_begin)[*labels_it];
+    vigra_assert(std::distance(mapping_begin, mapping_end) >= std::distance(label_blocks_begin, label_blocks_end), "");
+    ignore_argument(mapping_end);
+    parallel_foreach(numThreads, std::distance(label_blocks_begin, label_blocks_end),
+        [&](const int /*threadId*/, const uint64_t i){
+            // the iterator holds the reference to the chunk of label_block
+            LabelBlocksIterator label_blocks_it = label_blocks_begin + i;
+            LabelBlock label_block = *label_blocks_it;
+            auto const & mapping = mapping_begin[i];
+            for(typename LabelBlock::iterator labels_it = label_block.begin();
+                labels_it != label_block.end();
+                ++labels_it)
+            {
+                vigra_assert(*labels_it < mapping.size(), "");
+                *labels_it = mapping[*labels_it];
+            }
         }
-    }
+    );
 }
 
 } // namespace blockwise_labeling_detail
@@ -439,7 +451,8 @@ Label labelMultiArrayBlockwise(const MultiArrayView<N, Data, S1>& data,
                                          options, equal, mapping);
 
     // replace local labels by global labels
-    toGlobalLabels(label_blocks.begin(), label_blocks.end(), mapping.begin(), mapping.end());
+    toGlobalLabels(label_blocks.begin(), label_blocks.end(), mapping.begin(), mapping.end(),
+                   options.getNumThreads());
     return last_label;
 }
 
@@ -489,7 +502,8 @@ Label labelMultiArrayBlockwise(const ChunkedArray<N, Data>& data,
     MultiArray<N, std::vector<Label> > mapping(data.chunkArrayShape());
     Label result = labelMultiArrayBlockwise(data, labels, options, equal, mapping);
     typedef typename ChunkedArray<N, Data>::shape_type Shape;
-    toGlobalLabels(labels.chunk_begin(Shape(0), data.shape()), labels.chunk_end(Shape(0), data.shape()), mapping.begin(), mapping.end());
+    toGlobalLabels(labels.chunk_begin(Shape(0), data.shape()), labels.chunk_end(Shape(0), data.shape()),
+                   mapping.begin(), mapping.end(), options.getNumThreads());
     return result;
 }
 
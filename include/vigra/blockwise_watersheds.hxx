@@ -43,8 +43,10 @@
 #include "blockwise_labeling.hxx"
 #include "metaprogramming.hxx"
 #include "overlapped_blocks.hxx"
+#include "priority_queue.hxx"
 
 #include <limits>
+#include <vector>
 
 namespace vigra
 {
@@ -76,7 +78,9 @@ void prepareBlockwiseWatersheds(const Overlaps<DataArray>& overlaps,
         itBegin,end,
         [&](const int /*threadId*/, const Coordinate  iterVal){
 
-            DirectionsBlock directions_block = directions_blocks_begin[iterVal];
+            // the iterator holds the reference to the chunk of directions_block
+            DirectionsBlocksIterator directions_blocks_it = directions_blocks_begin + iterVal;
+            DirectionsBlock directions_block = *directions_blocks_it;
             OverlappingBlock<DataArray> data_block = overlaps[iterVal];
 
             typedef GridGraph<DataArray::actual_dimension, undirected_tag> Graph;
@@ -131,6 +135,230 @@ struct UnionFindWatershedsEquality
     {};
 };
 
+    // Process the blocks of seededWatershedsBlockwise() until nothing changes.
+    // The blocks are visited in 2^N colors (parities), so that the blocks
+    // processed in parallel never access each other's chunks (including the
+    // halos). A block is revisited when one of its neighbors has changed since
+    // it was last processed. process_block(block, first_visit) must return
+    // whether the block has changed.
+template <unsigned int N, class ProcessBlock>
+void sweepBlocks(const typename MultiArrayShape<N>::type& blocks_shape,
+                 int num_threads,
+                 ProcessBlock process_block)
+{
+    typedef typename MultiArrayShape<N>::type Shape;
+
+    MultiCoordinateIterator<N> blocks_begin(blocks_shape);
+    MultiCoordinateIterator<N> blocks_end = blocks_begin.getEndIterator();
+    MultiArray<N, int> processed_at(blocks_shape, -1), changed_at(blocks_shape, -1);
+    int step = 0;
+    for(bool processed = true; processed; )
+    {
+        processed = false;
+        for(int color = 0; color < (1 << N); ++color, ++step)
+        {
+            std::vector<Shape> todo;
+            for(MultiCoordinateIterator<N> block = blocks_begin; block != blocks_end; ++block)
+            {
+                int block_color = 0;
+                for(int k = 0; k < (int)N; ++k)
+                    block_color |= ((*block)[k] & 1) << k;
+                if(block_color != color)
+                    continue;
+
+                bool needs_update = processed_at[*block] < 0;
+                MultiCoordinateIterator<N> offset(Shape(3));
+                MultiCoordinateIterator<N> offset_end = offset.getEndIterator();
+                for(; !needs_update && offset != offset_end; ++offset)
+                {
+                    Shape neighbor = *block + *offset - Shape(1);
+                    if(neighbor != *block && allLessEqual(Shape(0), neighbor) && allLess(neighbor, blocks_shape))
+                        needs_update = changed_at[neighbor] > processed_at[*block];
+                }
+                if(needs_update)
+                    todo.push_back(*block);
+            }
+
+            parallel_foreach(num_threads, todo.size(),
+                [&](const int /*threadId*/, const uint64_t k){
+                    Shape block = todo[k];
+                    if(process_block(block, processed_at[block] < 0))
+                        changed_at[block] = step;
+                    processed_at[block] = step;
+                }
+            );
+            if(!todo.empty())
+                processed = true;
+        }
+    }
+}
+
+    // First stage of seededWatershedsBlockwise(): compute the flooding cost of every
+    // pixel in a block, i.e. the minimum over all seeds of the maximal data value
+    // along a path from the seed. Unreached pixels have the maximal cost. The
+    // pixels in the halo act as sources, and on the first visit, the seeds in the
+    // block as well (later, the block interior is already consistent).
+template <unsigned int N, class Data>
+bool floodBlockCosts(const Overlaps<ChunkedArray<N, Data> >& data_overlaps,
+                     const Overlaps<ChunkedArray<N, Data> >& costs_overlaps,
+                     ChunkedArray<N, Data>& costs,
+                     const typename MultiArrayShape<N>::type& block_coordinates,
+                     NeighborhoodType neighborhood,
+                     bool first_visit)
+{
+    typedef typename MultiArrayShape<N>::type Shape;
+    typedef GridGraph<N, undirected_tag> Graph;
+    typedef typename Graph::NodeIt GraphScanner;
+    typedef typename Graph::OutArcIt NeighborIterator;
+
+    OverlappingBlock<ChunkedArray<N, Data> > data_block = data_overlaps[block_coordinates];
+    OverlappingBlock<ChunkedArray<N, Data> > costs_block = costs_overlaps[block_coordinates];
+    const std::pair<Shape, Shape>& inner_bounds = data_block.inner_bounds;
+    MultiArray<N, Data> const & data = data_block.block;
+    MultiArray<N, Data> & block_costs = costs_block.block;
+
+    Graph graph(data.shape(), neighborhood);
+    PriorityQueue<Shape, Data, true> pqueue;
+    for(GraphScanner node(graph); node != lemon::INVALID; ++node)
+    {
+        if(block_costs[*node] < NumericTraits<Data>::max() && (first_visit || !within(*node, inner_bounds)))
+            pqueue.push(*node, block_costs[*node]);
+    }
+
+    bool changed = false;
+    while(!pqueue.empty())
+    {
+        Shape node = pqueue.top();
+        Data cost = static_cast<Data>(pqueue.topPriority());
+        pqueue.pop();
+        if(cost != block_costs[node]) // outdated entry
+            continue;
+
+        for(NeighborIterator arc(graph, node); arc != lemon::INVALID; ++arc)
+        {
+            Shape target = graph.target(*arc);
+            Data target_cost = std::max(cost, data[target]);
+            if(within(target, inner_bounds) && target_cost < block_costs[target])
+            {
+                block_costs[target] = target_cost;
+                pqueue.push(target, target_cost);
+                changed = true;
+            }
+        }
+    }
+
+    if(changed)
+        costs.commitSubarray(block_coordinates * costs.chunkShape(),
+                             block_costs.subarray(inner_bounds.first, inner_bounds.second));
+    return changed;
+}
+
+    // Second stage of seededWatershedsBlockwise(): with the flooding costs known,
+    // every pixel inherits the label of the neighbor that region growing would
+    // have processed first, i.e. the one with the lowest cost, then the one with
+    // the fewest steps on its cost level (approximating the FIFO order of region
+    // growing on plateaus), then the one with the smallest label. Seeds have zero
+    // steps. Since this neighbor always has lower cost or fewer steps, the labeling
+    // is unique and every region is connected to its seed.
+template <unsigned int N, class Data, class Label>
+bool floodBlockLabels(const Overlaps<ChunkedArray<N, Data> >& data_overlaps,
+                      const Overlaps<ChunkedArray<N, Data> >& costs_overlaps,
+                      const Overlaps<ChunkedArray<N, Label> >& labels_overlaps,
+                      const Overlaps<ChunkedArray<N, UInt32> >& steps_overlaps,
+                      ChunkedArray<N, Label>& labels,
+                      ChunkedArray<N, UInt32>& steps,
+                      const typename MultiArrayShape<N>::type& block_coordinates,
+                      NeighborhoodType neighborhood,
+                      bool first_visit)
+{
+    typedef typename MultiArrayShape<N>::type Shape;
+    typedef GridGraph<N, undirected_tag> Graph;
+    typedef typename Graph::NodeIt GraphScanner;
+    typedef typename Graph::OutArcIt NeighborIterator;
+    typedef std::pair<Data, UInt32> Priority;
+
+    OverlappingBlock<ChunkedArray<N, Data> > data_block = data_overlaps[block_coordinates];
+    OverlappingBlock<ChunkedArray<N, Data> > costs_block = costs_overlaps[block_coordinates];
+    OverlappingBlock<ChunkedArray<N, Label> > labels_block = labels_overlaps[block_coordinates];
+    OverlappingBlock<ChunkedArray<N, UInt32> > steps_block = steps_overlaps[block_coordinates];
+    const std::pair<Shape, Shape>& inner_bounds = data_block.inner_bounds;
+    MultiArray<N, Data> const & data = data_block.block;
+    MultiArray<N, Data> const & block_costs = costs_block.block;
+    MultiArray<N, Label> & block_labels = labels_block.block;
+    MultiArray<N, UInt32> & block_steps = steps_block.block;
+
+    // process the pixels in the order of (cost, steps), so that the candidates
+    // of a pixel are usually final before the pixel itself is evaluated
+    Graph graph(data.shape(), neighborhood);
+    PriorityQueue<Shape, Priority, true> pqueue;
+    for(GraphScanner node(graph); node != lemon::INVALID; ++node)
+    {
+        if(block_labels[*node] != 0 && (first_visit || !within(*node, inner_bounds)))
+            pqueue.push(*node, Priority(block_costs[*node], block_steps[*node]));
+    }
+
+    bool changed = false;
+    while(!pqueue.empty())
+    {
+        Shape node = pqueue.top();
+        UInt32 node_steps = pqueue.topPriority().second;
+        pqueue.pop();
+        if(node_steps != block_steps[node]) // outdated entry
+            continue;
+
+        Data cost = block_costs[node];
+        for(NeighborIterator arc(graph, node); arc != lemon::INVALID; ++arc)
+        {
+            Shape target = graph.target(*arc);
+            Data target_cost = block_costs[target];
+            if(!within(target, inner_bounds) || target_cost < cost ||
+               (block_labels[target] != 0 && block_steps[target] == 0)) // seeds are never relabeled
+                continue;
+
+            // re-evaluate the target from all its neighbors, since the label
+            // of the best one may have changed
+            Data best_cost = NumericTraits<Data>::max();
+            UInt32 best_steps = NumericTraits<UInt32>::max();
+            Label best_label = 0;
+            for(NeighborIterator candidate(graph, target); candidate != lemon::INVALID; ++candidate)
+            {
+                Shape source = graph.target(*candidate);
+                Label source_label = block_labels[source];
+                if(source_label == 0)
+                    continue;
+                Data source_cost = block_costs[source];
+                UInt32 source_steps = block_steps[source];
+                if(best_label == 0 || source_cost < best_cost ||
+                   (source_cost == best_cost && (source_steps < best_steps ||
+                                                 (source_steps == best_steps && source_label < best_label))))
+                {
+                    best_cost = source_cost;
+                    best_steps = source_steps;
+                    best_label = source_label;
+                }
+            }
+            UInt32 target_steps = (best_cost < target_cost)
+                                      ? 1
+                                      : best_steps + 1;
+            if(best_label != block_labels[target] || target_steps != block_steps[target])
+            {
+                block_labels[target] = best_label;
+                block_steps[target] = target_steps;
+                pqueue.push(target, Priority(target_cost, target_steps));
+                changed = true;
+            }
+        }
+    }
+
+    if(changed)
+    {
+        Shape block_begin = block_coordinates * labels.chunkShape();
+        labels.commitSubarray(block_begin, block_labels.subarray(inner_bounds.first, inner_bounds.second));
+        steps.commitSubarray(block_begin, block_steps.subarray(inner_bounds.first, inner_bounds.second));
+    }
+    return changed;
+}
+
 } // namespace blockwise_watersheds_detail
 
 /*************************************************************/
@@ -257,6 +485,195 @@ unionFindWatershedsBlockwise(const ChunkedArray<N, Data>& data,
     return unionFindWatershedsBlockwise(data, labels, options, directions);
 }
 
+/*************************************************************/
+/*                                                           */
+/*                      seededWatershedsBlockwise            */
+/*                                                           */
+/*************************************************************/
+
+/** \weakgroup ParallelProcessing
+    \sa seededWatershedsBlockwise <B>(...)</B>
+*/
+
+/** \brief Blockwise seeded watersheds transform for ChunkedArrays.
+
+    <b> Declaration:</b>
+
+    \code
+    namespace vigra {
+        template <unsigned int N, class Data, class Label>
+        Label
+        seededWatershedsBlockwise(const ChunkedArray<N, Data>& data,
+                                  ChunkedArray<N, Label>& labels,  // holds the seeds on input
+                                  BlockwiseLabelOptions const & options = BlockwiseLabelOptions());
+
+        // provide temporary storage for the flooding costs
+        template <unsigned int N, class Data, class Label>
+        Label
+        seededWatershedsBlockwise(const ChunkedArray<N, Data>& data,
+                                  ChunkedArray<N, Label>& labels,
+                                  BlockwiseLabelOptions const & options,
+                                  ChunkedArray<N, Data>& temporary_storage);
+
+        // provide temporary storage for the flooding costs and the step counts
+        template <unsigned int N, class Data, class Label>
+        Label
+        seededWatershedsBlockwise(const ChunkedArray<N, Data>& data,
+                                  ChunkedArray<N, Label>& labels,
+                                  BlockwiseLabelOptions const & options,
+                                  ChunkedArray<N, Data>& temporary_storage,
+                                  ChunkedArray<N, UInt32>& temporary_steps);
+    }
+    \endcode
+
+    This is the out-of-core counterpart of \ref watershedsMultiArray() with method
+    <tt>regionGrowing()</tt> and explicit seeds: \a labels must contain the seeds
+    (non-zero labels), and all other pixels are assigned to a seed by region
+    growing (complete grow, no contours). The result is the same as that of
+    watershedsMultiArray(), except that ties (pixels that would be reached by
+    several regions at the same flooding level and time) may be resolved differently.
+    In contrast to watershedsMultiArray(), the result does not depend on the
+    processing order, i.e. it is the same for all chunk shapes and numbers of threads.
+
+    The computation proceeds in two stages. First, the flooding cost of every pixel
+    is determined, i.e. the smallest possible maximal \a data value along a path from
+    any seed. Then, every pixel inherits the label of its neighbor with the lowest
+    cost. In each stage, the chunks are processed independently, together with a halo
+    of one pixel whose current values act as additional sources. Chunks of the same
+    parity (along every axis) do not touch and are processed in parallel, using
+    the number of threads and the neighborhood given in \a options. This is repeated
+    for the chunks whose neighbors have changed until the result is consistent
+    across all chunk borders, so that only a few chunks of each array need to be
+    in memory at the same time. If \a temporary_storage is provided, it is used
+    to hold the flooding costs, and if \a temporary_steps is provided, it is used to
+    hold the number of steps of each pixel on its cost level (see the second stage).
+    Otherwise, a newly created \ref vigra::ChunkedArrayCompressed is used for each, so
+    that the temporary arrays are bounded by its cache like the other arrays. Pass
+    e.g. a \ref vigra::ChunkedArrayTmpFile or \ref vigra::ChunkedArrayLazy instead to
+    control where the temporary data are held.
+
+    The chunk shapes of all arrays must agree. Custom block shapes in \a options
+    are not supported.
+
+    Return: the largest seed label.
+
+    <b> Usage: </b>
+
+    <b>\#include </b> \<vigra/blockwise_watersheds.hxx\><br>
+    Namespace: vigra
+
+    \code
+    Shape3 shape = Shape3(1000);
+    Shape3 chunk_shape = Shape3(64);
+    ChunkedArrayHDF5<3, float> data(hdf5_file, "gradient", HDF5File::Default, shape, chunk_shape);
+    ChunkedArrayHDF5<3, UInt32> labels(hdf5_file, "seeds", HDF5File::Default, shape, chunk_shape);
+    // fill data and seeds ...
+
+    seededWatershedsBlockwise(data, labels, BlockwiseLabelOptions().neighborhood(IndirectNeighborhood));
+    \endcode
+    */
+doxygen_overloaded_function(template <...> unsigned int seededWatershedsBlockwise)
+
+template <unsigned int N, class Data, class Label>
+Label seededWatershedsBlockwise(const ChunkedArray<N, Data>& data,
+                                ChunkedArray<N, Label>& labels,
+                                BlockwiseLabelOptions const & options,
+                                ChunkedArray<N, Data>& costs,
+                                ChunkedArray<N, UInt32>& steps)
+{
+    using namespace blockwise_watersheds_detail;
+
+    typedef typename ChunkedArray<N, Data>::shape_type Shape;
+    Shape shape = data.shape();
+    vigra_precondition(shape == labels.shape() && shape == costs.shape() && shape == steps.shape(),
+        "seededWatershedsBlockwise(): shapes of data and labels do not match");
+    Shape chunk_shape = data.chunkShape();
+    vigra_precondition(chunk_shape == labels.chunkShape() && chunk_shape == costs.chunkShape() &&
+                       chunk_shape == steps.chunkShape(),
+        "seededWatershedsBlockwise(): chunk shapes do not match");
+    vigra_precondition(options.getBlockShape().size() == 0,
+        "seededWatershedsBlockwise(): custom block shapes not supported "
+        "(always uses the array's chunk shape).");
+
+    Shape blocks_shape = data.chunkArrayShape();
+    MultiCoordinateIterator<N> blocks_begin(blocks_shape);
+    MultiCoordinateIterator<N> blocks_end = blocks_begin.getEndIterator();
+    typedef typename MultiCoordinateIterator<N>::value_type Coordinate;
+
+    // initialize the costs of the seeds with their data values, and all steps with zero
+    MultiArray<N, Label> max_labels(blocks_shape);
+    parallel_foreach(options.getNumThreads(),
+        blocks_begin, blocks_end,
+        [&](const int /*threadId*/, const Coordinate block){
+            Shape block_begin = block * chunk_shape;
+            Shape block_shape = min(block_begin + chunk_shape, shape) - block_begin;
+            MultiArray<N, Data> block_data(block_shape), block_costs(block_shape);
+            MultiArray<N, Label> block_labels(block_shape);
+            MultiArray<N, UInt32> block_steps(block_shape);
+            data.checkoutSubarray(block_begin, block_data);
+            labels.checkoutSubarray(block_begin, block_labels);
+
+            Label max_label = 0;
+            for(MultiArrayIndex k = 0; k < block_labels.size(); ++k)
+            {
+                if(block_labels[k] != 0)
+                {
+                    block_costs[k] = block_data[k];
+                    max_label = std::max(max_label, block_labels[k]);
+                }
+                else
+                {
+                    block_costs[k] = NumericTraits<Data>::max();
+                }
+            }
+            costs.commitSubarray(block_begin, block_costs);
+            steps.commitSubarray(block_begin, block_steps);
+            max_labels[block] = max_label;
+        }
+    );
+
+    Overlaps<ChunkedArray<N, Data> > data_overlaps(data, chunk_shape, Shape(1), Shape(1));
+    Overlaps<ChunkedArray<N, Data> > costs_overlaps(costs, chunk_shape, Shape(1), Shape(1));
+    sweepBlocks<N>(blocks_shape, options.getNumThreads(),
+        [&](Shape const & block, bool first_visit){
+            return floodBlockCosts(data_overlaps, costs_overlaps, costs,
+                                   block, options.getNeighborhood(), first_visit);
+        }
+    );
+
+    Overlaps<ChunkedArray<N, Label> > labels_overlaps(labels, chunk_shape, Shape(1), Shape(1));
+    Overlaps<ChunkedArray<N, UInt32> > steps_overlaps(steps, chunk_shape, Shape(1), Shape(1));
+    sweepBlocks<N>(blocks_shape, options.getNumThreads(),
+        [&](Shape const & block, bool first_visit){
+            return floodBlockLabels(data_overlaps, costs_overlaps, labels_overlaps, steps_overlaps,
+                                    labels, steps, block, options.getNeighborhood(), first_visit);
+        }
+    );
+
+    return *std::max_element(max_labels.begin(), max_labels.end());
+}
+
+template <unsigned int N, class Data, class Label>
+inline Label
+seededWatershedsBlockwise(const ChunkedArray<N, Data>& data,
+                          ChunkedArray<N, Label>& labels,
+                          BlockwiseLabelOptions const & options,
+                          ChunkedArray<N, Data>& costs)
+{
+    ChunkedArrayCompressed<N, UInt32> steps(data.shape(), data.chunkShape());
+    return seededWatershedsBlockwise(data, labels, options, costs, steps);
+}
+
+template <unsigned int N, class Data, class Label>
+inline Label
+seededWatershedsBlockwise(const ChunkedArray<N, Data>& data,
+                          ChunkedArray<N, Label>& labels,
+                          BlockwiseLabelOptions const & options = BlockwiseLabelOptions())
+{
+    ChunkedArrayCompressed<N, Data> costs(data.shape(), data.chunkShape());
+    return seededWatershedsBlockwise(data, labels, options, costs);
+}
+
 //@}
 
 } // namespace vigra
@@ -50,7 +50,26 @@ enum CompressionMethod {  DEFAULT_COMPRESSION=-2,  // use default method (depend
                           ZLIB_FAST=1, // fastest compression using zlib
                           ZLIB=6,      // zlib default compression level
                           ZLIB_BEST=9, // highest compression using zlib
-                          LZ4          // very fast LZ4 algorithm
+                          LZ4,         // very fast LZ4 algorithm
+                          ZSTD_FAST,   // fastest compression using zstd (level 1)
+                          ZSTD,        // zstd default compression level (level 3)
+                          ZSTD_BEST    // high compression using zstd (level 19), slow
+                       };
+
+    /** Reversible filters that reorder the bytes of an array of fixed-size
+        elements before compression.
+
+        Compression algorithms only find repetitions of whole bytes. In arrays of
+        multi-byte elements (e.g. float data), the high-order bytes of neighboring
+        elements are often identical or similar, but they are interleaved with
+        almost random low-order bytes. SHUFFLE stores the first bytes of all
+        elements, then the second bytes, and so on. BITSHUFFLE additionally
+        transposes the bits within each of these byte planes, so that slowly
+        varying bits end up in long runs.
+    */
+enum CompressionFilter {  NO_FILTER=0,  // compress the data as is
+                          SHUFFLE,      // group the k-th bytes of all elements
+                          BITSHUFFLE    // group the k-th bits of all elements
                        };
 
 /** Compress the source buffer.
@@ -60,6 +79,17 @@ enum CompressionMethod {  DEFAULT_COMPRESSION=-2,  // use default method (depend
 VIGRA_EXPORT void compress(char const * source, std::size_t size, ArrayVector<char> & dest, CompressionMethod method);
 VIGRA_EXPORT void compress(char const * source, std::size_t size, std::vector<char> & dest, CompressionMethod method);
 
+/** Compress the source buffer after applying the given filter.
+
+    'elementSize' is the size of the array elements in bytes (e.g. 4 for float).
+    The destination array will be resized as required. Decompress with the
+    same filter and element size.
+*/
+VIGRA_EXPORT void compress(char const * source, std::size_t size, ArrayVector<char> & dest, CompressionMethod method,
+                           CompressionFilter filter, std::size_t elementSize);
+VIGRA_EXPORT void compress(char const * source, std::size_t size, std::vector<char> & dest, CompressionMethod method,
+                           CompressionFilter filter, std::size_t elementSize);
+
 /** Uncompress the source buffer when the uncompressed size is known.
 
     The destination buffer must be allocated to the correct size.
@@ -67,6 +97,31 @@ VIGRA_EXPORT void compress(char const * source, std::size_t size, std::vector<ch
 VIGRA_EXPORT void uncompress(char const * source, std::size_t srcSize, 
                              char * dest, std::size_t destSize, CompressionMethod method);
 
+/** Uncompress the source buffer and revert the given filter.
+
+    The destination buffer must be allocated to the correct size.
+*/
+VIGRA_EXPORT void uncompress(char const * source, std::size_t srcSize,
+                             char * dest, std::size_t destSize, CompressionMethod method,
+                             CompressionFilter filter, std::size_t elementSize);
+
+/** Apply a compression filter to an array of 'size' bytes.
+
+    'dest' must point to a different buffer of the same size. If 'size'
+    is not a multiple of 'elementSize', the remaining bytes are copied unchanged.
+*/
+VIGRA_EXPORT void applyCompressionFilter(char const * source, char * dest, std::size_t size,
+                                         CompressionFilter filter, std::size_t elementSize);
+
+/** Revert the effect of applyCompressionFilter().
+*/
+VIGRA_EXPORT void revertCompressionFilter(char const * source, char * dest, std::size_t size,
+                                          CompressionFilter filter, std::size_t elementSize);
+
+/** Check if VIGRA was compiled with support for the given compression method.
+*/
+VIGRA_EXPORT bool isCompressionAvailable(CompressionMethod method);
+
 
 } // namespace vigra
 
@@ -60,10 +60,15 @@ namespace vigra {
 /** \brief Apply rank order filter with disc structuring function to the image.
 
     The pixel values of the source image <b> must</b> be in the range
-    0...255. Radius must be >= 0. Rank must be in the range 0.0 <= rank 
+    0...255, unless the source is a <tt>MultiArrayView</tt> with value type
+    <tt>UInt16</tt> or <tt>Int16</tt>, which is processed with a two-level
+    histogram. Radius must be >= 0. Rank must be in the range 0.0 <= rank 
     <= 1.0. The filter acts as a minimum filter if rank = 0.0, 
     as a median if rank = 0.5, and as a maximum filter if rank = 1.0.
     Accessor are used to access the pixel data.
+
+    For rectangular windows, \ref rankOrderFilter() in \<vigra/medianfilter.hxx\>
+    is faster, because its running time does not depend on the window size.
     
     <b> Declarations:</b>
     
@@ -395,6 +400,140 @@ discRankOrderFilter(MultiArrayView<2, T1, S1> const & src,
                         radius, rank);
 }
 
+namespace detail {
+
+    // discRankOrderFilter() for 16-bit data: the window histogram is split
+    // into 256 coarse bins (upper byte) and 65536 fine bins, so that the
+    // search for the rank visits at most 512 bins per pixel.
+template <class T1, class S1,
+          class T2, class S2>
+void
+discRankOrderFilter16(MultiArrayView<2, T1, S1> const & src,
+                      MultiArrayView<2, T2, S2> dest,
+                      int radius, float rank)
+{
+    vigra_precondition((rank >= 0.0) && (rank <= 1.0),
+            "discRankOrderFilter(): Rank must be between 0 and 1"
+            " (inclusive).");
+
+    vigra_precondition(radius >= 0,
+            "discRankOrderFilter(): Radius must be >= 0.");
+
+    const int offset = -(int)NumericTraits<T1>::min();
+    const int w = src.shape(0), h = src.shape(1);
+
+    std::vector<int> struct_function(radius+1);
+    struct_function[0] = radius;
+
+    double r2 = (double)radius*radius;
+    for(int i=1; i<=radius; ++i)
+    {
+        double r = (double) i - 0.5;
+        struct_function[i] = (int)(VIGRA_CSTD::sqrt(r2 - r*r) + 0.5);
+    }
+
+    std::vector<long> coarse(256), fine(65536);
+
+    for(int y=0; y<h; ++y)
+    {
+        int ymin = std::max(-radius, -y),
+            ymax = std::min(radius, h - y - 1);
+        long winsize = 0;
+
+        for(int x=0; x<w; ++x)
+        {
+            // add (or remove) the pixels entering (or leaving) the window
+            for(int yy=ymin; yy<=ymax; ++yy)
+            {
+                int sf = struct_function[yy < 0 ? -yy : yy];
+                if(x == 0)
+                {
+                    for(int xx=0; xx<=std::min(sf, w-1); ++xx)
+                    {
+                        int bin = (int)src(xx, y+yy) + offset;
+                        ++coarse[bin >> 8];
+                        ++fine[bin];
+                        ++winsize;
+                    }
+                    continue;
+                }
+                if(x - sf - 1 >= 0)
+                {
+                    int bin = (int)src(x-sf-1, y+yy) + offset;
+                    --coarse[bin >> 8];
+                    --fine[bin];
+                    --winsize;
+                }
+                if(x + sf < w)
+                {
+                    int bin = (int)src(x+sf, y+yy) + offset;
+                    ++coarse[bin >> 8];
+                    ++fine[bin];
+                    ++winsize;
+                }
+            }
+
+            // find the first bin where the cumulative count reaches the rank
+            long leftsum = 0;
+            int c = 0;
+            for(; c<255; ++c)
+            {
+                long sum = leftsum + coarse[c];
+                if(rank == 0.0 ? sum > 0 : (float)sum / winsize >= rank)
+                    break;
+                leftsum = sum;
+            }
+            int bin = c << 8, end = bin + 255;
+            for(; bin<end; ++bin)
+            {
+                leftsum += fine[bin];
+                if(rank == 0.0 ? leftsum > 0 : (float)leftsum / winsize >= rank)
+                    break;
+            }
+            dest(x, y) = static_cast<T1>(bin - offset);
+        }
+
+        // clear the bins of the last window, which is much cheaper
+        // than refilling all fine bins for the next row
+        for(int yy=ymin; yy<=ymax; ++yy)
+        {
+            int sf = struct_function[yy < 0 ? -yy : yy];
+            for(int xx=std::max(0, w-1-sf); xx<w; ++xx)
+            {
+                int bin = (int)src(xx, y+yy) + offset;
+                coarse[bin >> 8] = 0;
+                fine[bin] = 0;
+            }
+        }
+    }
+}
+
+} // namespace detail
+
+template <class S1,
+          class T2, class S2>
+inline void
+discRankOrderFilter(MultiArrayView<2, UInt16, S1> const & src,
+                    MultiArrayView<2, T2, S2> dest,
+                    int radius, float rank)
+{
+    vigra_precondition(src.shape() == dest.shape(),
+        "discRankOrderFilter(): shape mismatch between input and output.");
+    detail::discRankOrderFilter16(src, dest, radius, rank);
+}
+
+template <class S1,
+          class T2, class S2>
+inline void
+discRankOrderFilter(MultiArrayView<2, Int16, S1> const & src,
+                    MultiArrayView<2, T2, S2> dest,
+                    int radius, float rank)
+{
+    vigra_precondition(src.shape() == dest.shape(),
+        "discRankOrderFilter(): shape mismatch between input and output.");
+    detail::discRankOrderFilter16(src, dest, radius, rank);
+}
+
 /********************************************************/
 /*                                                      */
 /*                      discErosion                     */
@@ -485,7 +624,7 @@ discErosion(MultiArrayView<2, T1, S1> const & src,
 {
     vigra_precondition(src.shape() == dest.shape(),
         "discErosion(): shape mismatch between input and output.");
-    discErosion(srcImageRange(src), destImage(dest), radius);
+    discRankOrderFilter(src, dest, radius, 0.0f);
 }
 
 /********************************************************/
@@ -578,7 +717,7 @@ discDilation(MultiArrayView<2, T1, S1> const & src,
 {
     vigra_precondition(src.shape() == dest.shape(),
         "discDilation(): shape mismatch between input and output.");
-    discDilation(srcImageRange(src), destImage(dest), radius);
+    discRankOrderFilter(src, dest, radius, 1.0f);
 }
 
 /********************************************************/
@@ -671,7 +810,7 @@ discMedian(MultiArrayView<2, T1, S1> const & src,
 {
     vigra_precondition(src.shape() == dest.shape(),
         "discMedian(): shape mismatch between input and output.");
-    discMedian(srcImageRange(src), destImage(dest), radius);
+    discRankOrderFilter(src, dest, radius, 0.5f);
 }
 
 /********************************************************/
@@ -684,10 +823,15 @@ discMedian(MultiArrayView<2, T1, S1> const & src,
     using a mask.
     
     The pixel values of the source image <b> must</b> be in the range
-    0...255. Radius must be >= 0. Rank must be in the range 0.0 <= rank 
+    0...255, unless the source is a <tt>MultiArrayView</tt> with value type
+    <tt>UInt16</tt> or <tt>Int16</tt>, which is processed with a two-level
+    histogram. Radius must be >= 0. Rank must be in the range 0.0 <= rank 
     <= 1.0. The filter acts as a minimum filter if rank = 0.0, 
     as a median if rank = 0.5, and as a maximum filter if rank = 1.0.
     Accessor are used to access the pixel data.
+
+    For rectangular windows, \ref rankOrderFilter() in \<vigra/medianfilter.hxx\>
+    is faster, because its running time does not depend on the window size.
     
     The mask is only applied to th input image, i.e. the function
     generates an output wherever the current disc contains at least 
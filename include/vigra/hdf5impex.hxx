@@ -74,12 +74,19 @@
 # include <hdf5_hl.h>
 #endif
 
+// H5Dread_chunk() is needed to decode chunks in parallel
+#if H5_VERS_MAJOR > 1 || (H5_VERS_MAJOR == 1 && (H5_VERS_MINOR > 10 || (H5_VERS_MINOR == 10 && H5_VERS_RELEASE >= 2)))
+# define VIGRA_HDF5_DIRECT_CHUNK_READ
+#endif
+
 #include "impex.hxx"
 #include "multi_array.hxx"
 #include "multi_iterator_coupled.hxx"
 #include "multi_impex.hxx"
 #include "utilities.hxx"
 #include "error.hxx"
+#include "threadpool.hxx"
+#include "compression.hxx"
 
 #if defined(_MSC_VER)
 #  include <io.h>
@@ -787,6 +794,27 @@ class HDF5ImportInfo
 
 namespace detail {
 
+    // smallest prime >= n, used for the number of chunk cache slots
+inline std::size_t hdf5NextPrime(std::size_t n)
+{
+    if(n <= 2)
+        return 2;
+    for(n |= 1;; n += 2)
+    {
+        bool prime = true;
+        for(std::size_t k=3; k*k <= n; k += 2)
+        {
+            if(n % k == 0)
+            {
+                prime = false;
+                break;
+            }
+        }
+        if(prime)
+            return n;
+    }
+}
+
 template <class T>
 struct HDF5TypeTraits
 {
@@ -985,6 +1013,37 @@ class HDF5File
 
     bool read_only_;
 
+    // number of threads that decode chunks in read() and readBlock()
+    int read_threads_;
+
+    // chunk cache of the datasets opened by this object,
+    // see setChunkCache() and setSequentialAccess()
+    struct ChunkCacheOptions
+    {
+        ChunkCacheOptions()
+        : bytes(H5D_CHUNK_CACHE_NBYTES_DEFAULT),
+          slots(H5D_CHUNK_CACHE_NSLOTS_DEFAULT),
+          w0(H5D_CHUNK_CACHE_W0_DEFAULT),
+          axis(-1),
+          max_bytes(0)
+        {}
+
+        bool isDefault() const
+        {
+            return axis < 0 &&
+                   bytes == H5D_CHUNK_CACHE_NBYTES_DEFAULT &&
+                   slots == H5D_CHUNK_CACHE_NSLOTS_DEFAULT &&
+                   w0 == H5D_CHUNK_CACHE_W0_DEFAULT;
+        }
+
+        std::size_t bytes, slots;
+        double w0;
+        int axis;
+        std::size_t max_bytes;
+    };
+
+    ChunkCacheOptions chunk_cache_;
+
     // helper classes for ls() and listAttributes()
     struct ls_closure
     {
@@ -1045,7 +1104,8 @@ class HDF5File
         A file can later be opened via the open() function. Time tagging of datasets is disabled.
         */
     HDF5File()
-    : track_time(0)
+    : track_time(0),
+      read_threads_(0)
     {}
 
         /** \brief Construct with time tagging of datasets enabled.
@@ -1054,7 +1114,8 @@ class HDF5File
         */
     explicit HDF5File(bool track_creation_times)
     : track_time(track_creation_times ? 1 : 0),
-      read_only_(true)
+      read_only_(true),
+      read_threads_(0)
     {}
 
         /** \brief Open or create an HDF5File object.
@@ -1063,7 +1124,8 @@ class HDF5File
         The current group is set to "/". By default, the files is opened in read-only mode.
         */
     explicit HDF5File(std::string filePath, OpenMode mode = ReadOnly, bool track_creation_times = false)
-        : track_time(track_creation_times ? 1 : 0)
+        : track_time(track_creation_times ? 1 : 0),
+          read_threads_(0)
     {
         open(filePath, mode);
     }
@@ -1074,7 +1136,8 @@ class HDF5File
         The current group is set to "/". By default, the files is opened in read-only mode.
         */
     explicit HDF5File(char const * filePath, OpenMode mode = ReadOnly, bool track_creation_times = false)
-        : track_time(track_creation_times ? 1 : 0)
+        : track_time(track_creation_times ? 1 : 0),
+          read_threads_(0)
     {
         open(std::string(filePath), mode);
     }
@@ -1099,8 +1162,8 @@ class HDF5File
                       const std::string & pathname = "",
                       bool read_only = false)
     : fileHandle_(fileHandle),
-      read_only_(read_only)
-
+      read_only_(read_only),
+      read_threads_(0)
     {
         // get group handle for given pathname
         // calling openCreateGroup_ without setting a valid cGroupHandle does
@@ -1126,7 +1189,9 @@ class HDF5File
     HDF5File(HDF5File const & other)
     : fileHandle_(other.fileHandle_),
       track_time(other.track_time),
-      read_only_(other.read_only_)
+      read_only_(other.read_only_),
+      read_threads_(other.read_threads_),
+      chunk_cache_(other.chunk_cache_)
     {
         cGroupHandle_ = HDF5Handle(openCreateGroup_(other.currentGroupName_()), &H5Gclose,
                                    "HDF5File(HDF5File const &): Failed to open group.");
@@ -1157,6 +1222,8 @@ class HDF5File
                                        "HDF5File::operator=(): Failed to open group.");
             track_time = other.track_time;
             read_only_ = other.read_only_;
+            read_threads_ = other.read_threads_;
+            chunk_cache_ = other.chunk_cache_;
         }
         return *this;
     }
@@ -1181,6 +1248,83 @@ class HDF5File
         read_only_ = stat;
     }
 
+        /** \brief Set the number of threads that decode chunks in read() and readBlock().
+
+            Chunked datasets that are at most shuffled and deflate-compressed (as written by
+            HDF5File) are read chunk by chunk via <tt>H5Dread_chunk()</tt> (requires HDF5 1.10.2 or
+            later). The chunks are decompressed in parallel and copied directly into the target
+            array, so that strided targets need no full-size intermediate buffer. HDF5 itself is
+            only called from the reading thread. Pass <tt>ParallelOptions::Auto</tt> to use all
+            cores, or 0 (the default) to decode the chunks sequentially. ChunkedArrayHDF5 sets this
+            to 0 for its copy of the file, because it reads chunks while holding a global lock.
+        */
+    void setReadThreads(int n)
+    {
+        read_threads_ = n;
+    }
+
+        /** \brief The number of threads that decode chunks in read() and readBlock().
+        */
+    int readThreads() const
+    {
+        return read_threads_;
+    }
+
+        /** \brief Set the raw data chunk cache of datasets opened subsequently.
+
+            By default, HDF5 caches 1 MB of decompressed chunks per dataset, which is too
+            small when a large chunked dataset is accessed in slices: every slice then
+            decompresses the same chunks again. \a nbytes is the cache size in bytes,
+            \a nslots the number of hash table slots (ideally a prime that is 10 to 100 times
+            the number of chunks fitting into the cache), and \a w0 the preemption policy
+            between 0 and 1 (at 1, chunks that have been read or written completely are
+            evicted first). The defaults
+            <tt>H5D_CHUNK_CACHE_NBYTES_DEFAULT</tt>, <tt>H5D_CHUNK_CACHE_NSLOTS_DEFAULT</tt>,
+            and <tt>H5D_CHUNK_CACHE_W0_DEFAULT</tt> keep the respective setting of the file.
+
+            The settings apply to all datasets opened or created by this object
+            afterwards, including those used by \ref ChunkedArrayHDF5, and are inherited
+            by copies of this object. A previous setSequentialAccess() hint is cancelled.
+        */
+    void setChunkCache(std::size_t nbytes,
+                       std::size_t nslots = H5D_CHUNK_CACHE_NSLOTS_DEFAULT,
+                       double w0 = H5D_CHUNK_CACHE_W0_DEFAULT)
+    {
+        vigra_precondition(w0 == H5D_CHUNK_CACHE_W0_DEFAULT || (w0 >= 0.0 && w0 <= 1.0),
+            "HDF5File::setChunkCache(): w0 must be between 0 and 1.");
+        chunk_cache_ = ChunkCacheOptions();
+        chunk_cache_.bytes = nbytes;
+        chunk_cache_.slots = nslots;
+        chunk_cache_.w0 = w0;
+    }
+
+        /** \brief Size the chunk cache for datasets that are traversed slice by slice.
+
+            Declares that datasets opened subsequently are accessed in consecutive slices
+            perpendicular to \a axis (counted as in getDatasetShape(), i.e. the bands of
+            multi-band datasets are axis 0). The chunk cache of each dataset is then made
+            large enough to hold one layer of chunks across the whole slice, so that every
+            chunk is decompressed only once during the sweep, and chunks are preempted
+            in the order of use. The cache size is limited to \a max_bytes. The hint has
+            no effect on unchunked datasets, and is cancelled by setChunkCache() or
+            useDefaultChunkCache().
+        */
+    void setSequentialAccess(int axis, std::size_t max_bytes = std::size_t(1) << 30)
+    {
+        vigra_precondition(axis >= 0,
+            "HDF5File::setSequentialAccess(): axis must be non-negative.");
+        chunk_cache_ = ChunkCacheOptions();
+        chunk_cache_.axis = axis;
+        chunk_cache_.max_bytes = max_bytes;
+    }
+
+        /** \brief Use the file's default chunk cache for datasets opened subsequently.
+        */
+    void useDefaultChunkCache()
+    {
+        chunk_cache_ = ChunkCacheOptions();
+    }
+
         /** \brief Open or create the given file in the given mode and set the group to "/".
             If another file is currently open, it is first closed.
          */
@@ -2545,7 +2689,73 @@ class HDF5File
         // Open parent group
         HDF5Handle groupHandle(openGroup_(groupname), &H5Gclose, "HDF5File::getDatasetHandle_(): Internal error");
 
-        return H5Dopen(groupHandle, setname.c_str(), H5P_DEFAULT);
+        hid_t datasetHandle = H5Dopen(groupHandle, setname.c_str(), H5P_DEFAULT);
+        if(datasetHandle < 0 || chunk_cache_.isDefault())
+            return datasetHandle;
+
+        // the chunk cache can only be set when the dataset is opened,
+        // so we reopen it with the appropriate access properties
+        HDF5Handle access;
+        {
+            HDF5Handle dataset(datasetHandle, &H5Dclose, "HDF5File::getDatasetHandle_(): Internal error");
+            HDF5Handle properties(H5Dget_create_plist(dataset), &H5Pclose,
+                                  "HDF5File::getDatasetHandle_(): unable to access property list.");
+            HDF5Handle dataspace(H5Dget_space(dataset), &H5Sclose,
+                                 "HDF5File::getDatasetHandle_(): unable to access dataspace.");
+            HDF5Handle datatype(H5Dget_type(dataset), &H5Tclose,
+                                "HDF5File::getDatasetHandle_(): unable to access datatype.");
+            int rank = H5Sget_simple_extent_ndims(dataspace);
+            ArrayVector<hsize_t> shape(rank), chunks;
+            H5Sget_simple_extent_dims(dataspace, shape.data(), NULL);
+            if(H5Pget_layout(properties) == H5D_CHUNKED)
+            {
+                chunks.resize(rank);
+                H5Pget_chunk(properties, rank, chunks.data());
+            }
+            access = HDF5Handle(chunkCacheProperties_(shape, chunks, H5Tget_size(datatype)), &H5Pclose,
+                                "HDF5File::getDatasetHandle_(): unable to create property list.");
+        }
+        return H5Dopen(groupHandle, setname.c_str(), access);
+    }
+
+        /* create a dataset access property list according to the chunk cache options
+           ('shape' and 'chunks' in HDF5 order, 'chunks' is empty for unchunked datasets)
+         */
+    hid_t chunkCacheProperties_(ArrayVector<hsize_t> const & shape,
+                                ArrayVector<hsize_t> const & chunks,
+                                std::size_t typeSize) const
+    {
+        hid_t properties = H5Pcreate(H5P_DATASET_ACCESS);
+        if(properties < 0 || chunk_cache_.isDefault())
+            return properties;
+
+        std::size_t bytes = chunk_cache_.bytes,
+                    slots = chunk_cache_.slots;
+        double w0 = chunk_cache_.w0;
+        int const rank = (int)shape.size();
+        if(chunk_cache_.axis >= 0)
+        {
+            if(chunks.size() == 0 || chunk_cache_.axis >= rank)
+                return properties;
+
+            // the chunks intersected by a slice perpendicular to 'axis'
+            int const axis = rank - 1 - chunk_cache_.axis;
+            std::size_t chunkCount = 1;
+            bytes = typeSize;
+            for(int k=0; k<rank; ++k)
+            {
+                bytes *= chunks[k];
+                if(k != axis)
+                    chunkCount *= (shape[k] + chunks[k] - 1) / chunks[k];
+            }
+            chunkCount = std::max<std::size_t>(1, std::min(chunkCount, chunk_cache_.max_bytes / bytes));
+            bytes = std::min(chunkCount*bytes, chunk_cache_.max_bytes);
+            slots = detail::hdf5NextPrime(100*chunkCount);
+            w0 = 1.0;
+        }
+        // the *_DEFAULT values are resolved by HDF5 from the file access properties
+        H5Pset_chunk_cache(properties, slots, bytes, w0);
+        return properties;
     }
 
         /* get the type of an object specified by a string
@@ -2752,6 +2962,17 @@ class HDF5File
                       typename MultiArrayShape<N>::type &blockShape,
                       MultiArrayView<N, T, Stride> array,
                       const hid_t datatype, const int numBandsOfType);
+
+        /* Read a sub-block of a chunked dataset by decoding its chunks in parallel and
+           copying them directly into 'array'. Returns false (without reporting an error)
+           if the dataset's layout, type, or filters don't permit direct chunk access, or
+           if a plain H5Dread() is just as good.
+        */
+    template<unsigned int N, class T, class Stride>
+    bool readChunks_(hid_t dataset,
+                     typename MultiArrayShape<N>::type const & blockOffset,
+                     MultiArrayView<N, T, Stride> array,
+                     const hid_t datatype, const int numBandsOfType);
 };  /* class HDF5File */
 
 /********************************************************************/
@@ -2820,10 +3041,14 @@ HDF5File::createDataset(std::string datasetName,
         H5Pset_deflate(plist, compressionParameter);
     }
 
+    // set the chunk cache
+    HDF5Handle access(chunkCacheProperties_(shape_inv, chunks, H5Tget_size(TypeTraits::getH5DataType())),
+                      &H5Pclose, "HDF5File::createDataset(): unable to create property list.");
+
     //create the dataset.
     HDF5HandleShared datasetHandle(H5Dcreate(parent, setname.c_str(),
                                              TypeTraits::getH5DataType(),
-                                             dataspaceHandle, H5P_DEFAULT, plist, H5P_DEFAULT),
+                                             dataspaceHandle, H5P_DEFAULT, plist, access),
                                    &H5Dclose,
                                    "HDF5File::createDataset(): unable to create dataset.");
     if(parent != cGroupHandle_)
@@ -3145,7 +3370,11 @@ void HDF5File::read_(std::string datasetName,
                            "HDF5File::read(): Band count doesn't match destination array compound type.");
 
     herr_t status = 0;
-    if(array.isUnstrided())
+    if(readChunks_(datasetHandle, typename MultiArrayShape<N>::type(), array, datatype, numBandsOfType))
+    {
+        return;
+    }
+    else if(array.isUnstrided())
     {
         // when the array is unstrided, we can read the data directly into the array buffer
         status = H5Dread(datasetHandle, datatype, H5S_ALL, H5S_ALL, H5P_DEFAULT, array.data() );
@@ -3282,7 +3511,11 @@ herr_t HDF5File::readBlock_(HDF5HandleShared datasetHandle,
                         boffset.data(), bones.data(), bones.data(), bshape.data());
 
     herr_t status = 0;
-    if(array.isUnstrided())
+    if(readChunks_(datasetHandle, blockOffset, array, datatype, numBandsOfType))
+    {
+        return status;
+    }
+    else if(array.isUnstrided())
     {
         // when the array is unstrided, we can read the data directly into the array buffer
         status = H5Dread( datasetHandle, datatype, memspace_handle, dataspaceHandle, H5P_DEFAULT, array.data());
@@ -3301,6 +3534,149 @@ herr_t HDF5File::readBlock_(HDF5HandleShared datasetHandle,
 
 /********************************************************************/
 
+template<unsigned int N, class T, class Stride>
+bool HDF5File::readChunks_(hid_t dataset,
+                           typename MultiArrayShape<N>::type const & blockOffset,
+                           MultiArrayView<N, T, Stride> array,
+                           const hid_t datatype, const int numBandsOfType)
+{
+#ifndef VIGRA_HDF5_DIRECT_CHUNK_READ
+    return false;
+#else
+    typedef typename MultiArrayShape<N>::type Shape;
+
+    H5T_class_t const typeClass = H5Tget_class(datatype);
+    if(typeClass != H5T_INTEGER && typeClass != H5T_FLOAT)
+        return false;
+    // raw chunks can only be used when no type conversion is required
+    HDF5Handle filetype(H5Dget_type(dataset), &H5Tclose,
+                        "HDF5File::read(): unable to get dataset type.");
+    if(H5Tequal(filetype, datatype) <= 0)
+        return false;
+
+    HDF5Handle properties(H5Dget_create_plist(dataset), &H5Pclose,
+                          "HDF5File::read(): failed to get property list");
+    if(H5Pget_layout(properties) != H5D_CHUNKED)
+        return false;
+
+    // we can decode the filters written by HDF5File: shuffle (optional), then deflate (optional)
+    int const nfilters = H5Pget_nfilters(properties);
+    int shuffleIndex = -1, deflateIndex = -1;
+    for(int k=0; k<nfilters; ++k)
+    {
+        unsigned int flags = 0;
+        size_t nelements = 0;
+        H5Z_filter_t filter = H5Pget_filter2(properties, k, &flags, &nelements, NULL, 0, NULL, NULL);
+        if(filter == H5Z_FILTER_SHUFFLE && k == 0)
+            shuffleIndex = k;
+        else if(filter == H5Z_FILTER_DEFLATE && k == nfilters-1)
+            deflateIndex = k;
+        else
+            return false;
+    }
+    if(deflateIndex >= 0 && !isCompressionAvailable(ZLIB))
+        return false;
+
+    // chunk shape in VIGRA order, the bands must be in a single chunk
+    int const rank = numBandsOfType > 1 ? N+1 : N;
+    ArrayVector<hsize_t> h5chunks(rank);
+    H5Pget_chunk(properties, rank, h5chunks.data());
+    if(numBandsOfType > 1 && h5chunks[N] != (hsize_t)numBandsOfType)
+        return false;
+    Shape chunkShape;
+    for(unsigned int k=0; k<N; ++k)
+        chunkShape[N-1-k] = (MultiArrayIndex)h5chunks[k];
+
+    Shape const chunkBegin = blockOffset / chunkShape,
+                chunkEnd   = (blockOffset + array.shape() - Shape(1)) / chunkShape + Shape(1);
+    MultiCoordinateIterator<N> chunks(chunkEnd - chunkBegin);
+    std::ptrdiff_t const nChunks = chunks.getEndIterator() - chunks;
+
+    // a single H5Dread() into an unstrided array is just as fast
+    bool const parallel = ParallelOptions().numThreads(read_threads_).getNumThreads() > 1;
+    if(array.isUnstrided() && (nfilters == 0 || nChunks < 2 || !parallel))
+        return false;
+
+    // HDF5 is not thread-safe, so the raw chunks are read by this thread in batches,
+    // and then decoded and copied in parallel.
+    std::size_t const chunkBytes = prod(chunkShape)*sizeof(T);
+    std::size_t const scalarBytes = H5Tget_size(datatype);
+    std::ptrdiff_t const nThreads = std::max<std::ptrdiff_t>(ParallelOptions().numThreads(read_threads_).getNumThreads(), 1);
+    std::ptrdiff_t const batchSize = 2*nThreads;
+    std::vector<ArrayVector<char> > raw(batchSize);
+    std::vector<uint32_t> masks(batchSize);
+    std::vector<ArrayVector<char> > buffers(nThreads, ArrayVector<char>(chunkBytes));
+    ArrayVector<hsize_t> h5offset(rank);
+
+    // chunks that were never written contain the fill value
+    T fill;
+    if(H5Pget_fill_value(properties, datatype, &fill) < 0)
+        return false;
+    for(int k=1; k<numBandsOfType; ++k)
+        std::memcpy(reinterpret_cast<char *>(&fill) + k*scalarBytes, &fill, scalarBytes);
+
+    for(std::ptrdiff_t first=0; first<nChunks; first+=batchSize)
+    {
+        std::ptrdiff_t const count = std::min(batchSize, nChunks - first);
+        for(std::ptrdiff_t j=0; j<count; ++j)
+        {
+            Shape const chunkStart = (chunkBegin + chunks[first+j]) * chunkShape;
+            for(unsigned int k=0; k<N; ++k)
+                h5offset[k] = chunkStart[N-1-k];
+            if(numBandsOfType > 1)
+                h5offset[N] = 0;
+            hsize_t size = 0;
+            {
+                // HDF5 reports unallocated chunks as an error
+                HDF5DisableErrorOutput disableErrorOutput;
+                if(H5Dget_chunk_storage_size(dataset, h5offset.data(), &size) < 0)
+                    size = 0;
+            }
+            raw[j].resize(size);
+            if(size == 0)
+                continue;
+            if(H5Dread_chunk(dataset, H5P_DEFAULT, h5offset.data(), &masks[j], raw[j].data()) < 0)
+                return false;
+            if((deflateIndex < 0 || (masks[j] & (1u << deflateIndex))) && size != chunkBytes)
+                return false;
+        }
+
+        parallel_foreach(read_threads_, count,
+            [&](int thread_id, std::ptrdiff_t j)
+            {
+                Shape const chunkStart = (chunkBegin + chunks[first+j]) * chunkShape,
+                            start = max(chunkStart, blockOffset),
+                            stop  = min(chunkStart + chunkShape, blockOffset + array.shape());
+                if(raw[j].size() == 0)
+                {
+                    array.subarray(start - blockOffset, stop - blockOffset).init(fill);
+                    return;
+                }
+
+                // a set bit in the mask means that the filter was skipped for this chunk
+                bool const deflated = deflateIndex >= 0 && !(masks[j] & (1u << deflateIndex)),
+                           shuffled = shuffleIndex >= 0 && !(masks[j] & (1u << shuffleIndex));
+                char * data = buffers[thread_id].data();
+                if(deflated)
+                    uncompress(raw[j].data(), raw[j].size(), data, chunkBytes,
+                               ZLIB, shuffled ? SHUFFLE : NO_FILTER, scalarBytes);
+                else if(shuffled)
+                    revertCompressionFilter(raw[j].data(), data, chunkBytes, SHUFFLE, scalarBytes);
+                else
+                    std::copy(raw[j].begin(), raw[j].begin() + chunkBytes, data);
+
+                // the chunk is in C-order w.r.t. HDF5's dimensions, i.e. in VIGRA's scan order
+                MultiArrayView<N, T> chunk(chunkShape, reinterpret_cast<T *>(data));
+                array.subarray(start - blockOffset, stop - blockOffset) =
+                    chunk.subarray(start - chunkStart, stop - chunkStart);
+            });
+    }
+    return true;
+#endif
+}
+
+/********************************************************************/
+
 template<unsigned int N, class T, class Stride>
 void HDF5File::read_attribute_(std::string datasetName,
                                std::string attributeName,
@@ -12,6 +12,7 @@
 #include <algorithm>
 
 #include "applywindowfunction.hxx"
+#include "multi_array.hxx"
 
 namespace vigra
 {
@@ -52,6 +53,25 @@ namespace vigra
     }
     \endcode
 
+    pass 2D or 3D array views (this is an abbreviation for \ref rankOrderFilter()
+    with <tt>rank = 0.5</tt>):
+    \code
+    namespace vigra {
+        template <unsigned int N, class T1, class S1,
+                                  class T2, class S2>
+        void
+        medianFilter(MultiArrayView<N, T1, S1> const & src,
+                     MultiArrayView<N, T2, S2> dest,
+                     typename MultiArrayShape<N>::type const & window_shape,
+                     BorderTreatmentMode border = BORDER_TREATMENT_REPEAT);
+    }
+    \endcode
+
+    The array view versions use the fast algorithms of \ref rankOrderFilter(),
+    whose running time is independent of the window size for 8- and 16-bit data.
+    The only exception is BORDER_TREATMENT_REFLECT with a <tt>Diff2D</tt> window shape,
+    which keeps the traditional behavior of repeating the border pixel in the reflection.
+
     \deprecatedAPI{medianFilter}
     pass \ref ImageIterators and \ref DataAccessors :
     \code
@@ -91,6 +111,12 @@ namespace vigra
     
     // apply a median filter with a window size of 5x5
     medianFilter(src, dest, Diff2D(5,5));
+
+    MultiArray<3, UInt16> volume(Shape3(512, 512, 100)), res(volume.shape());
+    ...
+
+    // apply a median filter with a window size of 31x31x5
+    medianFilter(volume, res, Shape3(31, 31, 5));
     \endcode
     
     <b> Preconditions:</b>
@@ -180,10 +206,542 @@ inline void medianFilter(MultiArrayView<2, T1, S1> const & src,
 {
     vigra_precondition(src.shape() == dest.shape(),
                         "vigra::medianFilter(): shape mismatch between input and output.");
-    medianFilter(srcImageRange(src),
-                 destImage(dest), 
-                 window_shape, 
-                 border);
+    if(border == BORDER_TREATMENT_REFLECT)
+    {
+        // applyWindowFunction() repeats the border pixel when reflecting,
+        // rankOrderFilter() doesn't
+        medianFilter(srcImageRange(src),
+                     destImage(dest), 
+                     window_shape, 
+                     border);
+    }
+    else
+    {
+        vigra_precondition(window_shape.x <= src.shape(0) && window_shape.y <= src.shape(1),
+                           "vigra::medianFilter(): Filter window is larger than image!");
+        rankOrderFilter(src, dest, Shape2(window_shape.x, window_shape.y), 0.5, border);
+    }
+}
+
+/********************************************************/
+/*                                                      */
+/*                   rankOrderFilter                    */
+/*                                                      */
+/********************************************************/
+
+namespace detail {
+
+    // Types which are rank-filtered by means of two-level histograms
+    // (coarse bins index the upper bits, fine bins the lower bits).
+template <class T>
+struct RankFilterHistogramTraits
+{
+    typedef VigraFalseType UseHistogram;
+};
+
+template <class T, int OFFSET, int COARSE_BITS, int FINE_BITS, int MIN_WINDOW_SIZE>
+struct RankFilterHistogramTraitsImpl
+{
+    typedef VigraTrueType UseHistogram;
+
+    static const int coarseBits = COARSE_BITS;
+    static const int fineBits = FINE_BITS;
+        // below this window size, selection is faster than the histogram
+    static const int minWindowSize = MIN_WINDOW_SIZE;
+
+    static int toBin(T v)
+    {
+        return (int)v + OFFSET;
+    }
+
+    static T fromBin(int bin)
+    {
+        return (T)(bin - OFFSET);
+    }
+};
+
+template <>
+struct RankFilterHistogramTraits<UInt8>
+: public RankFilterHistogramTraitsImpl<UInt8, 0, 4, 4, 25>
+{};
+
+template <>
+struct RankFilterHistogramTraits<Int8>
+: public RankFilterHistogramTraitsImpl<Int8, 128, 4, 4, 25>
+{};
+
+template <>
+struct RankFilterHistogramTraits<UInt16>
+: public RankFilterHistogramTraitsImpl<UInt16, 0, 8, 8, 81>
+{};
+
+template <>
+struct RankFilterHistogramTraits<Int16>
+: public RankFilterHistogramTraitsImpl<Int16, 32768, 8, 8, 81>
+{};
+
+inline MultiArrayIndex
+rankFilterBorderIndex(MultiArrayIndex i, MultiArrayIndex n, BorderTreatmentMode border)
+{
+    if(i >= 0 && i < n)
+        return i;
+    switch(border)
+    {
+      case BORDER_TREATMENT_REPEAT:
+        return i < 0 ? 0 : n - 1;
+      case BORDER_TREATMENT_REFLECT:
+      {
+        if(n == 1)
+            return 0;
+        MultiArrayIndex period = 2*n - 2;
+        i %= period;
+        if(i < 0)
+            i += period;
+        return i < n ? i : period - i;
+      }
+      case BORDER_TREATMENT_WRAP:
+        i %= n;
+        return i < 0 ? i + n : i;
+      default: // BORDER_TREATMENT_ZEROPAD
+        return -1;
+    }
+}
+
+    // Copy 'src' into 'padded' (which is larger by 'radius' on either side)
+    // and fill the margin according to the border treatment.
+template <class T, class S>
+void
+rankFilterPad(MultiArrayView<3, T, S> const & src, MultiArray<3, T> & padded,
+              Shape3 const & radius, BorderTreatmentMode border)
+{
+    Shape3 shape(src.shape() + 2*radius);
+    padded.reshape(shape);
+
+    std::vector<MultiArrayIndex> index[3];
+    for(int k=0; k<3; ++k)
+    {
+        index[k].resize(shape[k]);
+        for(MultiArrayIndex i=0; i<shape[k]; ++i)
+            index[k][i] = rankFilterBorderIndex(i - radius[k], src.shape(k), border);
+    }
+
+    for(MultiArrayIndex z=0; z<shape[2]; ++z)
+    {
+        for(MultiArrayIndex y=0; y<shape[1]; ++y)
+        {
+            for(MultiArrayIndex x=0; x<shape[0]; ++x)
+            {
+                MultiArrayIndex xs = index[0][x], ys = index[1][y], zs = index[2][z];
+                padded(x, y, z) = (xs < 0 || ys < 0 || zs < 0)
+                                     ? T()
+                                     : src(xs, ys, zs);
+            }
+        }
+    }
+}
+
+template <class T>
+inline void
+rankFilterSort2(T & a, T & b)
+{
+    if(b < a)
+        std::swap(a, b);
+}
+
+    // median of 9 values by a sorting network with 19 comparisons
+    // (Paeth, Graphics Gems; Devillard, "Fast median search")
+template <class T>
+inline T
+rankFilterMedian9(T * p)
+{
+    rankFilterSort2(p[1], p[2]); rankFilterSort2(p[4], p[5]); rankFilterSort2(p[7], p[8]);
+    rankFilterSort2(p[0], p[1]); rankFilterSort2(p[3], p[4]); rankFilterSort2(p[6], p[7]);
+    rankFilterSort2(p[1], p[2]); rankFilterSort2(p[4], p[5]); rankFilterSort2(p[7], p[8]);
+    rankFilterSort2(p[0], p[3]); rankFilterSort2(p[5], p[8]); rankFilterSort2(p[4], p[7]);
+    rankFilterSort2(p[3], p[6]); rankFilterSort2(p[1], p[4]); rankFilterSort2(p[2], p[5]);
+    rankFilterSort2(p[4], p[7]); rankFilterSort2(p[4], p[2]); rankFilterSort2(p[6], p[4]);
+    rankFilterSort2(p[4], p[2]);
+    return p[4];
+}
+
+    // In all rankFilter*() functions below, 'src' is larger than 'dest' by
+    // 2*radius, such that dest(x,y,z) is computed from the window
+    // src(x...x+2*radius[0], y...y+2*radius[1], z...z+2*radius[2]).
+    // 'k' is the index of the desired element in the sorted window.
+template <class T1, class S1, class T2, class S2>
+void
+rankFilterMedian3x3(MultiArrayView<3, T1, S1> const & src,
+                    MultiArrayView<3, T2, S2> dest)
+{
+    T1 p[9];
+    for(MultiArrayIndex z=0; z<dest.shape(2); ++z)
+    {
+        for(MultiArrayIndex y=0; y<dest.shape(1); ++y)
+        {
+            for(MultiArrayIndex x=0; x<dest.shape(0); ++x)
+            {
+                for(int j=0; j<3; ++j)
+                    for(int i=0; i<3; ++i)
+                        p[3*j+i] = src(x+i, y+j, z);
+                dest(x, y, z) = rankFilterMedian9(p);
+            }
+        }
+    }
+}
+
+template <class T1, class S1, class T2, class S2>
+void
+rankFilterSelect(MultiArrayView<3, T1, S1> const & src,
+                 MultiArrayView<3, T2, S2> dest,
+                 Shape3 const & radius, MultiArrayIndex k)
+{
+    Shape3 window(2*radius + Shape3(1));
+    std::vector<T1> buffer(prod(window));
+    typename std::vector<T1>::iterator kth = buffer.begin() + k;
+
+    for(MultiArrayIndex z=0; z<dest.shape(2); ++z)
+    {
+        for(MultiArrayIndex y=0; y<dest.shape(1); ++y)
+        {
+            for(MultiArrayIndex x=0; x<dest.shape(0); ++x)
+            {
+                typename std::vector<T1>::iterator iter = buffer.begin();
+                for(MultiArrayIndex zz=z; zz<z+window[2]; ++zz)
+                    for(MultiArrayIndex yy=y; yy<y+window[1]; ++yy)
+                        for(MultiArrayIndex xx=x; xx<x+window[0]; ++xx, ++iter)
+                            *iter = src(xx, yy, zz);
+                std::nth_element(buffer.begin(), kth, buffer.end());
+                dest(x, y, z) = *kth;
+            }
+        }
+    }
+}
+
+    // Perreault and Hebert: "Median Filtering in Constant Time", 2007.
+    // Every column of the window has its own histogram, which is moved down
+    // by one row at a time. The window histogram is moved to the right
+    // by adding the entering and subtracting the leaving column histogram.
+    // The histograms have two levels: the coarse level is always kept up to
+    // date, whereas a bin of the fine level is only updated when the
+    // search for the rank actually visits it. In 3D, a column histogram
+    // covers the (y, z)-extent of the window.
+template <class Count, class T1, class S1, class T2, class S2>
+void
+rankFilterHistogram(MultiArrayView<3, T1, S1> const & src,
+                    MultiArrayView<3, T2, S2> dest,
+                    Shape3 const & radius, MultiArrayIndex k)
+{
+    typedef RankFilterHistogramTraits<T1> Traits;
+
+    const int fineBits   = Traits::fineBits,
+              coarseSize = 1 << Traits::coarseBits,
+              fineSize   = 1 << Traits::fineBits,
+              histSize   = coarseSize*fineSize;
+
+    const MultiArrayIndex w = dest.shape(0), h = dest.shape(1), d = dest.shape(2),
+                          wx = 2*radius[0]+1, wy = 2*radius[1]+1, wz = 2*radius[2]+1;
+
+    // Column histograms of 16-bit data are large, so we process the
+    // image in vertical strips of limited width.
+    MultiArrayIndex stripWidth = w;
+    if(histSize > 256)
+        stripWidth = std::min(w, std::max<MultiArrayIndex>(128 - wx + 1, wx));
+    const MultiArrayIndex maxColumns = stripWidth + wx - 1;
+
+    std::vector<Count> columnCoarse(maxColumns*coarseSize), columnFine(maxColumns*histSize);
+    std::vector<UInt32> kernelCoarse(coarseSize), kernelFine(histSize);
+    std::vector<MultiArrayIndex> lastUpdate(coarseSize);
+
+    for(MultiArrayIndex x0=0; x0<w; x0+=stripWidth)
+    {
+        const MultiArrayIndex x1 = std::min(x0 + stripWidth, w),
+                              columns = x1 - x0 + wx - 1;
+
+        for(MultiArrayIndex z=0; z<d; ++z)
+        {
+            std::fill(columnCoarse.begin(), columnCoarse.end(), Count());
+            std::fill(columnFine.begin(), columnFine.end(), Count());
+            for(MultiArrayIndex c=0; c<columns; ++c)
+            {
+                for(MultiArrayIndex zz=z; zz<z+wz; ++zz)
+                {
+                    for(MultiArrayIndex yy=0; yy<wy-1; ++yy)
+                    {
+                        int bin = Traits::toBin(src(x0+c, yy, zz));
+                        ++columnCoarse[c*coarseSize + (bin >> fineBits)];
+                        ++columnFine[c*histSize + bin];
+                    }
+                }
+            }
+
+            for(MultiArrayIndex y=0; y<h; ++y)
+            {
+                // move the column histograms down by one row
+                for(MultiArrayIndex c=0; c<columns; ++c)
+                {
+                    for(MultiArrayIndex zz=z; zz<z+wz; ++zz)
+                    {
+                        if(y > 0)
+                        {
+                            int bin = Traits::toBin(src(x0+c, y-1, zz));
+                            --columnCoarse[c*coarseSize + (bin >> fineBits)];
+                            --columnFine[c*histSize + bin];
+                        }
+                        int bin = Traits::toBin(src(x0+c, y+wy-1, zz));
+                        ++columnCoarse[c*coarseSize + (bin >> fineBits)];
+                        ++columnFine[c*histSize + bin];
+                    }
+                }
+
+                std::fill(kernelCoarse.begin(), kernelCoarse.end(), 0);
+                for(MultiArrayIndex c=0; c<wx; ++c)
+                    for(int b=0; b<coarseSize; ++b)
+                        kernelCoarse[b] += columnCoarse[c*coarseSize + b];
+                std::fill(lastUpdate.begin(), lastUpdate.end(), -wx);
+
+                for(MultiArrayIndex c=0; c<x1-x0; ++c)
+                {
+                    if(c > 0)
+                    {
+                        Count const * add = &columnCoarse[(c+wx-1)*coarseSize];
+                        Count const * sub = &columnCoarse[(c-1)*coarseSize];
+                        for(int b=0; b<coarseSize; ++b)
+                            kernelCoarse[b] += add[b] - sub[b];
+                    }
+
+                    MultiArrayIndex sum = 0;
+                    int coarse = 0;
+                    for(; coarse<coarseSize-1; ++coarse)
+                    {
+                        if(sum + (MultiArrayIndex)kernelCoarse[coarse] > k)
+                            break;
+                        sum += kernelCoarse[coarse];
+                    }
+
+                    // bring the fine level of the selected coarse bin up to date,
+                    // either incrementally or from scratch, whichever is cheaper
+                    UInt32 * fine = &kernelFine[coarse*fineSize];
+                    const MultiArrayIndex offset = coarse*fineSize;
+                    if(2*(c - lastUpdate[coarse]) > wx)
+                    {
+                        std::fill(fine, fine + fineSize, 0);
+                        for(MultiArrayIndex cc=c; cc<c+wx; ++cc)
+                        {
+                            Count const * add = &columnFine[cc*histSize + offset];
+                            for(int b=0; b<fineSize; ++b)
+                                fine[b] += add[b];
+                        }
+                    }
+                    else
+                    {
+                        for(MultiArrayIndex cc=lastUpdate[coarse]+1; cc<=c; ++cc)
+                        {
+                            Count const * add = &columnFine[(cc+wx-1)*histSize + offset];
+                            Count const * sub = &columnFine[(cc-1)*histSize + offset];
+                            for(int b=0; b<fineSize; ++b)
+                                fine[b] += add[b] - sub[b];
+                        }
+                    }
+                    lastUpdate[coarse] = c;
+
+                    int bin = 0;
+                    for(; bin<fineSize-1; ++bin)
+                    {
+                        sum += fine[bin];
+                        if(sum > k)
+                            break;
+                    }
+                    dest(x0+c, y, z) = Traits::fromBin(offset + bin);
+                }
+            }
+        }
+    }
+}
+
+template <class T1, class S1, class T2, class S2>
+inline void
+rankFilterDispatch(MultiArrayView<3, T1, S1> const & src,
+                   MultiArrayView<3, T2, S2> dest,
+                   Shape3 const & radius, MultiArrayIndex k,
+                   VigraTrueType /* use histogram */)
+{
+    typedef RankFilterHistogramTraits<T1> Traits;
+
+    if(prod(2*radius + Shape3(1)) < Traits::minWindowSize)
+        rankFilterSelect(src, dest, radius, k);
+    else if((2*radius[1]+1)*(2*radius[2]+1) <= NumericTraits<UInt16>::max())
+        rankFilterHistogram<UInt16>(src, dest, radius, k);
+    else
+        rankFilterHistogram<UInt32>(src, dest, radius, k);
+}
+
+template <class T1, class S1, class T2, class S2>
+inline void
+rankFilterDispatch(MultiArrayView<3, T1, S1> const & src,
+                   MultiArrayView<3, T2, S2> dest,
+                   Shape3 const & radius, MultiArrayIndex k,
+                   VigraFalseType /* use histogram */)
+{
+    rankFilterSelect(src, dest, radius, k);
+}
+
+template <class T1, class S1, class T2, class S2>
+void
+rankOrderFilterImpl(MultiArrayView<3, T1, S1> const & src,
+                    MultiArrayView<3, T2, S2> dest,
+                    Shape3 const & radius, double rank,
+                    BorderTreatmentMode border)
+{
+    const MultiArrayIndex k = (MultiArrayIndex)(rank*(prod(2*radius + Shape3(1)) - 1) + 0.5);
+
+    MultiArray<3, T1> padded;
+    MultiArrayView<3, T1, StridedArrayTag> in;
+    MultiArrayView<3, T2, StridedArrayTag> out;
+    if(border == BORDER_TREATMENT_AVOID)
+    {
+        if(!allLess(2*radius, src.shape()))
+            return;
+        in = src;
+        out = dest.subarray(radius, dest.shape() - radius);
+    }
+    else
+    {
+        rankFilterPad(src, padded, radius, border);
+        in = padded;
+        out = dest;
+    }
+
+    if(radius == Shape3(1, 1, 0) && k == 4)
+        rankFilterMedian3x3(in, out);
+    else
+        rankFilterDispatch(in, out, radius, k,
+                           typename RankFilterHistogramTraits<T1>::UseHistogram());
+}
+
+template <class T, class S>
+inline MultiArrayView<3, T, StridedArrayTag>
+rankFilterView3D(MultiArrayView<2, T, S> const & a)
+{
+    return a.insertSingletonDimension(2);
+}
+
+template <class T, class S>
+inline MultiArrayView<3, T, StridedArrayTag>
+rankFilterView3D(MultiArrayView<3, T, S> const & a)
+{
+    return a;
+}
+
+} // namespace detail
+
+/** \brief Rank order filter with a rectangular window in 2D and 3D.
+
+    The filter computes the value of rank <tt>rank</tt> (a number between 0 and 1)
+    in a window of size <tt>window_shape</tt> around every pixel, i.e. it acts as a
+    minimum filter if <tt>rank = 0.0</tt>, as a median filter if <tt>rank = 0.5</tt>,
+    and as a maximum filter if <tt>rank = 1.0</tt>. Precisely, if the window
+    contains <tt>n</tt> values, the result is the element with index
+    <tt>round(rank*(n-1))</tt> in the sorted window. The window must have
+    odd size along all axes.
+
+    The algorithm is chosen according to the pixel type and window size:
+    <ul>
+    <li> 3x3 median filters in 2D use a sorting network.
+    <li> 8- and 16-bit integer types (<tt>UInt8</tt>, <tt>Int8</tt>, <tt>UInt16</tt>,
+         <tt>Int16</tt>) use the constant-time histogram algorithm of
+         Perreault and H&eacute;bert with two-level histograms (16x16 bins for
+         8-bit, 256x256 bins for 16-bit data). The running time is independent
+         of the window size in 2D and linear in the window depth in 3D.
+    <li> All other cases select the rank from a copy of the window. The pixel type
+         must be sortable by <tt>operator<</tt>.
+    </ul>
+
+    The border treatment modes BORDER_TREATMENT_AVOID (leaving the border of
+    <tt>dest</tt> untouched), BORDER_TREATMENT_REPEAT, BORDER_TREATMENT_REFLECT,
+    BORDER_TREATMENT_WRAP, and BORDER_TREATMENT_ZEROPAD are supported.
+
+    <b> Declarations:</b>
+
+    \code
+    namespace vigra {
+        template <unsigned int N, class T1, class S1,
+                                  class T2, class S2>
+        void
+        rankOrderFilter(MultiArrayView<N, T1, S1> const & src,
+                        MultiArrayView<N, T2, S2> dest,
+                        typename MultiArrayShape<N>::type const & window_shape,
+                        double rank,
+                        BorderTreatmentMode border = BORDER_TREATMENT_REPEAT);
+    }
+    \endcode
+
+    <b> Usage:</b>
+
+    <b>\#include</b> \<vigra/medianfilter.hxx\><br/>
+    Namespace: vigra
+
+    \code
+    MultiArray<3, UInt16> src(Shape3(512, 512, 100)), dest(src.shape());
+    ...
+
+    // 90% quantile in a window of size 31x31x5
+    rankOrderFilter(src, dest, Shape3(31, 31, 5), 0.9);
+    \endcode
+
+    <b> Preconditions:</b>
+
+    \code
+    N == 2 || N == 3
+    0.0 <= rank <= 1.0
+    all window sizes are odd and positive
+    \endcode
+*/
+doxygen_overloaded_function(template <...> void rankOrderFilter)
+
+template <unsigned int N, class T1, class S1,
+                          class T2, class S2>
+void
+rankOrderFilter(MultiArrayView<N, T1, S1> const & src,
+                MultiArrayView<N, T2, S2> dest,
+                typename MultiArrayShape<N>::type const & window_shape,
+                double rank,
+                BorderTreatmentMode border = BORDER_TREATMENT_REPEAT)
+{
+    static_assert(N == 2 || N == 3,
+        "rankOrderFilter(): only implemented for 2D and 3D arrays.");
+
+    vigra_precondition(src.shape() == dest.shape(),
+        "rankOrderFilter(): shape mismatch between input and output.");
+    vigra_precondition(rank >= 0.0 && rank <= 1.0,
+        "rankOrderFilter(): Rank must be between 0 and 1 (inclusive).");
+    vigra_precondition(border == BORDER_TREATMENT_AVOID   ||
+                       border == BORDER_TREATMENT_REPEAT  ||
+                       border == BORDER_TREATMENT_REFLECT ||
+                       border == BORDER_TREATMENT_WRAP    ||
+                       border == BORDER_TREATMENT_ZEROPAD,
+        "rankOrderFilter(): Border treatment must be AVOID, REPEAT, REFLECT, WRAP, or ZEROPAD.");
+
+    Shape3 radius;
+    for(unsigned int k=0; k<N; ++k)
+    {
+        vigra_precondition(window_shape[k] > 0 && window_shape[k] % 2 == 1,
+            "rankOrderFilter(): Window size must be odd and positive.");
+        radius[k] = window_shape[k] / 2;
+    }
+
+    detail::rankOrderFilterImpl(detail::rankFilterView3D(src), detail::rankFilterView3D(dest),
+                                radius, rank, border);
+}
+
+template <unsigned int N, class T1, class S1,
+                          class T2, class S2>
+inline void
+medianFilter(MultiArrayView<N, T1, S1> const & src,
+             MultiArrayView<N, T2, S2> dest,
+             typename MultiArrayShape<N>::type const & window_shape,
+             BorderTreatmentMode border = BORDER_TREATMENT_REPEAT)
+{
+    rankOrderFilter(src, dest, window_shape, 0.5, border);
 }
 
 //@}
@@ -130,7 +130,9 @@
 #define VIGRA_MULTI_ARRAY_CHUNKED_HXX
 
 #include <queue>
+#include <deque>
 #include <string>
+#include <exception>
 
 #include "multi_fwd.hxx"
 #include "multi_handle.hxx"
@@ -138,6 +140,7 @@
 #include "memory.hxx"
 #include "metaprogramming.hxx"
 #include "threading.hxx"
+#include "threadpool.hxx"
 #include "compression.hxx"
 
 #ifdef _WIN32
@@ -353,19 +356,30 @@ class SharedChunkHandle
     static const long chunk_uninitialized = -3;
     static const long chunk_locked = -4;
     static const long chunk_failed = -5;
+    static const long chunk_prefetched = -6;  // loaded in the background, not yet accessed
 
     SharedChunkHandle()
     : pointer_(0)
     , chunk_state_()
+    , last_access_()
+    , cache_prev_(0)
+    , cache_next_(0)
+    , cache_stamp_(0)
     {
         chunk_state_ = chunk_uninitialized;
+        last_access_ = 0;
     }
 
     SharedChunkHandle(SharedChunkHandle const & rhs)
     : pointer_(rhs.pointer_)
     , chunk_state_()
+    , last_access_()
+    , cache_prev_(0)
+    , cache_next_(0)
+    , cache_stamp_(0)
     {
         chunk_state_ = chunk_uninitialized;
+        last_access_ = 0;
     }
 
     shape_type const & strides() const
@@ -375,6 +389,12 @@ class SharedChunkHandle
 
     ChunkBase<N, T> * pointer_;
     mutable threading::atomic_long chunk_state_;
+    mutable threading::atomic_long last_access_;  // for the cache eviction policy
+
+    // links of the chunk cache and the access time at insertion
+    // (protected by the array's chunk_lock_)
+    SharedChunkHandle * cache_prev_, * cache_next_;
+    long cache_stamp_;
 
   private:
     SharedChunkHandle & operator=(SharedChunkHandle const & rhs);
@@ -423,6 +443,16 @@ class ChunkedArrayBase
         return false;
     }
 
+    // number of chunks a ChunkIterator should request ahead of its position
+    virtual int prefetchDepth() const
+    {
+        return 0;
+    }
+
+    // hint that the chunk containing 'point' will be accessed soon
+    virtual void prefetchChunkAt(shape_type const &) const
+    {}
+
     MultiArrayIndex size() const
     {
         return prod(shape_);
@@ -1267,12 +1297,26 @@ createCoupledIterator(MultiArrayView<N, T, ChunkedArrayTag> const & m)
 class ChunkedArrayOptions
 {
   public:
+    /** \brief Strategies to select the chunk to be sent asleep when the cache is full.
+    */
+    enum CachePolicy {
+        FIFO,      ///< oldest chunk first (chunks still in use are moved to the back)
+        LRU,       ///< least recently accessed chunk first
+        Clock,     ///< second-chance approximation of LRU (cheaper bookkeeping)
+        ByteBudget ///< like LRU, but limits the bytes of the loaded chunks instead of their number
+    };
+
     /** \brief Initialize options with defaults.
     */
     ChunkedArrayOptions()
     : fill_value(0.0)
     , cache_max(-1)
     , compression_method(DEFAULT_COMPRESSION)
+    , compression_filter(NO_FILTER)
+    , io_threads(0)
+    , prefetch_depth(2)
+    , cache_policy(FIFO)
+    , cache_max_bytes(0)
     {}
 
     /** \brief Element value for read-only access of uninitialized chunks.
@@ -1320,11 +1364,373 @@ class ChunkedArrayOptions
         return ChunkedArrayOptions(*this).compression(v);
     }
 
+    /** \brief Reorder the bytes of inactive chunks before compression.
+
+        SHUFFLE and BITSHUFFLE group corresponding bytes (or bits) of all
+        elements in a chunk, which typically improves the compression of
+        multi-byte types such as float considerably (see \ref CompressionFilter).
+        Currently only used by \ref ChunkedArrayCompressed.
+
+        Default: NO_FILTER
+    */
+    ChunkedArrayOptions & compressionFilter(CompressionFilter v)
+    {
+        compression_filter = v;
+        return *this;
+    }
+
+    ChunkedArrayOptions compressionFilter(CompressionFilter v) const
+    {
+        return ChunkedArrayOptions(*this).compressionFilter(v);
+    }
+
+    /** \brief Number of background threads for asynchronous chunk I/O.
+
+        When positive, chunks ahead of a \ref ChunkIterator are loaded
+        (read, decompressed, or mapped) in the background, and chunks evicted
+        from the cache are written back asynchronously. See
+        \ref ChunkedArray::statistics() for measuring the effect.
+
+        Default: 0 (chunks are loaded and written back synchronously by the
+        accessing thread)
+    */
+    ChunkedArrayOptions & ioThreads(int v)
+    {
+        io_threads = v;
+        return *this;
+    }
+
+    ChunkedArrayOptions ioThreads(int v) const
+    {
+        return ChunkedArrayOptions(*this).ioThreads(v);
+    }
+
+    /** \brief Number of chunks a \ref ChunkIterator requests ahead of its
+        current position. Only effective when <tt>ioThreads() > 0</tt>.
+
+        Default: 2
+    */
+    ChunkedArrayOptions & prefetch(int v)
+    {
+        prefetch_depth = v;
+        return *this;
+    }
+
+    ChunkedArrayOptions prefetch(int v) const
+    {
+        return ChunkedArrayOptions(*this).prefetch(v);
+    }
+
+    /** \brief Eviction strategy of the chunk cache.
+
+        Default: FIFO
+    */
+    ChunkedArrayOptions & cachePolicy(CachePolicy v)
+    {
+        cache_policy = v;
+        return *this;
+    }
+
+    ChunkedArrayOptions cachePolicy(CachePolicy v) const
+    {
+        return ChunkedArrayOptions(*this).cachePolicy(v);
+    }
+
+    /** \brief Upper limit for \ref ChunkedArray::cacheBytes() under the
+        <tt>ByteBudget</tt> cache policy.
+
+        Only the uncompressed size of the loaded chunks counts, so the
+        budget bounds the main memory occupied by the cache regardless of
+        how well the chunks compress. Since chunks at the array border may
+        be smaller, the cache can hold more of those.
+
+        Default: 0 ( = cacheMax() times the size of an uncompressed chunk)
+    */
+    ChunkedArrayOptions & cacheMaxBytes(std::size_t v)
+    {
+        cache_max_bytes = v;
+        return *this;
+    }
+
+    ChunkedArrayOptions cacheMaxBytes(std::size_t v) const
+    {
+        return ChunkedArrayOptions(*this).cacheMaxBytes(v);
+    }
+
     double fill_value;
     int cache_max;
     CompressionMethod compression_method;
+    CompressionFilter compression_filter;
+    int io_threads, prefetch_depth;
+    CachePolicy cache_policy;
+    std::size_t cache_max_bytes;
+};
+
+/** \brief Access statistics of a \ref ChunkedArray.
+
+    Obtained by \ref ChunkedArray::statistics().
+*/
+struct ChunkedArrayStatistics
+{
+    ChunkedArrayStatistics()
+    : prefetched(0)
+    , prefetch_hits(0)
+    , stalls(0)
+    , write_behind(0)
+    , cache_hits(0)
+    , cache_misses(0)
+    , evictions(0)
+    {}
+
+    /** \brief Fraction of chunk accesses that found the chunk in memory
+        (0 if there were no accesses).
+    */
+    double cacheHitRate() const
+    {
+        return cache_hits + cache_misses == 0
+                 ? 0.0
+                 : (double)cache_hits / (double)(cache_hits + cache_misses);
+    }
+
+    /** \brief Fraction of prefetched chunks that were actually accessed
+        before being evicted from the cache (0 if nothing was prefetched).
+    */
+    double prefetchHitRate() const
+    {
+        return prefetched == 0
+                 ? 0.0
+                 : (double)prefetch_hits / (double)prefetched;
+    }
+
+    /** \brief Number of chunks loaded in the background.
+    */
+    std::size_t prefetched;
+
+    /** \brief Number of prefetched chunks that were subsequently accessed.
+    */
+    std::size_t prefetch_hits;
+
+    /** \brief Number of accesses that had to wait for a chunk, either
+        because it was asleep and had to be loaded by the accessing
+        thread, or because another thread was loading or
+        writing it back.
+    */
+    std::size_t stalls;
+
+    /** \brief Number of chunks written back asynchronously upon eviction.
+    */
+    std::size_t write_behind;
+
+    /** \brief Number of chunk accesses that found the chunk in memory.
+    */
+    std::size_t cache_hits;
+
+    /** \brief Number of chunk accesses that had to load an asleep chunk.
+        (The first access to an uninitialized chunk is not counted.)
+    */
+    std::size_t cache_misses;
+
+    /** \brief Number of chunks sent asleep by the cache eviction policy.
+    */
+    std::size_t evictions;
+};
+
+namespace detail {
+
+    // Thread-safe counters behind ChunkedArrayStatistics.
+    // Copies take a snapshot of the current values.
+struct ChunkedArrayCounters
+{
+    ChunkedArrayCounters()
+    {
+        reset();
+        access_clock.store(0);
+    }
+
+    ChunkedArrayCounters(ChunkedArrayCounters const & rhs)
+    {
+        *this = rhs;
+    }
+
+    ChunkedArrayCounters & operator=(ChunkedArrayCounters const & rhs)
+    {
+        prefetched.store(rhs.prefetched.load());
+        prefetch_hits.store(rhs.prefetch_hits.load());
+        stalls.store(rhs.stalls.load());
+        write_behind.store(rhs.write_behind.load());
+        cache_hits.store(rhs.cache_hits.load());
+        cache_misses.store(rhs.cache_misses.load());
+        evictions.store(rhs.evictions.load());
+        access_clock.store(rhs.access_clock.load());
+        return *this;
+    }
+
+    void reset()
+    {
+        prefetched.store(0);
+        prefetch_hits.store(0);
+        stalls.store(0);
+        write_behind.store(0);
+        cache_hits.store(0);
+        cache_misses.store(0);
+        evictions.store(0);
+    }
+
+    ChunkedArrayStatistics get() const
+    {
+        ChunkedArrayStatistics res;
+        res.prefetched    = prefetched.load();
+        res.prefetch_hits = prefetch_hits.load();
+        res.stalls        = stalls.load();
+        res.write_behind  = write_behind.load();
+        res.cache_hits    = cache_hits.load();
+        res.cache_misses  = cache_misses.load();
+        res.evictions     = evictions.load();
+        return res;
+    }
+
+    threading::atomic_long prefetched, prefetch_hits, stalls, write_behind,
+                           cache_hits, cache_misses, evictions;
+
+        // logical time stamp for LRU eviction (not part of the statistics)
+    threading::atomic_long access_clock;
+};
+
+    // Byte counter that the backends may update concurrently.
+    // Copies take a snapshot of the current value.
+class ChunkedArrayByteCount
+{
+  public:
+    ChunkedArrayByteCount(std::size_t v = 0)
+    {
+        value_.store((long)v);
+    }
+
+    ChunkedArrayByteCount(ChunkedArrayByteCount const & rhs)
+    {
+        value_.store(rhs.value_.load());
+    }
+
+    ChunkedArrayByteCount & operator=(ChunkedArrayByteCount const & rhs)
+    {
+        value_.store(rhs.value_.load());
+        return *this;
+    }
+
+    ChunkedArrayByteCount & operator=(std::size_t v)
+    {
+        value_.store((long)v);
+        return *this;
+    }
+
+    ChunkedArrayByteCount & operator+=(std::size_t v)
+    {
+        value_.fetch_add((long)v);
+        return *this;
+    }
+
+    ChunkedArrayByteCount & operator-=(std::size_t v)
+    {
+        value_.fetch_sub((long)v);
+        return *this;
+    }
+
+    operator std::size_t() const
+    {
+        return (std::size_t)value_.load();
+    }
+
+  private:
+    threading::atomic_long value_;
+};
+
+    // Ends, clock hand, and size of the chunk cache, i.e. of the doubly linked
+    // list threaded through the SharedChunkHandles. Since the links refer to the
+    // handles of a particular array, a copied array starts with an empty cache.
+template <class Handle>
+struct ChunkCacheList
+{
+    ChunkCacheList()
+    : front(0), back(0), hand(0), size(0)
+    {}
+
+    ChunkCacheList(ChunkCacheList const &)
+    : front(0), back(0), hand(0), size(0)
+    {}
+
+    ChunkCacheList & operator=(ChunkCacheList const &)
+    {
+        front = back = hand = 0;
+        size = 0;
+        return *this;
+    }
+
+    Handle * front, * back, * hand;
+    std::size_t size;
+};
+
+    // Threads that find a chunk in state chunk_locked block on one of these
+    // condition variables (selected by the handle's address) until the thread
+    // owning the chunk publishes its next state. Notification is skipped
+    // when nobody waits on the respective slot.
+class ChunkStateWaitTable
+{
+  public:
+    template <class Handle>
+    void wait(Handle const * handle)
+    {
+        Slot & s = slot(handle);
+        s.waiters.fetch_add(1);
+        {
+            threading::unique_lock<threading::mutex> lock(s.mutex);
+            while(handle->chunk_state_.load() == Handle::chunk_locked)
+                s.condition.wait(lock);
+        }
+        s.waiters.fetch_sub(1);
+    }
+
+    void notify(void const * handle)
+    {
+        Slot & s = slot(handle);
+        if(s.waiters.load() == 0)
+            return;
+        {
+            // make sure that waiters are either blocked or will see the new state
+            threading::lock_guard<threading::mutex> lock(s.mutex);
+        }
+        s.condition.notify_all();
+    }
+
+  private:
+    struct Slot
+    {
+        Slot()
+        {
+            waiters.store(0);
+        }
+
+        threading::mutex mutex;
+        threading::condition_variable condition;
+        threading::atomic_long waiters;
+    };
+
+    Slot & slot(void const * p)
+    {
+        return slots_[(reinterpret_cast<std::size_t>(p) >> 4) % size];
+    }
+
+    static const int size = 61;
+    Slot slots_[size];
 };
 
+inline ChunkStateWaitTable & chunkStateWaitTable()
+{
+    static ChunkStateWaitTable table;
+    return table;
+}
+
+} // namespace detail
+
 /** \weakgroup ParallelProcessing
     \sa ChunkedArray
  */
@@ -1391,12 +1797,29 @@ In-memory chunks (active and inactive) are placed in a cache. If a chunk
 transitions from the 'asleep' to the 'active' state, it is added to the cache,
 and an 'inactive' chunk is removed and sent 'asleep'. If there is no 'inactive'
 chunk in the cache, the cache size is temporarily increased. All state
-transitions are thread-safe.
+transitions are thread-safe. Access to an active chunk only requires an atomic
+reference count update, and different threads can load (e.g. decompress) or
+unload different chunks simultaneously. A thread that needs a chunk which is
+currently locked sleeps until the transition is finished.
 
 In order to optimize performance, the user should adjust the cache size (via
 \ref setCacheMaxSize() or \ref ChunkedArrayOptions) so that it can hold all
 chunks that are frequently needed (e.g. all chunks forming a row of the full
-array).
+array). Which 'inactive' chunk is sent asleep is determined by the cache policy
+(<tt>ChunkedArrayOptions::cachePolicy()</tt>): the default FIFO policy works well
+for streaming access, whereas LRU or Clock are preferable when some chunks are
+revisited repeatedly (e.g. in separable filters along the slowest axis). The
+ByteBudget policy limits \ref cacheBytes() instead of the number of chunks.
+The hit, miss, and eviction counters returned by \ref statistics() help to
+choose the policy and cache size.
+
+When the chunks are expensive to load (e.g. ChunkedArrayHDF5 or
+ChunkedArrayCompressed), I/O can be overlapped with computation by
+background threads (see <tt>ChunkedArrayOptions::ioThreads()</tt>). Chunk
+iterators then request the next chunks in iteration order ahead of time
+(<tt>ChunkedArrayOptions::prefetch()</tt>), and chunks evicted from the cache
+are written back asynchronously. Use \ref statistics() to check how often
+the accessing threads still had to wait for I/O.
 
 Another performance critical parameter is the chunk shape. While the system
 uses sensible defaults (512<sup>2</sup> for 2D arrays, 64<sup>3</sup> for 3D,
@@ -1613,12 +2036,12 @@ class ChunkedArray
     typedef ChunkBase<N, T> Chunk;
     typedef MultiArrayView<N, T, ChunkedArrayTag>                   view_type;
     typedef MultiArrayView<N, T const, ChunkedArrayTag>             const_view_type;
-    typedef std::queue<Handle*> CacheType;
 
     static const long chunk_asleep = Handle::chunk_asleep;
     static const long chunk_uninitialized = Handle::chunk_uninitialized;
     static const long chunk_locked = Handle::chunk_locked;
     static const long chunk_failed = Handle::chunk_failed;
+    static const long chunk_prefetched = Handle::chunk_prefetched;
 
     // constructor only called by derived classes (ChunkedArray is abstract)
     explicit ChunkedArray(shape_type const & shape,
@@ -1633,8 +2056,14 @@ class ChunkedArray
     , fill_scalar_(options.fill_value)
     , handle_array_(detail::computeChunkArrayShape(shape, bits_, mask_))
     , data_bytes_()
+    , cache_bytes_()
     , overhead_bytes_(handle_array_.size()*sizeof(Handle))
+    , prefetch_depth_(options.prefetch_depth)
+    , cache_policy_(options.cache_policy)
+    , cache_max_bytes_(options.cache_max_bytes)
     {
+        if(ParallelOptions().numThreads(options.io_threads).getNumThreads() > 0)
+            io_pool_.reset(new ThreadPool(options.io_threads));
         fill_value_chunk_.pointer_ = &fill_value_;
         fill_value_handle_.pointer_ = &fill_value_chunk_;
         fill_value_handle_.chunk_state_.store(1);
@@ -1663,7 +2092,7 @@ class ChunkedArray
     */
     int cacheSize() const
     {
-        return cache_.size();
+        return cache_.size;
     }
 
     /** \brief Bytes of main memory occupied by the array's data.
@@ -1676,6 +2105,16 @@ class ChunkedArray
         return data_bytes_;
     }
 
+    /** \brief Bytes occupied by the loaded (i.e. uncompressed) chunks.
+
+        In contrast to \ref dataBytes(), chunks that are asleep are not counted.
+        This is the quantity limited by the <tt>ByteBudget</tt> cache policy.
+    */
+    std::size_t cacheBytes() const
+    {
+        return cache_bytes_;
+    }
+
     /** \brief Bytes of main memory needed to manage the chunked storage.
     */
     std::size_t overheadBytes() const
@@ -1683,6 +2122,48 @@ class ChunkedArray
         return overhead_bytes_;
     }
 
+    /** \brief Cache, prefetch, and stall counters since construction or the last
+        call to resetStatistics().
+    */
+    ChunkedArrayStatistics statistics() const
+    {
+        return counters_.get();
+    }
+
+    /** \brief Reset all counters reported by statistics() to zero.
+    */
+    void resetStatistics()
+    {
+        counters_.reset();
+    }
+
+    /** \brief Block until all background prefetch and write-behind
+        operations have completed (no-op when <tt>ChunkedArrayOptions::ioThreads()</tt>
+        was zero).
+
+        If writing back an evicted chunk failed in the background, the first
+        such error is rethrown (and cleared) when \a rethrow is true. This also
+        happens in <tt>releaseChunks()</tt> and in the backends' <tt>flushToDisk()</tt>.
+        Backends must call <tt>finishIO(false)</tt> in their destructor, before
+        the chunks are deleted.
+    */
+    void finishIO(bool rethrow = true) const
+    {
+        if(!io_pool_)
+            return;
+        io_pool_->waitFinished();
+        if(!rethrow)
+            return;
+        std::exception_ptr error;
+        {
+            threading::lock_guard<threading::mutex> guard(*chunk_lock_);
+            error = io_error_;
+            io_error_ = std::exception_ptr();
+        }
+        if(error)
+            std::rethrow_exception(error);
+    }
+
     /** \brief Number of chunks along each coordinate direction.
     */
     virtual shape_type chunkArrayShape() const
@@ -1851,8 +2332,12 @@ class ChunkedArray
 
         if(cacheMaxSize() > 0)
         {
-            threading::lock_guard<threading::mutex> guard(*chunk_lock_);
-            cleanCache(cache_.size());
+            ArrayVector<Handle*> victims;
+            {
+                threading::lock_guard<threading::mutex> guard(*chunk_lock_);
+                cleanCache(cache_.size, victims);
+            }
+            releaseVictims(victims);
         }
     }
 
@@ -1861,12 +2346,14 @@ class ChunkedArray
     long acquireRef(Handle * handle) const
     {
         // Obtain a reference to the current chunk handle.
-        // We use a simple spin-lock here because it is very fast in case of success,
-        // and failures (i.e. collisions with another thread) are presumably
-        // very rare.
+        // In the common case (chunk in memory), this is a single compare-and-swap.
+        // If another thread is loading or unloading the chunk, we block until
+        // it publishes the new state.
         //
         // the function returns the old value of chunk_state_
+        // (a prefetched chunk is reported as refcount 0)
         long rc = handle->chunk_state_.load(threading::memory_order_acquire);
+        bool stalled = false;
         while(true)
         {
             if(rc >= 0)
@@ -1885,10 +2372,23 @@ class ChunkedArray
                 }
                 else if(rc == chunk_locked)
                 {
-                    // cache management in progress => try again later
-                    threading::this_thread::yield();
+                    // chunk is in transition => wait until it is done
+                    if(!stalled)
+                    {
+                        stalled = true;
+                        counters_.stalls.fetch_add(1);
+                    }
+                    detail::chunkStateWaitTable().wait(handle);
                     rc = handle->chunk_state_.load(threading::memory_order_acquire);
                 }
+                else if(rc == chunk_prefetched)
+                {
+                    if(handle->chunk_state_.compare_exchange_weak(rc, 1, threading::memory_order_seq_cst))
+                    {
+                        counters_.prefetch_hits.fetch_add(1);
+                        return 0;
+                    }
+                }
                 else if(handle->chunk_state_.compare_exchange_weak(rc, chunk_locked, threading::memory_order_seq_cst))
                 {
                     return rc;
@@ -1904,35 +2404,137 @@ class ChunkedArray
 
         long rc = acquireRef(handle);
         if(rc >= 0)
+        {
+            if(handle != &fill_value_handle_)
+            {
+                counters_.cache_hits.fetch_add(1);
+                touch(handle);
+            }
             return handle->pointer_->pointer_;
+        }
 
-        threading::lock_guard<threading::mutex> guard(*chunk_lock_);
+        if(rc == chunk_asleep)
+        {
+            counters_.cache_misses.fetch_add(1);
+            counters_.stalls.fetch_add(1);
+        }
+
+        return self->activateChunk(handle, isConst, insertInCache, chunk_index, rc, 1);
+    }
+
+    // Load a chunk whose state the caller has switched to chunk_locked
+    // (previous state 'rc'), and publish it with 'new_state'.
+    // The chunk_lock_ is only held for the cache bookkeeping, so that
+    // several threads can load (e.g. decompress) different chunks concurrently.
+    // NOTE: This function must be called without holding the chunk_lock_.
+    pointer
+    activateChunk(Handle * handle, bool isConst, bool insertInCache,
+                  shape_type const & chunk_index, long rc, long new_state)
+    {
+        T * p = 0;
         try
         {
-            T * p = self->loadChunk(&handle->pointer_, chunk_index);
-            Chunk * chunk = handle->pointer_;
+            p = loadChunk(&handle->pointer_, chunk_index);
             if(!isConst && rc == chunk_uninitialized)
                 std::fill(p, p + prod(chunkShape(chunk_index)), this->fill_value_);
+        }
+        catch(...)
+        {
+            setChunkState(handle, chunk_failed);
+            throw;
+        }
 
-            self->data_bytes_ += dataBytes(chunk);
+        std::size_t bytes = dataBytes(handle->pointer_);
+        data_bytes_ += bytes;
+        cache_bytes_ += bytes;
+        touch(handle);
 
-            if(cacheMaxSize() > 0 && insertInCache)
-            {
-                // insert in queue of mapped chunks
-                self->cache_.push(handle);
+        ArrayVector<Handle*> victims;
+        if(cacheMaxSize() > 0 && insertInCache)
+        {
+            threading::lock_guard<threading::mutex> guard(*chunk_lock_);
 
-                // do cache management if cache is full
-                // (note that we still hold the chunk_lock_)
-                self->cleanCache(2);
-            }
-            handle->chunk_state_.store(1, threading::memory_order_release);
-            return p;
+            // insert in queue of mapped chunks (unless a concurrent
+            // releaseChunks() hasn't removed it yet)
+            if(!cacheContains(handle))
+                cachePushBack(handle);
+
+            // do cache management if cache is full
+            cleanCache(2, victims);
+        }
+        setChunkState(handle, new_state);
+
+        try
+        {
+            releaseVictims(victims);
         }
         catch(...)
         {
-            handle->chunk_state_.store(chunk_failed);
+            if(new_state > 0)
+                unrefChunk(handle);
             throw;
         }
+        return p;
+    }
+
+    // Publish the state of a chunk that was locked by the present thread,
+    // and wake up the threads waiting for it.
+    void setChunkState(Handle * handle, long state) const
+    {
+        handle->chunk_state_.store(state);
+        detail::chunkStateWaitTable().notify(handle);
+    }
+
+    // record an access for the cache eviction policy
+    void touch(Handle * handle) const
+    {
+        if(cache_policy_ == ChunkedArrayOptions::Clock)
+            handle->last_access_.store(1);
+        else if(cache_policy_ != ChunkedArrayOptions::FIFO)
+            handle->last_access_.store(counters_.access_clock.fetch_add(1) + 1);
+    }
+
+    virtual int prefetchDepth() const
+    {
+        return io_pool_ ? prefetch_depth_ : 0;
+    }
+
+    // Load the chunk containing 'point' in the background if it is asleep.
+    // Called by ChunkIterator for the chunks ahead of its position.
+    virtual void prefetchChunkAt(shape_type const & point) const
+    {
+        if(!io_pool_ || !this->isInside(point))
+            return;
+
+        ChunkedArray * self = const_cast<ChunkedArray *>(this);
+        shape_type chunk_index(chunkStart(point));
+        Handle * handle = self->lookupHandle(chunk_index);
+        if(handle->chunk_state_.load() != chunk_asleep)
+            return;
+        io_pool_->enqueueDetached(
+            [self, handle, chunk_index](int)
+            {
+                self->prefetchChunk(handle, chunk_index);
+            });
+    }
+
+    // executed by the I/O threads
+    void prefetchChunk(Handle * handle, shape_type const & chunk_index)
+    {
+        // only claim the chunk if nobody else has loaded it in the meantime
+        long rc = chunk_asleep;
+        if(!handle->chunk_state_.compare_exchange_strong(rc, chunk_locked))
+            return;
+        try
+        {
+            activateChunk(handle, true, true, chunk_index, rc, chunk_prefetched);
+            counters_.prefetched.fetch_add(1);
+        }
+        catch(...)
+        {
+            // the chunk is now marked as failed and will raise
+            // an exception when it is accessed
+        }
     }
 
     // helper function for chunkForIterator()
@@ -1989,12 +2591,20 @@ class ChunkedArray
         return chunkForIteratorImpl(point, strides, upper_bound, h, true);
     }
 
-    // NOTE: This function must only be called while we hold the chunk_lock_.
-    //       This implies refcount != chunk_locked, so that race conditions are avoided.
-    long releaseChunk(Handle * handle, bool destroy = false)
+    // Try to switch an inactive chunk (or, if 'destroy' is true, an asleep one)
+    // to chunk_locked, so that the present thread may unload it. The chunk's
+    // bytes are deducted right away, so that cache management does not evict
+    // more chunks while the unload is pending.
+    bool lockForRelease(Handle * handle, bool destroy)
     {
         long rc = 0;
         bool mayUnload = handle->chunk_state_.compare_exchange_strong(rc, chunk_locked);
+        if(!mayUnload && rc == chunk_prefetched)
+        {
+            // prefetched, but never accessed
+            mayUnload = handle->chunk_state_.compare_exchange_strong(rc, chunk_locked);
+        }
+        bool loaded = mayUnload;
         if(!mayUnload && destroy)
         {
             rc = chunk_asleep;
@@ -2003,41 +2613,235 @@ class ChunkedArray
         if(mayUnload)
         {
             // refcount was zero or chunk_asleep => can unload
+            vigra_invariant(handle != &fill_value_handle_,
+               "ChunkedArray::releaseChunk(): attempt to release fill_value_handle_.");
+            std::size_t bytes = dataBytes(handle->pointer_);
+            data_bytes_ -= bytes;
+            if(loaded)
+                cache_bytes_ -= bytes;
+        }
+        return mayUnload;
+    }
+
+    // Send a chunk asleep (or destroy it) if it is not in use.
+    // Returns true if the chunk was released.
+    // NOTE: This function must be called without holding the chunk_lock_.
+    bool releaseChunk(Handle * handle, bool destroy = false)
+    {
+        if(!lockForRelease(handle, destroy))
+            return false;
+        deactivateChunk(handle, destroy);
+        return true;
+    }
+
+    // Unload a chunk that was locked by lockForRelease().
+    // NOTE: This function must be called without holding the chunk_lock_.
+    void deactivateChunk(Handle * handle, bool destroy)
+    {
+        try
+        {
+            Chunk * chunk = handle->pointer_;
+            bool didDestroy = unloadChunk(chunk, destroy);
+            data_bytes_ += dataBytes(chunk);
+            setChunkState(handle, didDestroy ? chunk_uninitialized : chunk_asleep);
+        }
+        catch(...)
+        {
+            setChunkState(handle, chunk_failed);
+            throw;
+        }
+    }
+
+    // Unload the chunks selected by cleanCache(). If background I/O is enabled,
+    // this is done by the I/O threads (write-behind). Otherwise, the first error
+    // is rethrown after all victims have been processed.
+    // NOTE: This function must be called without holding the chunk_lock_.
+    void releaseVictims(ArrayVector<Handle*> const & victims)
+    {
+        if(victims.size() == 0)
+            return;
+        if(io_pool_)
+        {
+            ChunkedArray * self = this;
+            for(std::size_t k=0; k<victims.size(); ++k)
+            {
+                Handle * handle = victims[k];
+                counters_.write_behind.fetch_add(1);
+                io_pool_->enqueueDetached(
+                    [self, handle](int)
+                    {
+                        try
+                        {
+                            self->deactivateChunk(handle, false);
+                        }
+                        catch(...)
+                        {
+                            // the chunk is now marked as failed, keep the first
+                            // error to be rethrown by finishIO()
+                            threading::lock_guard<threading::mutex> guard(*self->chunk_lock_);
+                            if(!self->io_error_)
+                                self->io_error_ = std::current_exception();
+                        }
+                    });
+            }
+            return;
+        }
+
+        std::exception_ptr error;
+        for(std::size_t k=0; k<victims.size(); ++k)
+        {
             try
             {
-                vigra_invariant(handle != &fill_value_handle_,
-                   "ChunkedArray::releaseChunk(): attempt to release fill_value_handle_.");
-                Chunk * chunk = handle->pointer_;
-                this->data_bytes_ -= dataBytes(chunk);
-                int didDestroy = unloadChunk(chunk, destroy);
-                this->data_bytes_ += dataBytes(chunk);
-                if(didDestroy)
-                    handle->chunk_state_.store(chunk_uninitialized);
-                else
-                    handle->chunk_state_.store(chunk_asleep);
+                deactivateChunk(victims[k], false);
             }
             catch(...)
             {
-                handle->chunk_state_.store(chunk_failed);
-                throw;
+                if(!error)
+                    error = std::current_exception();
             }
         }
-        return rc;
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    // The cache is a doubly linked list threaded through the chunk handles,
+    // so that chunks are appended, moved, and removed in constant time.
+    // NOTE: these functions must only be called while we hold the chunk_lock_
+    bool cacheContains(Handle const * handle) const
+    {
+        return handle->cache_prev_ != 0 || handle == cache_.front;
+    }
+
+    void cachePushBack(Handle * handle)
+    {
+        handle->cache_prev_ = cache_.back;
+        handle->cache_next_ = 0;
+        handle->cache_stamp_ = handle->last_access_.load();
+        if(cache_.back)
+            cache_.back->cache_next_ = handle;
+        else
+            cache_.front = handle;
+        cache_.back = handle;
+        ++cache_.size;
     }
 
+    // returns the chunk following 'handle'
+    Handle * cacheErase(Handle * handle)
+    {
+        Handle * next = handle->cache_next_;
+        if(handle->cache_prev_)
+            handle->cache_prev_->cache_next_ = next;
+        else
+            cache_.front = next;
+        if(next)
+            next->cache_prev_ = handle->cache_prev_;
+        else
+            cache_.back = handle->cache_prev_;
+        handle->cache_prev_ = 0;
+        handle->cache_next_ = 0;
+        if(cache_.hand == handle)
+            cache_.hand = next;
+        --cache_.size;
+        return next;
+    }
+
+    // Remove chunks from the cache until it satisfies its limit, and lock them
+    // for unloading. The chunks are only unloaded by a subsequent call to
+    // releaseVictims(), so that (de)compression and I/O happen outside the lock.
     // NOTE: this function must only be called while we hold the chunk_lock_
-    void cleanCache(int how_many = -1)
+    void cleanCache(int how_many, ArrayVector<Handle*> & victims)
     {
         if(how_many == -1)
-            how_many = cache_.size();
-        for(; cache_.size() > cacheMaxSize() && how_many > 0; --how_many)
+            how_many = cache_.size;
+        if(cache_policy_ == ChunkedArrayOptions::FIFO)
         {
-            Handle * handle = cache_.front();
-            cache_.pop();
-            long rc = releaseChunk(handle);
-            if(rc > 0) // refcount was positive => chunk is still needed
-                cache_.push(handle);
+            for(; cache_.size > cacheMaxSize() && how_many > 0; --how_many)
+            {
+                Handle * handle = cache_.front;
+                cacheErase(handle);
+                if(lockForRelease(handle, false))
+                {
+                    victims.push_back(handle);
+                    counters_.evictions.fetch_add(1);
+                }
+                else // chunk is still needed (or still being loaded)
+                {
+                    cachePushBack(handle);
+                }
+            }
         }
+        else
+        {
+            for(; cacheOverflow() && how_many > 0; --how_many)
+            {
+                Handle * handle = cache_policy_ == ChunkedArrayOptions::Clock
+                                       ? clockVictim()
+                                       : lruVictim();
+                if(handle == 0)
+                    break; // all chunks in the cache are in use
+                if(!lockForRelease(handle, false))
+                    continue; // chunk was acquired concurrently
+                cacheErase(handle);
+                victims.push_back(handle);
+                counters_.evictions.fetch_add(1);
+            }
+        }
+    }
+
+    bool cacheOverflow() const
+    {
+        if(cache_policy_ == ChunkedArrayOptions::ByteBudget)
+            return cache_bytes_ > cacheMaxBytes();
+        return cache_.size > cacheMaxSize();
+    }
+
+    static bool isEvictable(Handle const * handle)
+    {
+        long rc = handle->chunk_state_.load();
+        return rc == 0 || rc == chunk_prefetched;
+    }
+
+    // The least recently used inactive chunk in the cache, or 0.
+    // The list is ordered by the access time recorded at insertion. Chunks
+    // accessed since then, or still in use, are moved to the back on the way,
+    // so that the first unchanged inactive chunk is the least recently used one,
+    // and each access costs at most one move.
+    Handle * lruVictim()
+    {
+        for(std::size_t step=0, size=cache_.size; step < 2*size; ++step)
+        {
+            Handle * handle = cache_.front;
+            bool evictable = isEvictable(handle);
+            if(evictable && handle->last_access_.load() == handle->cache_stamp_)
+                return handle;
+            if(!evictable)
+                touch(handle);
+            cacheErase(handle);
+            cachePushBack(handle);
+        }
+        return 0;
+    }
+
+    // The first inactive chunk whose reference bit is clear
+    // (clearing the bits of the chunks passed over), or 0.
+    Handle * clockVictim()
+    {
+        for(std::size_t step=0, size=cache_.size; step < 2*size; ++step)
+        {
+            if(cache_.hand == 0)
+                cache_.hand = cache_.front;
+            Handle * handle = cache_.hand;
+            cache_.hand = handle->cache_next_;
+            if(!isEvictable(handle))
+                continue;
+            if(handle->last_access_.load() != 0)
+            {
+                handle->last_access_.store(0); // second chance
+                continue;
+            }
+            return handle;
+        }
+        return 0;
     }
 
     /** Sends all chunks asleep which are completely inside the given ROI.
@@ -2052,6 +2856,9 @@ class ChunkedArray
     {
         checkSubarrayBounds(start, stop, "ChunkedArray::releaseChunks()");
 
+        // chunks being loaded or written back in the background are locked
+        finishIO();
+
         MultiCoordinateIterator<N> i(chunkStart(start), chunkStop(stop)),
                                    end(i.getEndIterator());
         for(; i != end; ++i)
@@ -2064,20 +2871,55 @@ class ChunkedArray
                 continue;
             }
 
-            Handle * handle = this->lookupHandle(*i);
-            threading::lock_guard<threading::mutex> guard(*chunk_lock_);
-            releaseChunk(handle, destroy);
+            releaseChunk(this->lookupHandle(*i), destroy);
         }
 
         // remove all chunks from the cache that are asleep or unitialized
+        // (chunks being loaded concurrently are already in the cache)
         threading::lock_guard<threading::mutex> guard(*chunk_lock_);
-        int cache_size = cache_.size();
-        for(int k=0; k < cache_size; ++k)
+        for(Handle * handle = cache_.front; handle != 0; )
         {
-            Handle * handle = cache_.front();
-            cache_.pop();
-            if(handle->chunk_state_.load() >= 0)
-                cache_.push(handle);
+            long rc = handle->chunk_state_.load();
+            if(rc >= 0 || rc == chunk_prefetched || rc == chunk_locked)
+                handle = handle->cache_next_;
+            else
+                handle = cacheErase(handle);
+        }
+        cache_.hand = 0;
+    }
+
+    /** \brief Load the chunks in an ROI ahead of time.
+
+        Call this when the ROI from 'start' to 'stop' (in 'beyond' sense) will be
+        read soon. Chunks in the ROI that are currently asleep are loaded (e.g.
+        decompressed) and placed in the cache as inactive chunks. If background
+        I/O is enabled (see <tt>ChunkedArrayOptions::ioThreads()</tt>), this
+        function returns immediately and the chunks are loaded by the I/O threads.
+        Otherwise, the chunks are loaded in parallel according to 'options' before
+        the function returns. The cache should be big enough to hold the ROI's
+        chunks, because prefetched chunks are evicted like any other inactive chunk.
+    */
+    void prefetchSubarray(shape_type const & start, shape_type const & stop,
+                          ParallelOptions const & options = ParallelOptions()) const
+    {
+        checkSubarrayBounds(start, stop, "ChunkedArray::prefetchSubarray()");
+
+        ChunkedArray * self = const_cast<ChunkedArray *>(this);
+        MultiCoordinateIterator<N> chunks(chunkStart(start), chunkStop(stop));
+        std::ptrdiff_t nChunks = chunks.getEndIterator() - chunks;
+        if(io_pool_)
+        {
+            for(std::ptrdiff_t k=0; k<nChunks; ++k)
+                prefetchChunkAt(chunks[k] * this->chunk_shape_);
+        }
+        else
+        {
+            parallel_foreach(options.getNumThreads(), nChunks,
+                [self, &chunks](int, std::ptrdiff_t k)
+                {
+                    shape_type chunk_index(chunks[k]);
+                    self->prefetchChunk(self->lookupHandle(chunk_index), chunk_index);
+                });
         }
     }
 
@@ -2085,34 +2927,57 @@ class ChunkedArray
 
         The ROI's lower bound is given by 'start', its upper bound (in 'beyond' sense)
         is 'start + subarray.shape()'. Chunks in the ROI are only activated while
-        the read is in progress.
+        the read is in progress. When the ROI covers several chunks, they are
+        loaded (e.g. decompressed) and copied in parallel according to 'options'
+        (default: serial, pass e.g. <tt>ParallelOptions()</tt> to use the shared
+        \ref globalThreadPool()).
     */
     template <class U, class Stride>
     void
     checkoutSubarray(shape_type const & start,
-                     MultiArrayView<N, U, Stride> & subarray) const
+                     MultiArrayView<N, U, Stride> & subarray,
+                     ParallelOptions const & options = ParallelOptions().numThreads(0)) const
     {
         shape_type stop   = start + subarray.shape();
 
         checkSubarrayBounds(start, stop, "ChunkedArray::checkoutSubarray()");
 
-        chunk_const_iterator i = chunk_cbegin(start, stop);
-        for(; i.isValid(); ++i)
+        MultiCoordinateIterator<N> chunks(chunkStart(start), chunkStop(stop));
+        std::ptrdiff_t nChunks = chunks.getEndIterator() - chunks;
+        if(nChunks < 2 || options.getNumThreads() < 2)
         {
-            subarray.subarray(i.chunkStart()-start, i.chunkStop()-start) = *i;
+            chunk_const_iterator i = chunk_cbegin(start, stop);
+            for(; i.isValid(); ++i)
+            {
+                subarray.subarray(i.chunkStart()-start, i.chunkStop()-start) = *i;
+            }
+            return;
         }
+
+        parallel_foreach(options.getNumThreads(), nChunks,
+            [this, &chunks, &start, &stop, &subarray](int, std::ptrdiff_t k)
+            {
+                shape_type chunk_start(chunks[k] * this->chunk_shape_);
+                chunk_const_iterator i = chunk_cbegin(max(start, chunk_start),
+                                                      min(stop, chunk_start + this->chunk_shape_));
+                subarray.subarray(i.chunkStart()-start, i.chunkStop()-start) = *i;
+            });
     }
 
     /** \brief Copy an ordinary MultiArrayView into an ROI of the chunked array.
 
         The ROI's lower bound is given by 'start', its upper bound (in 'beyond' sense)
         is 'start + subarray.shape()'. Chunks in the ROI are only activated while
-        the write is in progress.
+        the write is in progress. When the ROI covers several chunks, they are
+        filled and released (e.g. compressed) in parallel according to 'options'
+        (default: serial, pass e.g. <tt>ParallelOptions()</tt> to use the shared
+        \ref globalThreadPool()).
     */
     template <class U, class Stride>
     void
     commitSubarray(shape_type const & start,
-                   MultiArrayView<N, U, Stride> const & subarray)
+                   MultiArrayView<N, U, Stride> const & subarray,
+                   ParallelOptions const & options = ParallelOptions().numThreads(0))
     {
         shape_type stop   = start + subarray.shape();
 
@@ -2120,11 +2985,26 @@ class ChunkedArray
                            "ChunkedArray::commitSubarray(): array is read-only.");
         checkSubarrayBounds(start, stop, "ChunkedArray::commitSubarray()");
 
-        chunk_iterator i = chunk_begin(start, stop);
-        for(; i.isValid(); ++i)
+        MultiCoordinateIterator<N> chunks(chunkStart(start), chunkStop(stop));
+        std::ptrdiff_t nChunks = chunks.getEndIterator() - chunks;
+        if(nChunks < 2 || options.getNumThreads() < 2)
         {
-            *i = subarray.subarray(i.chunkStart()-start, i.chunkStop()-start);
+            chunk_iterator i = chunk_begin(start, stop);
+            for(; i.isValid(); ++i)
+            {
+                *i = subarray.subarray(i.chunkStart()-start, i.chunkStop()-start);
+            }
+            return;
         }
+
+        parallel_foreach(options.getNumThreads(), nChunks,
+            [this, &chunks, &start, &stop, &subarray](int, std::ptrdiff_t k)
+            {
+                shape_type chunk_start(chunks[k] * this->chunk_shape_);
+                chunk_iterator i = chunk_begin(max(start, chunk_start),
+                                               min(stop, chunk_start + this->chunk_shape_));
+                *i = subarray.subarray(i.chunkStart()-start, i.chunkStop()-start);
+            });
     }
 
     // helper function for subarray()
@@ -2369,13 +3249,34 @@ class ChunkedArray
     void setCacheMaxSize(std::size_t c)
     {
         cache_max_size_ = c;
-        if(c < cache_.size())
+        if(c < cache_.size)
         {
-            threading::lock_guard<threading::mutex> guard(*chunk_lock_);
-            cleanCache();
+            ArrayVector<Handle*> victims;
+            {
+                threading::lock_guard<threading::mutex> guard(*chunk_lock_);
+                cleanCache(-1, victims);
+            }
+            releaseVictims(victims);
         }
     }
 
+    /** \brief Get the limit for \ref cacheBytes() under the <tt>ByteBudget</tt>
+        cache policy (see \ref ChunkedArrayOptions::cacheMaxBytes()).
+    */
+    std::size_t cacheMaxBytes() const
+    {
+        return cache_max_bytes_ > 0
+                   ? cache_max_bytes_
+                   : cacheMaxSize()*dataBytesPerChunk();
+    }
+
+    /** \brief Get the eviction strategy of the chunk cache.
+    */
+    ChunkedArrayOptions::CachePolicy cachePolicy() const
+    {
+        return cache_policy_;
+    }
+
     /** \brief Create a scan-order iterator for the entire chunked array.
     */
     iterator begin()
@@ -2476,13 +3377,19 @@ class ChunkedArray
     shape_type bits_, mask_;
     int cache_max_size_;
     VIGRA_SHARED_PTR<threading::mutex> chunk_lock_;
-    CacheType cache_;
+    detail::ChunkCacheList<Handle> cache_;
     Chunk fill_value_chunk_;
     Handle fill_value_handle_;
     value_type fill_value_;
     double fill_scalar_;
     MultiArray<N, Handle> handle_array_;
-    std::size_t data_bytes_, overhead_bytes_;
+    detail::ChunkedArrayByteCount data_bytes_, cache_bytes_, overhead_bytes_;
+    int prefetch_depth_;
+    VIGRA_SHARED_PTR<ThreadPool> io_pool_;
+    mutable std::exception_ptr io_error_;
+    mutable detail::ChunkedArrayCounters counters_;
+    ChunkedArrayOptions::CachePolicy cache_policy_;
+    std::size_t cache_max_bytes_;
 };
 
 /** Returns a CoupledScanOrderIterator to simultaneously iterate over image m1 and its coordinates.
@@ -2754,6 +3661,7 @@ class ChunkedArrayLazy
 
     ~ChunkedArrayLazy()
     {
+        this->finishIO(false);
         typename ChunkStorage::iterator i   = this->handle_array_.begin(),
                                         end = this->handle_array_.end();
         for(; i != end; ++i)
@@ -2855,14 +3763,15 @@ class ChunkedArrayCompressed
             compressed_.clear();
         }
 
-        void compress(CompressionMethod method)
+        void compress(CompressionMethod method, CompressionFilter filter = NO_FILTER)
         {
             if(this->pointer_ != 0)
             {
                 vigra_invariant(compressed_.size() == 0,
                     "ChunkedArrayCompressed::Chunk::compress(): compressed and uncompressed pointer are both non-zero.");
 
-                ::vigra::compress((char const *)this->pointer_, size_*sizeof(T), compressed_, method);
+                ::vigra::compress((char const *)this->pointer_, size_*sizeof(T), compressed_, method,
+                                  filter, filterElementSize());
 
                 // std::cerr << "compression ratio: " << double(compressed_.size())/(this->size()*sizeof(T)) << "\n";
                 detail::destroy_dealloc_n(this->pointer_, size_, alloc_);
@@ -2870,7 +3779,7 @@ class ChunkedArrayCompressed
             }
         }
 
-        pointer uncompress(CompressionMethod method)
+        pointer uncompress(CompressionMethod method, CompressionFilter filter = NO_FILTER)
         {
             if(this->pointer_ == 0)
             {
@@ -2879,7 +3788,8 @@ class ChunkedArrayCompressed
                     this->pointer_ = alloc_.allocate((typename Alloc::size_type)size_);
 
                     ::vigra::uncompress(compressed_.data(), compressed_.size(),
-                                        (char*)this->pointer_, size_*sizeof(T), method);
+                                        (char*)this->pointer_, size_*sizeof(T), method,
+                                        filter, filterElementSize());
                     compressed_.clear();
                 }
                 else
@@ -2895,6 +3805,12 @@ class ChunkedArrayCompressed
             return this->pointer_;
         }
 
+        // filters operate on the scalar type (e.g. float for RGBValue<float>)
+        static std::size_t filterElementSize()
+        {
+            return sizeof(typename ExpandElementResult<T>::type);
+        }
+
         ArrayVector<char> compressed_;
         MultiArrayIndex size_;
         Alloc alloc_;
@@ -2918,21 +3834,32 @@ class ChunkedArrayCompressed
         <li>ZLIB_FAST: Fast compression using 'zlib' (slower than LZ4, but higher compression).
         <li>ZLIB_BEST: Best compression using 'zlib', slow.
         <li>ZLIB_NONE: Use 'zlib' format without compression.
+        <li>ZSTD_FAST, ZSTD, ZSTD_BEST: 'zstd' compression at level 1, 3, and 19
+            respectively (only if VIGRA was compiled with zstd support, see
+            \ref isCompressionAvailable()). Level 1 is almost as fast as LZ4,
+            but compresses better.
         <li>DEFAULT_COMPRESSION: Same as LZ4.
         </ul>
+        In addition, <tt>options.compressionFilter(SHUFFLE)</tt> or
+        <tt>options.compressionFilter(BITSHUFFLE)</tt> reorder the bytes of
+        each chunk before compression, which helps a lot for float data.
     */
     explicit ChunkedArrayCompressed(shape_type const & shape,
                                     shape_type const & chunk_shape=shape_type(),
                                     ChunkedArrayOptions const & options = ChunkedArrayOptions())
     : ChunkedArray<N, T>(shape, chunk_shape, options),
-       compression_method_(options.compression_method)
+       compression_method_(options.compression_method),
+       compression_filter_(options.compression_filter)
     {
         if(compression_method_ == DEFAULT_COMPRESSION)
             compression_method_ = LZ4;
+        vigra_precondition(isCompressionAvailable(compression_method_),
+            "ChunkedArrayCompressed(): VIGRA was compiled without support for the requested compression method.");
     }
 
     ~ChunkedArrayCompressed()
     {
+        this->finishIO(false);
         typename ChunkStorage::iterator i   = this->handle_array_.begin(),
                                         end = this->handle_array_.end();
         for(; i != end; ++i)
@@ -2950,7 +3877,7 @@ class ChunkedArrayCompressed
             *p = new Chunk(this->chunkShape(index));
             this->overhead_bytes_ += sizeof(Chunk);
         }
-        return static_cast<Chunk *>(*p)->uncompress(compression_method_);
+        return static_cast<Chunk *>(*p)->uncompress(compression_method_, compression_filter_);
     }
 
     virtual bool unloadChunk(ChunkBase<N, T> * chunk, bool destroy)
@@ -2958,7 +3885,7 @@ class ChunkedArrayCompressed
         if(destroy)
             static_cast<Chunk *>(chunk)->deallocate();
         else
-            static_cast<Chunk *>(chunk)->compress(compression_method_);
+            static_cast<Chunk *>(chunk)->compress(compression_method_, compression_filter_);
         return destroy;
     }
 
@@ -2976,6 +3903,12 @@ class ChunkedArrayCompressed
             return "ChunkedArrayCompressed<ZLIB_BEST>";
           case LZ4:
             return "ChunkedArrayCompressed<LZ4>";
+          case ZSTD:
+            return "ChunkedArrayCompressed<ZSTD>";
+          case ZSTD_FAST:
+            return "ChunkedArrayCompressed<ZSTD_FAST>";
+          case ZSTD_BEST:
+            return "ChunkedArrayCompressed<ZSTD_BEST>";
           default:
             return "unknown";
         }
@@ -2994,6 +3927,7 @@ class ChunkedArrayCompressed
     }
 
     CompressionMethod compression_method_;
+    CompressionFilter compression_filter_;
 };
 
 /** \weakgroup ParallelProcessing
@@ -3187,6 +4121,7 @@ class ChunkedArrayTmpFile
 
     ~ChunkedArrayTmpFile()
     {
+        this->finishIO(false);
         typename ChunkStorage::iterator  i = this->handle_array_.begin(),
                                          end = this->handle_array_.end();
         for(; i != end; ++i)
@@ -3210,6 +4145,8 @@ class ChunkedArrayTmpFile
             shape_type shape = this->chunkShape(index);
             std::size_t chunk_size = computeAllocSize(shape);
         #ifdef VIGRA_NO_SPARSE_FILE
+            // chunks are loaded concurrently => serialize file growth
+            threading::lock_guard<threading::mutex> guard(*this->chunk_lock_);
             std::size_t offset = file_size_;
             if(offset + chunk_size > file_capacity_)
             {
@@ -3263,6 +4200,9 @@ class ChunkedArrayTmpFile
     std::size_t file_size_, file_capacity_;
 };
 
+template<unsigned int N, class U>
+class ChunkView;
+
 template<unsigned int N, class U>
 class ChunkIterator
 : public MultiCoordinateIterator<N>
@@ -3293,6 +4233,7 @@ class ChunkIterator
     ChunkIterator()
     : base_type()
     , base_type2()
+    , array_(0)
     {}
 
     ChunkIterator(array_type * array,
@@ -3307,6 +4248,7 @@ class ChunkIterator
     , chunk_shape_(chunk_shape)
     {
         getChunk();
+        prefetchNext();
     }
 
     ChunkIterator(ChunkIterator const & rhs)
@@ -3321,10 +4263,18 @@ class ChunkIterator
         getChunk();
     }
 
+    ~ChunkIterator()
+    {
+        if(array_)
+            array_->unrefChunk(&chunk_);
+    }
+
     ChunkIterator & operator=(ChunkIterator const & rhs)
     {
         if(this != &rhs)
         {
+            if(array_)
+                array_->unrefChunk(&chunk_);
             base_type::operator=(rhs);
             array_ = rhs.array_;
             chunk_ = rhs.chunk_;
@@ -3356,14 +4306,16 @@ class ChunkIterator
         return this;
     }
 
-    value_type operator[](MultiArrayIndex i) const
+        // The returned view keeps its chunk in memory as long as it exists
+        // (the view returned by operator* only as long as the iterator).
+    ChunkView<N, U> operator[](MultiArrayIndex i) const
     {
-        return *(ChunkIterator(*this) += i);
+        return ChunkView<N, U>(ChunkIterator(*this) += i);
     }
 
-    value_type operator[](const shape_type &coordOffset) const
+    ChunkView<N, U> operator[](const shape_type &coordOffset) const
     {
-        return *(ChunkIterator(*this) += coordOffset);
+        return ChunkView<N, U>(ChunkIterator(*this) += coordOffset);
     }
 
     void getChunk()
@@ -3377,6 +4329,22 @@ class ChunkIterator
         }
     }
 
+    // ask the array to load the next chunks in iteration order
+    void prefetchNext()
+    {
+        if(array_)
+        {
+            int depth = array_->prefetchDepth();
+            for(int k=1; k<=depth; ++k)
+            {
+                base_type next(static_cast<base_type const &>(*this) + k);
+                if(!next.isValid())
+                    break;
+                array_->prefetchChunkAt(max(start_, next.point()*chunk_shape_) + chunk_.offset_);
+            }
+        }
+    }
+
     shape_type chunkStart() const
     {
         return max(start_, this->point()*chunk_shape_) + chunk_.offset_;
@@ -3391,6 +4359,7 @@ class ChunkIterator
     {
         base_type::operator++();
         getChunk();
+        prefetchNext();
         return *this;
     }
 
@@ -3483,6 +4452,52 @@ class ChunkIterator
     shape_type start_, stop_, chunk_shape_, array_point_;
 };
 
+namespace detail {
+
+template<unsigned int N, class U>
+struct ChunkViewPin
+{
+    explicit ChunkViewPin(ChunkIterator<N, U> const & chunk)
+    : chunk_(chunk)
+    {}
+
+    ChunkIterator<N, U> chunk_;
+};
+
+} // namespace detail
+
+    // The view of a chunk returned by ChunkIterator::operator[]. It holds a
+    // reference to the chunk, so that the chunk cannot be evicted while the
+    // view exists. (The pin is a base class, so that it is initialized first.)
+template<unsigned int N, class U>
+class ChunkView
+: private detail::ChunkViewPin<N, U>
+, public MultiArrayView<N, typename UnqualifiedType<U>::type>
+{
+    typedef detail::ChunkViewPin<N, U>                           pin_type;
+    typedef MultiArrayView<N, typename UnqualifiedType<U>::type> view_type;
+
+  public:
+    explicit ChunkView(ChunkIterator<N, U> const & chunk)
+    : pin_type(chunk)
+    , view_type(*this->chunk_)
+    {}
+
+    ChunkView(ChunkView const & rhs)
+    : pin_type(rhs)
+    , view_type(*this->chunk_)
+    {}
+
+        // Like MultiArrayView, assignment copies the data, not the chunk.
+    ChunkView & operator=(ChunkView const & rhs)
+    {
+        view_type::operator=(rhs);
+        return *this;
+    }
+
+    using view_type::operator=;
+};
+
 //@}
 
 } // namespace vigra
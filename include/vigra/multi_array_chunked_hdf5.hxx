@@ -59,6 +59,19 @@ namespace vigra {
     \sa ChunkedArrayHDF5
 */
 
+namespace detail {
+
+    // The HDF5 library is not reentrant (unless built in thread-safe mode), but
+    // ChunkedArrayHDF5 loads and unloads chunks from several threads.
+    // All chunk I/O is therefore serialized by this lock.
+inline threading::mutex & chunkedArrayHDF5Lock()
+{
+    static threading::mutex lock;
+    return lock;
+}
+
+} // namespace detail
+
 /** Implement ChunkedArray as a chunked dataset in an HDF5 file.
 
     <b>\#include</b> \<vigra/multi_array_chunked_hdf5.hxx\> <br/>
@@ -113,6 +126,7 @@ class ChunkedArrayHDF5
 
         void write(bool deallocate = true)
         {
+            threading::lock_guard<threading::mutex> guard(detail::chunkedArrayHDF5Lock());
             if(this->pointer_ != 0)
             {
                 if(!array_->file_.isReadOnly())
@@ -132,6 +146,7 @@ class ChunkedArrayHDF5
 
         pointer read()
         {
+            threading::lock_guard<threading::mutex> guard(detail::chunkedArrayHDF5Lock());
             if(this->pointer_ == 0)
             {
                 this->pointer_ = alloc_.allocate(this->size());
@@ -183,6 +198,8 @@ class ChunkedArrayHDF5
         <li>ZLIB_NONE: Use 'zlib' format without compression.
         <li>DEFAULT_COMPRESSION: Same as ZLIB_FAST.
         </ul>
+        The dataset is opened with the chunk cache settings of 'file' (see
+        HDF5File::setChunkCache() and HDF5File::setSequentialAccess()).
     */
     ChunkedArrayHDF5(HDF5File const & file, std::string const & dataset,
                      HDF5File::OpenMode mode,
@@ -278,11 +295,17 @@ class ChunkedArrayHDF5
         vigra_precondition(exists || !file_.isReadOnly(),
             "ChunkedArrayHDF5(): dataset does not exist, but file is read-only.");
 
+        // Chunks are read while holding chunkedArrayHDF5Lock(). Decoding them in
+        // parallel would wait for thread pool workers that may themselves be
+        // blocked on this lock, so the chunks are decoded by the reading thread.
+        file_.setReadThreads(0);
+
         if(!exists || mode == HDF5File::New)
         {
             // FIXME: set rdcc_nbytes to 0 (disable cache, because we don't
             //        need two caches
-            // H5Pset_chunk_cache (dapl, rdcc_nslots, rdcc_nbytes, rdcc_w0);
+            // The chunk cache is configured via HDF5File::setChunkCache(),
+            // which createDataset() and getDatasetHandleShared() respect.
             // Chunk cache size (rdcc_nbytes) should be large
             // enough to hold all the chunks in a selection
             // * If this is not possible, it may be best to disable chunk
@@ -299,8 +322,8 @@ class ChunkedArrayHDF5
             // chunks as are needed for a single array chunk.
             if(compression_ == DEFAULT_COMPRESSION)
                 compression_ = ZLIB_FAST;
-            vigra_precondition(compression_ != LZ4,
-                "ChunkedArrayHDF5(): HDF5 does not support LZ4 compression.");
+            vigra_precondition(compression_ >= NO_COMPRESSION && compression_ <= ZLIB_BEST,
+                "ChunkedArrayHDF5(): HDF5 only supports ZLIB compression.");
 
             vigra_precondition(this->size() > 0,
                 "ChunkedArrayHDF5(): invalid shape.");
@@ -383,6 +406,8 @@ class ChunkedArrayHDF5
 
     void flushToDiskImpl(bool destroy, bool force_destroy)
     {
+        // the destructor (force_destroy) must not throw
+        this->finishIO(!force_destroy);
         if(file_.isReadOnly())
             return;
 
@@ -413,6 +438,7 @@ class ChunkedArrayHDF5
                 chunk->write(false);
             }
         }
+        threading::lock_guard<threading::mutex> io_guard(detail::chunkedArrayHDF5Lock());
         file_.flushToDisk();
     }
 
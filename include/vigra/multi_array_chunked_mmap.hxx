@@ -0,0 +1,539 @@
+/************************************************************************/
+/*                                                                      */
+/*               Copyright 2026 by the VIGRA developers                 */
+/*                                                                      */
+/*    This file is part of the VIGRA computer vision library.           */
+/*    The VIGRA Website is                                              */
+/*        http://hci.iwr.uni-heidelberg.de/vigra/                       */
+/*    Please direct questions, bug reports, and contributions to        */
+/*        ullrich.koethe@iwr.uni-heidelberg.de    or                    */
+/*        vigra@informatik.uni-hamburg.de                               */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef VIGRA_MULTI_ARRAY_CHUNKED_MMAP_HXX
+#define VIGRA_MULTI_ARRAY_CHUNKED_MMAP_HXX
+
+#include <cstring>
+
+#include "multi_array_chunked.hxx"
+#include "sized_int.hxx"
+
+#ifdef _WIN32
+# error "multi_array_chunked_mmap.hxx: ChunkedArrayMmap is currently only available on POSIX systems."
+#endif
+
+namespace vigra {
+
+namespace detail {
+
+    // File layout of ChunkedArrayMmap:
+    //  * the fixed header fields below,
+    //  * one byte per chunk (in scan order) which is non-zero when
+    //    the chunk has been initialized,
+    //  * padding up to 'alignment',
+    //  * the chunks in scan order, each padded to a multiple of 'alignment'.
+template <unsigned int N>
+struct ChunkedArrayMmapHeader
+{
+    typedef typename MultiArrayShape<N>::type  shape_type;
+
+    enum { version = 1, byteOrderMark = 0x01020304 };
+
+    ChunkedArrayMmapHeader()
+    : shape(), chunk_shape(), fill_value(0.0), alignment(0),
+      value_size(0), scalar_size(0), scalar_flags(0)
+    {}
+
+    template <class T>
+    void setValueType()
+    {
+        typedef typename ExpandElementResult<T>::type Scalar;
+        value_size   = sizeof(T);
+        scalar_size  = sizeof(Scalar);
+        scalar_flags = (NumericTraits<Scalar>::isIntegral::value ? 1 : 0) |
+                       (NumericTraits<Scalar>::isSigned::value ? 2 : 0);
+    }
+
+    static std::size_t fixedSize()
+    {
+        return 8 + 6*sizeof(UInt32) + 2*N*sizeof(Int64) + sizeof(double) + sizeof(UInt64);
+    }
+
+    void write(char * p) const
+    {
+        std::memcpy(p, magic(), 8);
+        p += 8;
+        writeField(p, UInt32(version));
+        writeField(p, UInt32(byteOrderMark));
+        writeField(p, UInt32(N));
+        writeField(p, value_size);
+        writeField(p, scalar_size);
+        writeField(p, scalar_flags);
+        for(unsigned int k=0; k<N; ++k)
+            writeField(p, Int64(shape[k]));
+        for(unsigned int k=0; k<N; ++k)
+            writeField(p, Int64(chunk_shape[k]));
+        writeField(p, fill_value);
+        writeField(p, UInt64(alignment));
+    }
+
+    void read(char const * p)
+    {
+        vigra_precondition(std::memcmp(p, magic(), 8) == 0,
+            "ChunkedArrayMmap(): file is not a ChunkedArrayMmap file.");
+        p += 8;
+        UInt32 v, bom, dim;
+        readField(p, v);
+        readField(p, bom);
+        readField(p, dim);
+        vigra_precondition(v == version,
+            "ChunkedArrayMmap(): unsupported file version.");
+        vigra_precondition(bom == byteOrderMark,
+            "ChunkedArrayMmap(): file was written with a different byte order.");
+        vigra_precondition(dim == N,
+            "ChunkedArrayMmap(): file has wrong dimension.");
+        readField(p, value_size);
+        readField(p, scalar_size);
+        readField(p, scalar_flags);
+        for(unsigned int k=0; k<N; ++k)
+        {
+            Int64 s;
+            readField(p, s);
+            shape[k] = s;
+        }
+        for(unsigned int k=0; k<N; ++k)
+        {
+            Int64 s;
+            readField(p, s);
+            chunk_shape[k] = s;
+        }
+        readField(p, fill_value);
+        UInt64 a;
+        readField(p, a);
+        alignment = a;
+    }
+
+    // the number of bytes before the first chunk
+    std::size_t dataOffset(std::size_t chunkCount) const
+    {
+        return alignUp(fixedSize() + chunkCount);
+    }
+
+    std::size_t alignUp(std::size_t size) const
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    static char const * magic()
+    {
+        return "VIGRAMAP";
+    }
+
+    template <class V>
+    static void writeField(char * & p, V v)
+    {
+        std::memcpy(p, &v, sizeof(V));
+        p += sizeof(V);
+    }
+
+    template <class V>
+    static void readField(char const * & p, V & v)
+    {
+        std::memcpy(&v, p, sizeof(V));
+        p += sizeof(V);
+    }
+
+    shape_type shape, chunk_shape;
+    double fill_value;
+    std::size_t alignment;
+    UInt32 value_size, scalar_size, scalar_flags;
+};
+
+} // namespace detail
+
+/** \addtogroup ChunkedArrayClasses
+*/
+//@{
+
+/** \weakgroup ParallelProcessing
+    \sa ChunkedArrayMmap
+*/
+
+/** Implement ChunkedArray as a persistent memory-mapped file.
+
+    <b>\#include</b> \<vigra/multi_array_chunked_mmap.hxx\> <br/>
+    Namespace: vigra
+
+    The chunks are stored uncompressed in a file with a small header that
+    records the array's shape, chunk shape, element type, and fill value, as well as
+    which chunks have already been written. Active chunks are mapped into memory
+    via <tt>mmap()</tt> on demand, and the OS is asked (via <tt>madvise()</tt>) to
+    read them ahead, so that no data are copied. Chunks that were never written
+    occupy no disk space (the file is sparse) and read as the fill value.
+
+    In contrast to \ref ChunkedArrayTmpFile, the file persists after the array is
+    destroyed and can be reopened almost instantly. In read-only mode, the mapped
+    pages are shared via the OS page cache, so that several processes can
+    access the same huge volume without duplicating it in memory.
+
+    Currently, this backend is only available on POSIX systems.
+
+    <b>Usage:</b>
+
+    \code
+    // create a new file
+    {
+        ChunkedArrayMmap<3, UInt32> labels("labels.vmm", Shape3(2000, 2000, 1000));
+        ... // fill 'labels'
+        labels.flushToDisk();   // optional: the destructor writes everything back as well
+    }
+
+    // reopen it read-only (e.g. in several processes at once)
+    ChunkedArrayMmap<3, UInt32> labels("labels.vmm");
+    \endcode
+*/
+template <unsigned int N, class T>
+class ChunkedArrayMmap
+: public ChunkedArray<N, T>
+{
+  public:
+
+    class Chunk
+    : public ChunkBase<N, T>
+    {
+      public:
+        typedef typename MultiArrayShape<N>::type  shape_type;
+        typedef T value_type;
+        typedef value_type * pointer;
+        typedef value_type & reference;
+
+        Chunk(shape_type const & shape,
+              std::size_t offset, size_t alloc_size,
+              int file, bool read_only)
+        : ChunkBase<N, T>(detail::defaultStride(shape))
+        , offset_(offset)
+        , alloc_size_(alloc_size)
+        , file_(file)
+        , read_only_(read_only)
+        {}
+
+        ~Chunk()
+        {
+            unmap();
+        }
+
+        pointer map()
+        {
+            if(this->pointer_ == 0)
+            {
+                int protection = read_only_ ? PROT_READ : PROT_READ | PROT_WRITE;
+                void * p = mmap(0, alloc_size_, protection, MAP_SHARED, file_, offset_);
+                if(p == MAP_FAILED)
+                    throw std::runtime_error("ChunkedArrayMmap::Chunk::map(): mmap() failed.");
+                // the chunk is about to be accessed => start reading it now
+                madvise(p, alloc_size_, MADV_WILLNEED);
+                this->pointer_ = (pointer)p;
+            }
+            return this->pointer_;
+        }
+
+        void unmap()
+        {
+            if(this->pointer_ != 0)
+            {
+                munmap(this->pointer_, alloc_size_);
+                this->pointer_ = 0;
+            }
+        }
+
+        void flush()
+        {
+            if(this->pointer_ != 0 && !read_only_)
+                msync(this->pointer_, alloc_size_, MS_SYNC);
+        }
+
+        std::size_t offset_, alloc_size_;
+        int file_;
+        bool read_only_;
+
+      private:
+        Chunk & operator=(Chunk const &);
+    };
+
+    typedef MultiArray<N, SharedChunkHandle<N, T>  > ChunkStorage;
+    typedef MultiArray<N, std::size_t>               OffsetStorage;
+    typedef typename ChunkStorage::difference_type   shape_type;
+    typedef T value_type;
+    typedef value_type * pointer;
+    typedef value_type & reference;
+    typedef detail::ChunkedArrayMmapHeader<N>        Header;
+
+        /** Access mode when an existing file is opened.
+        */
+    enum OpenMode {
+        ReadOnly,   ///< map the chunks read-only (may be shared by several processes)
+        ReadWrite   ///< map the chunks for reading and writing
+    };
+
+    /** \brief Create a new file 'filename' (overwriting an existing file)
+        holding an array of the given 'shape'.
+
+        The 'chunk_shape' and the fill value (see \ref ChunkedArrayOptions) are
+        stored in the file and restored upon reopening.
+    */
+    ChunkedArrayMmap(std::string const & filename,
+                     shape_type const & shape,
+                     shape_type const & chunk_shape=shape_type(),
+                     ChunkedArrayOptions const & options = ChunkedArrayOptions())
+    : ChunkedArray<N, T>(shape, chunk_shape, options)
+    , filename_(filename)
+    , read_only_(false)
+    {
+        header_.shape = this->shape_;
+        header_.chunk_shape = this->chunk_shape_;
+        header_.fill_value = options.fill_value;
+        header_.alignment = mmap_alignment;
+        header_.template setValueType<T>();
+
+        std::size_t file_size = init();
+
+        file_ = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if(file_ == -1)
+            throw std::runtime_error("ChunkedArrayMmap(): unable to create file '" + filename_ + "'.");
+        // a sparse file: chunks only occupy disk space once they are written
+        if(::ftruncate(file_, file_size) == -1)
+        {
+            ::close(file_);
+            throw std::runtime_error("ChunkedArrayMmap(): unable to resize file '" + filename_ + "'.");
+        }
+        mapHeader();
+        header_.write(header_map_);
+    }
+
+    /** \brief Open an existing file 'filename'.
+
+        Shape, chunk shape, and fill value are read from the file, and the
+        corresponding fields of 'options' are ignored. The element type
+        <tt>T</tt> must match the type the file was created with.
+    */
+    explicit ChunkedArrayMmap(std::string const & filename,
+                              OpenMode mode = ReadOnly,
+                              ChunkedArrayOptions const & options = ChunkedArrayOptions())
+    : ChunkedArrayMmap(filename, readHeader(filename), mode, options)
+    {}
+
+    ~ChunkedArrayMmap()
+    {
+        this->finishIO(false);
+        typename ChunkStorage::iterator  i = this->handle_array_.begin(),
+                                         end = this->handle_array_.end();
+        for(; i != end; ++i)
+        {
+            if(i->pointer_)
+                delete static_cast<Chunk*>(i->pointer_);
+            i->pointer_ = 0;
+        }
+        munmap(header_map_, header_size_);
+        ::close(file_);
+    }
+
+    /** \brief Write all mapped chunks and the header to the disk.
+
+        This must not be called while other threads access the array.
+    */
+    void flushToDisk()
+    {
+        this->finishIO();
+        if(read_only_)
+            return;
+        typename ChunkStorage::iterator  i = this->handle_array_.begin(),
+                                         end = this->handle_array_.end();
+        for(; i != end; ++i)
+        {
+            if(i->pointer_)
+                static_cast<Chunk*>(i->pointer_)->flush();
+        }
+        msync(header_map_, header_size_, MS_SYNC);
+        ::fsync(file_);
+    }
+
+    virtual pointer loadChunk(ChunkBase<N, T> ** p, shape_type const & index)
+    {
+        char & initialized = header_map_[Header::fixedSize() + dot(index, chunk_strides_)];
+        if(read_only_)
+        {
+            // const access to uninitialized chunks never gets here
+            vigra_precondition(initialized != 0,
+                "ChunkedArrayMmap::loadChunk(): array is read-only.");
+        }
+        if(*p == 0)
+        {
+            shape_type shape = this->chunkShape(index);
+            *p = new Chunk(shape, offset_array_[index], header_.alignUp(prod(shape)*sizeof(T)),
+                           file_, read_only_);
+            this->overhead_bytes_ += sizeof(Chunk);
+        }
+        pointer res = static_cast<Chunk*>(*p)->map();
+        if(!initialized)
+            initialized = 1; // the caller fills the chunk with the fill value
+        return res;
+    }
+
+    virtual bool unloadChunk(ChunkBase<N, T> * chunk, bool /* destroy*/)
+    {
+        static_cast<Chunk *>(chunk)->unmap();
+        return false; // never destroys the data
+    }
+
+    virtual bool isReadOnly() const
+    {
+        return read_only_;
+    }
+
+    virtual std::string backend() const
+    {
+        return "ChunkedArrayMmap<'" + filename_ + "'>";
+    }
+
+    virtual std::size_t dataBytes(ChunkBase<N,T> * c) const
+    {
+        return c->pointer_ == 0
+                 ? 0
+                 : static_cast<Chunk*>(c)->alloc_size_;
+    }
+
+    virtual std::size_t overheadBytesPerChunk() const
+    {
+        return sizeof(Chunk) + sizeof(SharedChunkHandle<N, T>) + sizeof(std::size_t) + 1;
+    }
+
+    std::string fileName() const
+    {
+        return filename_;
+    }
+
+  private:
+
+    ChunkedArrayMmap(std::string const & filename, Header const & header,
+                     OpenMode mode, ChunkedArrayOptions const & options)
+    : ChunkedArray<N, T>(header.shape, header.chunk_shape,
+                         ChunkedArrayOptions(options).fillValue(header.fill_value))
+    , filename_(filename)
+    , header_(header)
+    , read_only_(mode == ReadOnly)
+    {
+        Header expected;
+        expected.template setValueType<T>();
+        vigra_precondition(header_.value_size == expected.value_size &&
+                           header_.scalar_size == expected.scalar_size &&
+                           header_.scalar_flags == expected.scalar_flags,
+            "ChunkedArrayMmap(): file was created with a different element type.");
+        vigra_precondition(header_.chunk_shape == this->chunk_shape_,
+            "ChunkedArrayMmap(): invalid chunk shape in file.");
+        vigra_precondition(header_.alignment % mmap_alignment == 0,
+            "ChunkedArrayMmap(): file layout is incompatible with the page size of this machine.");
+
+        init();
+
+        file_ = ::open(filename_.c_str(), read_only_ ? O_RDONLY : O_RDWR);
+        if(file_ == -1)
+            throw std::runtime_error("ChunkedArrayMmap(): unable to open file '" + filename_ + "'.");
+        mapHeader();
+
+        // chunks that have been written before are asleep
+        typename ChunkStorage::iterator i   = this->handle_array_.begin(),
+                                        end = this->handle_array_.end();
+        for(std::size_t k=0; i != end; ++i, ++k)
+        {
+            if(header_map_[Header::fixedSize() + k] != 0)
+                i->chunk_state_.store(ChunkedArray<N, T>::chunk_asleep);
+        }
+    }
+
+    static Header readHeader(std::string const & filename)
+    {
+        int file = ::open(filename.c_str(), O_RDONLY);
+        if(file == -1)
+            throw std::runtime_error("ChunkedArrayMmap(): unable to open file '" + filename + "'.");
+        ArrayVector<char> buffer(Header::fixedSize());
+        ssize_t count = ::read(file, buffer.data(), buffer.size());
+        ::close(file);
+        vigra_precondition(count == (ssize_t)buffer.size(),
+            "ChunkedArrayMmap(): file is not a ChunkedArrayMmap file.");
+        Header header;
+        header.read(buffer.data());
+        return header;
+    }
+
+    // compute the chunk offsets and return the file size
+    std::size_t init()
+    {
+        chunk_strides_ = detail::defaultStride(this->chunkArrayShape());
+        offset_array_.reshape(this->chunkArrayShape());
+        header_size_ = header_.dataOffset(offset_array_.size());
+
+        typename OffsetStorage::iterator i   = offset_array_.begin(),
+                                         end = offset_array_.end();
+        std::size_t size = header_size_;
+        for(; i != end; ++i)
+        {
+            *i = size;
+            size += header_.alignUp(prod(this->chunkShape(i.point()))*sizeof(T));
+        }
+        this->overhead_bytes_ += offset_array_.size()*sizeof(std::size_t) + header_size_;
+        return size;
+    }
+
+    void mapHeader()
+    {
+        int protection = read_only_ ? PROT_READ : PROT_READ | PROT_WRITE;
+        void * p = mmap(0, header_size_, protection, MAP_SHARED, file_, 0);
+        if(p == MAP_FAILED)
+        {
+            ::close(file_);
+            throw std::runtime_error("ChunkedArrayMmap(): unable to map file header.");
+        }
+        header_map_ = (char *)p;
+    }
+
+    ChunkedArrayMmap(ChunkedArrayMmap const &);
+    ChunkedArrayMmap & operator=(ChunkedArrayMmap const &);
+
+    std::string filename_;
+    Header header_;
+    bool read_only_;
+    int file_;
+    char * header_map_;         // the header and the 'initialized' flags of the chunks
+    std::size_t header_size_;
+    OffsetStorage offset_array_;
+    shape_type chunk_strides_;
+};
+
+//@}
+
+} // namespace vigra
+
+#endif // VIGRA_MULTI_ARRAY_CHUNKED_MMAP_HXX
@@ -43,6 +43,11 @@
 #include "navigator.hxx"
 #include "copyimage.hxx"
 #include "threading.hxx"
+#include "threadpool.hxx"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace vigra {
 
@@ -204,11 +209,12 @@ inline fftw_plan
 fftwPlanCreate(unsigned int N, int* shape,
                FFTWComplex<double> * in,  int* instrides,  int instep,
                FFTWComplex<double> * out, int* outstrides, int outstep,
-               int sign, unsigned int planner_flags)
+               int sign, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftw_plan_many_dft(N, shape, 1,
-                              (fftw_complex *)in, instrides, instep, 0,
-                              (fftw_complex *)out, outstrides, outstep, 0,
+    return fftw_plan_many_dft(N, shape, howmany,
+                              (fftw_complex *)in, instrides, instep, idist,
+                              (fftw_complex *)out, outstrides, outstep, odist,
                               sign, planner_flags);
 }
 
@@ -216,11 +222,12 @@ inline fftw_plan
 fftwPlanCreate(unsigned int N, int* shape,
                double * in,  int* instrides,  int instep,
                FFTWComplex<double> * out, int* outstrides, int outstep,
-               int /*sign is ignored*/, unsigned int planner_flags)
+               int /*sign is ignored*/, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftw_plan_many_dft_r2c(N, shape, 1,
-                                   in, instrides, instep, 0,
-                                   (fftw_complex *)out, outstrides, outstep, 0,
+    return fftw_plan_many_dft_r2c(N, shape, howmany,
+                                   in, instrides, instep, idist,
+                                   (fftw_complex *)out, outstrides, outstep, odist,
                                    planner_flags);
 }
 
@@ -228,11 +235,12 @@ inline fftw_plan
 fftwPlanCreate(unsigned int N, int* shape,
                FFTWComplex<double> * in,  int* instrides,  int instep,
                double * out, int* outstrides, int outstep,
-               int /*sign is ignored*/, unsigned int planner_flags)
+               int /*sign is ignored*/, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftw_plan_many_dft_c2r(N, shape, 1,
-                                  (fftw_complex *)in, instrides, instep, 0,
-                                  out, outstrides, outstep, 0,
+    return fftw_plan_many_dft_c2r(N, shape, howmany,
+                                  (fftw_complex *)in, instrides, instep, idist,
+                                  out, outstrides, outstep, odist,
                                   planner_flags);
 }
 
@@ -240,11 +248,12 @@ inline fftwf_plan
 fftwPlanCreate(unsigned int N, int* shape,
                FFTWComplex<float> * in,  int* instrides,  int instep,
                FFTWComplex<float> * out, int* outstrides, int outstep,
-               int sign, unsigned int planner_flags)
+               int sign, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftwf_plan_many_dft(N, shape, 1,
-                               (fftwf_complex *)in, instrides, instep, 0,
-                               (fftwf_complex *)out, outstrides, outstep, 0,
+    return fftwf_plan_many_dft(N, shape, howmany,
+                               (fftwf_complex *)in, instrides, instep, idist,
+                               (fftwf_complex *)out, outstrides, outstep, odist,
                                sign, planner_flags);
 }
 
@@ -252,11 +261,12 @@ inline fftwf_plan
 fftwPlanCreate(unsigned int N, int* shape,
                float * in,  int* instrides,  int instep,
                FFTWComplex<float> * out, int* outstrides, int outstep,
-               int /*sign is ignored*/, unsigned int planner_flags)
+               int /*sign is ignored*/, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftwf_plan_many_dft_r2c(N, shape, 1,
-                                    in, instrides, instep, 0,
-                                    (fftwf_complex *)out, outstrides, outstep, 0,
+    return fftwf_plan_many_dft_r2c(N, shape, howmany,
+                                    in, instrides, instep, idist,
+                                    (fftwf_complex *)out, outstrides, outstep, odist,
                                     planner_flags);
 }
 
@@ -264,11 +274,12 @@ inline fftwf_plan
 fftwPlanCreate(unsigned int N, int* shape,
                FFTWComplex<float> * in,  int* instrides,  int instep,
                float * out, int* outstrides, int outstep,
-               int /*sign is ignored*/, unsigned int planner_flags)
+               int /*sign is ignored*/, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftwf_plan_many_dft_c2r(N, shape, 1,
-                                   (fftwf_complex *)in, instrides, instep, 0,
-                                   out, outstrides, outstep, 0,
+    return fftwf_plan_many_dft_c2r(N, shape, howmany,
+                                   (fftwf_complex *)in, instrides, instep, idist,
+                                   out, outstrides, outstep, odist,
                                    planner_flags);
 }
 
@@ -276,11 +287,12 @@ inline fftwl_plan
 fftwPlanCreate(unsigned int N, int* shape,
                FFTWComplex<long double> * in,  int* instrides,  int instep,
                FFTWComplex<long double> * out, int* outstrides, int outstep,
-               int sign, unsigned int planner_flags)
+               int sign, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftwl_plan_many_dft(N, shape, 1,
-                               (fftwl_complex *)in, instrides, instep, 0,
-                               (fftwl_complex *)out, outstrides, outstep, 0,
+    return fftwl_plan_many_dft(N, shape, howmany,
+                               (fftwl_complex *)in, instrides, instep, idist,
+                               (fftwl_complex *)out, outstrides, outstep, odist,
                                sign, planner_flags);
 }
 
@@ -288,11 +300,12 @@ inline fftwl_plan
 fftwPlanCreate(unsigned int N, int* shape,
                long double * in,  int* instrides,  int instep,
                FFTWComplex<long double> * out, int* outstrides, int outstep,
-               int /*sign is ignored*/, unsigned int planner_flags)
+               int /*sign is ignored*/, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftwl_plan_many_dft_r2c(N, shape, 1,
-                                    in, instrides, instep, 0,
-                                    (fftwl_complex *)out, outstrides, outstep, 0,
+    return fftwl_plan_many_dft_r2c(N, shape, howmany,
+                                    in, instrides, instep, idist,
+                                    (fftwl_complex *)out, outstrides, outstep, odist,
                                     planner_flags);
 }
 
@@ -300,11 +313,12 @@ inline fftwl_plan
 fftwPlanCreate(unsigned int N, int* shape,
                FFTWComplex<long double> * in,  int* instrides,  int instep,
                long double * out, int* outstrides, int outstep,
-               int /*sign is ignored*/, unsigned int planner_flags)
+               int /*sign is ignored*/, unsigned int planner_flags,
+               int howmany = 1, int idist = 0, int odist = 0)
 {
-    return fftwl_plan_many_dft_c2r(N, shape, 1,
-                                   (fftwl_complex *)in, instrides, instep, 0,
-                                   out, outstrides, outstep, 0,
+    return fftwl_plan_many_dft_c2r(N, shape, howmany,
+                                   (fftwl_complex *)in, instrides, instep, idist,
+                                   out, outstrides, outstep, odist,
                                    planner_flags);
 }
 
@@ -398,6 +412,91 @@ fftwPlanExecute(fftwl_plan plan, FFTWComplex<long double> * in,  long double * o
     fftwl_execute_dft_c2r(plan, (fftwl_complex *)in, out);
 }
 
+    // the first argument only selects the precision
+inline int fftwAlignmentOf(fftw_plan, void * p)
+{
+    return fftw_alignment_of((double *)p);
+}
+
+inline int fftwAlignmentOf(fftwf_plan, void * p)
+{
+    return fftwf_alignment_of((float *)p);
+}
+
+inline int fftwAlignmentOf(fftwl_plan, void * p)
+{
+    return fftwl_alignment_of((long double *)p);
+}
+
+inline bool fftwImportWisdom(fftw_plan, char const * filename)
+{
+    return fftw_import_wisdom_from_filename(filename) != 0;
+}
+
+inline bool fftwImportWisdom(fftwf_plan, char const * filename)
+{
+    return fftwf_import_wisdom_from_filename(filename) != 0;
+}
+
+inline bool fftwImportWisdom(fftwl_plan, char const * filename)
+{
+    return fftwl_import_wisdom_from_filename(filename) != 0;
+}
+
+inline bool fftwExportWisdom(fftw_plan, char const * filename)
+{
+    return fftw_export_wisdom_to_filename(filename) != 0;
+}
+
+inline bool fftwExportWisdom(fftwf_plan, char const * filename)
+{
+    return fftwf_export_wisdom_to_filename(filename) != 0;
+}
+
+inline bool fftwExportWisdom(fftwl_plan, char const * filename)
+{
+    return fftwl_export_wisdom_to_filename(filename) != 0;
+}
+
+    // Set the number of threads for subsequently created plans. FFTW's threaded
+    // planner requires linking with the fftw3_threads libraries, so it is only
+    // used when VIGRA_FFTW_THREADS is defined. Must be called with the FFTWLock held.
+#ifdef VIGRA_FFTW_THREADS
+
+inline bool fftwPlanWithNThreads(fftw_plan, int nThreads)
+{
+    static const bool initialized = fftw_init_threads() != 0;
+    if(initialized)
+        fftw_plan_with_nthreads(nThreads);
+    return initialized;
+}
+
+inline bool fftwPlanWithNThreads(fftwf_plan, int nThreads)
+{
+    static const bool initialized = fftwf_init_threads() != 0;
+    if(initialized)
+        fftwf_plan_with_nthreads(nThreads);
+    return initialized;
+}
+
+inline bool fftwPlanWithNThreads(fftwl_plan, int nThreads)
+{
+    static const bool initialized = fftwl_init_threads() != 0;
+    if(initialized)
+        fftwl_plan_with_nthreads(nThreads);
+    return initialized;
+}
+
+#else // VIGRA_FFTW_THREADS
+
+template <class PlanType>
+inline bool fftwPlanWithNThreads(PlanType, int)
+{
+    return false;
+}
+
+#endif // VIGRA_FFTW_THREADS
+
 template <int DUMMY>
 struct FFTWPaddingSize
 {
@@ -815,6 +914,308 @@ fftwCorrespondingShapeC2R(TinyVector<T, N> shape, bool oddDimension0 = false)
     return shape;
 }
 
+/********************************************************/
+/*                                                      */
+/*                     FFTWPlanCache                    */
+/*                                                      */
+/********************************************************/
+
+template <unsigned int N, class Real>
+class FFTWPlan;
+
+/** Process-wide cache of FFTW plans.
+
+    Creating a plan with FFTW's planner often takes much longer than executing it,
+    especially with <tt>FFTW_MEASURE</tt> and stronger planner flags. Therefore, \ref FFTWPlan
+    (and thus \ref fourierTransform(), \ref convolveFFT() and their relatives) looks up its plans
+    in this cache. Plans are keyed by shape, strides, transform direction, kind
+    (complex-to-complex, real-to-complex or complex-to-real), planner flags, batch layout,
+    number of threads, memory alignment of the arrays, and whether the transform is in-place,
+    so that a cached plan can always be executed on new arrays with FFTW's new-array execute
+    functions. Lookup and creation are serialized by the same mutex that protects FFTW's
+    planner. There is a separate cache for
+    each precision <tt>Real</tt>.
+
+    The cache is enabled by default. It holds at most maxSize() plans (default: 128). When
+    this is exceeded, the least recently used plans are destroyed, except for plans that are
+    still used by an FFTWPlan or FFTWConvolvePlan object. clear() destroys all unused plans
+    immediately, and the plans still in use when their last user releases them.
+
+    In addition, the cache provides access to FFTW's <a href="http://www.fftw.org/doc/Wisdom.html">wisdom</a>,
+    so that expensive planning results can be saved to a file and reused across program runs.
+
+    <b> Usage:</b>
+
+    <b>\#include</b> \<vigra/multi_fft.hxx\><br>
+    Namespace: vigra
+
+    \code
+    // load the results of previous planning (returns false if the file doesn't exist)
+    FFTWPlanCache<double>::importWisdom("fftw_wisdom.dat");
+
+    // plans are only measured when the wisdom doesn't contain them,
+    // and only once per shape in this process
+    for(int k=0; k<iterations; ++k)
+        FFTWPlan<2, double>(src, fourier, FFTW_MEASURE).execute(src, fourier);
+
+    FFTWPlanCache<double>::exportWisdom("fftw_wisdom.dat");
+    \endcode
+*/
+template <class Real = double>
+class FFTWPlanCache
+{
+  public:
+    typedef typename FFTWReal2Complex<Real>::plan_type PlanType;
+
+        /** \brief Enable or disable caching of new plans.
+
+            Plans that are already in the cache remain valid when the cache is disabled.
+        */
+    static void enable(bool on = true)
+    {
+        detail::FFTWLock<> lock;
+        enabled() = on;
+    }
+
+        /** \brief Disable caching of new plans.
+        */
+    static void disable()
+    {
+        enable(false);
+    }
+
+        /** \brief Check if new plans are cached.
+        */
+    static bool isEnabled()
+    {
+        detail::FFTWLock<> lock;
+        return enabled();
+    }
+
+        /** \brief The number of cached plans.
+        */
+    static std::size_t size()
+    {
+        detail::FFTWLock<> lock;
+        return plans().size();
+    }
+
+        /** \brief The maximal number of cached plans.
+        */
+    static std::size_t maxSize()
+    {
+        detail::FFTWLock<> lock;
+        return maxPlans();
+    }
+
+        /** \brief Set the maximal number of cached plans.
+
+            If the cache holds more plans, the least recently used unused plans
+            are destroyed immediately.
+        */
+    static void setMaxSize(std::size_t n)
+    {
+        detail::FFTWLock<> lock;
+        maxPlans() = n;
+        shrink();
+    }
+
+        /** \brief Remove all plans from the cache.
+
+            Unused plans are destroyed immediately, plans that are still used by
+            an FFTWPlan object are destroyed when it releases them.
+        */
+    static void clear()
+    {
+        detail::FFTWLock<> lock;
+        for(typename PlanMap::iterator i = plans().begin(); i != plans().end(); ++i)
+        {
+            if(users().find(i->second.plan) == users().end())
+                detail::fftwPlanDestroy(i->second.plan);
+            else
+                orphans().push_back(i->second.plan);
+        }
+        plans().clear();
+    }
+
+        /** \brief Add the wisdom in the given file to FFTW's accumulated wisdom.
+
+            Returns false if the file cannot be read or is not a valid wisdom file
+            for the present precision.
+        */
+    static bool importWisdom(std::string const & filename)
+    {
+        detail::FFTWLock<> lock;
+        return detail::fftwImportWisdom(PlanType(), filename.c_str());
+    }
+
+        /** \brief Write FFTW's accumulated wisdom to the given file.
+
+            Returns false if the file cannot be written.
+        */
+    static bool exportWisdom(std::string const & filename)
+    {
+        detail::FFTWLock<> lock;
+        return detail::fftwExportWisdom(PlanType(), filename.c_str());
+    }
+
+  private:
+    template <unsigned int N, class R>
+    friend class FFTWPlan;
+
+    typedef std::vector<std::ptrdiff_t> Key;
+
+    struct Entry
+    {
+        PlanType plan;
+        std::size_t last_use;
+    };
+
+    typedef std::map<Key, Entry> PlanMap;
+
+    static PlanMap & plans()
+    {
+        static PlanMap p;
+        return p;
+    }
+
+        // the number of FFTWPlan objects that use each cached plan
+    static std::map<PlanType, std::size_t> & users()
+    {
+        static std::map<PlanType, std::size_t> u;
+        return u;
+    }
+
+        // plans that were removed from the cache while still in use
+    static std::vector<PlanType> & orphans()
+    {
+        static std::vector<PlanType> o;
+        return o;
+    }
+
+    static std::size_t & maxPlans()
+    {
+        static std::size_t m = 128;
+        return m;
+    }
+
+    static std::size_t & useCount()
+    {
+        static std::size_t c = 0;
+        return c;
+    }
+
+        // Destroy the least recently used unused plans until the size limit is met.
+        // The caller must hold the FFTWLock.
+    static void shrink()
+    {
+        while(plans().size() > maxPlans())
+        {
+            typename PlanMap::iterator victim = plans().end();
+            for(typename PlanMap::iterator i = plans().begin(); i != plans().end(); ++i)
+                if(users().find(i->second.plan) == users().end() &&
+                   (victim == plans().end() || i->second.last_use < victim->second.last_use))
+                    victim = i;
+            if(victim == plans().end())
+                return;  // all plans are in use
+            detail::fftwPlanDestroy(victim->second.plan);
+            plans().erase(victim);
+        }
+    }
+
+        // Release a plan returned by getPlan() with 'cached' == true.
+        // The caller must hold the FFTWLock.
+    static void release(PlanType plan)
+    {
+        if(plan == 0)
+            return;
+        typename std::map<PlanType, std::size_t>::iterator u = users().find(plan);
+        vigra_invariant(u != users().end(),
+            "FFTWPlanCache::release(): plan is not in use.");
+        if(--u->second > 0)
+            return;
+        users().erase(u);
+        typename std::vector<PlanType>::iterator o = std::find(orphans().begin(), orphans().end(), plan);
+        if(o != orphans().end())
+        {
+            orphans().erase(o);
+            detail::fftwPlanDestroy(plan);
+        }
+        else
+        {
+            shrink();
+        }
+    }
+
+    static bool & enabled()
+    {
+        static bool e = true;
+        return e;
+    }
+
+        // Return a cached plan (or a new one when the cache is disabled, indicated by
+        // 'cached' == false). A cached plan must be passed to release() when it is
+        // no longer used. The caller must hold the FFTWLock.
+    template <class I, class O>
+    static PlanType getPlan(unsigned int N, int* shape,
+                            I * in,  int* instrides,  int instep,
+                            O * out, int* outstrides, int outstep,
+                            int sign, unsigned int planner_flags,
+                            int howmany, int idist, int odist,
+                            int nThreads, bool & cached)
+    {
+        if(!detail::fftwPlanWithNThreads(PlanType(), nThreads))
+            nThreads = 1;
+
+        cached = false;
+        if(!enabled())
+            return detail::fftwPlanCreate(N, shape, in, instrides, instep,
+                                          out, outstrides, outstep, sign, planner_flags,
+                                          howmany, idist, odist);
+
+        Key key;
+        key.reserve(3*N + 13);
+        key.push_back(N);
+        key.insert(key.end(), shape, shape + N);
+        key.insert(key.end(), instrides, instrides + N);
+        key.push_back(instep);
+        key.insert(key.end(), outstrides, outstrides + N);
+        key.push_back(outstep);
+        key.push_back(sign);
+        key.push_back(sizeof(I));
+        key.push_back(sizeof(O));
+        key.push_back(planner_flags);
+        key.push_back(howmany);
+        key.push_back(idist);
+        key.push_back(odist);
+        key.push_back(nThreads);
+        key.push_back((void*)in == (void*)out);
+        key.push_back(detail::fftwAlignmentOf(PlanType(), in));
+        key.push_back(detail::fftwAlignmentOf(PlanType(), out));
+
+        typename PlanMap::iterator i = plans().find(key);
+        if(i != plans().end())
+        {
+            i->second.last_use = ++useCount();
+            ++users()[i->second.plan];
+            cached = true;
+            return i->second.plan;
+        }
+        PlanType plan = detail::fftwPlanCreate(N, shape, in, instrides, instep,
+                                               out, outstrides, outstep, sign, planner_flags,
+                                               howmany, idist, odist);
+        if(plan != 0)
+        {
+            Entry entry = { plan, ++useCount() };
+            plans()[key] = entry;
+            ++users()[plan];
+            cached = true;
+            shrink();
+        }
+        return plan;
+    }
+};
+
 /********************************************************/
 /*                                                      */
 /*                       FFTWPlan                       */
@@ -832,6 +1233,10 @@ fftwCorrespondingShapeC2R(TinyVector<T, N> shape, bool oddDimension0 = false)
     about FFTW's planning process (by providing non-default planning flags) and/or want to re-use
     plans for several transformations.
 
+    The underlying FFTW plans are taken from the \ref FFTWPlanCache unless the cache
+    has been disabled, so that constructing an FFTWPlan for a previously used configuration
+    is cheap.
+
     <b> Usage:</b>
 
     <b>\#include</b> \<vigra/multi_fft.hxx\><br>
@@ -858,6 +1263,8 @@ class FFTWPlan
     PlanType plan;
     Shape shape, instrides, outstrides;
     int sign;
+    bool cached;  // plan is owned by FFTWPlanCache
+    int howmany, idist, odist;  // batch layout, see initMany()
 
   public:
         /** \brief Create an empty plan.
@@ -865,7 +1272,11 @@ class FFTWPlan
             The plan can be initialized later by one of the init() functions.
         */
     FFTWPlan()
-    : plan(0)
+    : plan(0),
+      cached(false),
+      howmany(1),
+      idist(0),
+      odist(0)
     {}
 
         /** \brief Create a plan for a complex-to-complex transform.
@@ -875,14 +1286,23 @@ class FFTWPlan
             \arg planner_flags must be a combination of the <a href="http://www.fftw.org/doc/Planner-Flags.html">planner
             flags</a> defined by the FFTW library. The default <tt>FFTW_ESTIMATE</tt> will guess
             optimal algorithm settings or read them from pre-loaded <a href="http://www.fftw.org/doc/Wisdom.html">"wisdom"</a>.
+            \arg options determines the number of threads FFTW uses to execute the plan. This
+            requires FFTW's thread support, which is enabled by compiling with
+            <tt>VIGRA_FFTW_THREADS</tt> defined and linking with the <tt>fftw3_threads</tt>
+            libraries. Otherwise, the option is ignored.
         */
     template <class C1, class C2>
     FFTWPlan(MultiArrayView<N, FFTWComplex<Real>, C1> in,
              MultiArrayView<N, FFTWComplex<Real>, C2> out,
-             int SIGN, unsigned int planner_flags = FFTW_ESTIMATE)
-    : plan(0)
+             int SIGN, unsigned int planner_flags = FFTW_ESTIMATE,
+             ParallelOptions const & options = ParallelOptions())
+    : plan(0),
+      cached(false),
+      howmany(1),
+      idist(0),
+      odist(0)
     {
-        init(in, out, SIGN, planner_flags);
+        init(in, out, SIGN, planner_flags, options);
     }
 
         /** \brief Create a plan for a real-to-complex transform.
@@ -895,14 +1315,23 @@ class FFTWPlan
             \arg planner_flags must be a combination of the <a href="http://www.fftw.org/doc/Planner-Flags.html">planner
             flags</a> defined by the FFTW library. The default <tt>FFTW_ESTIMATE</tt> will guess
             optimal algorithm settings or read them from pre-loaded <a href="http://www.fftw.org/doc/Wisdom.html">"wisdom"</a>.
+            \arg options determines the number of threads FFTW uses to execute the plan. This
+            requires FFTW's thread support, which is enabled by compiling with
+            <tt>VIGRA_FFTW_THREADS</tt> defined and linking with the <tt>fftw3_threads</tt>
+            libraries. Otherwise, the option is ignored.
         */
     template <class C1, class C2>
     FFTWPlan(MultiArrayView<N, Real, C1> in,
              MultiArrayView<N, FFTWComplex<Real>, C2> out,
-             unsigned int planner_flags = FFTW_ESTIMATE)
-    : plan(0)
+             unsigned int planner_flags = FFTW_ESTIMATE,
+             ParallelOptions const & options = ParallelOptions())
+    : plan(0),
+      cached(false),
+      howmany(1),
+      idist(0),
+      odist(0)
     {
-        init(in, out, planner_flags);
+        init(in, out, planner_flags, options);
     }
 
         /** \brief Create a plan for a complex-to-real transform.
@@ -915,21 +1344,34 @@ class FFTWPlan
             \arg planner_flags must be a combination of the <a href="http://www.fftw.org/doc/Planner-Flags.html">planner
             flags</a> defined by the FFTW library. The default <tt>FFTW_ESTIMATE</tt> will guess
             optimal algorithm settings or read them from pre-loaded <a href="http://www.fftw.org/doc/Wisdom.html">"wisdom"</a>.
+            \arg options determines the number of threads FFTW uses to execute the plan. This
+            requires FFTW's thread support, which is enabled by compiling with
+            <tt>VIGRA_FFTW_THREADS</tt> defined and linking with the <tt>fftw3_threads</tt>
+            libraries. Otherwise, the option is ignored.
         */
     template <class C1, class C2>
     FFTWPlan(MultiArrayView<N, FFTWComplex<Real>, C1> in,
              MultiArrayView<N, Real, C2> out,
-             unsigned int planner_flags = FFTW_ESTIMATE)
-    : plan(0)
+             unsigned int planner_flags = FFTW_ESTIMATE,
+             ParallelOptions const & options = ParallelOptions())
+    : plan(0),
+      cached(false),
+      howmany(1),
+      idist(0),
+      odist(0)
     {
-        init(in, out, planner_flags);
+        init(in, out, planner_flags, options);
     }
 
         /** \brief Copy constructor.
         */
     FFTWPlan(FFTWPlan const & other)
     : plan(other.plan),
-      sign(other.sign)
+      sign(other.sign),
+      cached(other.cached),
+      howmany(other.howmany),
+      idist(other.idist),
+      odist(other.odist)
     {
         FFTWPlan & o = const_cast<FFTWPlan &>(other);
         shape.swap(o.shape);
@@ -944,12 +1386,20 @@ class FFTWPlan
     {
         if(this != &other)
         {
+            {
+                detail::FFTWLock<> lock;
+                releasePlan();
+            }
             FFTWPlan & o = const_cast<FFTWPlan &>(other);
             plan = o.plan;
             shape.swap(o.shape);
             instrides.swap(o.instrides);
             outstrides.swap(o.outstrides);
             sign = o.sign;
+            cached = o.cached;
+            howmany = o.howmany;
+            idist = o.idist;
+            odist = o.odist;
             o.plan = 0; // act like std::auto_ptr
         }
         return *this;
@@ -960,7 +1410,7 @@ class FFTWPlan
     ~FFTWPlan()
     {
         detail::FFTWLock<> lock;
-        detail::fftwPlanDestroy(plan);
+        releasePlan();
     }
 
         /** \brief Init a complex-to-complex transform.
@@ -970,13 +1420,14 @@ class FFTWPlan
     template <class C1, class C2>
     void init(MultiArrayView<N, FFTWComplex<Real>, C1> in,
               MultiArrayView<N, FFTWComplex<Real>, C2> out,
-              int SIGN, unsigned int planner_flags = FFTW_ESTIMATE)
+              int SIGN, unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions())
     {
         vigra_precondition(in.strideOrdering() == out.strideOrdering(),
             "FFTWPlan.init(): input and output must have the same stride ordering.");
 
         initImpl(in.permuteStridesDescending(), out.permuteStridesDescending(),
-                 SIGN, planner_flags);
+                 SIGN, planner_flags, options.getActualNumThreads());
     }
 
         /** \brief Init a real-to-complex transform.
@@ -986,13 +1437,14 @@ class FFTWPlan
     template <class C1, class C2>
     void init(MultiArrayView<N, Real, C1> in,
               MultiArrayView<N, FFTWComplex<Real>, C2> out,
-              unsigned int planner_flags = FFTW_ESTIMATE)
+              unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions())
     {
         vigra_precondition(in.strideOrdering() == out.strideOrdering(),
             "FFTWPlan.init(): input and output must have the same stride ordering.");
 
         initImpl(in.permuteStridesDescending(), out.permuteStridesDescending(),
-                 FFTW_FORWARD, planner_flags);
+                 FFTW_FORWARD, planner_flags, options.getActualNumThreads());
     }
 
         /** \brief Init a complex-to-real transform.
@@ -1002,13 +1454,14 @@ class FFTWPlan
     template <class C1, class C2>
     void init(MultiArrayView<N, FFTWComplex<Real>, C1> in,
               MultiArrayView<N, Real, C2> out,
-              unsigned int planner_flags = FFTW_ESTIMATE)
+              unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions())
     {
         vigra_precondition(in.strideOrdering() == out.strideOrdering(),
             "FFTWPlan.init(): input and output must have the same stride ordering.");
 
         initImpl(in.permuteStridesDescending(), out.permuteStridesDescending(),
-                 FFTW_BACKWARD, planner_flags);
+                 FFTW_BACKWARD, planner_flags, options.getActualNumThreads());
     }
 
         /** \brief Execute a complex-to-complex transform.
@@ -1053,13 +1506,140 @@ class FFTWPlan
         executeImpl(in.permuteStridesDescending(), out.permuteStridesDescending());
     }
 
+        /** \brief Init a batch of complex-to-complex transforms.
+
+            The last dimension of \a in and \a out enumerates the items of the batch,
+            which are all transformed by a single call to executeMany(). This uses FFTW's
+            <a href="http://www.fftw.org/doc/Advanced-Complex-DFTs.html">advanced interface</a>
+            and is faster than transforming the items one by one. The remaining arguments are
+            the same as in the constructor for a single complex-to-complex transform.
+        */
+    template <class C1, class C2>
+    void initMany(MultiArrayView<N+1, FFTWComplex<Real>, C1> in,
+                  MultiArrayView<N+1, FFTWComplex<Real>, C2> out,
+                  int SIGN, unsigned int planner_flags = FFTW_ESTIMATE,
+                  ParallelOptions const & options = ParallelOptions())
+    {
+        initManyImpl(in, out, SIGN, planner_flags, options);
+    }
+
+        /** \brief Init a batch of real-to-complex transforms.
+
+            See the complex-to-complex version of initMany() for details.
+        */
+    template <class C1, class C2>
+    void initMany(MultiArrayView<N+1, Real, C1> in,
+                  MultiArrayView<N+1, FFTWComplex<Real>, C2> out,
+                  unsigned int planner_flags = FFTW_ESTIMATE,
+                  ParallelOptions const & options = ParallelOptions())
+    {
+        initManyImpl(in, out, FFTW_FORWARD, planner_flags, options);
+    }
+
+        /** \brief Init a batch of complex-to-real transforms.
+
+            See the complex-to-complex version of initMany() for details.
+        */
+    template <class C1, class C2>
+    void initMany(MultiArrayView<N+1, FFTWComplex<Real>, C1> in,
+                  MultiArrayView<N+1, Real, C2> out,
+                  unsigned int planner_flags = FFTW_ESTIMATE,
+                  ParallelOptions const & options = ParallelOptions())
+    {
+        initManyImpl(in, out, FFTW_BACKWARD, planner_flags, options);
+    }
+
+        /** \brief Execute a batch of complex-to-complex transforms.
+
+            The array shapes and strides must be the same as in the corresponding call to
+            initMany(), but the data may be different.
+        */
+    template <class C1, class C2>
+    void executeMany(MultiArrayView<N+1, FFTWComplex<Real>, C1> in,
+                     MultiArrayView<N+1, FFTWComplex<Real>, C2> out) const
+    {
+        executeManyImpl(in, out);
+    }
+
+        /** \brief Execute a batch of real-to-complex transforms.
+
+            The array shapes and strides must be the same as in the corresponding call to
+            initMany(), but the data may be different.
+        */
+    template <class C1, class C2>
+    void executeMany(MultiArrayView<N+1, Real, C1> in,
+                     MultiArrayView<N+1, FFTWComplex<Real>, C2> out) const
+    {
+        executeManyImpl(in, out);
+    }
+
+        /** \brief Execute a batch of complex-to-real transforms.
+
+            The array shapes and strides must be the same as in the corresponding call to
+            initMany(), but the data may be different.
+        */
+    template <class C1, class C2>
+    void executeMany(MultiArrayView<N+1, FFTWComplex<Real>, C1> in,
+                     MultiArrayView<N+1, Real, C2> out) const
+    {
+        executeManyImpl(in, out);
+    }
+
   private:
 
+        // Give the plan back to the cache or destroy it. The caller must hold the FFTWLock.
+    void releasePlan()
+    {
+        if(cached)
+            FFTWPlanCache<Real>::release(plan);
+        else
+            detail::fftwPlanDestroy(plan);
+        plan = 0;
+    }
+
+    template <class MI, class MO>
+    void initImpl(MI ins, MO outs, int SIGN, unsigned int planner_flags, int nThreads,
+                  int items = 1, int inDist = 0, int outDist = 0);
+
     template <class MI, class MO>
-    void initImpl(MI ins, MO outs, int SIGN, unsigned int planner_flags);
+    void executeImpl(MI ins, MO outs, int items = 1) const;
 
     template <class MI, class MO>
-    void executeImpl(MI ins, MO outs) const;
+    void initManyImpl(MI in, MO out, int SIGN, unsigned int planner_flags,
+                      ParallelOptions const & options)
+    {
+        vigra_precondition(in.shape(N) == out.shape(N),
+            "FFTWPlan::initMany(): input and output must have the same number of items.");
+        vigra_precondition(in.shape(N) > 0,
+            "FFTWPlan::initMany(): empty batch.");
+
+        MultiArrayView<N, typename MI::value_type, StridedArrayTag> in0 = in.bindOuter(0);
+        MultiArrayView<N, typename MO::value_type, StridedArrayTag> out0 = out.bindOuter(0);
+        vigra_precondition(in0.strideOrdering() == out0.strideOrdering(),
+            "FFTWPlan::initMany(): input and output must have the same stride ordering.");
+
+        initImpl(in0.permuteStridesDescending(), out0.permuteStridesDescending(),
+                 SIGN, planner_flags, options.getActualNumThreads(),
+                 in.shape(N), in.stride(N), out.stride(N));
+    }
+
+    template <class MI, class MO>
+    void executeManyImpl(MI in, MO out) const
+    {
+        vigra_precondition(in.stride(N) == idist && out.stride(N) == odist,
+            "FFTWPlan::executeMany(): strides mismatch between plan and data.");
+        vigra_precondition(in.shape(N) == out.shape(N),
+            "FFTWPlan::executeMany(): input and output must have the same number of items.");
+
+        MultiArrayView<N, typename MI::value_type, StridedArrayTag> in0 = in.bindOuter(0);
+        MultiArrayView<N, typename MO::value_type, StridedArrayTag> out0 = out.bindOuter(0);
+        executeImpl(in0.permuteStridesDescending(), out0.permuteStridesDescending(),
+                    in.shape(N));
+
+        typedef typename MO::value_type V;
+        if(sign == FFTW_BACKWARD)
+            out *= V(1.0) / Real(out0.size());
+    }
 
     void checkShapes(MultiArrayView<N, FFTWComplex<Real>, StridedArrayTag> in,
                      MultiArrayView<N, FFTWComplex<Real>, StridedArrayTag> out) const
@@ -1092,7 +1672,8 @@ class FFTWPlan
 template <unsigned int N, class Real>
 template <class MI, class MO>
 void
-FFTWPlan<N, Real>::initImpl(MI ins, MO outs, int SIGN, unsigned int planner_flags)
+FFTWPlan<N, Real>::initImpl(MI ins, MO outs, int SIGN, unsigned int planner_flags, int nThreads,
+                            int items, int inDist, int outDist)
 {
     checkShapes(ins, outs);
 
@@ -1114,25 +1695,33 @@ FFTWPlan<N, Real>::initImpl(MI ins, MO outs, int SIGN, unsigned int planner_flag
 
     {
         detail::FFTWLock<> lock;
-        PlanType newPlan = detail::fftwPlanCreate(N, newShape.begin(),
+        bool newCached = false;
+        PlanType newPlan = FFTWPlanCache<Real>::getPlan(N, newShape.begin(),
                                       ins.data(), itotal.begin(), ins.stride(N-1),
                                       outs.data(), ototal.begin(), outs.stride(N-1),
-                                      SIGN, planner_flags);
-        detail::fftwPlanDestroy(plan);
+                                      SIGN, planner_flags, items, inDist, outDist,
+                                      nThreads, newCached);
+        releasePlan();
         plan = newPlan;
+        cached = newCached;
     }
 
     shape.swap(newShape);
     instrides.swap(newIStrides);
     outstrides.swap(newOStrides);
     sign = SIGN;
+    howmany = items;
+    idist = inDist;
+    odist = outDist;
 }
 
 template <unsigned int N, class Real>
 template <class MI, class MO>
-void FFTWPlan<N, Real>::executeImpl(MI ins, MO outs) const
+void FFTWPlan<N, Real>::executeImpl(MI ins, MO outs, int items) const
 {
     vigra_precondition(plan != 0, "FFTWPlan::execute(): plan is NULL.");
+    vigra_precondition(items == howmany,
+        "FFTWPlan::execute(): number of items mismatch between plan and data.");
 
     typename MultiArrayShape<N>::type lshape(sign == FFTW_FORWARD
                                                 ? ins.shape()
@@ -1147,8 +1736,9 @@ void FFTWPlan<N, Real>::executeImpl(MI ins, MO outs) const
 
     detail::fftwPlanExecute(plan, ins.data(), outs.data());
 
+    // batches are normalized by executeManyImpl()
     typedef typename MO::value_type V;
-    if(sign == FFTW_BACKWARD)
+    if(sign == FFTW_BACKWARD && items == 1)
         outs *= V(1.0) / Real(outs.size());
 }
 
@@ -1169,6 +1759,13 @@ void FFTWPlan<N, Real>::executeImpl(MI ins, MO outs) const
     You only need this class if you want to have more control about FFTW's planning process
     (by providing non-default planning flags) and/or want to re-use plans for several convolutions.
 
+    executeMany() transforms all kernels and results in one batch with FFTW's advanced
+    interface (see FFTWPlan::initMany()). This is faster than convolving with the kernels
+    one by one, but requires memory for the spectra of all kernels at once.
+
+    The optional \ref ParallelOptions argument of the constructors and init functions
+    determines the number of threads FFTW uses to execute the plans (see \ref FFTWPlan).
+
     <b> Usage:</b>
 
     <b>\#include</b> \<vigra/multi_fft.hxx\><br>
@@ -1197,12 +1794,21 @@ class FFTWConvolvePlan
     typedef FFTWComplex<Real> Complex;
     typedef MultiArrayView<N, Real, UnstridedArrayTag >     RArray;
     typedef MultiArray<N, Complex, FFTWAllocator<Complex> > CArray;
+    typedef MultiArrayView<N+1, Real, StridedArrayTag >       RBatch;
+    typedef MultiArray<N+1, Complex, FFTWAllocator<Complex> > CBatch;
 
     FFTWPlan<N, Real> forward_plan, backward_plan;
     RArray realArray, realKernel;
     CArray fourierArray, fourierKernel;
     bool useFourierKernel;
 
+    // batched transforms of all kernels in executeMany(), created on demand
+    FFTWPlan<N, Real> forward_many_plan, backward_many_plan;
+    RBatch realKernels;
+    CBatch fourierKernels;
+    unsigned int plannerFlags;
+    ParallelOptions parallelOptions;
+
   public:
 
     typedef typename MultiArrayShape<N>::type Shape;
@@ -1212,7 +1818,8 @@ class FFTWConvolvePlan
             The plan can be initialized later by one of the init() functions.
         */
     FFTWConvolvePlan()
-    : useFourierKernel(false)
+    : useFourierKernel(false),
+      plannerFlags(FFTW_ESTIMATE)
     {}
 
         /** \brief Create a plan to convolve a real array with a real kernel.
@@ -1230,10 +1837,11 @@ class FFTWConvolvePlan
     FFTWConvolvePlan(MultiArrayView<N, Real, C1> in,
                      MultiArrayView<N, Real, C2> kernel,
                      MultiArrayView<N, Real, C3> out,
-                     unsigned int planner_flags = FFTW_ESTIMATE)
+                     unsigned int planner_flags = FFTW_ESTIMATE,
+                     ParallelOptions const & options = ParallelOptions())
     : useFourierKernel(false)
     {
-        init(in, kernel, out, planner_flags);
+        init(in, kernel, out, planner_flags, options);
     }
 
         /** \brief Create a plan to convolve a real array with a complex kernel.
@@ -1251,10 +1859,11 @@ class FFTWConvolvePlan
     FFTWConvolvePlan(MultiArrayView<N, Real, C1> in,
                      MultiArrayView<N, FFTWComplex<Real>, C2> kernel,
                      MultiArrayView<N, Real, C3> out,
-                     unsigned int planner_flags = FFTW_ESTIMATE)
+                     unsigned int planner_flags = FFTW_ESTIMATE,
+                     ParallelOptions const & options = ParallelOptions())
     : useFourierKernel(true)
     {
-        init(in, kernel, out, planner_flags);
+        init(in, kernel, out, planner_flags, options);
     }
 
         /** \brief Create a plan to convolve a complex array with a complex kernel.
@@ -1274,9 +1883,10 @@ class FFTWConvolvePlan
                      MultiArrayView<N, FFTWComplex<Real>, C2> kernel,
                      MultiArrayView<N, FFTWComplex<Real>, C3> out,
                      bool fourierDomainKernel,
-                     unsigned int planner_flags = FFTW_ESTIMATE)
+                     unsigned int planner_flags = FFTW_ESTIMATE,
+                     ParallelOptions const & options = ParallelOptions())
     {
-        init(in, kernel, out, fourierDomainKernel, planner_flags);
+        init(in, kernel, out, fourierDomainKernel, planner_flags, options);
     }
 
 
@@ -1295,12 +1905,13 @@ class FFTWConvolvePlan
     template <class C1, class C2, class C3>
     FFTWConvolvePlan(Shape inOut, Shape kernel,
                      bool useFourierKernel = false,
-                     unsigned int planner_flags = FFTW_ESTIMATE)
+                     unsigned int planner_flags = FFTW_ESTIMATE,
+                     ParallelOptions const & options = ParallelOptions())
     {
         if(useFourierKernel)
-            init(inOut, kernel, planner_flags);
+            init(inOut, kernel, planner_flags, options);
         else
-            initFourierKernel(inOut, kernel, planner_flags);
+            initFourierKernel(inOut, kernel, planner_flags, options);
     }
 
         /** \brief Init a plan to convolve a real array with a real kernel.
@@ -1311,11 +1922,12 @@ class FFTWConvolvePlan
     void init(MultiArrayView<N, Real, C1> in,
               MultiArrayView<N, Real, C2> kernel,
               MultiArrayView<N, Real, C3> out,
-              unsigned int planner_flags = FFTW_ESTIMATE)
+              unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions())
     {
         vigra_precondition(in.shape() == out.shape(),
             "FFTWConvolvePlan::init(): input and output must have the same shape.");
-        init(in.shape(), kernel.shape(), planner_flags);
+        init(in.shape(), kernel.shape(), planner_flags, options);
     }
 
         /** \brief Init a plan to convolve a real array with a complex kernel.
@@ -1326,11 +1938,12 @@ class FFTWConvolvePlan
     void init(MultiArrayView<N, Real, C1> in,
               MultiArrayView<N, FFTWComplex<Real>, C2> kernel,
               MultiArrayView<N, Real, C3> out,
-              unsigned int planner_flags = FFTW_ESTIMATE)
+              unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions())
     {
         vigra_precondition(in.shape() == out.shape(),
             "FFTWConvolvePlan::init(): input and output must have the same shape.");
-        initFourierKernel(in.shape(), kernel.shape(), planner_flags);
+        initFourierKernel(in.shape(), kernel.shape(), planner_flags, options);
     }
 
         /** \brief Init a plan to convolve a complex array with a complex kernel.
@@ -1342,12 +1955,13 @@ class FFTWConvolvePlan
               MultiArrayView<N, FFTWComplex<Real>, C2> kernel,
               MultiArrayView<N, FFTWComplex<Real>, C3> out,
               bool fourierDomainKernel,
-              unsigned int planner_flags = FFTW_ESTIMATE)
+              unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions())
     {
         vigra_precondition(in.shape() == out.shape(),
             "FFTWConvolvePlan::init(): input and output must have the same shape.");
         useFourierKernel = fourierDomainKernel;
-        initComplex(in.shape(), kernel.shape(), planner_flags);
+        initComplex(in.shape(), kernel.shape(), planner_flags, options);
     }
 
         /** \brief Init a plan to convolve a real array with a sequence of kernels.
@@ -1359,7 +1973,8 @@ class FFTWConvolvePlan
     template <class C1, class KernelIterator, class OutIterator>
     void initMany(MultiArrayView<N, Real, C1> in,
                   KernelIterator kernels, KernelIterator kernelsEnd,
-                  OutIterator outs, unsigned int planner_flags = FFTW_ESTIMATE)
+                  OutIterator outs, unsigned int planner_flags = FFTW_ESTIMATE,
+                  ParallelOptions const & options = ParallelOptions())
     {
         typedef typename std::iterator_traits<KernelIterator>::value_type KernelArray;
         typedef typename KernelArray::value_type KernelValue;
@@ -1377,13 +1992,13 @@ class FFTWConvolvePlan
         if(realKernel)
         {
             initMany(in.shape(), checkShapes(in.shape(), kernels, kernelsEnd, outs),
-                     planner_flags);
+                     planner_flags, options);
         }
         else
         {
             initFourierKernelMany(in.shape(),
                                   checkShapesFourier(in.shape(), kernels, kernelsEnd, outs),
-                                  planner_flags);
+                                  planner_flags, options);
         }
     }
 
@@ -1398,7 +2013,8 @@ class FFTWConvolvePlan
                   KernelIterator kernels, KernelIterator kernelsEnd,
                   OutIterator outs,
                   bool fourierDomainKernels,
-                  unsigned int planner_flags = FFTW_ESTIMATE)
+                  unsigned int planner_flags = FFTW_ESTIMATE,
+                  ParallelOptions const & options = ParallelOptions())
     {
         typedef typename std::iterator_traits<KernelIterator>::value_type KernelArray;
         typedef typename KernelArray::value_type KernelValue;
@@ -1416,34 +2032,40 @@ class FFTWConvolvePlan
 
         CArray newFourierArray(paddedShape), newFourierKernel(paddedShape);
 
-        FFTWPlan<N, Real> fplan(newFourierArray, newFourierArray, FFTW_FORWARD, planner_flags);
-        FFTWPlan<N, Real> bplan(newFourierArray, newFourierArray, FFTW_BACKWARD, planner_flags);
+        FFTWPlan<N, Real> fplan(newFourierArray, newFourierArray, FFTW_FORWARD, planner_flags, options);
+        FFTWPlan<N, Real> bplan(newFourierArray, newFourierArray, FFTW_BACKWARD, planner_flags, options);
 
         forward_plan = fplan;
         backward_plan = bplan;
         fourierArray.swap(newFourierArray);
         fourierKernel.swap(newFourierKernel);
+        resetBatch(planner_flags, options);
     }
 
     void init(Shape inOut, Shape kernel,
-              unsigned int planner_flags = FFTW_ESTIMATE);
+              unsigned int planner_flags = FFTW_ESTIMATE,
+              ParallelOptions const & options = ParallelOptions());
 
     void initFourierKernel(Shape inOut, Shape kernel,
-                           unsigned int planner_flags = FFTW_ESTIMATE);
+                           unsigned int planner_flags = FFTW_ESTIMATE,
+                           ParallelOptions const & options = ParallelOptions());
 
     void initComplex(Shape inOut, Shape kernel,
-                     unsigned int planner_flags = FFTW_ESTIMATE);
+                     unsigned int planner_flags = FFTW_ESTIMATE,
+                     ParallelOptions const & options = ParallelOptions());
 
     void initMany(Shape inOut, Shape maxKernel,
-                  unsigned int planner_flags = FFTW_ESTIMATE)
+                  unsigned int planner_flags = FFTW_ESTIMATE,
+                  ParallelOptions const & options = ParallelOptions())
     {
-        init(inOut, maxKernel, planner_flags);
+        init(inOut, maxKernel, planner_flags, options);
     }
 
     void initFourierKernelMany(Shape inOut, Shape kernels,
-                               unsigned int planner_flags = FFTW_ESTIMATE)
+                               unsigned int planner_flags = FFTW_ESTIMATE,
+                               ParallelOptions const & options = ParallelOptions())
     {
-        initFourierKernel(inOut, kernels, planner_flags);
+        initFourierKernel(inOut, kernels, planner_flags, options);
     }
 
         /** \brief Execute a plan to convolve a real array with a real kernel.
@@ -1529,6 +2151,17 @@ class FFTWConvolvePlan
 
   protected:
 
+    void resetBatch(unsigned int planner_flags, ParallelOptions const & options)
+    {
+        plannerFlags = planner_flags;
+        parallelOptions = options;
+        fourierKernels.reshape(typename CBatch::difference_type());
+        realKernels = RBatch();
+    }
+
+        // allocate the batch arrays and plans for 'count' kernels (if not already done)
+    void initBatch(MultiArrayIndex count, bool complexInput);
+
     template <class KernelIterator, class OutIterator>
     Shape checkShapes(Shape in,
                       KernelIterator kernels, KernelIterator kernelsEnd,
@@ -1567,7 +2200,8 @@ class FFTWConvolvePlan
 template <unsigned int N, class Real>
 void
 FFTWConvolvePlan<N, Real>::init(Shape in, Shape kernel,
-                                unsigned int planner_flags)
+                                unsigned int planner_flags,
+                                ParallelOptions const & options)
 {
     Shape paddedShape = fftwBestPaddedShapeR2C(in + kernel - Shape(1)),
           complexShape = fftwCorrespondingShapeR2C(paddedShape);
@@ -1579,8 +2213,8 @@ FFTWConvolvePlan<N, Real>::init(Shape in, Shape kernel,
     RArray newRealArray(paddedShape, realStrides, (Real*)newFourierArray.data());
     RArray newRealKernel(paddedShape, realStrides, (Real*)newFourierKernel.data());
 
-    FFTWPlan<N, Real> fplan(newRealArray, newFourierArray, planner_flags);
-    FFTWPlan<N, Real> bplan(newFourierArray, newRealArray, planner_flags);
+    FFTWPlan<N, Real> fplan(newRealArray, newFourierArray, planner_flags, options);
+    FFTWPlan<N, Real> bplan(newFourierArray, newRealArray, planner_flags, options);
 
     forward_plan = fplan;
     backward_plan = bplan;
@@ -1589,12 +2223,14 @@ FFTWConvolvePlan<N, Real>::init(Shape in, Shape kernel,
     fourierArray.swap(newFourierArray);
     fourierKernel.swap(newFourierKernel);
     useFourierKernel = false;
+    resetBatch(planner_flags, options);
 }
 
 template <unsigned int N, class Real>
 void
 FFTWConvolvePlan<N, Real>::initFourierKernel(Shape in, Shape kernel,
-                                             unsigned int planner_flags)
+                                             unsigned int planner_flags,
+                                             ParallelOptions const & options)
 {
     Shape complexShape = kernel,
           paddedShape  = fftwCorrespondingShapeC2R(complexShape);
@@ -1610,8 +2246,8 @@ FFTWConvolvePlan<N, Real>::initFourierKernel(Shape in, Shape kernel,
     RArray newRealArray(paddedShape, realStrides, (Real*)newFourierArray.data());
     RArray newRealKernel(paddedShape, realStrides, (Real*)newFourierKernel.data());
 
-    FFTWPlan<N, Real> fplan(newRealArray, newFourierArray, planner_flags);
-    FFTWPlan<N, Real> bplan(newFourierArray, newRealArray, planner_flags);
+    FFTWPlan<N, Real> fplan(newRealArray, newFourierArray, planner_flags, options);
+    FFTWPlan<N, Real> bplan(newFourierArray, newRealArray, planner_flags, options);
 
     forward_plan = fplan;
     backward_plan = bplan;
@@ -1620,12 +2256,14 @@ FFTWConvolvePlan<N, Real>::initFourierKernel(Shape in, Shape kernel,
     fourierArray.swap(newFourierArray);
     fourierKernel.swap(newFourierKernel);
     useFourierKernel = true;
+    resetBatch(planner_flags, options);
 }
 
 template <unsigned int N, class Real>
 void
 FFTWConvolvePlan<N, Real>::initComplex(Shape in, Shape kernel,
-                                        unsigned int planner_flags)
+                                        unsigned int planner_flags,
+                                        ParallelOptions const & options)
 {
     Shape paddedShape;
 
@@ -1644,13 +2282,56 @@ FFTWConvolvePlan<N, Real>::initComplex(Shape in, Shape kernel,
 
     CArray newFourierArray(paddedShape), newFourierKernel(paddedShape);
 
-    FFTWPlan<N, Real> fplan(newFourierArray, newFourierArray, FFTW_FORWARD, planner_flags);
-    FFTWPlan<N, Real> bplan(newFourierArray, newFourierArray, FFTW_BACKWARD, planner_flags);
+    FFTWPlan<N, Real> fplan(newFourierArray, newFourierArray, FFTW_FORWARD, planner_flags, options);
+    FFTWPlan<N, Real> bplan(newFourierArray, newFourierArray, FFTW_BACKWARD, planner_flags, options);
 
     forward_plan = fplan;
     backward_plan = bplan;
     fourierArray.swap(newFourierArray);
     fourierKernel.swap(newFourierKernel);
+    resetBatch(planner_flags, options);
+}
+
+template <unsigned int N, class Real>
+void
+FFTWConvolvePlan<N, Real>::initBatch(MultiArrayIndex count, bool complexInput)
+{
+    if(fourierKernels.shape(N) == count)
+        return;
+
+    typename CBatch::difference_type batchShape;
+    for(unsigned int k=0; k<N; ++k)
+        batchShape[k] = fourierArray.shape(k);
+    batchShape[N] = count;
+    CBatch newFourierKernels(batchShape);
+
+    if(complexInput)
+    {
+        if(!useFourierKernel)
+            forward_many_plan.initMany(newFourierKernels, newFourierKernels, FFTW_FORWARD,
+                                       plannerFlags, parallelOptions);
+        backward_many_plan.initMany(newFourierKernels, newFourierKernels, FFTW_BACKWARD,
+                                    plannerFlags, parallelOptions);
+        realKernels = RBatch();
+    }
+    else
+    {
+        // the real arrays are embedded in the complex ones, as in init()
+        typename RBatch::difference_type realShape, realStrides = 2*newFourierKernels.stride();
+        for(unsigned int k=0; k<N; ++k)
+            realShape[k] = realArray.shape(k);
+        realShape[N] = count;
+        realStrides[0] = 1;
+        RBatch newRealKernels(realShape, realStrides, (Real*)newFourierKernels.data());
+
+        if(!useFourierKernel)
+            forward_many_plan.initMany(newRealKernels, newFourierKernels,
+                                       plannerFlags, parallelOptions);
+        backward_many_plan.initMany(newFourierKernels, newRealKernels,
+                                    plannerFlags, parallelOptions);
+        realKernels = newRealKernels;
+    }
+    fourierKernels.swap(newFourierKernels);
 }
 
 #ifndef DOXYGEN // doxygen documents these functions as free functions
@@ -1796,17 +2477,20 @@ FFTWConvolvePlan<N, Real>::executeManyImpl(MultiArrayView<N, Real, C1> in,
     detail::fftEmbedArray(in, realArray);
     forward_plan.execute(realArray, fourierArray);
 
-    for(; kernels != kernelsEnd; ++kernels, ++outs)
-    {
-        detail::fftEmbedKernel(*kernels, realKernel);
-        forward_plan.execute(realKernel, fourierKernel);
+    MultiArrayIndex count = std::distance(kernels, kernelsEnd);
+    initBatch(count, false);
 
-        fourierKernel *= fourierArray;
+    for(MultiArrayIndex k=0; k<count; ++k, ++kernels)
+        detail::fftEmbedKernel(*kernels, realKernels.bindOuter(k));
+    forward_many_plan.executeMany(realKernels, fourierKernels);
 
-        backward_plan.execute(fourierKernel, realKernel);
+    for(MultiArrayIndex k=0; k<count; ++k)
+        fourierKernels.bindOuter(k) *= fourierArray;
 
-        *outs = realKernel.subarray(left, right);
-    }
+    backward_many_plan.executeMany(fourierKernels, realKernels);
+
+    for(MultiArrayIndex k=0; k<count; ++k, ++outs)
+        *outs = realKernels.bindOuter(k).subarray(left, right);
 }
 
 template <unsigned int N, class Real>
@@ -1834,16 +2518,21 @@ FFTWConvolvePlan<N, Real>::executeManyImpl(MultiArrayView<N, Real, C1> in,
     detail::fftEmbedArray(in, realArray);
     forward_plan.execute(realArray, fourierArray);
 
-    for(; kernels != kernelsEnd; ++kernels, ++outs)
+    MultiArrayIndex count = std::distance(kernels, kernelsEnd);
+    initBatch(count, false);
+
+    for(MultiArrayIndex k=0; k<count; ++k, ++kernels)
     {
-        fourierKernel = *kernels;
-        moveDCToHalfspaceUpperLeft(fourierKernel);
-        fourierKernel *= fourierArray;
+        MultiArrayView<N, Complex, StridedArrayTag> spectrum = fourierKernels.bindOuter(k);
+        spectrum = *kernels;
+        moveDCToHalfspaceUpperLeft(spectrum);
+        spectrum *= fourierArray;
+    }
 
-        backward_plan.execute(fourierKernel, realKernel);
+    backward_many_plan.executeMany(fourierKernels, realKernels);
 
-        *outs = realKernel.subarray(left, right);
-    }
+    for(MultiArrayIndex k=0; k<count; ++k, ++outs)
+        *outs = realKernels.bindOuter(k).subarray(left, right);
 }
 
 template <unsigned int N, class Real>
@@ -1871,25 +2560,32 @@ FFTWConvolvePlan<N, Real>::executeMany(MultiArrayView<N, FFTWComplex<Real>, C1>
     detail::fftEmbedArray(in, fourierArray);
     forward_plan.execute(fourierArray, fourierArray);
 
-    for(; kernels != kernelsEnd; ++kernels, ++outs)
+    MultiArrayIndex count = std::distance(kernels, kernelsEnd);
+    initBatch(count, true);
+
+    for(MultiArrayIndex k=0; k<count; ++k, ++kernels)
     {
+        MultiArrayView<N, Complex, StridedArrayTag> spectrum = fourierKernels.bindOuter(k);
         if(useFourierKernel)
         {
-            fourierKernel = *kernels;
-            moveDCToUpperLeft(fourierKernel);
+            spectrum = *kernels;
+            moveDCToUpperLeft(spectrum);
         }
         else
         {
-            detail::fftEmbedKernel(*kernels, fourierKernel);
-            forward_plan.execute(fourierKernel, fourierKernel);
+            detail::fftEmbedKernel(*kernels, spectrum);
         }
+    }
+    if(!useFourierKernel)
+        forward_many_plan.executeMany(fourierKernels, fourierKernels);
 
-        fourierKernel *= fourierArray;
+    for(MultiArrayIndex k=0; k<count; ++k)
+        fourierKernels.bindOuter(k) *= fourierArray;
 
-        backward_plan.execute(fourierKernel, fourierKernel);
+    backward_many_plan.executeMany(fourierKernels, fourierKernels);
 
-        *outs = fourierKernel.subarray(left, right);
-    }
+    for(MultiArrayIndex k=0; k<count; ++k, ++outs)
+        *outs = fourierKernels.bindOuter(k).subarray(left, right);
 }
 
 #endif // DOXYGEN
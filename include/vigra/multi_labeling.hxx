@@ -36,6 +36,8 @@
 #ifndef VIGRA_MULTI_LABELING_HXX
 #define VIGRA_MULTI_LABELING_HXX
 
+#include <vector>
+#include <functional>
 #include "multi_array.hxx"
 #include "multi_gridgraph.hxx"
 #include "union_find.hxx"
@@ -304,6 +306,252 @@ labelGraphWithBackground(GridGraph<N, DirectedTag> const & g,
 
 } // namespace lemon_graph
 
+namespace detail {
+
+    // A maximal sequence of equal values along the x-axis. Its label is
+    // the provisional index in the UnionFindArray (0 for background).
+template <class T, class Label>
+struct LabelingRun
+{
+    MultiArrayIndex begin, end;
+    T value;
+    Label label;
+};
+
+    // Run-based labeling of 1D, 2D, and 3D arrays with std::equal_to:
+    // Every line (along the x-axis) is split into runs. A run is merged
+    // with the overlapping runs of equal value in the neighboring lines
+    // that have already been visited (one line in 2D, two (direct) or
+    // four (indirect neighborhood) lines in 3D), so that union-find
+    // operations are only needed per run instead of per pixel.
+    // Provisional labels are written in the first pass and resolved in
+    // the second, as in lemon_graph::labelGraph(). Since the representative
+    // of a region is the first run in scan order, the final labels are the
+    // same as those of the graph-based algorithm.
+template <class T, class S1, class Label, class S2>
+Label
+labelScanlines(MultiArrayView<3, T, S1> const & data,
+               MultiArrayView<3, Label, S2> labels,
+               NeighborhoodType neighborhood,
+               bool hasBackground, T backgroundValue)
+{
+    typedef LabelingRun<T, Label> Run;
+
+    const MultiArrayIndex w = data.shape(0), h = data.shape(1), d = data.shape(2),
+                          ds = data.stride(0), ls = labels.stride(0),
+                          extend = neighborhood == IndirectNeighborhood ? 1 : 0;
+
+    UnionFindArray<Label> regions;
+    if(data.size() == 0)
+        return 0;
+
+    // runs of the previous and the current z-slice, lineStart[y] is the
+    // index of the first run of line y
+    std::vector<Run> runs[2];
+    std::vector<std::size_t> lineStart[2];
+    lineStart[0].resize(h+1, 0);
+    lineStart[1].resize(h+1, 0);
+
+    // pass 1: find connected components
+    for(MultiArrayIndex z=0; z<d; ++z)
+    {
+        std::vector<Run> & current = runs[z % 2];
+        std::vector<Run> const & previous = runs[(z+1) % 2];
+        std::vector<std::size_t> & currentStart = lineStart[z % 2];
+        std::vector<std::size_t> const & previousStart = lineStart[(z+1) % 2];
+        current.clear();
+
+        for(MultiArrayIndex y=0; y<h; ++y)
+        {
+            currentStart[y] = current.size();
+
+            // split the line into runs
+            T const * p = &data(0, y, z);
+            for(MultiArrayIndex x=0; x<w; )
+            {
+                Run run;
+                run.begin = x;
+                run.value = *p;
+                for(++x, p += ds; x<w && *p == run.value; ++x, p += ds)
+                {}
+                run.end = x;
+                current.push_back(run);
+            }
+
+            // the neighboring lines that have already been visited
+            Run const * neighbors[4];
+            Run const * neighborsEnd[4];
+            int neighborCount = 0;
+            if(y > 0)
+            {
+                neighbors[neighborCount] = &current[currentStart[y-1]];
+                neighborsEnd[neighborCount++] = &current[0] + currentStart[y];
+            }
+            if(z > 0)
+            {
+                MultiArrayIndex yy = extend ? std::max<MultiArrayIndex>(y-1, 0) : y,
+                                yend = extend ? std::min(y+2, h) : y+1;
+                for(; yy<yend; ++yy)
+                {
+                    neighbors[neighborCount] = &previous[0] + previousStart[yy];
+                    neighborsEnd[neighborCount++] = &previous[0] + previousStart[yy+1];
+                }
+            }
+
+            Label * l = &labels(0, y, z);
+            for(std::size_t k=currentStart[y]; k<current.size(); ++k)
+            {
+                Run & run = current[k];
+                if(hasBackground && run.value == backgroundValue)
+                {
+                    run.label = 0;
+                }
+                else
+                {
+                    // define tentative label for current run
+                    Label currentIndex = regions.nextFreeIndex();
+                    for(int n=0; n<neighborCount; ++n)
+                    {
+                        // skip the runs that end before the current one (they
+                        // cannot touch any later run of the current line either)
+                        while(neighbors[n] != neighborsEnd[n] &&
+                              neighbors[n]->end + extend <= run.begin)
+                            ++neighbors[n];
+                        // merge with the overlapping runs of equal value
+                        for(Run const * r = neighbors[n];
+                            r != neighborsEnd[n] && r->begin < run.end + extend; ++r)
+                        {
+                            if(r->value == run.value)
+                                currentIndex = regions.makeUnion(r->label, currentIndex);
+                        }
+                    }
+                    run.label = regions.finalizeIndex(currentIndex);
+                }
+                for(MultiArrayIndex x=run.begin; x<run.end; ++x, l += ls)
+                    *l = run.label;
+            }
+        }
+        currentStart[h] = current.size();
+    }
+
+    Label count = regions.makeContiguous();
+
+    // pass 2: make component labels contiguous
+    for(MultiArrayIndex z=0; z<d; ++z)
+    {
+        for(MultiArrayIndex y=0; y<h; ++y)
+        {
+            Label * l = &labels(0, y, z);
+            Label last = 0, lastLabel = regions.findLabel(0);
+            for(MultiArrayIndex x=0; x<w; ++x, l += ls)
+            {
+                if(*l != last)
+                {
+                    last = *l;
+                    lastLabel = regions.findLabel(last);
+                }
+                *l = lastLabel;
+            }
+        }
+    }
+    return count;
+}
+
+template <class T, class S>
+inline MultiArrayView<3, T, StridedArrayTag>
+labelingView3D(MultiArrayView<1, T, S> const & a)
+{
+    return a.insertSingletonDimension(1).insertSingletonDimension(2);
+}
+
+template <class T, class S>
+inline MultiArrayView<3, T, StridedArrayTag>
+labelingView3D(MultiArrayView<2, T, S> const & a)
+{
+    return a.insertSingletonDimension(2);
+}
+
+template <class T, class S>
+inline MultiArrayView<3, T, StridedArrayTag>
+labelingView3D(MultiArrayView<3, T, S> const & a)
+{
+    return a;
+}
+
+    // labelScanlines() is used for arrays up to 3D when regions are defined
+    // by plain equality, otherwise we fall back to the graph-based algorithm
+template <unsigned int N, class Equal>
+struct UseScanlineLabeling
+{
+    typedef VigraFalseType type;
+};
+
+template <unsigned int N, class T>
+struct UseScanlineLabeling<N, std::equal_to<T> >
+{
+    typedef typename IfBool<(N <= 3), VigraTrueType, VigraFalseType>::type type;
+};
+
+template <unsigned int N, class T, class S1,
+                          class Label, class S2,
+          class Equal>
+inline Label
+labelMultiArrayImpl(MultiArrayView<N, T, S1> const & data,
+                    MultiArrayView<N, Label, S2> labels,
+                    NeighborhoodType neighborhood,
+                    Equal const &,
+                    VigraTrueType /* use scanlines */)
+{
+    return labelScanlines(labelingView3D(data), labelingView3D(labels),
+                          neighborhood, false, T());
+}
+
+template <unsigned int N, class T, class S1,
+                          class Label, class S2,
+          class Equal>
+inline Label
+labelMultiArrayImpl(MultiArrayView<N, T, S1> const & data,
+                    MultiArrayView<N, Label, S2> labels,
+                    NeighborhoodType neighborhood,
+                    Equal const & equal,
+                    VigraFalseType /* use scanlines */)
+{
+    GridGraph<N, undirected_tag> graph(data.shape(), neighborhood);
+    return lemon_graph::labelGraph(graph, data, labels, equal);
+}
+
+template <unsigned int N, class T, class S1,
+                          class Label, class S2,
+          class Equal>
+inline Label
+labelMultiArrayWithBackgroundImpl(MultiArrayView<N, T, S1> const & data,
+                                  MultiArrayView<N, Label, S2> labels,
+                                  NeighborhoodType neighborhood,
+                                  T backgroundValue,
+                                  Equal const &,
+                                  VigraTrueType /* use scanlines */)
+{
+    return labelScanlines(labelingView3D(data), labelingView3D(labels),
+                          neighborhood, true, backgroundValue);
+}
+
+template <unsigned int N, class T, class S1,
+                          class Label, class S2,
+          class Equal>
+inline Label
+labelMultiArrayWithBackgroundImpl(MultiArrayView<N, T, S1> const & data,
+                                  MultiArrayView<N, Label, S2> labels,
+                                  NeighborhoodType neighborhood,
+                                  T backgroundValue,
+                                  Equal const & equal,
+                                  VigraFalseType /* use scanlines */)
+{
+    GridGraph<N, undirected_tag> graph(data.shape(), neighborhood);
+    return lemon_graph::labelGraphWithBackground(graph, data, labels, backgroundValue, equal);
+}
+
+} // namespace detail
+
     /** \brief Option object for labelMultiArray().
     */
 class LabelOptions
@@ -433,6 +681,13 @@ class LabelOptions
     <tt>IndirectNeighborhood</tt> (which corresponds to
     8-neighborhood in 2D and 26-neighborhood in 3D).
 
+    When the array has at most three dimensions and the default equality
+    predicate <tt>std::equal_to<T></tt> is used, the function labels
+    runs of equal values along the x-axis instead of individual pixels,
+    which is considerably faster for typical segmentations and masks.
+    Otherwise, the array is labeled by means of a \ref GridGraph.
+    Both algorithms produce identical results.
+
     Return:  the highest region label used
 
     <b> Usage:</b>
@@ -481,8 +736,8 @@ labelMultiArray(MultiArrayView<N, T, S1> const & data,
     vigra_precondition(data.shape() == labels.shape(),
         "labelMultiArray(): shape mismatch between input and output.");
 
-    GridGraph<N, undirected_tag> graph(data.shape(), neighborhood);
-    return lemon_graph::labelGraph(graph, data, labels, equal);
+    return detail::labelMultiArrayImpl(data, labels, neighborhood, equal,
+                                       typename detail::UseScanlineLabeling<N, Equal>::type());
 }
 
 template <unsigned int N, class T, class S1,
@@ -611,8 +866,8 @@ labelMultiArrayWithBackground(MultiArrayView<N, T, S1> const & data,
     vigra_precondition(data.shape() == labels.shape(),
         "labelMultiArrayWithBackground(): shape mismatch between input and output.");
 
-    GridGraph<N, undirected_tag> graph(data.shape(), neighborhood);
-    return lemon_graph::labelGraphWithBackground(graph, data, labels, backgroundValue, equal);
+    return detail::labelMultiArrayWithBackgroundImpl(data, labels, neighborhood, backgroundValue, equal,
+                                                     typename detail::UseScanlineLabeling<N, Equal>::type());
 }
 
 template <unsigned int N, class T, class S1,
@@ -224,21 +224,123 @@ generateWatershedSeeds(Graph const & g,
 #pragma GCC diagnostic ignored "-Wsign-compare"
 #endif
 
-template <class Graph, class T1Map, class T2Map>
+    // binary heap for seededWatersheds(), ordered by the exact boundary indicator values
+template <class Node, class CostType>
+class WatershedHeapQueue
+: public PriorityQueue<Node, CostType, true>
+{
+  public:
+    typedef PriorityQueue<Node, CostType, true> BaseType;
+    typedef CostType                           priority_type;
+
+    template <class V>
+    priority_type priority(V v) const
+    {
+        return static_cast<priority_type>(v);
+    }
+
+    bool exceeds(priority_type p, double threshold) const
+    {
+        return p > threshold;
+    }
+
+    priority_type topPriority() const
+    {
+        return static_cast<priority_type>(BaseType::topPriority());
+    }
+};
+
+    // Hierarchical queue for seededWatersheds(): one FIFO per level, where
+    // the levels are the boundary indicator values (v - offset) * scale,
+    // rounded down and clamped to [0, levels-1]. It relies on the fact that
+    // region growing never pushes nodes with a lower level than the last popped one.
+template <class Node>
+class WatershedHierarchicalQueue
+{
+    std::vector<std::vector<Node> > buckets_;
+    std::size_t size_, head_;
+    std::ptrdiff_t top_;
+    double offset_, scale_;
+
+  public:
+    typedef std::ptrdiff_t priority_type;
+
+    WatershedHierarchicalQueue(std::size_t levels, double offset, double scale)
+    : buckets_(levels),
+      size_(0), head_(0), top_((priority_type)levels),
+      offset_(offset), scale_(scale)
+    {}
+
+    template <class V>
+    priority_type priority(V v) const
+    {
+        double level = std::floor((v - offset_) * scale_);
+        if(!(level > 0.0))  // also catches NaN
+            return 0;
+        if(level >= (double)buckets_.size())
+            return (priority_type)buckets_.size() - 1;
+        return (priority_type)level;
+    }
+
+    bool exceeds(priority_type p, double threshold) const
+    {
+        return p > std::floor((threshold - offset_) * scale_);
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    priority_type topPriority() const
+    {
+        return top_;
+    }
+
+    Node const & top() const
+    {
+        return buckets_[top_][head_];
+    }
+
+    void pop()
+    {
+        --size_;
+        if(++head_ == buckets_[top_].size())
+        {
+            // release the memory, since this level will not be used again
+            std::vector<Node>().swap(buckets_[top_]);
+            head_ = 0;
+            while(top_ < (priority_type)buckets_.size() && buckets_[top_].empty())
+                ++top_;
+        }
+    }
+
+    void push(Node const & v, priority_type priority)
+    {
+        if(priority < top_)
+        {
+            vigra_assert(head_ == 0, "WatershedHierarchicalQueue::push(): priority below current level.");
+            top_ = priority;
+        }
+        ++size_;
+        buckets_[priority].push_back(v);
+    }
+};
+
+template <class Graph, class T1Map, class T2Map, class Queue>
 typename T2Map::value_type
 seededWatersheds(Graph const & g,
                  T1Map const & data,
                  T2Map & labels,
-                 WatershedOptions const & options)
+                 WatershedOptions const & options,
+                 Queue & pqueue)
 {
     typedef typename Graph::Node        Node;
     typedef typename Graph::NodeIt      graph_scanner;
     typedef typename Graph::OutArcIt    neighbor_iterator;
-    typedef typename T1Map::value_type  CostType;
+    typedef typename Queue::priority_type CostType;
     typedef typename T2Map::value_type  LabelType;
 
-    PriorityQueue<Node, CostType, true> pqueue;
-
     bool keepContours = ((options.terminate & KeepContours) != 0);
     LabelType maxRegionLabel = 0;
 
@@ -256,9 +358,9 @@ seededWatersheds(Graph const & g,
                 {
                     // register all seeds that have an unlabeled neighbor
                     if(label == options.biased_label)
-                        pqueue.push(*node, data[*node] * options.bias);
+                        pqueue.push(*node, pqueue.priority(data[*node] * options.bias));
                     else
-                        pqueue.push(*node, data[*node]);
+                        pqueue.push(*node, pqueue.priority(data[*node]));
                     break;
                 }
             }
@@ -274,7 +376,7 @@ seededWatersheds(Graph const & g,
         CostType cost = pqueue.topPriority();
         pqueue.pop();
 
-        if((options.terminate & StopAtThreshold) && (cost > options.max_cost))
+        if((options.terminate & StopAtThreshold) && pqueue.exceeds(cost, options.max_cost))
             break;
 
         LabelType label = labels[node];
@@ -290,8 +392,8 @@ seededWatersheds(Graph const & g,
             {
                 labels[g.target(*arc)] = label;
                 CostType priority = (label == options.biased_label)
-                                       ? data[g.target(*arc)] * options.bias
-                                       : data[g.target(*arc)];
+                                       ? pqueue.priority(data[g.target(*arc)] * options.bias)
+                                       : pqueue.priority(data[g.target(*arc)]);
                 if(priority < cost)
                     priority = cost;
                 pqueue.push(g.target(*arc), priority);
@@ -301,8 +403,8 @@ seededWatersheds(Graph const & g,
                 // The present neighbor is adjacent to more than one region
                 // => mark it as contour.
                 CostType priority = (neighborLabel == options.biased_label)
-                                       ? data[g.target(*arc)] * options.bias
-                                       : data[g.target(*arc)];
+                                       ? pqueue.priority(data[g.target(*arc)] * options.bias)
+                                       : pqueue.priority(data[g.target(*arc)]);
                 if(cost < priority) // neighbor not yet processed
                     labels[g.target(*arc)] = contourLabel;
             }
@@ -327,6 +429,89 @@ seededWatersheds(Graph const & g,
     return maxRegionLabel;
 }
 
+template <class Graph, class T1Map, class T2Map>
+typename T2Map::value_type
+seededWatersheds(Graph const & g,
+                 T1Map const & data,
+                 T2Map & labels,
+                 WatershedOptions const & options)
+{
+    typedef typename Graph::Node        Node;
+    typedef typename T1Map::value_type  CostType;
+
+    static const bool isSmallInteger = NumericTraits<CostType>::isIntegral::value &&
+                                       sizeof(CostType) <= 2;
+
+    WatershedOptions::QueueType queue_type = options.queue_type;
+    if(queue_type == WatershedOptions::AutomaticQueue)
+        queue_type = isSmallInteger
+                         ? WatershedOptions::HierarchicalQueue
+                         : WatershedOptions::HeapQueue;
+
+    if(queue_type == WatershedOptions::HeapQueue)
+    {
+        WatershedHeapQueue<Node, CostType> pqueue;
+        return seededWatersheds(g, data, labels, options, pqueue);
+    }
+
+    double offset, scale;
+    std::size_t levels;
+    if(isSmallInteger && options.bias == 1.0)
+    {
+        // one level per value
+        offset = (double)NumericTraits<CostType>::min();
+        scale  = 1.0;
+        levels = (std::size_t)((double)NumericTraits<CostType>::max() - offset) + 1;
+    }
+    else
+    {
+        vigra_precondition(options.queue_levels > 1,
+            "watershedsGraph(): hierarchical queue needs at least two levels.");
+        double minimum = NumericTraits<double>::max(),
+               maximum = -NumericTraits<double>::max();
+        for(typename Graph::NodeIt node(g); node != lemon::INVALID; ++node)
+        {
+            double v = (double)data[*node];
+            if(v < minimum)
+                minimum = v;
+            if(maximum < v)
+                maximum = v;
+        }
+        if(options.bias != 1.0)
+        {
+            // the priorities of the biased label are scaled by the bias,
+            // so they may lie outside the range of the data
+            double biasedMinimum = minimum * options.bias,
+                   biasedMaximum = maximum * options.bias;
+            minimum = std::min(minimum, std::min(biasedMinimum, biasedMaximum));
+            maximum = std::max(maximum, std::max(biasedMinimum, biasedMaximum));
+        }
+        std::size_t typeLevels = isSmallInteger
+                                    ? (std::size_t)((double)NumericTraits<CostType>::max() -
+                                                    (double)NumericTraits<CostType>::min()) + 1
+                                    : 0;
+        if(isSmallInteger &&
+           maximum - minimum < (double)std::max<std::size_t>(options.queue_levels, typeLevels))
+        {
+            // still one level per value, but over the biased range
+            offset = std::floor(minimum);
+            scale  = 1.0;
+            levels = (std::size_t)(std::floor(maximum) - offset) + 1;
+        }
+        else
+        {
+            // quantize the range of the data
+            levels = options.queue_levels;
+            offset = minimum;
+            scale  = (maximum > minimum)
+                         ? (levels - 1) / (maximum - minimum)
+                         : 1.0;
+        }
+    }
+    WatershedHierarchicalQueue<Node> pqueue(levels, offset, scale);
+    return seededWatersheds(g, data, labels, options, pqueue);
+}
+
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
@@ -448,6 +633,11 @@ generateWatershedSeeds(MultiArrayView<N, T, S1> const & data,
          (remaining pixels keep label 0).
     <li> <tt>biasLabel()</tt>: Whether one region (label) is to be preferred or discouraged by biasing its cost
          with a given factor (smaller than 1 for preference, larger than 1 for discouragement).
+    <li> <tt>heapQueue()</tt>, <tt>hierarchicalQueue()</tt>: Which priority queue to use in region growing.
+         By default, a hierarchical queue with one level per value is used for 8- and 16-bit
+         integer data, and a binary heap otherwise. <tt>hierarchicalQueue(levels)</tt> quantizes
+         other value types (e.g. <tt>float</tt>) into the given number of levels, which is
+         considerably faster, but only approximates the exact flooding order.
     </ul>
 
     The option <tt>turboAlgorithm()</tt> is implied by method <tt>regionGrowing()</tt> (this is
@@ -40,8 +40,10 @@
 #include <map>
 #include <stack>
 #include <algorithm>
+#include <memory>
 
 #include "multi_array.hxx"
+#include "multi_array_chunked.hxx"
 #include "sampling.hxx"
 #include "threading.hxx"
 #include "threadpool.hxx"
@@ -107,14 +109,14 @@ struct RFMapUpdater<ArgMaxAcc>
 
 
 
-/// Loop over the split dimensions and compute the score of all considered splits.
-template <typename FEATURES, typename LABELS, typename SAMPLER, typename SCORER>
-void split_score(
+/// Compute the score of all considered splits in dimension d.
+template <typename FEATURES, typename LABELS, typename SCORER>
+void split_score_dim(
         FEATURES const & features,
         LABELS const & labels,
         std::vector<double> const & instance_weights,
         std::vector<size_t> const & instances,
-        SAMPLER const & dim_sampler,
+        size_t d,
         SCORER & score
 ){
     typedef typename FEATURES::value_type FeatureType;
@@ -123,41 +125,358 @@ void split_score(
     auto sorted_indices = std::vector<size_t>(feats.size()); // storage for the index sort result
     auto tosort_instances = std::vector<size_t>(feats.size()); // storage for the sorted instances
 
+    // Copy the features to a vector with the correct size (so the sort is faster because of data locality).
+    for (size_t kk = 0; kk < instances.size(); ++kk)
+        feats[kk] = features(instances[kk], d);
+
+    // Sort the features.
+    indexSort(feats.begin(), feats.end(), sorted_indices.begin());
+    std::copy(instances.begin(), instances.end(), tosort_instances.begin());
+    applyPermutation(sorted_indices.begin(), sorted_indices.end(), instances.begin(), tosort_instances.begin());
+
+    // Get the score of the splits.
+    score(features, labels, instance_weights, tosort_instances.begin(), tosort_instances.end(), d);
+}
+
+/// Loop over the split dimensions and compute the score of all considered splits.
+template <typename FEATURES, typename LABELS, typename SAMPLER, typename SCORER>
+void split_score(
+        FEATURES const & features,
+        LABELS const & labels,
+        std::vector<double> const & instance_weights,
+        std::vector<size_t> const & instances,
+        SAMPLER const & dim_sampler,
+        SCORER & score
+){
     for (int i = 0; i < dim_sampler.sampleSize(); ++i)
+        split_score_dim(features, labels, instance_weights, instances, dim_sampler[i], score);
+}
+
+
+
+/// Check whether FEATURES is a ChunkedArray (or derived from one).
+template <typename FEATURES>
+struct RFIsChunkedArray
+{
+    template <typename T>
+    static std::true_type test(ChunkedArray<2, T> const *);
+    static std::false_type test(...);
+
+    static const bool value = decltype(test(static_cast<FEATURES const *>(0)))::value;
+};
+
+/// Element access to a two-dimensional ChunkedArray with the interface of a feature matrix.
+/// It is used during training in place of the ChunkedArray itself.
+template <typename T>
+class RFChunkedFeatures
+{
+public:
+
+    typedef T value_type;
+    typedef Shape2 shape_type;
+
+    explicit RFChunkedFeatures(ChunkedArray<2, T> const & array)
+        :
+        array_(array)
+    {}
+
+    shape_type const & shape() const
+    {
+        return array_.shape();
+    }
+
+    value_type operator()(MultiArrayIndex i, MultiArrayIndex d) const
+    {
+        return array_.getItem(Shape2(i, d));
+    }
+
+    ChunkedArray<2, T> const & array() const
+    {
+        return array_;
+    }
+
+private:
+
+    ChunkedArray<2, T> const & array_;
+};
+
+/// The type of the features that are used during training (access_type) and of the
+/// features of the trained forest (storage_type). ChunkedArrays are accessed via
+/// RFChunkedFeatures, and the trained forest predicts on in-memory arrays.
+template <typename FEATURES, bool CHUNKED = RFIsChunkedArray<FEATURES>::value>
+struct RFTrainingFeatures
+{
+    typedef FEATURES storage_type;
+    typedef FEATURES const & access_type;
+};
+
+template <typename FEATURES>
+struct RFTrainingFeatures<FEATURES, true>
+{
+    typedef typename FEATURES::value_type value_type;
+    typedef MultiArray<2, value_type> storage_type;
+    typedef RFChunkedFeatures<value_type> access_type;
+};
+
+/// The maximum number of rows that are used to find the bin thresholds of a ChunkedArray.
+static const size_t rf_binning_sample_size = 1 << 18;
+
+/// The features quantized into at most 256 bins each, used for histogram-based training.
+template <typename FEATURETYPE>
+class RFBinnedFeatures
+{
+public:
+
+    typedef FEATURETYPE FeatureType;
+
+    template <typename FEATURES>
+    RFBinnedFeatures(
+        FEATURES const & features,
+        size_t max_bins,
+        size_t num_classes,
+        int n_threads
+    )   :
+        codes_(Shape2(features.shape()[1], features.shape()[0])),
+        thresholds_(features.shape()[1]),
+        offsets_(features.shape()[1]+1, 0),
+        num_classes_(num_classes)
     {
-        size_t const d = dim_sampler[i];
+        vigra_precondition(max_bins >= 2 && max_bins <= 256,
+                           "RFBinnedFeatures(): Number of bins must be in [2, 256].");
+        size_t const num_instances = features.shape()[0];
+        size_t const num_features = features.shape()[1];
 
-        // Copy the features to a vector with the correct size (so the sort is faster because of data locality).
-        for (size_t kk = 0; kk < instances.size(); ++kk)
-            feats[kk] = features(instances[kk], d);
+        parallel_foreach(n_threads, num_features,
+            [&](size_t, size_t d)
+            {
+                std::vector<FeatureType> values(num_instances);
+                for (size_t i = 0; i < num_instances; ++i)
+                    values[i] = features(i, d);
+                compute_thresholds(values, max_bins, thresholds_[d]);
+                for (size_t i = 0; i < num_instances; ++i)
+                    codes_(d, i) = bin(d, features(i, d));
+            }
+        );
+        compute_offsets();
+    }
 
-        // Sort the features.
-        indexSort(feats.begin(), feats.end(), sorted_indices.begin());
-        std::copy(instances.begin(), instances.end(), tosort_instances.begin());
-        applyPermutation(sorted_indices.begin(), sorted_indices.end(), instances.begin(), tosort_instances.begin());
+    /// Quantize the features of a ChunkedArray, reading it chunk by chunk. The thresholds are
+    /// computed from all rows, or from a regular subset of the chunk rows if there are more
+    /// than rf_binning_sample_size rows. Only one chunk per thread is held in memory at a time.
+    RFBinnedFeatures(
+        RFChunkedFeatures<FeatureType> const & features,
+        size_t max_bins,
+        size_t num_classes,
+        int n_threads
+    )   :
+        codes_(Shape2(features.shape()[1], features.shape()[0])),
+        thresholds_(features.shape()[1]),
+        offsets_(features.shape()[1]+1, 0),
+        num_classes_(num_classes)
+    {
+        vigra_precondition(max_bins >= 2 && max_bins <= 256,
+                           "RFBinnedFeatures(): Number of bins must be in [2, 256].");
+        ChunkedArray<2, FeatureType> const & array = features.array();
+        Shape2 const shape = array.shape();
+        Shape2 const chunk_shape = array.chunkShape();
+        Shape2 const chunks = array.chunkArrayShape();
+
+        // Select the chunk rows for the thresholds.
+        size_t const max_sample_chunks = std::max<size_t>(rf_binning_sample_size / chunk_shape[0], 1);
+        size_t const step = (chunks[0] + max_sample_chunks - 1) / max_sample_chunks;
+        std::vector<size_t> sample_chunks;
+        for (size_t c = 0; c < (size_t)chunks[0]; c += step)
+            sample_chunks.push_back(c);
+
+        // Find the thresholds, one column of chunks at a time.
+        parallel_foreach(n_threads, chunks[1],
+            [&](size_t, size_t c)
+            {
+                MultiArrayIndex const d0 = c*chunk_shape[1];
+                MultiArrayIndex const width = std::min(chunk_shape[1], shape[1] - d0);
+                std::vector<std::vector<FeatureType> > values(width);
+                MultiArray<2, FeatureType> block;
+                for (auto r : sample_chunks)
+                {
+                    MultiArrayIndex const i0 = r*chunk_shape[0];
+                    block.reshape(Shape2(std::min(chunk_shape[0], shape[0] - i0), width));
+                    array.checkoutSubarray(Shape2(i0, d0), block);
+                    for (MultiArrayIndex d = 0; d < width; ++d)
+                        values[d].insert(values[d].end(), block.template bind<1>(d).begin(), block.template bind<1>(d).end());
+                }
+                for (MultiArrayIndex d = 0; d < width; ++d)
+                    compute_thresholds(values[d], max_bins, thresholds_[d0 + d]);
+            }
+        );
 
-        // Get the score of the splits.
-        score(features, labels, instance_weights, tosort_instances.begin(), tosort_instances.end(), d);
+        // Compute the codes, one chunk at a time.
+        parallel_foreach(n_threads, prod(chunks),
+            [&](size_t, size_t k)
+            {
+                Shape2 const start = Shape2(k % chunks[0], k / chunks[0]) * chunk_shape;
+                MultiArray<2, FeatureType> block(min(chunk_shape, shape - start));
+                array.checkoutSubarray(start, block);
+                for (MultiArrayIndex d = 0; d < block.shape(1); ++d)
+                    for (MultiArrayIndex i = 0; i < block.shape(0); ++i)
+                        codes_(start[1] + d, start[0] + i) = bin(start[1] + d, block(i, d));
+            }
+        );
+        compute_offsets();
+    }
+
+    /// The number of bins of dimension d.
+    size_t num_bins(size_t d) const
+    {
+        return thresholds_[d].size() + 1;
     }
+
+    /// The bin of value v in dimension d.
+    /// A value is in bin k or lower if and only if it is less or equal to thresholds_[d][k].
+    UInt8 bin(size_t d, FeatureType v) const
+    {
+        return static_cast<UInt8>(
+            std::lower_bound(thresholds_[d].begin(), thresholds_[d].end(), v) - thresholds_[d].begin());
+    }
+
+    /// The size of a histogram over all dimensions and classes.
+    size_t histogram_size() const
+    {
+        return offsets_.back();
+    }
+
+    /// Compute the class histograms of the given instances in all dimensions.
+    template <typename LABELS, typename ITER>
+    void histogram(
+        LABELS const & labels,
+        std::vector<double> const & instance_weights,
+        ITER begin,
+        ITER end,
+        std::vector<double> & hist
+    ) const {
+        hist.assign(histogram_size(), 0.0);
+        size_t const num_features = thresholds_.size();
+        for (ITER it = begin; it != end; ++it)
+        {
+            size_t const i = *it;
+            double const w = instance_weights[i];
+            if (w == 0.0)
+                continue;
+            double * h = hist.data() + static_cast<size_t>(labels(i));
+            UInt8 const * codes = &codes_(0, i);
+            for (size_t d = 0; d < num_features; ++d)
+                h[offsets_[d] + codes[d]*num_classes_] += w;
+        }
+    }
+
+    MultiArray<2, UInt8> codes_; // the bin of each feature (first index) and instance (second index)
+    std::vector<std::vector<FeatureType> > thresholds_; // the thresholds between the bins of each feature
+    std::vector<size_t> offsets_; // the start of each feature in a histogram
+    size_t num_classes_;
+
+private:
+
+    /// Sort the values and cut them into at most max_bins bins of roughly equal population.
+    /// Equal values always end up in the same bin.
+    static void compute_thresholds(
+        std::vector<FeatureType> & values,
+        size_t max_bins,
+        std::vector<FeatureType> & thresholds
+    ){
+        std::sort(values.begin(), values.end());
+        size_t const num_values = values.size();
+        size_t num_bins = 0;
+        size_t start = 0;
+        while (start < num_values)
+        {
+            size_t const bins_left = max_bins - num_bins;
+            size_t stop = bins_left > 1
+                              ? start + (num_values - start + bins_left - 1) / bins_left
+                              : num_values;
+            stop = std::upper_bound(values.begin() + stop - 1, values.end(), values[stop-1]) - values.begin();
+            ++num_bins;
+            if (stop < num_values)
+            {
+                // Use the midpoint between the bins, unless it cannot be represented.
+                FeatureType const left = values[stop-1];
+                FeatureType const right = values[stop];
+                FeatureType const mid = static_cast<FeatureType>(0.5*left + 0.5*right);
+                thresholds.push_back(left <= mid && mid < right ? mid : left);
+            }
+            start = stop;
+        }
+    }
+
+    void compute_offsets()
+    {
+        for (size_t d = 0; d + 1 < offsets_.size(); ++d)
+            offsets_[d+1] = offsets_[d] + num_bins(d)*num_classes_;
+    }
+};
+
+
+
+/// Compute the score of the splits between the histogram bins of dimension d.
+template <typename FEATURETYPE, typename SCORER>
+void split_score_binned_dim(
+        RFBinnedFeatures<FEATURETYPE> const & bins,
+        std::vector<double> const & hist,
+        size_t d,
+        SCORER & score
+){
+    score.binned(hist.begin() + bins.offsets_[d], bins.num_bins(d), bins.thresholds_[d], d);
 }
 
 
 
+/// The number of nodes that are taken from the node stack and split at once.
+/// It does not depend on the number of threads, so that the trees are the same
+/// for any number of threads.
+static const size_t rf_node_batch_size = 16;
+
+/// The state of a node while it is being split.
+template <typename NODE, typename ITER, typename SCORER>
+struct RFNodeTask
+{
+    NODE node;
+    ITER begin, end, split_iter;
+    size_t depth;
+    std::vector<double> priors;
+    std::vector<size_t> dims;       // the sampled split dimensions
+    std::vector<size_t> instances;  // the instances that are used to find the split (exact training)
+    std::vector<double> hist;       // the class histograms of the node (binned training)
+    std::vector<double> small_hist; // the class histograms of the smaller child (binned training)
+    std::vector<SCORER> scores;     // the best split in each of the sampled dimensions
+    int best;                       // the index of the best split in scores, -1 if there is none
+    std::vector<double> priors_left, priors_right;
+    NODE n_left, n_right;
+    bool split_left, split_right;
+};
+
+
+
 /**
  * @brief Train a single randomized decision tree.
+ *
+ * Up to rf_node_batch_size nodes are taken from the node stack at once. The random numbers
+ * for these nodes are drawn sequentially, then the sampled split dimensions of all nodes
+ * are evaluated in parallel, and finally the nodes are partitioned in parallel.
+ * Graph updates, stop criteria, and visitors are called sequentially in stack order.
+ * n_threads is the number of threads for the parallel loops. It must be 1 if the
+ * function is itself called from a parallel loop over the trees.
  */
-template <typename RF, typename SCORER, typename VISITOR, typename STOP, typename RANDENGINE>
+template <typename RF, typename SCORER, typename VISITOR, typename STOP, typename RANDENGINE, typename FEATURES>
 void random_forest_single_tree(
-        typename RF::Features const & features,
+        FEATURES const & features,
         MultiArray<1, size_t>  const & labels,
         RandomForestOptions const & options,
         VISITOR & visitor,
         STOP stop,
         RF & tree,
-        RANDENGINE const & randengine
+        RANDENGINE const & randengine,
+        int n_threads = 1,
+        RFBinnedFeatures<typename RF::Features::value_type> const * bins = 0
 ){
-    typedef typename RF::Features Features;
-    typedef typename Features::value_type FeatureType;
+    typedef typename RF::Features::value_type FeatureType;
     typedef LessEqualSplitTest<FeatureType> SplitTests;
     typedef typename RF::Node Node;
     typedef typename RF::ACC ACC;
@@ -214,6 +533,7 @@ void random_forest_single_tree(
     PropertyMap<Node, IterPair> instance_range;  // begin and end of the instances of a node in the bookkeeping vector
     PropertyMap<Node, std::vector<double> > node_distributions;  // the class distributions in the nodes
     PropertyMap<Node, size_t> node_depths;  // the depth of each node
+    PropertyMap<Node, std::vector<double> > node_histograms;  // the class histograms of the nodes (binned training only)
     {
         auto const rootnode = tree.graph_.addNode();
         node_stack.push(rootnode);
@@ -226,6 +546,13 @@ void random_forest_single_tree(
         node_distributions.insert(rootnode, priors);
 
         node_depths.insert(rootnode, 0);
+
+        if (bins)
+        {
+            node_histograms.insert(rootnode, std::vector<double>());
+            bins->histogram(labels, instance_weights, instance_indices.begin(), instance_indices.end(),
+                            node_histograms.at(rootnode));
+        }
     }
 
     // Call the visitor.
@@ -233,120 +560,239 @@ void random_forest_single_tree(
 
     // Split the nodes.
     detail::RFMapUpdater<ACC> node_map_updater;
+    typedef RFNodeTask<Node, InstanceIter, SCORER> Task;
+    std::vector<Task> tasks;
+    std::vector<std::pair<size_t, size_t> > dim_items;
     while (!node_stack.empty())
     {
-        // Get the data of the current node.
-        auto const node = node_stack.top();
-        node_stack.pop();
-        auto const begin = instance_range.at(node).first;
-        auto const end = instance_range.at(node).second;
-        auto const & priors = node_distributions.at(node);
-        auto const depth = node_depths.at(node);
-
-        // Get the instances with weight > 0.
-        std::vector<size_t> used_instances;
-        for (auto it = begin; it != end; ++it)
-            if (instance_weights[*it] > 1e-10)
-                used_instances.push_back(*it);
-
-        // Find the best split.
-        dim_sampler.sample();
-        SCORER score(priors);
-        if (options.resample_count_ == 0 || used_instances.size() <= options.resample_count_)
+        // Get the data of the next nodes and draw their random numbers.
+        tasks.clear();
+        while (!node_stack.empty() && tasks.size() < rf_node_batch_size)
         {
-            // Find the split using all instances.
-            detail::split_score(
-                features,
-                labels,
-                instance_weights,
-                used_instances,
-                dim_sampler,
-                score
-            );
-        }
-        else
-        {
-            // Generate a random subset of the instances.
-            Sampler<MersenneTwister> resampler(used_instances.begin(), used_instances.end(), SamplerOptions().withoutReplacement().sampleSize(options.resample_count_), &randengine);
-            resampler.sample();
-            auto indices = std::vector<size_t>(options.resample_count_);
-            for (size_t i = 0; i < options.resample_count_; ++i)
-                indices[i] = used_instances[resampler[i]];
-
-            // Find the split using the subset.
-            detail::split_score(
-                features,
-                labels,
-                instance_weights,
-                indices,
-                dim_sampler,
-                score
-            );
+            tasks.push_back(Task());
+            Task & task = tasks.back();
+            task.node = node_stack.top();
+            node_stack.pop();
+            task.begin = instance_range.at(task.node).first;
+            task.end = instance_range.at(task.node).second;
+            task.priors = node_distributions.at(task.node);
+            task.depth = node_depths.at(task.node);
+            task.best = -1;
+
+            dim_sampler.sample();
+            for (int i = 0; i < dim_sampler.sampleSize(); ++i)
+                task.dims.push_back(dim_sampler[i]);
+            if (bins)
+            {
+                task.hist.swap(node_histograms.at(task.node));
+                node_histograms.erase(task.node);
+                continue;
+            }
+
+            // Get the instances with weight > 0.
+            std::vector<size_t> used_instances;
+            for (auto it = task.begin; it != task.end; ++it)
+                if (instance_weights[*it] > 1e-10)
+                    used_instances.push_back(*it);
+
+            if (options.resample_count_ == 0 || used_instances.size() <= options.resample_count_)
+            {
+                // Find the split using all instances.
+                task.instances.swap(used_instances);
+            }
+            else
+            {
+                // Generate a random subset of the instances.
+                Sampler<MersenneTwister> resampler(used_instances.begin(), used_instances.end(), SamplerOptions().withoutReplacement().sampleSize(options.resample_count_), &randengine);
+                resampler.sample();
+                task.instances.resize(options.resample_count_);
+                for (size_t i = 0; i < options.resample_count_; ++i)
+                    task.instances[i] = used_instances[resampler[i]];
+            }
         }
 
-        // If no split was found, the node is terminal.
-        if (!score.split_found_)
+        // Find the best split in each sampled dimension of each node.
+        dim_items.clear();
+        for (size_t k = 0; k < tasks.size(); ++k)
         {
-            tree.node_responses_.insert(node, ACCInputType());
-            node_map_updater(tree.node_responses_.at(node), node_distributions.at(node));
-            continue;
+            for (size_t j = 0; j < tasks[k].dims.size(); ++j)
+            {
+                tasks[k].scores.emplace_back(tasks[k].priors);
+                dim_items.push_back(std::make_pair(k, j));
+            }
         }
-
-        // Create the child nodes and split the instances accordingly.
-        auto const n_left = tree.graph_.addNode();
-        auto const n_right = tree.graph_.addNode();
-        tree.graph_.addArc(node, n_left);
-        tree.graph_.addArc(node, n_right);
-        auto const best_split = score.best_split_;
-        auto const best_dim = score.best_dim_;
-        auto const split_iter = std::partition(begin, end,
-            [&](size_t i)
+        parallel_foreach(n_threads, dim_items.size(),
+            [&](size_t, size_t i)
             {
-                return features(i, best_dim) <= best_split;
+                Task & task = tasks[dim_items[i].first];
+                size_t const j = dim_items[i].second;
+                if (bins)
+                    detail::split_score_binned_dim(*bins, task.hist, task.dims[j], task.scores[j]);
+                else
+                    detail::split_score_dim(features, labels, instance_weights, task.instances, task.dims[j], task.scores[j]);
             }
         );
 
-        // Call the visitor.
-        visitor.visit_after_split(tree, features, labels, instance_weights, score, begin, split_iter, end);
-
-        instance_range.insert(n_left, IterPair(begin, split_iter));
-        instance_range.insert(n_right, IterPair(split_iter, end));
-        tree.split_tests_.insert(node, SplitTests(best_dim, best_split));
-        node_depths.insert(n_left, depth+1);
-        node_depths.insert(n_right, depth+1);
+        // Select the best split of each node, preferring the first of equally good splits
+        // (as if all dimensions had been scanned by a single scorer), and split the instances accordingly.
+        parallel_foreach(n_threads, tasks.size(),
+            [&](size_t, size_t k)
+            {
+                Task & task = tasks[k];
+                for (size_t j = 0; j < task.scores.size(); ++j)
+                    if (task.scores[j].split_found_ &&
+                        (task.best < 0 || task.scores[j].best_score_ < task.scores[task.best].best_score_))
+                        task.best = j;
+                if (task.best < 0)
+                    return;
+
+                auto const best_split = task.scores[task.best].best_split_;
+                auto const best_dim = task.scores[task.best].best_dim_;
+                if (bins)
+                {
+                    // The split is a bin threshold, so the bins tell the side of each instance.
+                    UInt8 const best_bin = bins->bin(best_dim, best_split);
+                    UInt8 const * codes = &bins->codes_(best_dim, 0);
+                    MultiArrayIndex const stride = bins->codes_.stride(1);
+                    task.split_iter = std::partition(task.begin, task.end,
+                        [&](size_t i)
+                        {
+                            return codes[i*stride] <= best_bin;
+                        }
+                    );
+                }
+                else
+                {
+                    task.split_iter = std::partition(task.begin, task.end,
+                        [&](size_t i)
+                        {
+                            return features(i, best_dim) <= best_split;
+                        }
+                    );
+                }
 
-        // Compute the class distribution for the left child.
-        auto priors_left = std::vector<double>(spec.num_classes_, 0.0);
-        for (auto it = begin; it != split_iter; ++it)
-            priors_left[labels(*it)] += instance_weights[*it];
-        node_distributions.insert(n_left, priors_left);
+                // Compute the class distributions of the children.
+                task.priors_left.assign(spec.num_classes_, 0.0);
+                for (auto it = task.begin; it != task.split_iter; ++it)
+                    task.priors_left[labels(*it)] += instance_weights[*it];
+                task.priors_right.assign(spec.num_classes_, 0.0);
+                for (auto it = task.split_iter; it != task.end; ++it)
+                    task.priors_right[labels(*it)] += instance_weights[*it];
+            }
+        );
 
-        // Check if the left child is terminal.
-        if (stop(labels, RFNodeDescription<decltype(priors_left)>(depth+1, priors_left)))
-        {
-            tree.node_responses_.insert(n_left, ACCInputType());
-            node_map_updater(tree.node_responses_.at(n_left), node_distributions.at(n_left));
-        }
-        else
+        bool need_histograms = false;
+        for (auto & task : tasks)
         {
-            node_stack.push(n_left);
-        }
+            Node const node = task.node;
 
-        // Compute the class distribution for the right child.
-        auto priors_right = std::vector<double>(spec.num_classes_, 0.0);
-        for (auto it = split_iter; it != end; ++it)
-            priors_right[labels(*it)] += instance_weights[*it];
-        node_distributions.insert(n_right, priors_right);
+            // If no split was found, the node is terminal.
+            if (task.best < 0)
+            {
+                tree.node_responses_.insert(node, ACCInputType());
+                node_map_updater(tree.node_responses_.at(node), node_distributions.at(node));
+                continue;
+            }
 
-        // Check if the right child is terminal.
-        if (stop(labels, RFNodeDescription<decltype(priors_right)>(depth+1, priors_right)))
-        {
-            tree.node_responses_.insert(n_right, ACCInputType());
-            node_map_updater(tree.node_responses_.at(n_right), node_distributions.at(n_right));
+            // Create the child nodes.
+            auto const n_left = tree.graph_.addNode();
+            auto const n_right = tree.graph_.addNode();
+            tree.graph_.addArc(node, n_left);
+            tree.graph_.addArc(node, n_right);
+            auto const & score = task.scores[task.best];
+            auto const begin = task.begin;
+            auto const split_iter = task.split_iter;
+            auto const end = task.end;
+            auto const depth = task.depth;
+
+            // Call the visitor.
+            visitor.visit_after_split(tree, features, labels, instance_weights, score, begin, split_iter, end);
+
+            instance_range.insert(n_left, IterPair(begin, split_iter));
+            instance_range.insert(n_right, IterPair(split_iter, end));
+            tree.split_tests_.insert(node, SplitTests(score.best_dim_, score.best_split_));
+            node_depths.insert(n_left, depth+1);
+            node_depths.insert(n_right, depth+1);
+
+            // Check if the left child is terminal.
+            auto const & priors_left = task.priors_left;
+            node_distributions.insert(n_left, priors_left);
+            bool const split_left = !stop(labels, RFNodeDescription<std::vector<double> >(depth+1, priors_left));
+            if (!split_left)
+            {
+                tree.node_responses_.insert(n_left, ACCInputType());
+                node_map_updater(tree.node_responses_.at(n_left), node_distributions.at(n_left));
+            }
+            else
+            {
+                node_stack.push(n_left);
+            }
+
+            // Check if the right child is terminal.
+            auto const & priors_right = task.priors_right;
+            node_distributions.insert(n_right, priors_right);
+            bool const split_right = !stop(labels, RFNodeDescription<std::vector<double> >(depth+1, priors_right));
+            if (!split_right)
+            {
+                tree.node_responses_.insert(n_right, ACCInputType());
+                node_map_updater(tree.node_responses_.at(n_right), node_distributions.at(n_right));
+            }
+            else
+            {
+                node_stack.push(n_right);
+            }
+
+            task.n_left = n_left;
+            task.n_right = n_right;
+            task.split_left = split_left;
+            task.split_right = split_right;
+            need_histograms = need_histograms || split_left || split_right;
         }
-        else
+
+        // Compute the histograms of the children that will be split. Only the smaller
+        // child is counted, the larger one is obtained by subtraction from the parent.
+        if (!bins || !need_histograms)
+            continue;
+        parallel_foreach(n_threads, tasks.size(),
+            [&](size_t, size_t k)
+            {
+                Task & task = tasks[k];
+                if (task.best < 0 || !(task.split_left || task.split_right))
+                {
+                    std::vector<double>().swap(task.hist);
+                    return;
+                }
+                bool const left_is_smaller = (task.split_iter - task.begin) <= (task.end - task.split_iter);
+                if (left_is_smaller)
+                    bins->histogram(labels, instance_weights, task.begin, task.split_iter, task.small_hist);
+                else
+                    bins->histogram(labels, instance_weights, task.split_iter, task.end, task.small_hist);
+                if (left_is_smaller ? task.split_right : task.split_left)
+                    for (size_t i = 0; i < task.hist.size(); ++i)
+                        task.hist[i] -= task.small_hist[i];
+                else
+                    std::vector<double>().swap(task.hist);
+                if (!(left_is_smaller ? task.split_left : task.split_right))
+                    std::vector<double>().swap(task.small_hist);
+            }
+        );
+        for (auto & task : tasks)
         {
-            node_stack.push(n_right);
+            if (task.best < 0 || !(task.split_left || task.split_right))
+                continue;
+            bool const left_is_smaller = (task.split_iter - task.begin) <= (task.end - task.split_iter);
+            Node const small_node = left_is_smaller ? task.n_left : task.n_right;
+            Node const large_node = left_is_smaller ? task.n_right : task.n_left;
+            if (task.hist.size() > 0)
+            {
+                node_histograms.insert(large_node, std::vector<double>());
+                node_histograms.at(large_node).swap(task.hist);
+            }
+            if (task.small_hist.size() > 0)
+            {
+                node_histograms.insert(small_node, std::vector<double>());
+                node_histograms.at(small_node).swap(task.small_hist);
+            }
         }
     }
 
@@ -363,7 +809,7 @@ template <typename FEATURES,
           typename SCORER,
           typename STOP,
           typename RANDENGINE>
-RandomForest<FEATURES, LABELS>
+RandomForest<typename RFTrainingFeatures<FEATURES>::storage_type, LABELS>
 random_forest_impl(
         FEATURES const & features,
         LABELS const & labels,
@@ -376,7 +822,8 @@ random_forest_impl(
     typedef LABELS Labels;
     // typedef typename Features::value_type FeatureType;
     typedef typename Labels::value_type LabelType;
-    typedef RandomForest<FEATURES, LABELS> RF;
+    typedef RFTrainingFeatures<FEATURES> TrainingFeatures;
+    typedef RandomForest<typename TrainingFeatures::storage_type, LABELS> RF;
 
     ProblemSpec<LabelType> pspec;
     pspec.num_instances(features.shape()[0])
@@ -420,20 +867,27 @@ random_forest_impl(
     else if (options.n_threads_ == -1)
         n_threads = std::thread::hardware_concurrency();
 
-    // Use the global random engine to create seeds for the random engines that run in the threads.
+    // Quantize the features for histogram-based training. ChunkedArrays are always
+    // quantized, so that the trees only need the bins in memory.
+    typename TrainingFeatures::access_type training_features(features);
+    size_t histogram_bins = options.histogram_bins_;
+    if (histogram_bins == 0 && RFIsChunkedArray<FEATURES>::value)
+        histogram_bins = 256;
+    std::unique_ptr<detail::RFBinnedFeatures<typename FEATURES::value_type> > bins;
+    if (histogram_bins > 0)
+        bins.reset(new detail::RFBinnedFeatures<typename FEATURES::value_type>(
+            training_features, histogram_bins, distinct_labels.size(), n_threads));
+
+    // Use the global random engine to create distinct seeds for the random engines of the trees.
+    // Each tree gets its own engine, so that the result does not depend on the number of threads.
     UniformIntRandomFunctor<RANDENGINE> rand_functor(randengine);
     std::set<UInt32> seeds;
-    while (seeds.size() < n_threads)
-    {
-        seeds.insert(rand_functor());
-    }
-    vigra_assert(seeds.size() == n_threads, "random_forest_impl(): Could not create random seeds.");
-
-    // Create the random engines that run in the threads.
     std::vector<RANDENGINE> rand_engines;
-    for (auto seed : seeds)
+    while (rand_engines.size() < tree_count)
     {
-        rand_engines.push_back(RANDENGINE(seed));
+        UInt32 const seed = rand_functor();
+        if (seeds.insert(seed).second)
+            rand_engines.push_back(RANDENGINE(seed));
     }
 
     // Call the visitor.
@@ -448,21 +902,32 @@ random_forest_impl(
         tree_visitors.emplace_back(visitor);
     }
 
-    // Train the trees.
-    ThreadPool pool((size_t)n_threads);
-    std::vector<threading::future<void> > futures;
-    for (size_t i = 0; i < tree_count; ++i)
+    // Train the trees. If there are enough trees to keep all threads busy, the trees are
+    // trained in parallel and each tree is split sequentially. Otherwise, the trees are
+    // trained one after another and the nodes of each tree are split in parallel.
+    // The two levels are never nested, so that no pool task waits for other tasks.
+    if (n_threads > 1 && tree_count >= n_threads)
     {
-        futures.emplace_back(
-            pool.enqueue([&features, &transformed_labels, &options, &tree_visitors, &stop, &trees, i, &rand_engines](size_t thread_id)
-                {
-                    random_forest_single_tree<RF, SCORER, VisitorCopyType, STOP>(features, transformed_labels, options, tree_visitors[i], stop, trees[i], rand_engines[thread_id]);
-                }
-            )
-        );
+        ThreadPool pool((size_t)n_threads);
+        std::vector<threading::future<void> > futures;
+        for (size_t i = 0; i < tree_count; ++i)
+        {
+            futures.emplace_back(
+                pool.enqueue([&training_features, &transformed_labels, &options, &tree_visitors, &stop, &trees, i, &rand_engines, &bins](size_t)
+                    {
+                        random_forest_single_tree<RF, SCORER, VisitorCopyType, STOP>(training_features, transformed_labels, options, tree_visitors[i], stop, trees[i], rand_engines[i], 1, bins.get());
+                    }
+                )
+            );
+        }
+        for (auto & fut : futures)
+            fut.get();
+    }
+    else
+    {
+        for (size_t i = 0; i < tree_count; ++i)
+            random_forest_single_tree<RF, SCORER, VisitorCopyType, STOP>(training_features, transformed_labels, options, tree_visitors[i], stop, trees[i], rand_engines[i], (int)n_threads, bins.get());
     }
-    for (auto & fut : futures)
-        fut.get();
 
     // Merge the trees together.
     RF rf(trees[0]);
@@ -471,6 +936,7 @@ random_forest_impl(
     {
         rf.merge(trees[i]);
     }
+    rf.compile();
 
     // Call the visitor.
     visitor.visit_after_training(tree_visitors, rf, features, labels);
@@ -483,7 +949,7 @@ random_forest_impl(
 /// \brief Get the stop criterion from the option object and pass it as template argument.
 template <typename FEATURES, typename LABELS, typename VISITOR, typename SCORER, typename RANDENGINE>
 inline
-RandomForest<FEATURES, LABELS>
+RandomForest<typename RFTrainingFeatures<FEATURES>::storage_type, LABELS>
 random_forest_impl0(
         FEATURES const & features,
         LABELS const & labels,
@@ -521,6 +987,16 @@ random_forest_impl0(
     a specific random number generator instance, which is especially useful when you want to
     enforce deterministic algorithm behavior during debugging.
 
+    The features may also be given as a two-dimensional \ref vigra::ChunkedArray (e.g. a
+    \ref vigra::ChunkedArrayHDF5), so that training sets larger than the main memory can be used
+    without subsampling. The features are then read chunk by chunk and quantized for
+    histogram-based training (see \ref vigra::rf3::RandomForestOptions::histogram_bins(),
+    256 bins are used if no number is set), so that only one byte per feature and instance
+    is held in memory. If the array has more than 2^18 rows, the bin thresholds are computed
+    from a regular subset of its chunk rows. The returned forest has the feature type
+    <tt>MultiArray<2, T></tt> and predicts in-memory data as usual. Visitors that need the
+    feature matrix during training (such as \ref vigra::rf3::OOBError) cannot be used in this case.
+
     <b> Declaration:</b>
 
     \code
@@ -529,7 +1005,7 @@ random_forest_impl0(
                   typename LABELS,
                   typename VISITOR = vigra::rf3::RFStopVisiting,
                   typename RANDENGINE = vigra::MersenneTwister>
-        vigra::rf3::RandomForest<FEATURES, LABELS>
+        vigra::rf3::RandomForest<FEATURES, LABELS> // RandomForest<MultiArray<2, T>, LABELS> for a ChunkedArray<2, T>
         random_forest(
                 FEATURES const & features,
                 LABELS const & labels,
@@ -578,7 +1054,7 @@ doxygen_overloaded_function(template <...> void random_forest)
 
 template <typename FEATURES, typename LABELS, typename VISITOR, typename RANDENGINE>
 inline
-RandomForest<FEATURES, LABELS>
+RandomForest<typename detail::RFTrainingFeatures<FEATURES>::storage_type, LABELS>
 random_forest(
         FEATURES const & features,
         LABELS const & labels,
@@ -601,7 +1077,7 @@ random_forest(
 
 template <typename FEATURES, typename LABELS, typename VISITOR>
 inline
-RandomForest<FEATURES, LABELS>
+RandomForest<typename detail::RFTrainingFeatures<FEATURES>::storage_type, LABELS>
 random_forest(
         FEATURES const & features,
         LABELS const & labels,
@@ -614,7 +1090,7 @@ random_forest(
 
 template <typename FEATURES, typename LABELS>
 inline
-RandomForest<FEATURES, LABELS>
+RandomForest<typename detail::RFTrainingFeatures<FEATURES>::storage_type, LABELS>
 random_forest(
         FEATURES const & features,
         LABELS const & labels,
@@ -626,7 +1102,7 @@ random_forest(
 
 template <typename FEATURES, typename LABELS>
 inline
-RandomForest<FEATURES, LABELS>
+RandomForest<typename detail::RFTrainingFeatures<FEATURES>::storage_type, LABELS>
 random_forest(
         FEATURES const & features,
         LABELS const & labels
@@ -37,6 +37,8 @@
 
 #include <type_traits>
 #include <thread>
+#include <vector>
+#include <functional>
 
 #include "../multi_shape.hxx"
 #include "../binary_forest.hxx"
@@ -105,10 +107,22 @@ public:
     );
 
     /// \brief Grow this forest by incorporating the other.
+    /// \note This discards the compiled inference layout, call compile() afterwards.
     void merge(
         RandomForest const & other
     );
 
+    /// \brief Build the contiguous inference layout that is used by predict(), predict_probabilities() and leaf_ids().
+    /// \note This is done automatically by the constructor and by random_forest(). It must be repeated
+    ///       after the graph, the split tests or the node responses have been modified.
+    void compile();
+
+    /// \brief Return whether the compiled inference layout is up to date with the graph.
+    bool is_compiled() const
+    {
+        return flat_nodes_.size() == graph_.numNodes() && flat_roots_.size() == graph_.numRoots();
+    }
+
     /// \brief Predict the given data and return the average number of split comparisons.
     /// \note labels must be a 1-D array with size <tt>features.shape(0)</tt>.
     void predict(
@@ -179,6 +193,60 @@ public:
 
 private:
 
+    /// \brief A node of the compiled inference layout.
+    /// \note The children of an internal node are stored consecutively, starting at index child_.
+    ///       For leaves, -child_ is the index into flat_responses_ and flat_leaf_ids_.
+    struct FlatNode
+    {
+        SplitTests test_;
+        std::ptrdiff_t child_;
+    };
+
+    /// \brief The nodes of all trees, each tree in breadth-first order.
+    std::vector<FlatNode> flat_nodes_;
+
+    /// \brief The index of each tree's root in flat_nodes_.
+    std::vector<size_t> flat_roots_;
+
+    /// \brief The responses of the leaves in the order of the compiled layout.
+    std::vector<AccInputType> flat_responses_;
+
+    /// \brief The graph node ids of the leaves in the order of the compiled layout.
+    std::vector<size_t> flat_leaf_ids_;
+
+    /// \brief The number of instances that are moved through a tree together during prediction.
+    enum { prediction_block_size = 64 };
+
+    /// \brief Move the given rows through tree k of the compiled layout in lock step, one level at a time,
+    ///        store the leaf index that each row reaches in leaves, and return the number of split comparisons.
+    template <typename ROW>
+    double descend_block(
+        std::vector<ROW> const & rows,
+        size_t k,
+        std::ptrdiff_t * leaves
+    ) const;
+
+    /// \brief Move the active rows of a block one level down by evaluating the split test of their node.
+    template <typename ROW>
+    void descend_level(
+        std::vector<ROW> const & rows,
+        size_t const * active,
+        size_t num_active,
+        std::ptrdiff_t * leaves,
+        std::false_type
+    ) const;
+
+    /// \brief Move the active rows of a block one level down by comparing their feature values
+    ///        against the thresholds of LessEqualSplitTest directly, in one loop over the block.
+    template <typename ROW>
+    void descend_level(
+        std::vector<ROW> const & rows,
+        size_t const * active,
+        size_t num_active,
+        std::ptrdiff_t * leaves,
+        std::true_type
+    ) const;
+
     /// \brief Compute the leaf ids of the instances in [from, to).
     template <typename IDS, typename INDICES>
     double leaf_ids_impl(
@@ -189,11 +257,13 @@ private:
         INDICES const & tree_indices
     ) const;
 
+    /// \brief Compute the probabilities of the instances in [from, to).
     template<typename PROBS>
     void predict_probabilities_impl(
         FEATURES const & features,
         PROBS & probs,
-        const size_t i,
+        size_t from,
+        size_t to,
         const std::vector<size_t> & tree_indices) const;
 
 };
@@ -218,7 +288,9 @@ RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::RandomForest(
     split_tests_(split_tests),
     node_responses_(node_responses),
     problem_spec_(problem_spec)
-{}
+{
+    compile();
+}
 
 template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
 void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::merge(
@@ -239,6 +311,55 @@ void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::merge(
     {
         node_responses_.insert(Node(p.first.id()+offset), p.second);
     }
+
+    // Merging is usually done many times in a row, so the layout is only rebuilt on request.
+    flat_nodes_.clear();
+    flat_roots_.clear();
+    flat_responses_.clear();
+    flat_leaf_ids_.clear();
+}
+
+template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
+void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::compile()
+{
+    flat_nodes_.clear();
+    flat_roots_.clear();
+    flat_responses_.clear();
+    flat_leaf_ids_.clear();
+    flat_nodes_.reserve(graph_.numNodes());
+
+    // Lay out each tree in breadth-first order, so that the top levels of a tree
+    // (which are visited by every instance) share few cache lines and siblings are adjacent.
+    std::vector<Node> queue;
+    for (size_t k = 0; k < graph_.numRoots(); ++k)
+    {
+        size_t const first = flat_nodes_.size();
+        flat_roots_.push_back(first);
+        queue.clear();
+        queue.push_back(graph_.getRoot(k));
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            // The node queue[i] is stored at flat_nodes_[first+i].
+            Node const node = queue[i];
+            size_t const degree = graph_.outDegree(node);
+            FlatNode flat;
+            if (degree > 0)
+            {
+                flat.test_ = split_tests_.at(node);
+                flat.child_ = first + queue.size();
+                for (size_t c = 0; c < degree; ++c)
+                    queue.push_back(graph_.getChild(node, c));
+            }
+            else
+            {
+                flat.test_ = SplitTests();
+                flat.child_ = -static_cast<std::ptrdiff_t>(flat_responses_.size());
+                flat_responses_.push_back(node_responses_.at(node));
+                flat_leaf_ids_.push_back(node.id());
+            }
+            flat_nodes_.push_back(flat);
+        }
+    }
 }
 
 // FIXME TODO we don't support the selection of tree indices any more in predict_probabilities, might be a good idea
@@ -307,45 +428,166 @@ void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::predict_probabilities(
     if (n_threads < 1)
         n_threads = 1;
     
+    size_t const num_blocks = (num_instances + prediction_block_size - 1) / prediction_block_size;
     parallel_foreach(
         n_threads,
-        num_instances,
-        [&features,&probs,&tree_indices_cpy,this](size_t, size_t i) {
-            this->predict_probabilities_impl(features, probs, i, tree_indices_cpy);
+        num_blocks,
+        [&features,&probs,&tree_indices_cpy,num_instances,this](size_t, size_t b) {
+            size_t const from = b*prediction_block_size;
+            size_t const to = std::min<size_t>(from + prediction_block_size, num_instances);
+            this->predict_probabilities_impl(features, probs, from, to, tree_indices_cpy);
         }
     );
 }
 
+template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
+template <typename ROW>
+double RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::descend_block(
+    std::vector<ROW> const & rows,
+    size_t k,
+    std::ptrdiff_t * leaves
+) const {
+    // Advancing all rows by one level before going deeper keeps many independent
+    // memory accesses in flight, instead of one dependent chain per row.
+    typedef std::integral_constant<bool, IsLessEqualSplitTest<SplitTests>::value> DirectCompare;
+    vigra_assert(rows.size() <= prediction_block_size,
+                 "RandomForest::descend_block(): Too many rows.");
+    FlatNode const * nodes = flat_nodes_.data();
+    size_t const n = rows.size();
+    std::fill(leaves, leaves + n, static_cast<std::ptrdiff_t>(flat_roots_[k]));
+    double split_comparisons = 0.0;
+    size_t active[prediction_block_size];
+    while (true)
+    {
+        size_t num_active = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (nodes[leaves[i]].child_ > 0)
+                active[num_active++] = i;
+        if (num_active == 0)
+            break;
+        descend_level(rows, active, num_active, leaves, DirectCompare());
+        split_comparisons += num_active;
+    }
+    for (size_t i = 0; i < n; ++i)
+        leaves[i] = -nodes[leaves[i]].child_;
+    return split_comparisons;
+}
+
+template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
+template <typename ROW>
+void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::descend_level(
+    std::vector<ROW> const & rows,
+    size_t const * active,
+    size_t num_active,
+    std::ptrdiff_t * leaves,
+    std::false_type
+) const {
+    FlatNode const * nodes = flat_nodes_.data();
+    for (size_t j = 0; j < num_active; ++j)
+    {
+        size_t const i = active[j];
+        FlatNode const & node = nodes[leaves[i]];
+        leaves[i] = node.child_ + node.test_(rows[i]);
+    }
+}
+
+template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
+template <typename ROW>
+void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::descend_level(
+    std::vector<ROW> const & rows,
+    size_t const * active,
+    size_t num_active,
+    std::ptrdiff_t * leaves,
+    std::true_type
+) const {
+    // compare in the type that LessEqualSplitTest::operator() would use
+    typedef typename std::common_type<typename std::decay<decltype(rows[0](0))>::type,
+                                      decltype(std::declval<SplitTests>().val_)>::type Value;
+    FlatNode const * nodes = flat_nodes_.data();
+
+    // gather the feature values, thresholds and children of the current nodes
+    Value values[prediction_block_size], thresholds[prediction_block_size];
+    std::ptrdiff_t children[prediction_block_size];
+    for (size_t j = 0; j < num_active; ++j)
+    {
+        size_t const i = active[j];
+        FlatNode const & node = nodes[leaves[i]];
+        values[j] = rows[i](node.test_.dim_);
+        thresholds[j] = node.test_.val_;
+        children[j] = node.child_;
+    }
+
+    // compare the whole block at once (branch-free, so that the compiler can vectorize it),
+    // the negated comparison sends NaN to the right child as LessEqualSplitTest does
+    for (size_t j = 0; j < num_active; ++j)
+        children[j] += !(values[j] <= thresholds[j]);
+
+    for (size_t j = 0; j < num_active; ++j)
+        leaves[active[j]] = children[j];
+}
+
 template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
 template <typename PROBS>
 void RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::predict_probabilities_impl(
     FEATURES const & features,
     PROBS & probs,
-    const size_t i,
+    size_t from,
+    size_t to,
     const std::vector<size_t> & tree_indices
 ) const {
 
-    // instantiate the accumulation function and the vector to store the tree node results
+    // instantiate the accumulation function
     ACC acc;
+
+    if (is_compiled())
+    {
+        // find the leaves of all instances in all trees
+        size_t const n = to - from;
+        std::vector<decltype(features.template bind<0>(from))> rows;
+        rows.reserve(n);
+        for (size_t i = from; i < to; ++i)
+            rows.push_back(features.template bind<0>(i));
+        std::vector<std::ptrdiff_t> leaves(tree_indices.size()*n);
+        for (size_t j = 0; j < tree_indices.size(); ++j)
+            descend_block(rows, tree_indices[j], &leaves[j*n]);
+
+        // write the tree results into the probabilities (without copying the leaf responses)
+        std::vector<std::reference_wrapper<AccInputType const> > tree_results;
+        tree_results.reserve(tree_indices.size());
+        for (size_t i = 0; i < n; ++i)
+        {
+            tree_results.clear();
+            for (size_t j = 0; j < tree_indices.size(); ++j)
+                tree_results.push_back(std::cref(flat_responses_[leaves[j*n + i]]));
+            auto sub_probs = probs.template bind<0>(from + i);
+            acc(tree_results.begin(), tree_results.end(), sub_probs.begin());
+        }
+        return;
+    }
+
     std::vector<AccInputType> tree_results;
     tree_results.reserve(tree_indices.size());
-    auto const sub_features = features.template bind<0>(i);
-    
-    // loop over the trees
-    for (auto k : tree_indices)
+    for (size_t i = from; i < to; ++i)
     {
-        Node node = graph_.getRoot(k);
-        while (graph_.outDegree(node) > 0)
+        auto const sub_features = features.template bind<0>(i);
+
+        // loop over the trees
+        tree_results.clear();
+        for (auto k : tree_indices)
         {
-            size_t const child_index = split_tests_.at(node)(sub_features);
-            node = graph_.getChild(node, child_index);
+            Node node = graph_.getRoot(k);
+            while (graph_.outDegree(node) > 0)
+            {
+                size_t const child_index = split_tests_.at(node)(sub_features);
+                node = graph_.getChild(node, child_index);
+            }
+            tree_results.emplace_back(node_responses_.at(node));
         }
-        tree_results.emplace_back(node_responses_.at(node));
-    }
 
-    // write the tree results into the probabilities
-    auto sub_probs = probs.template bind<0>(i);
-    acc(tree_results.begin(), tree_results.end(), sub_probs.begin());    
+        // write the tree results into the probabilities
+        auto sub_probs = probs.template bind<0>(i);
+        acc(tree_results.begin(), tree_results.end(), sub_probs.begin());
+    }
 }
 
 template <typename FEATURES, typename LABELS, typename SPLITTESTS, typename ACC>
@@ -382,15 +624,15 @@ double RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::leaf_ids(
     if (n_threads < 1)
         n_threads = 1;
     std::vector<double> split_comparisons(n_threads, 0.0);
-    std::vector<size_t> indices(num_instances);
-    std::iota(indices.begin(), indices.end(), 0);
+    size_t const num_blocks = (num_instances + prediction_block_size - 1) / prediction_block_size;
     std::fill(ids.begin(), ids.end(), -1);
     parallel_foreach(
         n_threads,
-        indices.begin(),
-        indices.end(),
-        [this, &features, &ids, &split_comparisons, &tree_indices](size_t thread_id, size_t i) {
-            split_comparisons[thread_id] += this->leaf_ids_impl(features, ids, i, i+1, tree_indices);
+        num_blocks,
+        [this, &features, &ids, &split_comparisons, &tree_indices, num_instances](size_t thread_id, size_t b) {
+            size_t const from = b*prediction_block_size;
+            size_t const to = std::min<size_t>(from + prediction_block_size, num_instances);
+            split_comparisons[thread_id] += this->leaf_ids_impl(features, ids, from, to, tree_indices);
         }
     );
 
@@ -417,6 +659,25 @@ double RandomForest<FEATURES, LABELS, SPLITTESTS, ACC>::leaf_ids_impl(
                        "RandomForest::leaf_ids_impl(): Leaf array has wrong shape.");
 
     double split_comparisons = 0.0;
+    if (is_compiled())
+    {
+        std::vector<decltype(features.template bind<0>(from))> rows;
+        std::vector<std::ptrdiff_t> leaves(prediction_block_size);
+        for (size_t block = from; block < to; block += prediction_block_size)
+        {
+            size_t const block_end = std::min<size_t>(block + prediction_block_size, to);
+            rows.clear();
+            for (size_t i = block; i < block_end; ++i)
+                rows.push_back(features.template bind<0>(i));
+            for (auto k : tree_indices)
+            {
+                split_comparisons += descend_block(rows, k, leaves.data());
+                for (size_t i = block; i < block_end; ++i)
+                    ids(i, k) = flat_leaf_ids_[leaves[i - block]];
+            }
+        }
+        return split_comparisons;
+    }
     for (size_t i = from; i < to; ++i)
     {
         auto const sub_features = features.template bind<0>(i);
@@ -73,6 +73,16 @@ public:
     T val_;
 };
 
+/// \brief Tells whether SPLITTESTS is a LessEqualSplitTest, so that the compiled
+///        prediction can compare feature values and thresholds directly.
+template <typename SPLITTESTS>
+struct IsLessEqualSplitTest : public std::false_type
+{};
+
+template <typename T>
+struct IsLessEqualSplitTest<LessEqualSplitTest<T> > : public std::true_type
+{};
+
 
 
 struct ArgMaxAcc
@@ -276,6 +286,61 @@ namespace detail
             }
         }
 
+        /// Evaluate the splits between the bins of the class histogram of dimension dim
+        /// (binned training). The bins are stored consecutively, each holding the weighted
+        /// counts of all classes, and thresholds[b] separates bin b from bin b+1.
+        template <typename ITER, typename THRESHOLDS>
+        void binned(
+            ITER hist,
+            size_t num_bins,
+            THRESHOLDS const & thresholds,
+            size_t dim
+        ){
+            double const eps = 1e-10;
+            size_t const num_classes = priors_.size();
+
+            // The last non-empty bin must go to the right.
+            size_t last = num_bins;
+            while (last > 0)
+            {
+                ITER bin = hist + (last-1)*num_classes;
+                if (std::accumulate(bin, bin + num_classes, 0.0) > eps)
+                    break;
+                --last;
+            }
+
+            Functor score;
+
+            std::vector<double> counts(num_classes, 0.0);
+            double n_left = 0;
+            for (size_t b = 0; b + 1 < last; ++b)
+            {
+                // Move the bin from the right side to the left side.
+                double bin_total = 0.0;
+                for (size_t c = 0; c < num_classes; ++c)
+                {
+                    double const v = hist[b*num_classes + c];
+                    counts[c] += v;
+                    bin_total += v;
+                }
+
+                // Skip if there is no new split.
+                if (bin_total <= eps)
+                    continue;
+                n_left += bin_total;
+
+                // Update the score.
+                split_found_ = true;
+                double const s = score(priors_, counts, n_total_, n_left);
+                if (s < best_score_)
+                {
+                    best_score_ = s;
+                    best_split_ = thresholds[b];
+                    best_dim_ = dim;
+                }
+            }
+        }
+
         bool split_found_; // whether a split was found at all
         double best_split_; // the threshold of the best split
         size_t best_dim_; // the dimension of the best split
@@ -596,7 +661,8 @@ public:
         min_num_instances_(1),
         use_stratification_(false),
         n_threads_(-1),
-        class_weights_()
+        class_weights_(),
+        histogram_bins_(0)
     {}
 
     /**
@@ -762,6 +828,27 @@ public:
         return *this;
     }
 
+    /**
+     * @brief Search the splits on per-node class histograms of quantized features.
+     * @details
+     * If \a n is non-zero, each feature is quantized once into at most \a n bins of
+     * roughly equal population before training. The split search in a node then
+     * only considers the boundaries between these bins and works on class histograms
+     * instead of sorting the feature values. The histograms of the larger child are
+     * computed by subtracting the smaller child from the parent. This is much faster for
+     * large training sets, at the price of coarser thresholds. In this mode, resample_count
+     * is ignored.
+     *
+     * Default: \a n = 0 (sort the feature values in every node and consider all splits)
+     */
+    RandomForestOptions & histogram_bins(size_t n)
+    {
+        vigra_precondition(n == 0 || (n >= 2 && n <= 256),
+                           "RandomForestOptions::histogram_bins(): Number of bins must be 0 or in [2, 256].");
+        histogram_bins_ = n;
+        return *this;
+    }
+
     /**
      * @brief Get the actual number of features per node.
      *
@@ -795,6 +882,7 @@ public:
     bool use_stratification_;
     int n_threads_;
     std::vector<double> class_weights_;
+    size_t histogram_bins_;
 
 };
 
@@ -0,0 +1,750 @@
+/************************************************************************/
+/*                                                                      */
+/*               Copyright 2026 by the VIGRA developers                 */
+/*                                                                      */
+/*    This file is part of the VIGRA computer vision library.           */
+/*    The VIGRA Website is                                              */
+/*        http://hci.iwr.uni-heidelberg.de/vigra/                       */
+/*    Please direct questions, bug reports, and contributions to        */
+/*        ullrich.koethe@iwr.uni-heidelberg.de    or                    */
+/*        vigra@informatik.uni-hamburg.de                               */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/*                                                                      */
+/************************************************************************/
+
+
+#ifndef VIGRA_RF3_IMPEX_BINARY_HXX
+#define VIGRA_RF3_IMPEX_BINARY_HXX
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+#include "config.hxx"
+#include "sized_int.hxx"
+#include "numerictraits.hxx"
+#include "multi_array.hxx"
+#include "threadpool.hxx"
+#include "random_forest_3/random_forest.hxx"
+
+#ifdef _WIN32
+# error "random_forest_3_binary_impex.hxx: MappedRandomForest is currently only available on POSIX systems."
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+namespace vigra
+{
+namespace rf3
+{
+
+namespace detail
+{
+
+/// Convert a float to IEEE 754 half precision (round to nearest even).
+inline UInt16 rf_float_to_half(float value)
+{
+    UInt32 f;
+    std::memcpy(&f, &value, sizeof(f));
+    UInt32 const sign = (f >> 16) & 0x8000;
+    UInt32 const a = f & 0x7fffffff;
+    if (a >= 0x7f800000) // inf and nan
+        return static_cast<UInt16>(sign | 0x7c00 | (a > 0x7f800000 ? 0x200 : 0));
+    if (a >= 0x477ff000) // rounds to inf
+        return static_cast<UInt16>(sign | 0x7c00);
+    if (a < 0x38800000) // subnormal half
+    {
+        if (a < 0x33000000)
+            return static_cast<UInt16>(sign);
+        UInt32 const mantissa = (a & 0x7fffff) | 0x800000;
+        UInt32 const shift = 126 - (a >> 23);
+        UInt32 h = mantissa >> shift;
+        UInt32 const rest = mantissa & ((1u << shift) - 1);
+        UInt32 const halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1)))
+            ++h;
+        return static_cast<UInt16>(sign | h);
+    }
+    UInt32 h = (a - 0x38000000) >> 13;
+    UInt32 const rest = a & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        ++h;
+    return static_cast<UInt16>(sign | h);
+}
+
+/// Convert an IEEE 754 half precision value to float.
+inline float rf_half_to_float(UInt16 h)
+{
+    UInt32 const sign = static_cast<UInt32>(h & 0x8000) << 16;
+    UInt32 const exponent = (h >> 10) & 0x1f;
+    UInt32 const mantissa = h & 0x3ff;
+    UInt32 f;
+    if (exponent == 0)
+    {
+        float const v = mantissa * (1.0f / 16777216.0f);
+        return sign ? -v : v;
+    }
+    else if (exponent == 31)
+        f = sign | 0x7f800000 | (mantissa << 13);
+    else
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float value;
+    std::memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+/// The thresholds of a mapped forest, stored with the feature type.
+template <typename T>
+struct RFPlainThresholds
+{
+    T operator()(size_t i) const
+    {
+        return data_[i];
+    }
+
+    T const * data_;
+};
+
+/// The thresholds of a mapped forest, stored in half precision.
+struct RFHalfThresholds
+{
+    float operator()(size_t i) const
+    {
+        return rf_half_to_float(data_[i]);
+    }
+
+    UInt16 const * data_;
+};
+
+// File layout of the binary random forest format:
+//  * the fixed header fields below,
+//  * the sections listed in 'offsets', each starting at a multiple of 'alignment':
+//     - the index of each tree's root node (Int64, one per tree),
+//     - the split dimension of each node (UInt32, one per node),
+//     - the split threshold of each node (feature type or half, one per node),
+//     - the child index of each node (Int64, one per node), which is the index of the
+//       left child (the right child follows it) for internal nodes and minus the leaf
+//       index for leaves,
+//     - the class scores of each leaf (double, num_classes per leaf),
+//     - the class labels (label type, one per class).
+// The nodes of each tree are stored in breadth-first order.
+struct RFBinaryHeader
+{
+    enum { version = 1, byteOrderMark = 0x01020304, alignment = 64, num_sections = 6 };
+    enum Section { Roots, Dims, Thresholds, Children, Responses, Labels };
+    enum Flags { HalfThresholds = 1 };
+
+    RFBinaryHeader()
+    :   flags(0), threshold_size(0), feature_size(0), feature_flags(0), label_size(0), label_flags(0),
+        num_features(0), num_classes(0), num_trees(0), num_nodes(0), num_leaves(0), file_size(0)
+    {
+        std::fill(offsets, offsets + num_sections, 0);
+    }
+
+    template <class T>
+    static UInt32 typeFlags()
+    {
+        return (NumericTraits<T>::isIntegral::value ? 1 : 0) |
+               (NumericTraits<T>::isSigned::value ? 2 : 0);
+    }
+
+    static std::size_t fixedSize()
+    {
+        return 8 + 8*sizeof(UInt32) + (6 + num_sections)*sizeof(UInt64);
+    }
+
+    static std::size_t alignUp(std::size_t size)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // Compute the section offsets and the file size from the section sizes.
+    void layout(std::size_t const * sizes)
+    {
+        std::size_t offset = alignUp(fixedSize());
+        for (int k = 0; k < num_sections; ++k)
+        {
+            offsets[k] = offset;
+            offset = alignUp(offset + sizes[k]);
+        }
+        file_size = offset;
+    }
+
+    // Check that each section is aligned and lies within the file.
+    void checkLayout() const
+    {
+        UInt64 const num_elements[num_sections] = {
+            num_trees, num_nodes, num_nodes, num_nodes, num_leaves, num_classes };
+        UInt64 const element_sizes[num_sections] = {
+            sizeof(Int64), sizeof(UInt32), threshold_size, sizeof(Int64), num_classes*sizeof(double), label_size };
+        vigra_precondition(num_classes <= file_size / sizeof(double),
+            "MappedRandomForest(): invalid number of classes.");
+        for (int k = 0; k < num_sections; ++k)
+        {
+            vigra_precondition(offsets[k] % alignment == 0,
+                "MappedRandomForest(): misaligned section.");
+            vigra_precondition(offsets[k] >= fixedSize() && offsets[k] <= file_size &&
+                               (element_sizes[k] == 0 ||
+                                num_elements[k] <= (file_size - offsets[k]) / element_sizes[k]),
+                "MappedRandomForest(): section exceeds the file size.");
+        }
+    }
+
+    void write(char * p) const
+    {
+        std::memcpy(p, magic(), 8);
+        p += 8;
+        writeField(p, UInt32(version));
+        writeField(p, UInt32(byteOrderMark));
+        writeField(p, flags);
+        writeField(p, threshold_size);
+        writeField(p, feature_size);
+        writeField(p, feature_flags);
+        writeField(p, label_size);
+        writeField(p, label_flags);
+        writeField(p, num_features);
+        writeField(p, num_classes);
+        writeField(p, num_trees);
+        writeField(p, num_nodes);
+        writeField(p, num_leaves);
+        writeField(p, file_size);
+        for (int k = 0; k < num_sections; ++k)
+            writeField(p, offsets[k]);
+    }
+
+    void read(char const * p)
+    {
+        vigra_precondition(std::memcmp(p, magic(), 8) == 0,
+            "MappedRandomForest(): file is not a binary random forest file.");
+        p += 8;
+        UInt32 v, bom;
+        readField(p, v);
+        readField(p, bom);
+        vigra_precondition(v == version,
+            "MappedRandomForest(): unsupported file version.");
+        vigra_precondition(bom == byteOrderMark,
+            "MappedRandomForest(): file was written with a different byte order.");
+        readField(p, flags);
+        readField(p, threshold_size);
+        readField(p, feature_size);
+        readField(p, feature_flags);
+        readField(p, label_size);
+        readField(p, label_flags);
+        readField(p, num_features);
+        readField(p, num_classes);
+        readField(p, num_trees);
+        readField(p, num_nodes);
+        readField(p, num_leaves);
+        readField(p, file_size);
+        for (int k = 0; k < num_sections; ++k)
+            readField(p, offsets[k]);
+    }
+
+    static char const * magic()
+    {
+        return "VIGRARF3";
+    }
+
+    template <class V>
+    static void writeField(char * & p, V v)
+    {
+        std::memcpy(p, &v, sizeof(V));
+        p += sizeof(V);
+    }
+
+    template <class V>
+    static void readField(char const * & p, V & v)
+    {
+        std::memcpy(&v, p, sizeof(V));
+        p += sizeof(V);
+    }
+
+    UInt32 flags, threshold_size, feature_size, feature_flags, label_size, label_flags;
+    UInt64 num_features, num_classes, num_trees, num_nodes, num_leaves, file_size;
+    UInt64 offsets[num_sections];
+};
+
+} // namespace detail
+
+/** \brief Write a random forest to a file in the binary format of \ref vigra::rf3::MappedRandomForest.
+
+    All nodes of the forest are written into a few contiguous arrays, so that the file can
+    be mapped into memory and used without any parsing. Each leaf stores the class scores of
+    its tree as computed by the forest's accumulator. If <tt>half_thresholds</tt> is true,
+    the split thresholds are rounded to half precision, which shrinks the node arrays by up to
+    a third, but may change the predictions of instances close to a threshold. This requires
+    a floating-point feature type. The split tests must be \ref vigra::rf3::LessEqualSplitTest.
+
+    Throws <tt>std::runtime_error</tt> if the file cannot be written.
+*/
+template <typename RF>
+void random_forest_export_binary(
+        RF const & rf,
+        std::string const & filename,
+        bool half_thresholds = false
+){
+    typedef typename RF::FeatureType FeatureType;
+    typedef typename RF::LabelType LabelType;
+    typedef typename RF::Node Node;
+    typedef detail::RFBinaryHeader Header;
+
+    static_assert(std::is_same<typename RF::SplitTests, LessEqualSplitTest<FeatureType> >::value,
+                  "random_forest_export_binary(): Only LessEqualSplitTest is supported.");
+    vigra_precondition(!half_thresholds || !NumericTraits<FeatureType>::isIntegral::value,
+                       "random_forest_export_binary(): Half precision thresholds require a floating-point feature type.");
+
+    auto const & spec = rf.problem_spec_;
+    auto const & graph = rf.graph_;
+    size_t const num_classes = spec.num_classes_;
+
+    // Lay out the trees in breadth-first order (as in RandomForest::compile()).
+    std::vector<Int64> roots, children;
+    std::vector<UInt32> dims;
+    std::vector<FeatureType> thresholds;
+    std::vector<UInt16> half;
+    std::vector<double> responses;
+    std::vector<Node> queue;
+    std::vector<double> scores;
+    typename RF::ACC acc;
+    for (size_t k = 0; k < graph.numRoots(); ++k)
+    {
+        size_t const first = children.size();
+        roots.push_back(first);
+        queue.clear();
+        queue.push_back(graph.getRoot(k));
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            Node const node = queue[i];
+            size_t const degree = graph.outDegree(node);
+            if (degree > 0)
+            {
+                vigra_precondition(degree == 2,
+                                   "random_forest_export_binary(): Only binary trees are supported.");
+                auto const & test = rf.split_tests_.at(node);
+                dims.push_back(static_cast<UInt32>(test.dim_));
+                thresholds.push_back(test.val_);
+                children.push_back(first + queue.size());
+                for (size_t c = 0; c < degree; ++c)
+                    queue.push_back(graph.getChild(node, c));
+            }
+            else
+            {
+                dims.push_back(0);
+                thresholds.push_back(FeatureType());
+                children.push_back(-static_cast<Int64>(responses.size() / num_classes));
+
+                // The scores of a single tree, padded to the number of classes.
+                scores.assign(num_classes, 0.0);
+                auto const & response = rf.node_responses_.at(node);
+                acc(&response, &response + 1, scores.begin());
+                responses.insert(responses.end(), scores.begin(), scores.end());
+            }
+        }
+    }
+
+    Header header;
+    header.flags = half_thresholds ? Header::HalfThresholds : 0;
+    header.threshold_size = half_thresholds ? sizeof(UInt16) : sizeof(FeatureType);
+    header.feature_size = sizeof(FeatureType);
+    header.feature_flags = Header::typeFlags<FeatureType>();
+    header.label_size = sizeof(LabelType);
+    header.label_flags = Header::typeFlags<LabelType>();
+    header.num_features = spec.num_features_;
+    header.num_classes = num_classes;
+    header.num_trees = roots.size();
+    header.num_nodes = children.size();
+    header.num_leaves = responses.size() / num_classes;
+
+    char const * thresholds_data = reinterpret_cast<char const *>(thresholds.data());
+    if (half_thresholds)
+    {
+        for (auto t : thresholds)
+            half.push_back(detail::rf_float_to_half(static_cast<float>(t)));
+        thresholds_data = reinterpret_cast<char const *>(half.data());
+    }
+    char const * const data[Header::num_sections] = {
+        reinterpret_cast<char const *>(roots.data()),
+        reinterpret_cast<char const *>(dims.data()),
+        thresholds_data,
+        reinterpret_cast<char const *>(children.data()),
+        reinterpret_cast<char const *>(responses.data()),
+        reinterpret_cast<char const *>(spec.distinct_classes_.data())
+    };
+    std::size_t const sizes[Header::num_sections] = {
+        roots.size()*sizeof(Int64),
+        dims.size()*sizeof(UInt32),
+        children.size()*header.threshold_size,
+        children.size()*sizeof(Int64),
+        responses.size()*sizeof(double),
+        num_classes*sizeof(LabelType)
+    };
+    header.layout(sizes);
+
+    std::vector<char> buffer(header.file_size, 0);
+    header.write(buffer.data());
+    for (int k = 0; k < Header::num_sections; ++k)
+        if (sizes[k] > 0)
+            std::memcpy(&buffer[header.offsets[k]], data[k], sizes[k]);
+
+    std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    if (!file)
+        throw std::runtime_error("random_forest_export_binary(): unable to write file '" + filename + "'.");
+}
+
+/** \brief A random forest that is mapped read-only from a file in the binary format.
+
+    <b>\#include</b> \<vigra/random_forest_3_binary_impex.hxx\><br>
+    Namespace: vigra::rf3
+
+    The file is written by \ref vigra::rf3::random_forest_export_binary(). It is mapped into
+    memory via <tt>mmap()</tt>, and prediction works directly on the mapped node arrays, so
+    that opening a forest needs no parsing, and all processes that open the same file share
+    a single copy of the model in the OS page cache. The constructor only checks the header
+    and the node indices once, so that a corrupt file cannot cause reads outside the mapping.
+    The forest only supports prediction. The class scores are the sums of the leaf scores
+    of all trees, which are the probabilities of the original forest for the default
+    accumulator \ref vigra::rf3::ArgMaxVectorAcc and proportional to them for
+    \ref vigra::rf3::ArgMaxAcc.
+
+    Currently, this class is only available on POSIX systems.
+
+    <b>Usage:</b>
+
+    \code
+    auto rf = random_forest(train_features, train_labels);
+    rf3::random_forest_export_binary(rf, "forest.vrf");
+
+    // e.g. in another process
+    rf3::MappedRandomForest<MultiArray<2, float>, MultiArray<1, UInt32> > mapped("forest.vrf");
+    mapped.predict(test_features, test_labels);
+    \endcode
+*/
+template <typename FEATURES, typename LABELS>
+class MappedRandomForest
+{
+public:
+
+    typedef FEATURES Features;
+    typedef typename Features::value_type FeatureType;
+    typedef LABELS Labels;
+    typedef typename Labels::value_type LabelType;
+
+    /// \brief Map the forest in the given file.
+    /// \note Throws std::runtime_error if the file cannot be opened and a PreconditionViolation
+    ///       if it is not a valid forest file for the feature and label types.
+    explicit MappedRandomForest(std::string const & filename);
+
+    ~MappedRandomForest()
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+
+    MappedRandomForest(MappedRandomForest const &) = delete;
+    MappedRandomForest & operator=(MappedRandomForest const &) = delete;
+
+    /// \brief Predict the given data.
+    /// \note labels must be a 1-D array with size <tt>features.shape(0)</tt>.
+    void predict(
+        FEATURES const & features,
+        LABELS & labels,
+        int n_threads = -1
+    ) const;
+
+    /// \brief Predict the class scores of the given data.
+    /// \note probs should have the shape (features.shape()[0], num_classes).
+    template <typename PROBS>
+    void predict_probabilities(
+        FEATURES const & features,
+        PROBS & probs,
+        int n_threads = -1
+    ) const;
+
+    /// \brief Return the number of nodes.
+    size_t num_nodes() const
+    {
+        return header_.num_nodes;
+    }
+
+    /// \brief Return the number of trees.
+    size_t num_trees() const
+    {
+        return header_.num_trees;
+    }
+
+    /// \brief Return the number of classes.
+    size_t num_classes() const
+    {
+        return header_.num_classes;
+    }
+
+    /// \brief Return the number of features.
+    size_t num_features() const
+    {
+        return header_.num_features;
+    }
+
+    /// \brief Return whether the thresholds are stored in half precision.
+    bool half_thresholds() const
+    {
+        return (header_.flags & detail::RFBinaryHeader::HalfThresholds) != 0;
+    }
+
+    /// \brief Return the class label of class k.
+    LabelType class_label(size_t k) const
+    {
+        return labels_[k];
+    }
+
+private:
+
+    /// \brief The number of instances that are moved through a tree together during prediction.
+    enum { prediction_block_size = 64 };
+
+    /// \brief Move the given rows through tree k in lock step, one level at a time,
+    ///        and store the leaf index that each row reaches in leaves.
+    template <typename ROW, typename THRESHOLDS>
+    void descend_block(
+        std::vector<ROW> const & rows,
+        size_t k,
+        THRESHOLDS const & thresholds,
+        std::ptrdiff_t * leaves
+    ) const;
+
+    /// \brief Add the scores of all trees to the probabilities of the instances in [from, to).
+    template <typename PROBS, typename THRESHOLDS>
+    void predict_probabilities_impl(
+        FEATURES const & features,
+        PROBS & probs,
+        size_t from,
+        size_t to,
+        THRESHOLDS const & thresholds
+    ) const;
+
+    char const * data_;
+    size_t size_;
+    detail::RFBinaryHeader header_;
+    Int64 const * roots_;
+    UInt32 const * dims_;
+    void const * thresholds_;
+    Int64 const * children_;
+    double const * responses_;
+    LabelType const * labels_;
+};
+
+template <typename FEATURES, typename LABELS>
+MappedRandomForest<FEATURES, LABELS>::MappedRandomForest(std::string const & filename)
+{
+    typedef detail::RFBinaryHeader Header;
+
+    int file = ::open(filename.c_str(), O_RDONLY);
+    if (file == -1)
+        throw std::runtime_error("MappedRandomForest(): unable to open file '" + filename + "'.");
+    struct stat info;
+    if (fstat(file, &info) != 0 || (size_t)info.st_size < Header::fixedSize())
+    {
+        ::close(file);
+        throw std::runtime_error("MappedRandomForest(): unable to read file '" + filename + "'.");
+    }
+    size_ = info.st_size;
+    void * p = mmap(0, size_, PROT_READ, MAP_SHARED, file, 0);
+    ::close(file); // the mapping stays valid
+    if (p == MAP_FAILED)
+        throw std::runtime_error("MappedRandomForest(): mmap() failed.");
+    // the whole model is needed for prediction => start reading it now
+    madvise(p, size_, MADV_WILLNEED);
+    data_ = static_cast<char const *>(p);
+
+    try
+    {
+        header_.read(data_);
+        vigra_precondition(header_.file_size <= size_,
+            "MappedRandomForest(): file is truncated.");
+        vigra_precondition(header_.feature_size == sizeof(FeatureType) &&
+                           header_.feature_flags == Header::typeFlags<FeatureType>(),
+            "MappedRandomForest(): file was written for a different feature type.");
+        vigra_precondition(header_.label_size == sizeof(LabelType) &&
+                           header_.label_flags == Header::typeFlags<LabelType>(),
+            "MappedRandomForest(): file was written for a different label type.");
+        vigra_precondition(header_.threshold_size == (half_thresholds() ? sizeof(UInt16) : sizeof(FeatureType)),
+            "MappedRandomForest(): inconsistent threshold type.");
+        vigra_precondition(header_.num_classes > 0 && header_.num_trees > 0,
+            "MappedRandomForest(): the forest is empty.");
+        header_.checkLayout();
+
+        roots_ = reinterpret_cast<Int64 const *>(data_ + header_.offsets[Header::Roots]);
+        dims_ = reinterpret_cast<UInt32 const *>(data_ + header_.offsets[Header::Dims]);
+        thresholds_ = data_ + header_.offsets[Header::Thresholds];
+        children_ = reinterpret_cast<Int64 const *>(data_ + header_.offsets[Header::Children]);
+        responses_ = reinterpret_cast<double const *>(data_ + header_.offsets[Header::Responses]);
+        labels_ = reinterpret_cast<LabelType const *>(data_ + header_.offsets[Header::Labels]);
+
+        // Check the node indices once, so that prediction needs no checks. The children
+        // of a node follow it, so that every descent ends in a leaf.
+        Int64 const num_nodes = header_.num_nodes;
+        Int64 const num_leaves = header_.num_leaves;
+        for (size_t k = 0; k < header_.num_trees; ++k)
+            vigra_precondition(roots_[k] >= 0 && roots_[k] < num_nodes,
+                "MappedRandomForest(): invalid root index.");
+        for (Int64 node = 0; node < num_nodes; ++node)
+        {
+            Int64 const child = children_[node];
+            if (child > 0)
+                vigra_precondition(child > node && child < num_nodes - 1 &&
+                                   dims_[node] < header_.num_features,
+                    "MappedRandomForest(): invalid split node.");
+            else
+                vigra_precondition(child > -num_leaves,
+                    "MappedRandomForest(): invalid leaf index.");
+        }
+    }
+    catch (...)
+    {
+        munmap(p, size_);
+        throw;
+    }
+}
+
+template <typename FEATURES, typename LABELS>
+void MappedRandomForest<FEATURES, LABELS>::predict(
+    FEATURES const & features,
+    LABELS & labels,
+    int n_threads
+) const {
+    vigra_precondition(features.shape()[0] == labels.shape()[0],
+                       "MappedRandomForest::predict(): Shape mismatch between features and labels.");
+
+    MultiArray<2, double> probs(Shape2(features.shape()[0], num_classes()));
+    predict_probabilities(features, probs, n_threads);
+    for (size_t i = 0; i < (size_t)features.shape()[0]; ++i)
+    {
+        auto const sub_probs = probs.template bind<0>(i);
+        auto it = std::max_element(sub_probs.begin(), sub_probs.end());
+        labels(i) = labels_[std::distance(sub_probs.begin(), it)];
+    }
+}
+
+template <typename FEATURES, typename LABELS>
+template <typename PROBS>
+void MappedRandomForest<FEATURES, LABELS>::predict_probabilities(
+    FEATURES const & features,
+    PROBS & probs,
+    int n_threads
+) const {
+    vigra_precondition(features.shape()[0] == probs.shape()[0],
+                       "MappedRandomForest::predict_probabilities(): Shape mismatch between features and probabilities.");
+    vigra_precondition((size_t)features.shape()[1] == num_features(),
+                       "MappedRandomForest::predict_probabilities(): Number of features in prediction differs from training.");
+    vigra_precondition((size_t)probs.shape()[1] == num_classes(),
+                       "MappedRandomForest::predict_probabilities(): Number of labels in probabilities differs from training.");
+
+    size_t const num_instances = features.shape()[0];
+    size_t const num_blocks = (num_instances + prediction_block_size - 1) / prediction_block_size;
+    detail::RFPlainThresholds<FeatureType> const plain = { static_cast<FeatureType const *>(thresholds_) };
+    detail::RFHalfThresholds const half = { static_cast<UInt16 const *>(thresholds_) };
+    bool const use_half = half_thresholds();
+    parallel_foreach(
+        n_threads,
+        num_blocks,
+        [&](size_t, size_t b) {
+            size_t const from = b*prediction_block_size;
+            size_t const to = std::min<size_t>(from + prediction_block_size, num_instances);
+            if (use_half)
+                this->predict_probabilities_impl(features, probs, from, to, half);
+            else
+                this->predict_probabilities_impl(features, probs, from, to, plain);
+        }
+    );
+}
+
+template <typename FEATURES, typename LABELS>
+template <typename ROW, typename THRESHOLDS>
+void MappedRandomForest<FEATURES, LABELS>::descend_block(
+    std::vector<ROW> const & rows,
+    size_t k,
+    THRESHOLDS const & thresholds,
+    std::ptrdiff_t * leaves
+) const {
+    size_t const n = rows.size();
+    std::fill(leaves, leaves + n, static_cast<std::ptrdiff_t>(roots_[k]));
+    for (bool active = true; active; )
+    {
+        active = false;
+        for (size_t i = 0; i < n; ++i)
+        {
+            std::ptrdiff_t const node = leaves[i];
+            Int64 const child = children_[node];
+            if (child > 0)
+            {
+                leaves[i] = child + (rows[i](dims_[node]) <= thresholds(node) ? 0 : 1);
+                active = true;
+            }
+        }
+    }
+    for (size_t i = 0; i < n; ++i)
+        leaves[i] = -children_[leaves[i]];
+}
+
+template <typename FEATURES, typename LABELS>
+template <typename PROBS, typename THRESHOLDS>
+void MappedRandomForest<FEATURES, LABELS>::predict_probabilities_impl(
+    FEATURES const & features,
+    PROBS & probs,
+    size_t from,
+    size_t to,
+    THRESHOLDS const & thresholds
+) const {
+    size_t const n = to - from;
+    size_t const num_classes = header_.num_classes;
+    std::vector<decltype(features.template bind<0>(from))> rows;
+    rows.reserve(n);
+    for (size_t i = from; i < to; ++i)
+        rows.push_back(features.template bind<0>(i));
+
+    std::vector<double> sums(n*num_classes, 0.0);
+    std::vector<std::ptrdiff_t> leaves(n);
+    for (size_t k = 0; k < header_.num_trees; ++k)
+    {
+        descend_block(rows, k, thresholds, leaves.data());
+        for (size_t i = 0; i < n; ++i)
+        {
+            double const * scores = responses_ + leaves[i]*num_classes;
+            for (size_t c = 0; c < num_classes; ++c)
+                sums[i*num_classes + c] += scores[c];
+        }
+    }
+    for (size_t i = 0; i < n; ++i)
+        for (size_t c = 0; c < num_classes; ++c)
+            probs(from + i, c) = sums[i*num_classes + c];
+}
+
+} // namespace rf3
+} // namespace vigra
+
+#endif // VIGRA_RF3_IMPEX_BINARY_HXX
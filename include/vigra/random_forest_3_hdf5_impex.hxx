@@ -41,6 +41,7 @@
 #include <sstream>
 #include <iomanip>
 #include <stack>
+#include <queue>
 
 #include "config.hxx"
 #include "random_forest_3/random_forest.hxx"
@@ -37,7 +37,11 @@
 #define VIGRA_THREADPOOL_HXX
 
 #include <vector>
-#include <queue>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 #include "mathutil.hxx"
@@ -139,8 +143,172 @@ class ParallelOptions
 /*                                                      */
 /********************************************************/
 
+class ThreadPool;
+
+namespace detail {
+
+    // A queued task together with the group it belongs to. The group is the
+    // address of the ParallelTaskLatch the task counts down (0 for tasks that
+    // are not part of a parallel region), so that ThreadPool::waitFor() can
+    // pick exactly the tasks it is waiting for.
+struct ThreadPoolTask
+{
+    ThreadPoolTask()
+    :   group(0)
+    {}
+
+    ThreadPoolTask(std::function<void(int)> f, const void * g = 0)
+    :   function(std::move(f)),
+        group(g)
+    {}
+
+    void operator()(int id)
+    {
+        function(id);
+    }
+
+    std::function<void(int)> function;
+    const void * group;
+};
+
+    // Task queue owned by a single worker of a ThreadPool. The owner pushes
+    // and pops at the back (LIFO order keeps its working set in cache), idle
+    // workers steal from the front. Each queue has its own mutex, so workers
+    // only contend when they actually steal from the same victim.
+class ThreadPoolWorkerQueue
+{
+  public:
+    typedef ThreadPoolTask Task;
+
+    void push(Task && task)
+    {
+        threading::lock_guard<threading::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+
+    bool pop(Task & task)
+    {
+        threading::lock_guard<threading::mutex> lock(mutex_);
+        if(tasks_.empty())
+            return false;
+        task = std::move(tasks_.back());
+        tasks_.pop_back();
+        return true;
+    }
+
+    bool steal(Task & task)
+    {
+        threading::unique_lock<threading::mutex> lock(mutex_, threading::try_to_lock);
+        if(!lock.owns_lock() || tasks_.empty())
+            return false;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+        return true;
+    }
+
+        // remove the most recently pushed task of the given group
+    bool take(const void * group, Task & task)
+    {
+        threading::lock_guard<threading::mutex> lock(mutex_);
+        for(auto i = tasks_.rbegin(); i != tasks_.rend(); ++i)
+        {
+            if(i->group == group)
+            {
+                task = std::move(*i);
+                tasks_.erase(std::next(i).base());
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    threading::mutex mutex_;
+    std::deque<Task> tasks_;
+};
+
+    // Completion state shared by all tasks of a single parallel_foreach() call.
+    // It replaces one future per task: tasks just count down, and the first
+    // exception thrown by any task is stored and rethrown by wait().
+class ParallelTaskLatch
+{
+  public:
+    explicit ParallelTaskLatch(std::ptrdiff_t count = 0)
+    :   remaining_(count),
+        failed_(0)
+    {}
+
+    void add(std::ptrdiff_t count = 1)
+    {
+        remaining_.fetch_add(count);
+    }
+
+    void countDown()
+    {
+        if(remaining_.fetch_sub(1) == 1)
+        {
+            threading::lock_guard<threading::mutex> lock(mutex_);
+            done_.notify_all();
+        }
+    }
+
+    void fail(std::exception_ptr e)
+    {
+        threading::lock_guard<threading::mutex> lock(mutex_);
+        if(!exception_)
+            exception_ = e;
+        failed_.store(1);
+    }
+
+    bool failed() const
+    {
+        return failed_.load() != 0;
+    }
+
+    bool done() const
+    {
+        return remaining_.load() == 0;
+    }
+
+    void wait()
+    {
+        threading::unique_lock<threading::mutex> lock(mutex_);
+        done_.wait(lock, [this]{ return this->remaining_.load() == 0; });
+        if(exception_)
+            std::rethrow_exception(exception_);
+    }
+
+  private:
+    threading::atomic_long remaining_, failed_;
+    threading::mutex mutex_;
+    threading::condition_variable done_;
+    std::exception_ptr exception_;
+};
+
+    // Identifies the pool and worker index of the calling thread
+    // (pool == 0 if the calling thread is not a pool worker).
+struct ThreadPoolWorkerInfo
+{
+    ThreadPool * pool;
+    int index;
+};
+
+inline ThreadPoolWorkerInfo & threadPoolCurrentWorker()
+{
+    static thread_local ThreadPoolWorkerInfo info = { 0, -1 };
+    return info;
+}
+
+} // namespace detail
+
     /**\brief Thread pool class to manage a set of parallel workers.
 
+        Each worker owns a task queue. Tasks enqueued from within a worker
+        are pushed onto that worker's own queue, tasks from other threads are
+        distributed round-robin. A worker whose queue runs empty steals tasks
+        from the other queues, so that there is no single lock all tasks have
+        to pass through.
+
         <b>\#include</b> \<vigra/threadpool.hxx\><br>
         Namespace: vigra
     */
@@ -196,13 +364,47 @@ class ThreadPool
     template<class F>
     threading::future<void> enqueue(F&& f) ;
 
+    /**
+     * Enqueue a task without creating a future. This avoids the allocation
+     * of a shared state per task, but the caller is responsible for
+     * synchronization, and \arg f must not throw (an exception escaping
+     * \arg f terminates the program). This is the entry point used by
+     * <tt>parallel_foreach()</tt>. \arg group identifies the latch the
+     * task belongs to (see <tt>waitFor()</tt>).
+     */
+    template<class F>
+    void enqueueDetached(F&& f, detail::ParallelTaskLatch * group = 0);
+
+    /**
+     * Block until all tasks counted by \arg latch are finished and rethrow
+     * the first exception raised by any of them.
+     *
+     * If the calling thread is a worker of this pool (i.e. the wait happens
+     * inside a nested parallel region), it does not block, but executes queued
+     * tasks of the same latch until the latch is released ("help while waiting").
+     * Therefore, nested parallel regions run on the same workers without deadlock
+     * and without starting additional threads. Tasks of other groups are never
+     * run from within the wait, so an unrelated (possibly long or blocking)
+     * task cannot delay the caller or be nested inside it.
+     */
+    void waitFor(detail::ParallelTaskLatch & latch);
+
+    /**
+     * Return the pool whose worker is the calling thread, or 0 if the
+     * calling thread does not belong to any ThreadPool.
+     */
+    static ThreadPool * current()
+    {
+        return detail::threadPoolCurrentWorker().pool;
+    }
+
     /**
      * Block until all tasks are finished.
      */
     void waitFinished()
     {
         threading::unique_lock<threading::mutex> lock(queue_mutex);
-        finish_condition.wait(lock, [this](){ return tasks.empty() && (busy == 0); });
+        finish_condition.wait(lock, [this](){ return queued.load() == 0 && busy.load() == 0; });
     }
 
     /**
@@ -215,63 +417,58 @@ class ThreadPool
 
 private:
 
+    typedef detail::ThreadPoolWorkerQueue::Task Task;
+
     // helper function to init the thread pool
     void init(const ParallelOptions & options);
 
+    // main loop of worker 'ti'
+    void work(int ti);
+
+    // put a task into the queue of the current worker or, if called from
+    // outside the pool, into the next queue in round-robin order
+    void push(Task && task);
+
+    // get a task from the queue of worker 'ti' or steal one from another worker
+    bool acquire(int ti, Task & task);
+
+    // get a task of the given group from any queue, starting with worker 'ti'
+    bool acquireFromGroup(int ti, const void * group, Task & task);
+
+    // execute an acquired task on worker 'ti' and update the bookkeeping
+    void run(int ti, Task & task);
+
     // need to keep track of threads so we can join them
     std::vector<threading::thread> workers;
 
-    // the task queue
-    std::queue<std::function<void(int)> > tasks;
+    // one task queue per worker
+    std::vector<std::unique_ptr<detail::ThreadPoolWorkerQueue> > queues;
 
     // synchronization
     threading::mutex queue_mutex;
     threading::condition_variable worker_condition;
     threading::condition_variable finish_condition;
     bool stop;
-    threading::atomic_long busy, processed;
+    threading::atomic_long busy, processed, queued, idle, next_queue;
 };
 
 inline void ThreadPool::init(const ParallelOptions & options)
 {
     busy.store(0);
     processed.store(0);
+    queued.store(0);
+    idle.store(0);
+    next_queue.store(0);
 
     const size_t actualNThreads = options.getNumThreads();
+    for(size_t ti = 0; ti<actualNThreads; ++ti)
+        queues.emplace_back(new detail::ThreadPoolWorkerQueue());
     for(size_t ti = 0; ti<actualNThreads; ++ti)
     {
         workers.emplace_back(
             [ti,this]
             {
-                for(;;)
-                {
-                    std::function<void(int)> task;
-                    {
-                        threading::unique_lock<threading::mutex> lock(this->queue_mutex);
-
-                        // will wait if : stop == false  AND queue is empty
-                        // if stop == true AND queue is empty thread function will return later
-                        //
-                        // so the idea of this wait, is : If where are not in the destructor
-                        // (which sets stop to true, we wait here for new jobs)
-                        this->worker_condition.wait(lock, [this]{ return this->stop || !this->tasks.empty(); });
-                        if(!this->tasks.empty())
-                        {
-                            ++busy;
-                            task = std::move(this->tasks.front());
-                            this->tasks.pop();
-                            lock.unlock();
-                            task(ti);
-                            ++processed;
-                            --busy;
-                            finish_condition.notify_one();
-                        }
-                        else if(stop)
-                        {
-                            return;
-                        }
-                    }
-                }
+                this->work((int)ti);
             }
         );
     }
@@ -288,17 +485,53 @@ inline ThreadPool::~ThreadPool()
         worker.join();
 }
 
-template<class F>
-inline auto
-ThreadPool::enqueueReturning(F&& f) -> threading::future<decltype(f(0))>
+inline void ThreadPool::work(int ti)
 {
-    typedef decltype(f(0)) result_type;
-    typedef threading::packaged_task<result_type(int)> PackageType;
+    detail::ThreadPoolWorkerInfo & me = detail::threadPoolCurrentWorker();
+    me.pool  = this;
+    me.index = ti;
 
-    auto task = std::make_shared<PackageType>(f);
-    auto res = task->get_future();
+    Task task;
+    for(;;)
+    {
+        if(acquire(ti, task))
+        {
+            run(ti, task);
+            continue;
+        }
 
-    if(workers.size()>0){
+        threading::unique_lock<threading::mutex> lock(queue_mutex);
+
+        // will wait if : stop == false  AND no task is queued anywhere
+        // if stop == true AND all queues are empty the thread function returns
+        //
+        // 'idle' is incremented before 'queued' is checked, and push() increments
+        // 'queued' before it checks 'idle', so a wake-up cannot be lost.
+        ++idle;
+        worker_condition.wait(lock, [this]{ return this->stop || this->queued.load() > 0; });
+        --idle;
+        if(stop && queued.load() == 0)
+            return;
+    }
+}
+
+inline void ThreadPool::push(Task && task)
+{
+    detail::ThreadPoolWorkerInfo const & me = detail::threadPoolCurrentWorker();
+    if(me.pool == this)
+    {
+        // fast path: tasks created by a worker go to its own queue without
+        // touching the global mutex
+        ++queued;
+        queues[me.index]->push(std::move(task));
+        if(idle.load() > 0)
+        {
+            threading::lock_guard<threading::mutex> lock(queue_mutex);
+            worker_condition.notify_one();
+        }
+    }
+    else
+    {
         {
             threading::unique_lock<threading::mutex> lock(queue_mutex);
 
@@ -306,15 +539,105 @@ ThreadPool::enqueueReturning(F&& f) -> threading::future<decltype(f(0))>
             if(stop)
                 throw std::runtime_error("enqueue on stopped ThreadPool");
 
-            tasks.emplace(
-                [task](int tid)
-                {
-                    (*task)(std::move(tid));
-                }
-            );
+            ++queued;
+            queues[next_queue.fetch_add(1) % queues.size()]->push(std::move(task));
         }
         worker_condition.notify_one();
     }
+}
+
+inline bool ThreadPool::acquire(int ti, Task & task)
+{
+    const int n = (int)queues.size();
+    bool found = queues[ti]->pop(task);
+    for(int k=1; !found && k<n; ++k)
+        found = queues[(ti + k) % n]->steal(task);
+    if(!found)
+        return false;
+    // increment 'busy' before decrementing 'queued', so that waitFinished()
+    // never sees both counters at zero while a task is still in flight
+    ++busy;
+    --queued;
+    return true;
+}
+
+inline bool ThreadPool::acquireFromGroup(int ti, const void * group, Task & task)
+{
+    const int n = (int)queues.size();
+    bool found = false;
+    for(int k=0; !found && k<n; ++k)
+        found = queues[(ti + k) % n]->take(group, task);
+    if(!found)
+        return false;
+    ++busy;
+    --queued;
+    return true;
+}
+
+inline void ThreadPool::run(int ti, Task & task)
+{
+    task(ti);
+    task = Task();
+    ++processed;
+    --busy;
+    if(busy.load() == 0 && queued.load() == 0)
+    {
+        threading::lock_guard<threading::mutex> lock(queue_mutex);
+        finish_condition.notify_all();
+    }
+}
+
+inline void ThreadPool::waitFor(detail::ParallelTaskLatch & latch)
+{
+    detail::ThreadPoolWorkerInfo const & me = detail::threadPoolCurrentWorker();
+    if(me.pool == this)
+    {
+        Task task;
+        while(!latch.done())
+        {
+            if(acquireFromGroup(me.index, &latch, task))
+                run(me.index, task);
+            else
+                threading::this_thread::yield();
+        }
+    }
+    latch.wait();
+}
+
+    /** \brief Process-wide thread pool shared by all parallel algorithms.
+
+        The pool is created on first use with <tt>ParallelOptions::Auto</tt>
+        threads. <tt>parallel_foreach()</tt> uses it whenever the requested number
+        of threads equals this default, so that repeated parallel calls do not
+        create and join new threads, and nested calls share the same workers.
+
+        <b>\#include</b> \<vigra/threadpool.hxx\><br>
+        Namespace: vigra
+    */
+inline ThreadPool & globalThreadPool()
+{
+    static ThreadPool pool(ParallelOptions::Auto);
+    return pool;
+}
+
+template<class F>
+inline auto
+ThreadPool::enqueueReturning(F&& f) -> threading::future<decltype(f(0))>
+{
+    typedef decltype(f(0)) result_type;
+    typedef threading::packaged_task<result_type(int)> PackageType;
+
+    auto task = std::make_shared<PackageType>(f);
+    auto res = task->get_future();
+
+    if(workers.size()>0){
+        push(Task(
+            [task](int tid)
+            {
+                (*task)(std::move(tid));
+            }
+        ));
+    }
     else{
         (*task)(0);
     }
@@ -343,26 +666,17 @@ ThreadPool::enqueue(F&& f)
 
     auto res = task->get_future();
     if(workers.size()>0){
-        {
-            threading::unique_lock<threading::mutex> lock(queue_mutex);
-
-            // don't allow enqueueing after stopping the pool
-            if(stop)
-                throw std::runtime_error("enqueue on stopped ThreadPool");
-
-            tasks.emplace(
-               [task](int tid)
-               {
+        push(Task(
+           [task](int tid)
+           {
 #if defined(USE_BOOST_THREAD) && \
     !defined(BOOST_THREAD_PROVIDES_VARIADIC_THREAD)
-                    (*task)();
+                (*task)();
 #else
-                    (*task)(std::move(tid));
+                (*task)(std::move(tid));
 #endif
-               }
-            );
-        }
-        worker_condition.notify_one();
+           }
+        ));
     }
     else{
 #if defined(USE_BOOST_THREAD) && \
@@ -375,12 +689,78 @@ ThreadPool::enqueue(F&& f)
     return res;
 }
 
+template<class F>
+inline void
+ThreadPool::enqueueDetached(F&& f, detail::ParallelTaskLatch * group)
+{
+    if(workers.size()>0)
+        push(Task(std::forward<F>(f), group));
+    else
+        f(0);
+}
+
 /********************************************************/
 /*                                                      */
 /*                   parallel_foreach                   */
 /*                                                      */
 /********************************************************/
 
+namespace detail {
+
+    // Hands out index ranges of decreasing size (guided self-scheduling):
+    // each request takes a fraction of the remaining work, so that early chunks
+    // are large (little overhead) and late chunks are small (good load balance).
+class ParallelChunkScheduler
+{
+  public:
+    ParallelChunkScheduler(std::ptrdiff_t nItems, std::ptrdiff_t nThreads)
+    :   total_(nItems),
+        nThreads_(std::max<std::ptrdiff_t>(nThreads, 1)),
+        minChunk_(std::max<std::ptrdiff_t>(nItems / (32*nThreads_), 1)),
+        next_(0)
+    {}
+
+    bool next(std::ptrdiff_t & begin, std::ptrdiff_t & end)
+    {
+        long current = next_.load();
+        for(;;)
+        {
+            if(current >= total_)
+                return false;
+            std::ptrdiff_t chunk = std::max<std::ptrdiff_t>((total_ - current) / (2*nThreads_), minChunk_);
+            long stop = (long)std::min<std::ptrdiff_t>(current + chunk, total_);
+            if(next_.compare_exchange_weak(current, stop))
+            {
+                begin = current;
+                end   = stop;
+                return true;
+            }
+        }
+    }
+
+    std::ptrdiff_t maxChunks() const
+    {
+        return (total_ + minChunk_ - 1) / minChunk_;
+    }
+
+  private:
+    std::ptrdiff_t total_, nThreads_, minChunk_;
+    threading::atomic_long next_;
+};
+
+    // State shared by the tasks of a parallel_foreach() over a random access range.
+struct ParallelChunkedTasks
+{
+    ParallelChunkedTasks(std::ptrdiff_t nItems, std::ptrdiff_t nThreads)
+    :   scheduler(nItems, nThreads)
+    {}
+
+    ParallelTaskLatch latch;
+    ParallelChunkScheduler scheduler;
+};
+
+} // namespace detail
+
 // nItems must be either zero or std::distance(iter, end).
 // NOTE: the redundancy of nItems and iter,end here is due to the fact that, for forward iterators,
 // computing the distance from iterators is costly, and, for input iterators, we might not know in advance
@@ -396,29 +776,38 @@ inline void parallel_foreach_impl(
 ){
     std::ptrdiff_t workload = std::distance(iter, end);
     vigra_precondition(workload == nItems || nItems == 0, "parallel_foreach(): Mismatch between num items and begin/end.");
-    const float workPerThread = float(workload)/pool.nThreads();
-    const std::ptrdiff_t chunkedWorkPerThread = std::max<std::ptrdiff_t>(roundi(workPerThread/3.0), 1);
-
-    std::vector<threading::future<void> > futures;
-    for( ;iter<end; iter+=chunkedWorkPerThread)
+    if(workload == 0)
+        return;
+
+    // one task per worker, each task repeatedly grabs the next chunk
+    // until the range is exhausted
+    const std::ptrdiff_t nThreads = pool.nThreads();
+    auto shared = std::make_shared<detail::ParallelChunkedTasks>(workload, nThreads);
+    const std::ptrdiff_t nTasks = std::min(nThreads, shared->scheduler.maxChunks());
+    shared->latch.add(nTasks);
+    for(std::ptrdiff_t k=0; k<nTasks; ++k)
     {
-        const size_t lc = std::min(workload, chunkedWorkPerThread);
-        workload-=lc;
-        futures.emplace_back(
-            pool.enqueue(
-                [&f, iter, lc]
-                (int id)
+        pool.enqueueDetached(
+            [&f, iter, shared]
+            (int id)
+            {
+                try
+                {
+                    std::ptrdiff_t b, e;
+                    while(!shared->latch.failed() && shared->scheduler.next(b, e))
+                        for(; b<e; ++b)
+                            f(id, iter[b]);
+                }
+                catch(...)
                 {
-                    for(size_t i=0; i<lc; ++i)
-                        f(id, iter[i]);
+                    shared->latch.fail(std::current_exception());
                 }
-            )
+                shared->latch.countDown();
+            },
+            &shared->latch
         );
     }
-    for (auto & fut : futures)
-    {
-        fut.get();
-    }
+    pool.waitFor(shared->latch);
 }
 
 
@@ -427,7 +816,7 @@ inline void parallel_foreach_impl(
 template<class ITER, class F>
 inline void parallel_foreach_impl(
     ThreadPool & pool,
-    const std::ptrdiff_t nItems,
+    std::ptrdiff_t nItems,
     ITER iter,
     ITER end,
     F && f,
@@ -435,28 +824,40 @@ inline void parallel_foreach_impl(
 ){
     if (nItems == 0)
         nItems = std::distance(iter, end);
+    if (nItems == 0)
+        return;
 
+    // forward iterators cannot be advanced by an arbitrary amount cheaply,
+    // so the range is split in advance, but all tasks share a single latch
     std::ptrdiff_t workload = nItems;
     const float workPerThread = float(workload)/pool.nThreads();
     const std::ptrdiff_t chunkedWorkPerThread = std::max<std::ptrdiff_t>(roundi(workPerThread/3.0), 1);
 
-    std::vector<threading::future<void> > futures;
+    auto latch = std::make_shared<detail::ParallelTaskLatch>(1);
     for(;;)
     {
         const size_t lc = std::min(chunkedWorkPerThread, workload);
         workload -= lc;
-        futures.emplace_back(
-            pool.enqueue(
-                [&f, iter, lc]
-                (int id)
+        latch->add();
+        pool.enqueueDetached(
+            [&f, iter, lc, latch]
+            (int id)
+            {
+                try
                 {
                     auto iterCopy = iter;
-                    for(size_t i=0; i<lc; ++i){
+                    for(size_t i=0; i<lc && !latch->failed(); ++i){
                         f(id, *iterCopy);
                         ++iterCopy;
                     }
                 }
-            )
+                catch(...)
+                {
+                    latch->fail(std::current_exception());
+                }
+                latch->countDown();
+            },
+            latch.get()
         );
         for (size_t i = 0; i < lc; ++i)
         {
@@ -470,8 +871,8 @@ inline void parallel_foreach_impl(
         if(workload==0)
             break;
     }
-    for (auto & fut : futures)
-        fut.get();
+    latch->countDown();
+    pool.waitFor(*latch);
 }
 
 
@@ -487,22 +888,31 @@ inline void parallel_foreach_impl(
     std::input_iterator_tag
 ){
     std::ptrdiff_t num_items = 0;
-    std::vector<threading::future<void> > futures;
+    auto latch = std::make_shared<detail::ParallelTaskLatch>(1);
     for (; iter != end; ++iter)
     {
         auto item = *iter;
-        futures.emplace_back(
-            pool.enqueue(
-                [&f, &item](int id){
-                    f(id, item);
+        latch->add();
+        pool.enqueueDetached(
+            [&f, item, latch](int id){
+                try
+                {
+                    if(!latch->failed())
+                        f(id, item);
+                }
+                catch(...)
+                {
+                    latch->fail(std::current_exception());
                 }
-            )
+                latch->countDown();
+            },
+            latch.get()
         );
         ++num_items;
     }
+    latch->countDown();
+    pool.waitFor(*latch);
     vigra_postcondition(num_items == nItems || nItems == 0, "parallel_foreach(): Mismatch between num items and begin/end.");
-    for (auto & fut : futures)
-        fut.get();
 }
 
 // Runs foreach on a single thread.
@@ -569,11 +979,25 @@ inline void parallel_foreach_single_thread(
     can provide the optional argument <tt>nItems</tt> to avoid the a
     <tt>std::distance(begin, end)</tt> call to compute the range's length.
 
-    Parameter <tt>nThreads</tt> controls the number of threads. <tt>parallel_foreach</tt>
-    will split the work into about three times as many parallel tasks.
+    Parameter <tt>nThreads</tt> controls the number of threads. For random access
+    iterators, <tt>parallel_foreach</tt> starts one task per thread, and each task
+    repeatedly claims the next chunk of the range, where chunk sizes decrease
+    as the remaining work shrinks (guided scheduling). Other ranges are split
+    into about three times as many parallel tasks as there are threads.
+    No future is created per chunk; the first exception thrown by \arg f is
+    rethrown in the calling thread after all tasks have finished.
     If <tt>nThreads = ParallelOptions::Auto</tt>, the number of threads is set to
     the machine default (<tt>std::thread::hardware_concurrency()</tt>).
 
+    If the requested number of threads equals the default (i.e. <tt>ParallelOptions::Auto</tt>),
+    the work is executed by the shared <tt>globalThreadPool()</tt>, otherwise a temporary
+    pool is created. When <tt>parallel_foreach</tt> is called from inside a task that
+    already runs on a ThreadPool, no new threads are started: the nested region is
+    executed by the workers of the enclosing pool (provided its thread indices fit
+    into <tt>[0, nThreads)</tt>, otherwise sequentially), and the waiting worker executes
+    pending tasks instead of blocking. Thus, nested parallel regions cannot
+    deadlock or oversubscribe the machine.
+
     If <tt>nThreads = 0</tt>, the function will not use threads,
     but will call the functor sequentially. This can also be enforced by setting the
     preprocessor flag <tt>VIGRA_SINGLE_THREADED</tt>, ignoring the value of
@@ -651,9 +1075,31 @@ inline void parallel_foreach(
     F && f,
     const std::ptrdiff_t nItems = 0)
 {
-
-    ThreadPool pool(nThreads);
-    parallel_foreach(pool, begin, end, f, nItems);
+    const size_t actualNThreads = ParallelOptions().numThreads((int)nThreads).getNumThreads();
+    ThreadPool * current = ThreadPool::current();
+    if(current != 0)
+    {
+        // Nested call from a pool worker: never start additional threads.
+        // Run on the worker's own pool if its thread indices fit into the
+        // requested range, and sequentially in the calling thread otherwise.
+        if(actualNThreads > 0 && current->nThreads() <= actualNThreads)
+            parallel_foreach(*current, begin, end, f, nItems);
+        else
+            parallel_foreach_single_thread(begin, end, f, nItems);
+    }
+    else if(actualNThreads <= 1)
+    {
+        parallel_foreach_single_thread(begin, end, f, nItems);
+    }
+    else if(actualNThreads == (size_t)ParallelOptions().getNumThreads())
+    {
+        parallel_foreach(globalThreadPool(), begin, end, f, nItems);
+    }
+    else
+    {
+        ThreadPool pool((int)actualNThreads);
+        parallel_foreach(pool, begin, end, f, nItems);
+    }
 }
 
 template<class F>
@@ -677,6 +1123,353 @@ inline void parallel_foreach(
     parallel_foreach(threadpool, iter, iter.end(), f, nItems);
 }
 
+/********************************************************/
+/*                                                      */
+/*                   parallel_reduce                    */
+/*                                                      */
+/********************************************************/
+
+namespace detail {
+
+    // Thread-local state of parallel_reduce(), padded so that the states
+    // of different threads do not share a cache line. (alignas() would not
+    // be honored by std::vector's allocator before C++17.)
+template <class T>
+struct ParallelReduceState
+{
+    ParallelReduceState(T const & v)
+    :   value(v),
+        padding()
+    {}
+
+    T value;
+    char padding[64];
+};
+
+    // Adapts the user functor of parallel_reduce() to the signature
+    // expected by parallel_foreach().
+template <class T, class F>
+struct ParallelReduceFunctor
+{
+    ParallelReduceFunctor(std::vector<ParallelReduceState<T> > & states, F & f)
+    :   states_(states),
+        f_(f)
+    {}
+
+    template <class ITEM>
+    void operator()(int thread_id, ITEM && item) const
+    {
+        f_(thread_id, states_[thread_id].value, std::forward<ITEM>(item));
+    }
+
+    std::vector<ParallelReduceState<T> > & states_;
+    F & f_;
+};
+
+} // namespace detail
+
+/** \brief Reduce a range in parallel, using thread-local state and a combine step.
+
+    <b> Declarations:</b>
+
+    \code
+    namespace vigra {
+        // pass the desired number of threads or ParallelOptions::Auto
+        template<class ITER, class T, class F, class C>
+        T parallel_reduce(int64_t nThreads,
+                          ITER begin, ITER end,
+                          T const & identity,
+                          F && f, C && combine,
+                          const uint64_t nItems = 0);
+
+        // use an existing thread pool
+        template<class ITER, class T, class F, class C>
+        T parallel_reduce(ThreadPool & pool,
+                          ITER begin, ITER end,
+                          T const & identity,
+                          F && f, C && combine,
+                          const uint64_t nItems = 0);
+
+        // reduce over the integers from 0 ... (nItems-1)
+        template<class T, class F, class C>
+        T parallel_reduce(int64_t nThreads, uint64_t nItems,
+                          T const & identity, F && f, C && combine);
+
+        template<class T, class F, class C>
+        T parallel_reduce(ThreadPool & pool, uint64_t nItems,
+                          T const & identity, F && f, C && combine);
+    }
+    \endcode
+
+    Every thread gets its own copy of \arg identity as local state. The functor
+    \arg f is called as <tt>f(thread_id, state, *iter)</tt> for all items and
+    shall accumulate the item into <tt>state</tt> (of type <tt>T &</tt>). Afterwards,
+    the thread-local states are merged in the order of the thread indices by
+    calls to <tt>combine(result, state)</tt>, where <tt>result</tt> is a <tt>T &</tt>
+    initialized with \arg identity, and <tt>state</tt> a <tt>T const &</tt>.
+    The merged result is returned.
+
+    Since the assignment of items to threads is dynamic, \arg combine should
+    be associative and commutative (up to rounding, if T is a floating-point
+    type). Threading behavior (including nested calls) is the same as in
+    \ref parallel_foreach().
+
+    <b>Usage:</b>
+
+    \code
+    #include <vigra/threadpool.hxx>
+
+    // compute a histogram of 8-bit values
+    std::vector<UInt8> data = ...;
+    std::vector<size_t> histogram =
+        parallel_reduce(ParallelOptions::Auto, data.begin(), data.end(),
+            std::vector<size_t>(256, 0),
+            [](size_t, std::vector<size_t> & h, UInt8 v)
+            {
+                ++h[v];
+            },
+            [](std::vector<size_t> & h, std::vector<size_t> const & other)
+            {
+                for(int k=0; k<256; ++k)
+                    h[k] += other[k];
+            });
+    \endcode
+ */
+doxygen_overloaded_function(template <...> T parallel_reduce)
+
+template<class ITER, class T, class F, class C>
+inline T parallel_reduce(
+    ThreadPool & pool,
+    ITER begin,
+    ITER end,
+    T const & identity,
+    F && f,
+    C && combine,
+    const std::ptrdiff_t nItems = 0)
+{
+    std::vector<detail::ParallelReduceState<T> > states(std::max<size_t>(pool.nThreads(), 1),
+                                                        detail::ParallelReduceState<T>(identity));
+    parallel_foreach(pool, begin, end,
+                     detail::ParallelReduceFunctor<T, F>(states, f), nItems);
+    T result(identity);
+    for(auto const & state: states)
+        combine(result, state.value);
+    return result;
+}
+
+template<class ITER, class T, class F, class C>
+inline T parallel_reduce(
+    int64_t nThreads,
+    ITER begin,
+    ITER end,
+    T const & identity,
+    F && f,
+    C && combine,
+    const std::ptrdiff_t nItems = 0)
+{
+    const size_t actualNThreads = ParallelOptions().numThreads((int)nThreads).getNumThreads();
+    std::vector<detail::ParallelReduceState<T> > states(std::max<size_t>(actualNThreads, 1),
+                                                        detail::ParallelReduceState<T>(identity));
+    parallel_foreach((int64_t)actualNThreads, begin, end,
+                     detail::ParallelReduceFunctor<T, F>(states, f), nItems);
+    T result(identity);
+    for(auto const & state: states)
+        combine(result, state.value);
+    return result;
+}
+
+template<class T, class F, class C>
+inline T parallel_reduce(
+    int64_t nThreads,
+    std::ptrdiff_t nItems,
+    T const & identity,
+    F && f,
+    C && combine)
+{
+    auto iter = range(nItems);
+    return parallel_reduce(nThreads, iter, iter.end(), identity, f, combine, nItems);
+}
+
+template<class T, class F, class C>
+inline T parallel_reduce(
+    ThreadPool & pool,
+    std::ptrdiff_t nItems,
+    T const & identity,
+    F && f,
+    C && combine)
+{
+    auto iter = range(nItems);
+    return parallel_reduce(pool, iter, iter.end(), identity, f, combine, nItems);
+}
+
+/********************************************************/
+/*                                                      */
+/*               parallel_exclusive_scan                */
+/*                                                      */
+/********************************************************/
+
+namespace detail {
+
+template<class ITER, class OUT_ITER, class T, class OP>
+T exclusive_scan_serial(ITER begin, ITER end, OUT_ITER out, T value, OP & op)
+{
+    for(; begin != end; ++begin, ++out)
+    {
+        T next = op(value, *begin);
+        *out = value;
+        value = next;
+    }
+    return value;
+}
+
+template<class ITER, class OUT_ITER, class T, class OP>
+T parallel_exclusive_scan_impl(ThreadPool * pool, std::ptrdiff_t nThreads,
+                               ITER begin, ITER end, OUT_ITER out, T init, OP & op)
+{
+    // below this size per thread, the parallel version does not pay off
+    static const std::ptrdiff_t minBlockSize = 1 << 12;
+
+    const std::ptrdiff_t n = std::distance(begin, end);
+    const std::ptrdiff_t nBlocks = std::min(nThreads, n / minBlockSize);
+    if(nBlocks < 2)
+        return exclusive_scan_serial(begin, end, out, init, op);
+
+    const std::ptrdiff_t blockSize = (n + nBlocks - 1) / nBlocks;
+
+    // pass 1: reduce each block
+    std::vector<T> blockSums(nBlocks, init);
+    auto reduceBlock = [&](int, std::ptrdiff_t k)
+    {
+        ITER b = begin + k*blockSize,
+             e = begin + std::min(n, (k+1)*blockSize);
+        T sum = *b;
+        for(++b; b != e; ++b)
+            sum = op(sum, *b);
+        blockSums[k] = sum;
+    };
+
+    // pass 2: scan each block starting from the total of its predecessors
+    std::vector<T> blockOffsets(nBlocks, init);
+    auto scanBlock = [&](int, std::ptrdiff_t k)
+    {
+        const std::ptrdiff_t b = k*blockSize,
+                             e = std::min(n, (k+1)*blockSize);
+        exclusive_scan_serial(begin + b, begin + e, out + b, blockOffsets[k], op);
+    };
+
+    if(pool)
+        parallel_foreach(*pool, nBlocks, reduceBlock);
+    else
+        parallel_foreach((int64_t)nThreads, nBlocks, reduceBlock);
+
+    for(std::ptrdiff_t k=1; k<nBlocks; ++k)
+        blockOffsets[k] = op(blockOffsets[k-1], blockSums[k-1]);
+
+    if(pool)
+        parallel_foreach(*pool, nBlocks, scanBlock);
+    else
+        parallel_foreach((int64_t)nThreads, nBlocks, scanBlock);
+
+    // 'out' may alias the input, so the total must come from pass 1
+    return op(blockOffsets[nBlocks-1], blockSums[nBlocks-1]);
+}
+
+} // namespace detail
+
+/** \brief Compute an exclusive prefix scan of a range in parallel.
+
+    <b> Declarations:</b>
+
+    \code
+    namespace vigra {
+        // pass the desired number of threads or ParallelOptions::Auto
+        template<class ITER, class OUT_ITER, class T, class OP = std::plus<T> >
+        T parallel_exclusive_scan(int64_t nThreads,
+                                  ITER begin, ITER end, OUT_ITER out,
+                                  T init, OP op = OP());
+
+        // use an existing thread pool
+        template<class ITER, class OUT_ITER, class T, class OP = std::plus<T> >
+        T parallel_exclusive_scan(ThreadPool & pool,
+                                  ITER begin, ITER end, OUT_ITER out,
+                                  T init, OP op = OP());
+    }
+    \endcode
+
+    Writes <tt>out[0] = init</tt>, <tt>out[k] = op(out[k-1], begin[k-1])</tt> for
+    <tt>k = 1 ... n-1</tt> (where <tt>n = end - begin</tt>) and returns the total
+    <tt>op(out[n-1], begin[n-1])</tt> (or <tt>init</tt> if the range is empty).
+    Both iterators must be random access iterators, and \arg op must be
+    associative. \arg out may be equal to \arg begin (in-place scan).
+
+    The range is split into one block per thread. The blocks are first
+    reduced in parallel, then the block totals are scanned sequentially,
+    and finally each block is scanned in parallel, starting from the total
+    of its predecessors. Short ranges are scanned sequentially, since the
+    second pass over the data would not pay off.
+
+    <b>Usage:</b>
+
+    \code
+    #include <vigra/threadpool.hxx>
+
+    // compute the start index of each block from the block sizes
+    std::vector<int> sizes = ..., offsets(sizes.size());
+    int total = parallel_exclusive_scan(ParallelOptions::Auto,
+                                        sizes.begin(), sizes.end(), offsets.begin(), 0);
+    \endcode
+ */
+doxygen_overloaded_function(template <...> T parallel_exclusive_scan)
+
+template<class ITER, class OUT_ITER, class T, class OP>
+inline T parallel_exclusive_scan(
+    ThreadPool & pool,
+    ITER begin,
+    ITER end,
+    OUT_ITER out,
+    T init,
+    OP op)
+{
+    return detail::parallel_exclusive_scan_impl(&pool, (std::ptrdiff_t)pool.nThreads(),
+                                                begin, end, out, init, op);
+}
+
+template<class ITER, class OUT_ITER, class T>
+inline T parallel_exclusive_scan(
+    ThreadPool & pool,
+    ITER begin,
+    ITER end,
+    OUT_ITER out,
+    T init)
+{
+    return parallel_exclusive_scan(pool, begin, end, out, init, std::plus<T>());
+}
+
+template<class ITER, class OUT_ITER, class T, class OP>
+inline T parallel_exclusive_scan(
+    int64_t nThreads,
+    ITER begin,
+    ITER end,
+    OUT_ITER out,
+    T init,
+    OP op)
+{
+    const std::ptrdiff_t actualNThreads = ParallelOptions().numThreads((int)nThreads).getNumThreads();
+    return detail::parallel_exclusive_scan_impl((ThreadPool*)0, actualNThreads,
+                                                begin, end, out, init, op);
+}
+
+template<class ITER, class OUT_ITER, class T>
+inline T parallel_exclusive_scan(
+    int64_t nThreads,
+    ITER begin,
+    ITER end,
+    OUT_ITER out,
+    T init)
+{
+    return parallel_exclusive_scan(nThreads, begin, end, out, init, std::plus<T>());
+}
+
 //@}
 
 } // namespace vigra
@@ -39,12 +39,15 @@
 
 /*std*/
 #include <map>
+#include <atomic>
+#include <vector>
 
 /*vigra*/
 #include "config.hxx"
 #include "error.hxx"
 #include "array_vector.hxx"
 #include "iteratoradapter.hxx"
+#include "threadpool.hxx"
 
 namespace vigra {
 
@@ -321,6 +324,140 @@ class UnionFindArray
     }
 };
 
+/** \brief Thread-safe variant of UnionFindArray.
+
+    Holds a fixed number of indices <tt>0 ... size()-1</tt>, which are initially
+    separate sets. In contrast to UnionFindArray, \ref makeUnion() and
+    \ref findIndex() may be called concurrently from any number of threads.
+    Each entry stores its parent index in a <tt>std::atomic<T></tt>, and roots
+    are the entries that point to themselves. Two sets are linked by a
+    compare-and-swap on the root with the larger index, so that (as in
+    UnionFindArray) the smaller index becomes the representative, and
+    \ref findIndex() shortens the paths it walks by path halving. Since parents
+    always have smaller indices than their children, concurrent updates can
+    never create cycles.
+
+    The number of indices must be known in advance, because the array cannot
+    grow while other threads access it. \ref makeContiguous() must only be
+    called after all unions are done. It runs in parallel and afterwards,
+    \ref findLabel() returns the contiguous labels.
+
+    <b>\#include</b> \<vigra/union_find.hxx\><br>
+    Namespace: vigra
+*/
+template <class T>
+class ConcurrentUnionFindArray
+{
+    typedef std::ptrdiff_t IndexType;
+
+    std::vector<std::atomic<T> > parents_;
+    std::vector<T> labels_;
+
+  public:
+        /** Create \a size separate sets with indices <tt>0 ... size-1</tt>.
+        */
+    explicit ConcurrentUnionFindArray(T size = 0)
+    : parents_((std::size_t)size)
+    {
+        for(T k=0; k < size; ++k)
+            parents_[(IndexType)k].store(k, std::memory_order_relaxed);
+    }
+
+        /** The number of indices.
+        */
+    T size() const
+    {
+        return (T)parents_.size();
+    }
+
+        /** Find the representative of \a index. Safe to call concurrently
+            with other calls to findIndex() and makeUnion().
+        */
+    T findIndex(T index)
+    {
+        T parent = parents_[(IndexType)index].load(std::memory_order_relaxed);
+        while(parent != index)
+        {
+            // path halving: let index skip its parent
+            T grandparent = parents_[(IndexType)parent].load(std::memory_order_relaxed);
+            if(grandparent != parent)
+                parents_[(IndexType)index].compare_exchange_weak(parent, grandparent,
+                                                                 std::memory_order_relaxed);
+            index = grandparent;
+            parent = parents_[(IndexType)index].load(std::memory_order_relaxed);
+        }
+        return index;
+    }
+
+        /** Merge the sets containing \a l1 and \a l2 and return the
+            representative of the merged set. Safe to call concurrently.
+        */
+    T makeUnion(T l1, T l2)
+    {
+        while(true)
+        {
+            T i1 = findIndex(l1);
+            T i2 = findIndex(l2);
+            if(i1 == i2)
+                return i1;
+            if(i2 < i1)
+                std::swap(i1, i2);
+            // link only if i2 is still a root, otherwise retry
+            T expected = i2;
+            if(parents_[(IndexType)i2].compare_exchange_strong(expected, i1))
+                return i1;
+            l1 = i1;
+            l2 = i2;
+        }
+    }
+
+        /** Renumber the sets contiguously, starting at 0, in the order of
+            their representatives, and return the largest label (i.e. the
+            number of sets minus one, as in UnionFindArray::makeContiguous()).
+            Must not be called concurrently with makeUnion().
+        */
+    T makeContiguous(int nThreads = ParallelOptions::Auto)
+    {
+        IndexType size = (IndexType)parents_.size();
+        std::vector<T> is_root((std::size_t)size);
+        labels_.resize((std::size_t)size);
+
+        // point every index directly to its representative
+        parallel_foreach(nThreads, size,
+            [&](int, IndexType i)
+            {
+                T root = findIndex((T)i);
+                parents_[i].store(root, std::memory_order_relaxed);
+                is_root[i] = (root == (T)i) ? 1 : 0;
+            });
+
+        // number the roots
+        T count = parallel_exclusive_scan(nThreads, is_root.begin(), is_root.end(),
+                                          labels_.begin(), T(0));
+
+        // and propagate their labels to the other indices
+        parallel_foreach(nThreads, size,
+            [&](int, IndexType i)
+            {
+                T root = parents_[i].load(std::memory_order_relaxed);
+                if(root != (T)i)
+                    labels_[i] = labels_[(IndexType)root];
+            });
+        return count - 1;
+    }
+
+        /** Return the label of \a index, i.e. its representative before
+            and its contiguous label after makeContiguous().
+        */
+    T findLabel(T index)
+    {
+        T root = findIndex(index);
+        return labels_.empty()
+                   ? root
+                   : labels_[(IndexType)root];
+    }
+};
+
 } // namespace vigra
 
 #endif // VIGRA_UNION_FIND_HXX
@@ -775,11 +775,13 @@ class WatershedOptions
 {
   public:
     enum Method { RegionGrowing, UnionFind };
+    enum QueueType { AutomaticQueue, HeapQueue, HierarchicalQueue };
 
     double max_cost, bias;
     SRGType terminate;
     Method method;
-    unsigned int biased_label, bucket_count;
+    QueueType queue_type;
+    unsigned int biased_label, bucket_count, queue_levels;
     SeedOptions seed_options;
 
 
@@ -795,8 +797,10 @@ class WatershedOptions
       bias(1.0),
       terminate(CompleteGrow),
       method(RegionGrowing),
+      queue_type(AutomaticQueue),
       biased_label(0),
       bucket_count(0),
+      queue_levels(65536),
       seed_options(SeedOptions().unspecified())
     {}
 
@@ -937,6 +941,63 @@ class WatershedOptions
         method = UnionFind;
         return *this;
     }
+
+        /** \brief Specify the priority queue of the region growing algorithm
+            on graphs and multi-dimensional arrays.
+
+            Possible values are <tt>WatershedOptions::AutomaticQueue</tt>,
+            <tt>WatershedOptions::HeapQueue</tt>, and <tt>WatershedOptions::HierarchicalQueue</tt>
+            (see \ref heapQueue() and \ref hierarchicalQueue() for details).
+            The automatic choice uses a hierarchical queue with one level per value
+            when the boundary indicator is an 8- or 16-bit integer type, and a heap
+            otherwise.
+
+            Default: AutomaticQueue.
+        */
+    WatershedOptions & useQueue(QueueType type)
+    {
+        queue_type = type;
+        return *this;
+    }
+
+        /** \brief Use a binary heap in region growing on graphs and
+            multi-dimensional arrays.
+
+            The pixels are processed in the exact order of their
+            boundary indicator values for all value types.
+
+            Default: only for value types other than 8- and 16-bit integers.
+        */
+    WatershedOptions & heapQueue()
+    {
+        queue_type = HeapQueue;
+        return *this;
+    }
+
+        /** \brief Use a hierarchical queue in region growing on graphs and
+            multi-dimensional arrays.
+
+            A hierarchical queue holds one FIFO per priority level, so that
+            pushing and popping are constant-time operations. For 8- and 16-bit
+            integer types, there is one level per value, and the result is
+            the same as with a heap (up to the order of ties). For all other
+            types, the range of the boundary indicator is quantized into
+            <tt>levels</tt> equidistant levels, and pixels in the same level
+            are processed in FIFO order. This is much faster than a heap
+            for large data, but approximates the exact flooding order.
+            If a label is biased (see \ref biasLabel()), the levels cover
+            the biased costs as well.
+
+            Default: only for 8- and 16-bit integers.
+        */
+    WatershedOptions & hierarchicalQueue(unsigned int levels = 65536)
+    {
+        vigra_precondition(levels > 1,
+            "WatershedOptions::hierarchicalQueue(): need at least two levels.");
+        queue_type = HierarchicalQueue;
+        queue_levels = levels;
+        return *this;
+    }
 };
 
 namespace detail {
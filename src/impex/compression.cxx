@@ -35,14 +35,186 @@
 
 #include <algorithm>
 #include "vigra/compression.hxx"
+#include "vigra/sized_int.hxx"
 #include "lz4.h"
 
 #ifdef HasZLIB
 #include <zlib.h>
 #endif
 
+#ifdef HasZSTD
+#include <zstd.h>
+#endif
+
 namespace vigra {
 
+namespace {
+
+#ifdef HasZSTD
+int zstdLevel(CompressionMethod method)
+{
+    switch(method)
+    {
+      case ZSTD_FAST:
+        return 1;
+      case ZSTD_BEST:
+        return 19;
+      default:
+        return 3;
+    }
+}
+#endif
+
+    // Transpose the 8x8 bit matrix whose rows are the bytes of 'x'
+    // (Hacker's Delight, section 7-3). The transposition is its own inverse.
+inline UInt64 transposeBits8x8(UInt64 x)
+{
+    UInt64 t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+    // Split each group of 8 bytes into its 8 bit planes, and store bit plane k
+    // of all groups contiguously. The last (size % 8) bytes are copied.
+void bitshufflePlane(unsigned char const * source, unsigned char * dest, std::size_t size)
+{
+    std::size_t groups = size / 8;
+    for(std::size_t g=0; g<groups; ++g)
+    {
+        UInt64 x = 0;
+        for(int k=0; k<8; ++k)
+            x |= UInt64(source[8*g+k]) << (8*k);
+        x = transposeBits8x8(x);
+        for(int k=0; k<8; ++k)
+            dest[k*groups+g] = (unsigned char)(x >> (8*k));
+    }
+    std::copy(source + 8*groups, source + size, dest + 8*groups);
+}
+
+void bitunshufflePlane(unsigned char const * source, unsigned char * dest, std::size_t size)
+{
+    std::size_t groups = size / 8;
+    for(std::size_t g=0; g<groups; ++g)
+    {
+        UInt64 x = 0;
+        for(int k=0; k<8; ++k)
+            x |= UInt64(source[k*groups+g]) << (8*k);
+        x = transposeBits8x8(x);
+        for(int k=0; k<8; ++k)
+            dest[8*g+k] = (unsigned char)(x >> (8*k));
+    }
+    std::copy(source + 8*groups, source + size, dest + 8*groups);
+}
+
+} // anonymous namespace
+
+void applyCompressionFilter(char const * source, char * dest, std::size_t size,
+                            CompressionFilter filter, std::size_t elementSize)
+{
+    vigra_precondition(elementSize > 0,
+        "applyCompressionFilter(): elementSize must be positive.");
+    std::size_t count = size / elementSize;
+    switch(filter)
+    {
+      case NO_FILTER:
+      {
+        std::copy(source, source+size, dest);
+        break;
+      }
+      case SHUFFLE:
+      {
+        for(std::size_t i=0; i<count; ++i)
+            for(std::size_t j=0; j<elementSize; ++j)
+                dest[j*count+i] = source[i*elementSize+j];
+        std::copy(source + count*elementSize, source + size, dest + count*elementSize);
+        break;
+      }
+      case BITSHUFFLE:
+      {
+        ArrayVector<char> tmp(size);
+        applyCompressionFilter(source, tmp.data(), size, SHUFFLE, elementSize);
+        for(std::size_t j=0; j<elementSize; ++j)
+            bitshufflePlane((unsigned char const *)tmp.data() + j*count,
+                            (unsigned char *)dest + j*count, count);
+        std::copy(tmp.data() + count*elementSize, tmp.data() + size, dest + count*elementSize);
+        break;
+      }
+      default:
+        vigra_precondition(false, "applyCompressionFilter(): Unknown filter.");
+    }
+}
+
+void revertCompressionFilter(char const * source, char * dest, std::size_t size,
+                             CompressionFilter filter, std::size_t elementSize)
+{
+    vigra_precondition(elementSize > 0,
+        "revertCompressionFilter(): elementSize must be positive.");
+    std::size_t count = size / elementSize;
+    switch(filter)
+    {
+      case NO_FILTER:
+      {
+        std::copy(source, source+size, dest);
+        break;
+      }
+      case SHUFFLE:
+      {
+        for(std::size_t i=0; i<count; ++i)
+            for(std::size_t j=0; j<elementSize; ++j)
+                dest[i*elementSize+j] = source[j*count+i];
+        std::copy(source + count*elementSize, source + size, dest + count*elementSize);
+        break;
+      }
+      case BITSHUFFLE:
+      {
+        ArrayVector<char> tmp(size);
+        for(std::size_t j=0; j<elementSize; ++j)
+            bitunshufflePlane((unsigned char const *)source + j*count,
+                              (unsigned char *)tmp.data() + j*count, count);
+        std::copy(source + count*elementSize, source + size, tmp.data() + count*elementSize);
+        revertCompressionFilter(tmp.data(), dest, size, SHUFFLE, elementSize);
+        break;
+      }
+      default:
+        vigra_precondition(false, "revertCompressionFilter(): Unknown filter.");
+    }
+}
+
+bool isCompressionAvailable(CompressionMethod method)
+{
+    switch(method)
+    {
+      case ZLIB:
+      case ZLIB_NONE:
+      case ZLIB_FAST:
+      case ZLIB_BEST:
+    #ifdef HasZLIB
+        return true;
+    #else
+        return false;
+    #endif
+      case ZSTD:
+      case ZSTD_FAST:
+      case ZSTD_BEST:
+    #ifdef HasZSTD
+        return true;
+    #else
+        return false;
+    #endif
+      case DEFAULT_COMPRESSION:
+      case NO_COMPRESSION:
+      case LZ4:
+        return true;
+      default:
+        return false;
+    }
+}
+
 std::size_t compressImpl(char const * source, std::size_t srcSize, 
                          ArrayVector<char> & buffer,
                          CompressionMethod method)
@@ -79,6 +251,21 @@ std::size_t compressImpl(char const * source, std::size_t srcSize,
         vigra_postcondition(destSize > 0, "compress(): lz4 compression failed.");
         return destSize;
       }
+      case ZSTD:
+      case ZSTD_FAST:
+      case ZSTD_BEST:
+      {
+    #ifdef HasZSTD
+        std::size_t destSize = ::ZSTD_compressBound(srcSize);
+        buffer.resize(destSize);
+        destSize = ::ZSTD_compress(buffer.data(), destSize, source, srcSize, zstdLevel(method));
+        vigra_postcondition(!::ZSTD_isError(destSize), "compress(): zstd compression failed.");
+        return destSize;
+    #else
+        vigra_precondition(false, "compress(): VIGRA was compiled without ZSTD compression.");
+        return 0;
+    #endif
+      }
 
 #if 0  // currently unsupported
       case SNAPPY:
@@ -133,6 +320,32 @@ void compress(char const * source, std::size_t size, std::vector<char> & dest, C
     dest.insert(dest.begin(), buffer.data(), buffer.data() + destSize);
 }
 
+void compress(char const * source, std::size_t size, ArrayVector<char> & dest, CompressionMethod method,
+              CompressionFilter filter, std::size_t elementSize)
+{
+    if(filter == NO_FILTER)
+    {
+        compress(source, size, dest, method);
+        return;
+    }
+    ArrayVector<char> filtered(size);
+    applyCompressionFilter(source, filtered.data(), size, filter, elementSize);
+    compress(filtered.data(), size, dest, method);
+}
+
+void compress(char const * source, std::size_t size, std::vector<char> & dest, CompressionMethod method,
+              CompressionFilter filter, std::size_t elementSize)
+{
+    if(filter == NO_FILTER)
+    {
+        compress(source, size, dest, method);
+        return;
+    }
+    ArrayVector<char> filtered(size);
+    applyCompressionFilter(source, filtered.data(), size, filter, elementSize);
+    compress(filtered.data(), size, dest, method);
+}
+
 void uncompress(char const * source, std::size_t srcSize, 
                 char * dest, std::size_t destSize, CompressionMethod method)
 {
@@ -164,6 +377,18 @@ void uncompress(char const * source, std::size_t srcSize,
         vigra_postcondition(sourceLen >= 0 && static_cast<unsigned>(sourceLen) == srcSize, "uncompress(): lz4 decompression failed.");
         break;
       }
+      case ZSTD:
+      case ZSTD_FAST:
+      case ZSTD_BEST:
+      {
+    #ifdef HasZSTD
+        std::size_t destLen = ::ZSTD_decompress(dest, destSize, source, srcSize);
+        vigra_postcondition(!::ZSTD_isError(destLen) && destLen == destSize, "uncompress(): zstd decompression failed.");
+    #else
+        vigra_precondition(false, "uncompress(): VIGRA was compiled without ZSTD compression.");
+    #endif
+        break;
+      }
       
 #if 0 // currently unsupported
       case SNAPPY:
@@ -193,6 +418,20 @@ void uncompress(char const * source, std::size_t srcSize,
     }
 }
 
+void uncompress(char const * source, std::size_t srcSize,
+                char * dest, std::size_t destSize, CompressionMethod method,
+                CompressionFilter filter, std::size_t elementSize)
+{
+    if(filter == NO_FILTER)
+    {
+        uncompress(source, srcSize, dest, destSize, method);
+        return;
+    }
+    ArrayVector<char> filtered(destSize);
+    uncompress(source, srcSize, filtered.data(), destSize, method);
+    revertCompressionFilter(filtered.data(), dest, destSize, filter, elementSize);
+}
+
 /** Uncompress a data buffer when the uncompressed size is unknown.
 
     The destination array will be resized as required.
@@ -57,6 +57,13 @@ struct BlockwiseConvolutionTest
         kernel.initAveraging(3, 2);
         vector<Kernel1D<double> > kernels(N, kernel);
         
+        // output to a compressed array whose cache is smaller than the number of chunks,
+        // so that chunks are evicted while the blocks are processed
+        ChunkedArray small_chunks(shape, Shape(8));
+        small_chunks.commitSubarray(Shape(0), data);
+        ChunkedArrayCompressed<3, int> compressed_result(shape, Shape(8), ChunkedArrayOptions().cacheMax(2));
+        separableConvolveBlockwise(small_chunks, compressed_result, kernels.begin());
+
         separableConvolveMultiArray(data, data, kernels.begin()); // data now contains output
         
         separableConvolveBlockwise(chunked_data, chunked_data, kernels.begin());
@@ -67,6 +74,12 @@ struct BlockwiseConvolutionTest
         {
             shouldEqual(data[i], checked_out_data[i]);
         }
+
+        compressed_result.checkoutSubarray(Shape(0), checked_out_data);
+        for(int i = 0; i != data.size(); ++i)
+        {
+            shouldEqual(data[i], checked_out_data[i]);
+        }
     }
 
     void testParallel()
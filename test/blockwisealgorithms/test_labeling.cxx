@@ -267,6 +267,51 @@ struct BlockwiseLabelingTest
                                      oldschool_label_array.begin(), oldschool_label_array.end()), true);
     }
 
+    void chunkedArraySmallCacheTest()
+    {
+        typedef ChunkedArrayLazy<3, UInt8> DataArray;
+        typedef ChunkedArrayCompressed<3, UInt32> LabelArray;
+        typedef DataArray::shape_type Shape;
+
+        Shape shape = Shape(64);
+        Shape chunk_shape = Shape(8);
+
+        MultiArray<3, UInt8> oldschool_data_array(shape);
+        fillRandom(oldschool_data_array.begin(), oldschool_data_array.end(), 2);
+        DataArray data(shape, chunk_shape);
+        data.commitSubarray(Shape(0), oldschool_data_array);
+
+        using namespace vigra::blockwise;
+
+        std::vector<bool> with_backgrounds;
+        with_backgrounds.push_back(false);
+        with_backgrounds.push_back(true);
+        for(std::size_t k = 0; k != with_backgrounds.size(); ++k)
+        {
+            // the cache of the labels is much smaller than the number of chunks,
+            // so that chunks are evicted while several threads label them
+            LabelArray labels(shape, chunk_shape, ChunkedArrayOptions().cacheMax(2));
+            BlockwiseLabelOptions options;
+            options.neighborhood(DirectNeighborhood).numThreads(4);
+            if(with_backgrounds[k])
+                options.ignoreBackgroundValue(0);
+
+            UInt32 tested_label_number = labelMultiArrayBlockwise(data, labels, options);
+            MultiArray<3, UInt32> checked_out_labels(shape);
+            labels.checkoutSubarray(Shape(0), checked_out_labels);
+
+            MultiArray<3, UInt32> oldschool_label_array(shape);
+            UInt32 actual_label_number = with_backgrounds[k]
+                    ? labelMultiArrayWithBackground(oldschool_data_array, oldschool_label_array,
+                                                    DirectNeighborhood, UInt8(0))
+                    : labelMultiArray(oldschool_data_array, oldschool_label_array, DirectNeighborhood);
+
+            shouldEqual(tested_label_number, actual_label_number);
+            shouldEqual(equivalentLabels(checked_out_labels.begin(), checked_out_labels.end(),
+                                         oldschool_label_array.begin(), oldschool_label_array.end()), true);
+        }
+    }
+
     void fiveDimensionalRandomTest()
     {
         testOnData(array_fives.begin(), array_fives.end(),
@@ -295,6 +340,7 @@ struct BlockwiseLabelingTestSuite
         add(testCase(&BlockwiseLabelingTest::fiveDimensionalRandomTest));
         add(testCase(&BlockwiseLabelingTest::debugTest));
         add(testCase(&BlockwiseLabelingTest::chunkedArrayTest));
+        add(testCase(&BlockwiseLabelingTest::chunkedArraySmallCacheTest));
     }
 };
 
@@ -41,6 +41,7 @@
 #include <vigra/multi_gridgraph.hxx>
 #include <vigra/unittest.hxx>
 #include <vigra/multi_watersheds.hxx>
+#include <vigra/multi_convolution.hxx>
 
 #include <iostream>
 #include <sstream>
@@ -50,6 +51,37 @@
 using namespace std;
 using namespace vigra;
 
+// flooding cost of each pixel: the smallest maximal data value along a path from any seed
+template <class Array, class LabelArray>
+Array floodingCosts(const Array& data, const LabelArray& seeds, NeighborhoodType neighborhood)
+{
+    typedef typename Array::difference_type Shape;
+    typedef typename Array::value_type Data;
+    typedef GridGraph<Array::actual_dimension, undirected_tag> Graph;
+
+    Graph graph(data.shape(), neighborhood);
+    Array costs(data.shape());
+    MultiArray<Array::actual_dimension, bool> done(data.shape());
+    PriorityQueue<Shape, Data, true> pqueue;
+    for(typename Graph::NodeIt node(graph); node != lemon::INVALID; ++node)
+        if(seeds[*node] != 0)
+            pqueue.push(*node, data[*node]);
+    while(!pqueue.empty())
+    {
+        Shape node = pqueue.top();
+        Data cost = pqueue.topPriority();
+        pqueue.pop();
+        if(done[node])
+            continue;
+        done[node] = true;
+        costs[node] = cost;
+        for(typename Graph::OutArcIt arc(graph, node); arc != lemon::INVALID; ++arc)
+            if(!done[graph.target(*arc)])
+                pqueue.push(graph.target(*arc), std::max(cost, data[graph.target(*arc)]));
+    }
+    return costs;
+}
+
 struct BlockwiseWatershedTest
 {
     void oneDimensionalTest()
@@ -201,6 +233,102 @@ struct BlockwiseWatershedTest
         shouldEqual(equivalentLabels(tested_labels.begin(), tested_labels.end(),
                                      correct_labels.begin(), correct_labels.end()),
                     true);
+
+        // several threads, with the directions in a compressed array whose cache
+        // is smaller than the number of chunks
+        Shape small_chunk_shape(8, 8, 4);
+        Array small_chunks_data(shape, small_chunk_shape);
+        small_chunks_data.commitSubarray(Shape(0), oldschool_data);
+        LabelArray small_chunks_labels(shape, small_chunk_shape);
+        ChunkedArrayCompressed<3, unsigned short> directions(shape, small_chunk_shape,
+                                                             ChunkedArrayOptions().cacheMax(2));
+        tested_label_number = unionFindWatershedsBlockwise(small_chunks_data, small_chunks_labels,
+                                                           BlockwiseLabelOptions().neighborhood(neighborhood)
+                                                                                  .numThreads(4),
+                                                           directions);
+        shouldEqual(correct_label_number, tested_label_number);
+        shouldEqual(equivalentLabels(small_chunks_labels.begin(), small_chunks_labels.end(),
+                                     correct_labels.begin(), correct_labels.end()),
+                    true);
+    }
+    void seededChunkedTest()
+    {
+        typedef MultiArray<3, float> OldschoolArray;
+        typedef MultiArray<3, unsigned int> OldschoolLabelArray;
+        typedef OldschoolArray::difference_type Shape;
+
+        Shape shape(20, 30, 10);
+        OldschoolArray noise(shape), oldschool_data(shape);
+        fillRandom(noise.begin(), noise.end(), 1000);
+        gaussianSmoothMultiArray(noise, oldschool_data, 1.5);
+
+        vector<Shape> chunk_shapes;
+        chunk_shapes.push_back(Shape(32, 32, 16));
+        chunk_shapes.push_back(Shape(8, 8, 4));
+        chunk_shapes.push_back(Shape(2, 4, 2));
+
+        for(int n = 0; n != 2; ++n)
+        {
+            NeighborhoodType neighborhood = n == 0 ? DirectNeighborhood : IndirectNeighborhood;
+
+            OldschoolLabelArray seeds(shape);
+            unsigned int seed_number = generateWatershedSeeds(oldschool_data, seeds, neighborhood,
+                                                              SeedOptions().minima());
+            OldschoolLabelArray correct_labels(seeds);
+            watershedsMultiArray(oldschool_data, correct_labels, neighborhood);
+            OldschoolArray correct_costs = floodingCosts(oldschool_data, seeds, neighborhood);
+
+            for(decltype(chunk_shapes.size()) c = 0; c != chunk_shapes.size(); ++c)
+            {
+                for(int threads = 1; threads <= 4; threads += 3)
+                {
+                    ChunkedArrayLazy<3, float> data(shape, chunk_shapes[c]);
+                    data.commitSubarray(Shape(0), oldschool_data);
+                    ChunkedArrayLazy<3, unsigned int> labels(shape, chunk_shapes[c]);
+                    labels.commitSubarray(Shape(0), seeds);
+                    ChunkedArrayLazy<3, float> costs(shape, chunk_shapes[c]);
+
+                    BlockwiseLabelOptions options;
+                    options.neighborhood(neighborhood).numThreads(threads);
+                    shouldEqual(seededWatershedsBlockwise(data, labels, options, costs), seed_number);
+
+                    OldschoolLabelArray tested_labels(shape);
+                    OldschoolArray tested_costs(shape);
+                    labels.checkoutSubarray(Shape(0), tested_labels);
+                    costs.checkoutSubarray(Shape(0), tested_costs);
+                    should(tested_costs == correct_costs);
+                    should(tested_labels == correct_labels);
+                }
+            }
+
+            // several threads, with all arrays compressed and caches that are smaller
+            // than the number of chunks; the steps storage holds stale values
+            Shape small_chunk_shape(8, 8, 4);
+            ChunkedArrayOptions small_cache = ChunkedArrayOptions().cacheMax(2);
+            ChunkedArrayCompressed<3, float> data(shape, small_chunk_shape, small_cache);
+            data.commitSubarray(Shape(0), oldschool_data);
+            ChunkedArrayCompressed<3, float> costs(shape, small_chunk_shape, small_cache);
+            ChunkedArrayCompressed<3, UInt32> steps(shape, small_chunk_shape, small_cache);
+            steps.commitSubarray(Shape(0), MultiArray<3, UInt32>(shape, 7u));
+            ChunkedArrayCompressed<3, unsigned int> labels(shape, small_chunk_shape, small_cache);
+            labels.commitSubarray(Shape(0), seeds);
+            BlockwiseLabelOptions options;
+            options.neighborhood(neighborhood).numThreads(4);
+            shouldEqual(seededWatershedsBlockwise(data, labels, options, costs, steps), seed_number);
+
+            OldschoolLabelArray tested_labels(shape);
+            OldschoolArray tested_costs(shape);
+            labels.checkoutSubarray(Shape(0), tested_labels);
+            costs.checkoutSubarray(Shape(0), tested_costs);
+            should(tested_costs == correct_costs);
+            should(tested_labels == correct_labels);
+
+            // default temporary storage
+            labels.commitSubarray(Shape(0), seeds);
+            shouldEqual(seededWatershedsBlockwise(data, labels, options), seed_number);
+            labels.checkoutSubarray(Shape(0), tested_labels);
+            should(tested_labels == correct_labels);
+        }
     }
 };
 
@@ -213,6 +341,7 @@ struct BlockwiseWatershedTestSuite
         add(testCase(&BlockwiseWatershedTest::fourDimensionalRandomTest));
         add(testCase(&BlockwiseWatershedTest::oneDimensionalTest));
         add(testCase(&BlockwiseWatershedTest::chunkedTest));
+        add(testCase(&BlockwiseWatershedTest::seededChunkedTest));
     }
 };
 
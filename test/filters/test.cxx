@@ -12,7 +12,10 @@
 #include "vigra/stdimage.hxx"
 #include "vigra/impex.hxx"
 
+#include "vigra/multi_array.hxx"
+#include "vigra/random.hxx"
 #include "vigra/medianfilter.hxx"
+#include "vigra/flatmorphology.hxx"
 #include "vigra/shockfilter.hxx"
 #include "vigra/specklefilters.hxx"
 
@@ -225,6 +228,199 @@ struct MedianFilterExactTest
     
 };
 
+struct RankOrderFilterTest
+{
+    typedef MultiArrayIndex Index;
+
+        // rank order filter by sorting the complete window,
+        // using vigra's standard border treatment
+    template <unsigned int N, class T>
+    static void
+    referenceFilter(MultiArrayView<N, T> const & src, MultiArrayView<N, T> dest,
+                    TinyVector<Index, N> const & window, double rank,
+                    BorderTreatmentMode border)
+    {
+        typedef TinyVector<Index, N> Shape;
+        Shape radius;
+        for(unsigned int k=0; k<N; ++k)
+            radius[k] = window[k] / 2;
+
+        MultiCoordinateIterator<N> p(src.shape()), end = p.getEndIterator();
+        for(; p != end; ++p)
+        {
+            std::vector<T> values;
+            MultiCoordinateIterator<N> w(window), wend = w.getEndIterator();
+            for(; w != wend; ++w)
+            {
+                Shape q = *p + *w - radius;
+                bool zero = false;
+                for(unsigned int k=0; k<N; ++k)
+                {
+                    Index n = src.shape(k);
+                    if(q[k] >= 0 && q[k] < n)
+                        continue;
+                    if(border == BORDER_TREATMENT_REPEAT)
+                        q[k] = q[k] < 0 ? 0 : n - 1;
+                    else if(border == BORDER_TREATMENT_REFLECT)
+                        q[k] = q[k] < 0 ? -q[k] : 2*n - 2 - q[k];
+                    else if(border == BORDER_TREATMENT_WRAP)
+                        q[k] = q[k] < 0 ? q[k] + n : q[k] - n;
+                    else
+                        zero = true;
+                }
+                values.push_back(zero ? T() : src[q]);
+            }
+            std::sort(values.begin(), values.end());
+            dest[*p] = values[(std::size_t)(rank*(values.size() - 1) + 0.5)];
+        }
+    }
+
+    template <unsigned int N, class T>
+    static void
+    checkFilter(TinyVector<Index, N> const & shape, TinyVector<Index, N> const & window,
+                double rank, int maxValue)
+    {
+        MultiArray<N, T> src(shape), res(shape), ref(shape);
+        RandomMT19937 random(42);
+        for(auto & v : src)
+            v = (T)((int)random.uniformInt(maxValue + 1) + (int)NumericTraits<T>::min());
+
+        BorderTreatmentMode modes[] = { BORDER_TREATMENT_REPEAT, BORDER_TREATMENT_REFLECT,
+                                        BORDER_TREATMENT_WRAP, BORDER_TREATMENT_ZEROPAD };
+        for(auto border : modes)
+        {
+            referenceFilter<N, T>(src, ref, window, rank, border);
+            rankOrderFilter(src, res, window, rank, border);
+            shouldEqualSequence(res.begin(), res.end(), ref.begin());
+        }
+
+        // AVOID computes the interior only
+        res = 0;
+        rankOrderFilter(src, res, window, rank, BORDER_TREATMENT_AVOID);
+        ref = 0;
+        referenceFilter<N, T>(src, ref, window, rank, BORDER_TREATMENT_REPEAT);
+        TinyVector<Index, N> radius;
+        for(unsigned int k=0; k<N; ++k)
+            radius[k] = window[k] / 2;
+        MultiArrayView<N, T> interior = res.subarray(radius, shape - radius);
+        should(interior == ref.subarray(radius, shape - radius));
+        interior = 0;
+        should(res == (MultiArray<N, T>(shape)));
+    }
+
+    void testRankOrderFilter2D()
+    {
+        // sorting network
+        checkFilter<2, UInt8>(Shape2(20, 15), Shape2(3, 3), 0.5, 255);
+        // histograms
+        checkFilter<2, UInt8>(Shape2(40, 30), Shape2(11, 7), 0.5, 255);
+        checkFilter<2, Int8>(Shape2(40, 30), Shape2(7, 9), 0.2, 255);
+        checkFilter<2, UInt16>(Shape2(300, 20), Shape2(15, 11), 0.5, 65535);
+        checkFilter<2, UInt16>(Shape2(300, 20), Shape2(101, 3), 0.0, 1000);
+        checkFilter<2, Int16>(Shape2(300, 20), Shape2(21, 5), 1.0, 65535);
+        // selection
+        checkFilter<2, UInt16>(Shape2(30, 20), Shape2(5, 3), 0.7, 65535);
+        checkFilter<2, float>(Shape2(30, 20), Shape2(5, 7), 0.5, 100);
+    }
+
+    void testRankOrderFilter3D()
+    {
+        checkFilter<3, UInt8>(Shape3(20, 15, 10), Shape3(5, 5, 3), 0.5, 255);
+        checkFilter<3, UInt16>(Shape3(20, 15, 10), Shape3(5, 3, 7), 0.7, 65535);
+        checkFilter<3, UInt16>(Shape3(20, 15, 10), Shape3(3, 3, 1), 0.5, 65535);
+        checkFilter<3, double>(Shape3(10, 15, 10), Shape3(3, 3, 3), 0.3, 100);
+    }
+
+    void testMedianFilter()
+    {
+        MultiArray<2, UInt8> src(Shape2(23, 17)), res(src.shape()), ref(src.shape());
+        RandomMT19937 random(1);
+        for(auto & v : src)
+            v = random.uniformInt(256);
+
+        // the array view version must be consistent with the iterator version
+        BorderTreatmentMode modes[] = { BORDER_TREATMENT_AVOID, BORDER_TREATMENT_REPEAT,
+                                        BORDER_TREATMENT_REFLECT, BORDER_TREATMENT_WRAP,
+                                        BORDER_TREATMENT_ZEROPAD };
+        for(auto border : modes)
+        {
+            for(int size=3; size<=11; size+=4)
+            {
+                res = 0;
+                ref = 0;
+                medianFilter(srcImageRange(src), destImage(ref), Diff2D(size, size), border);
+                medianFilter(src, res, Diff2D(size, size), border);
+                should(res == ref);
+                if(border != BORDER_TREATMENT_REFLECT)
+                {
+                    res = 0;
+                    medianFilter(src, res, Shape2(size, size), border);
+                    should(res == ref);
+                }
+            }
+        }
+
+        MultiArray<3, UInt16> volume(Shape3(15, 10, 8)), vres(volume.shape()), vref(volume.shape());
+        for(auto & v : volume)
+            v = random.uniformInt(65536);
+        medianFilter(volume, vres, Shape3(9, 9, 3));
+        rankOrderFilter(volume, vref, Shape3(9, 9, 3), 0.5);
+        should(vres == vref);
+
+        try
+        {
+            medianFilter(volume, vres, Shape3(9, 4, 3));
+            failTest("no exception thrown");
+        }
+        catch(PreconditionViolation & c)
+        {
+            std::string expected("\nPrecondition violation!\nrankOrderFilter(): Window size must be odd and positive.");
+            std::string message(c.what());
+            should(0 == expected.compare(message.substr(0,expected.size())));
+        }
+    }
+
+    void testDiscRankOrderFilter16()
+    {
+        MultiArray<2, UInt8> src8(Shape2(40, 30)), res8(src8.shape());
+        MultiArray<2, UInt16> src16(src8.shape()), res16(src8.shape());
+        MultiArray<2, Int16> srcS(src8.shape()), resS(src8.shape());
+        RandomMT19937 random(2);
+        for(Index k=0; k<src8.size(); ++k)
+        {
+            src8[k] = random.uniformInt(256);
+            src16[k] = 256*src8[k] + 255;
+            srcS[k] = (Int16)(256*src8[k] - 32768);
+        }
+
+        // 16-bit data with the same ordering must give corresponding results
+        float ranks[] = { 0.0f, 0.2f, 0.5f, 0.9f, 1.0f };
+        for(auto rank : ranks)
+        {
+            for(int radius=0; radius<=6; radius+=3)
+            {
+                discRankOrderFilter(src8, res8, radius, rank);
+                discRankOrderFilter(src16, res16, radius, rank);
+                discRankOrderFilter(srcS, resS, radius, rank);
+                for(Index k=0; k<src8.size(); ++k)
+                {
+                    shouldEqual(res16[k], 256*res8[k] + 255);
+                    shouldEqual(resS[k], 256*res8[k] - 32768);
+                }
+            }
+        }
+
+        discErosion(src8, res8, 4);
+        discErosion(src16, res16, 4);
+        for(Index k=0; k<src8.size(); ++k)
+            shouldEqual(res16[k], 256*res8[k] + 255);
+        discMedian(src8, res8, 4);
+        discMedian(src16, res16, 4);
+        for(Index k=0; k<src8.size(); ++k)
+            shouldEqual(res16[k], 256*res8[k] + 255);
+    }
+};
+
 struct MedianFilterTestSuite
 : public vigra::test_suite
 {
@@ -238,6 +434,10 @@ struct MedianFilterTestSuite
         add( testCase( &MedianFilterExactTest::testREFLECT));
         add( testCase( &MedianFilterExactTest::testWRAP));
         add( testCase( &MedianFilterExactTest::testZEROPAD));
+        add( testCase( &RankOrderFilterTest::testRankOrderFilter2D));
+        add( testCase( &RankOrderFilterTest::testRankOrderFilter3D));
+        add( testCase( &RankOrderFilterTest::testMedianFilter));
+        add( testCase( &RankOrderFilterTest::testDiscRankOrderFilter16));
    }
 };
 
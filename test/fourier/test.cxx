@@ -489,6 +489,143 @@ struct MultiFFTTest
         shouldEqual(Shape3(120, 256, 260), fftwBestPaddedShapeR2C(s));
     }
 
+    void testPlanCache()
+    {
+        typedef FFTWPlanCache<double> Cache;
+        Cache::clear();
+        shouldEqual(Cache::size(), 0u);
+        should(Cache::isEnabled());
+
+        Shape2 s(64, 48);
+        DArray2 in(s);
+        for (int k=0; k<in.size(); ++k)
+            in[k] = rand()/(double)RAND_MAX;
+
+        CArray2 out(s), ref(s);
+        fourierTransform(in, out);
+        ref = out;
+        std::size_t count = Cache::size();
+        should(count > 0);
+
+        // same configuration => cached plan
+        fourierTransform(in, out);
+        shouldEqual(Cache::size(), count);
+        shouldEqualSequence(out.data(), out.data()+out.size(), ref.data());
+
+        // plans and their copies don't destroy cached plans
+        {
+            FFTWPlan<2, double> plan(out, out, FFTW_FORWARD);
+            FFTWPlan<2, double> copy(plan);
+            out = in;
+            copy.execute(out, out);
+        }
+        shouldEqual(Cache::size(), count);
+        shouldEqualSequence(out.data(), out.data()+out.size(), ref.data());
+
+        // new shape => new plan
+        DArray2 in2(Shape2(32, 48));
+        CArray2 out2(in2.shape());
+        fourierTransform(in2, out2);
+        should(Cache::size() > count);
+        count = Cache::size();
+
+        Cache::disable();
+        DArray2 in3(Shape2(30, 20));
+        CArray2 out3(in3.shape());
+        fourierTransform(in3, out3);
+        shouldEqual(Cache::size(), count);
+        Cache::enable();
+
+        std::string wisdom("testwisdom.dat");
+        should(Cache::exportWisdom(wisdom));
+        should(Cache::importWisdom(wisdom));
+        should(!Cache::importWisdom("does_not_exist.dat"));
+
+        Cache::clear();
+        shouldEqual(Cache::size(), 0u);
+
+        // plans in use survive clear() and remain usable
+        {
+            FFTWPlan<2, double> plan(out, out, FFTW_FORWARD);
+            shouldEqual(Cache::size(), 1u);
+            Cache::clear();
+            shouldEqual(Cache::size(), 0u);
+            out = in;
+            plan.execute(out, out);
+            shouldEqualSequence(out.data(), out.data()+out.size(), ref.data());
+        }
+
+        // the cache is bounded, but plans in use are not evicted
+        shouldEqual(Cache::maxSize(), 128u);
+        Cache::setMaxSize(2);
+        {
+            FFTWPlan<2, double> plan(out, out, FFTW_FORWARD);
+            for (int k=0; k<4; ++k)
+            {
+                DArray2 in4(Shape2(10+k, 12));
+                CArray2 out4(in4.shape());
+                fourierTransform(in4, out4);
+                should(Cache::size() <= 2u);
+            }
+            Cache::setMaxSize(0);
+            shouldEqual(Cache::size(), 1u);
+            out = in;
+            plan.execute(out, out);
+            shouldEqualSequence(out.data(), out.data()+out.size(), ref.data());
+        }
+        shouldEqual(Cache::size(), 0u);
+        Cache::setMaxSize(128);
+    }
+
+    void testBatchedFFT()
+    {
+        Shape2 s(30, 20);
+        MultiArray<3, double> in(Shape3(30, 20, 3)), back(in.shape());
+        for (int k=0; k<in.size(); ++k)
+            in[k] = rand()/(double)RAND_MAX;
+        MultiArray<3, C> fourier(Shape3(16, 20, 3));
+
+        FFTWPlan<2, double> forward, backward;
+        forward.initMany(in, fourier, FFTW_ESTIMATE, ParallelOptions().numThreads(2));
+        backward.initMany(fourier, back);
+        forward.executeMany(in, fourier);
+        backward.executeMany(fourier, back);
+
+        for (int k=0; k<3; ++k)
+        {
+            CArray2 single(fftwCorrespondingShapeR2C(s));
+            fourierTransform(in.bindOuter(k), single);
+            MultiArrayView<2, C> item = fourier.bindOuter(k);
+            shouldEqualSequenceTolerance(item.begin(), item.end(), single.begin(), C(1e-12, 1e-12));
+        }
+        shouldEqualSequenceTolerance(back.begin(), back.end(), in.begin(), 1e-12);
+
+        // a plan for a batch can't be used for single arrays
+        try
+        {
+            forward.execute(in.bindOuter(0), fourier.bindOuter(0));
+            failTest("no exception thrown");
+        }
+        catch(PreconditionViolation &)
+        {}
+
+        // batched complex convolution gives the same result as single convolutions
+        CArray2 cin(s);
+        for (int k=0; k<cin.size(); ++k)
+            cin[k] = C(rand()/(double)RAND_MAX, rand()/(double)RAND_MAX);
+        CArray2 kernel1(Shape2(5, 5), C(0.04)), kernel2(Shape2(3, 7), C(0.0, 1.0/21.0)),
+                out1(s), out2(s), ref1(s), ref2(s);
+        convolveFFTComplex(cin, kernel1, ref1, false);
+        convolveFFTComplex(cin, kernel2, ref2, false);
+
+        MultiArrayView<2, C> kernels[] = { kernel1, kernel2 };
+        MultiArrayView<2, C> outs[] = { out1, out2 };
+        convolveFFTComplexMany(cin, kernels, kernels+2, outs, false);
+
+        shouldEqualSequenceTolerance(out1.begin(), out1.end(), ref1.begin(), C(1e-12, 1e-12));
+        shouldEqualSequenceTolerance(out2.begin(), out2.end(), ref2.begin(), C(1e-12, 1e-12));
+    }
+
     void testConvolveFFT()
     {
         typedef MultiArrayView<2, double> MV;
@@ -712,6 +849,8 @@ struct FFTWTestSuite
         add( testCase(&MultiFFTTest::testFFT2D));
         add( testCase(&MultiFFTTest::testFFT3D));
         add( testCase(&MultiFFTTest::testPadding));
+        add( testCase(&MultiFFTTest::testPlanCache));
+        add( testCase(&MultiFFTTest::testBatchedFFT));
         add( testCase(&MultiFFTTest::testConvolveFFT));
         add( testCase(&MultiFFTTest::testConvolveFFTComplex));
         add( testCase(&MultiFFTTest::testConvolveFourierKernel));
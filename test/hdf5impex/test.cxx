@@ -41,6 +41,7 @@
 #include "vigra/stdimage.hxx"
 #include "vigra/unittest.hxx"
 #include "vigra/hdf5impex.hxx"
+#include "vigra/multi_array_chunked_hdf5.hxx"
 #include "vigra/multi_array.hxx"
 #include "vigra/multi_impex.hxx"
 
@@ -1112,6 +1113,185 @@ public:
 
 
 
+    void testHDF5FileParallelChunkRead()
+    {
+        std::string file_name( "testfile_HDF5File_parallel_chunks.hdf5");
+
+        MultiArray<3, float> out_data(Shape3(45, 38, 21));
+        for (int i = 0; i < out_data.size(); ++i)
+            out_data[i] = (float)(i % 1000) + 0.25f;
+        MultiArray<2, TinyVector<float, 3> > out_data_tv(Shape2(70, 53));
+        for (int i = 0; i < out_data_tv.size(); ++i)
+            out_data_tv[i] = TinyVector<float, 3>(i, -i, 0.5f*i);
+
+        HDF5File file (file_name, HDF5File::New);
+        file.write("/compressed", out_data, Shape3(16, 8, 16), 5);
+        file.write("/uncompressed", out_data, Shape3(16, 16, 8), 0);
+        file.write("/multiband", out_data_tv, Shape2(32, 16), 3);
+
+        // partially written dataset (unallocated chunks contain the fill value)
+        file.createDataset<3, float>("/partial", out_data.shape(), 7.0f, Shape3(16, 16, 16), 5);
+        file.writeBlock("/partial", Shape3(16, 0, 0), out_data.subarray(Shape3(16, 0, 0), Shape3(32, 16, 16)));
+        file.close();
+
+        // shuffled and deflated chunks, as written by other programs
+        {
+            HDF5Handle h5file(H5Fopen(file_name.c_str(), H5F_ACC_RDWR, H5P_DEFAULT), &H5Fclose, "");
+            hsize_t dims[3] = { 21, 38, 45 }, chunks[3] = { 8, 16, 16 };
+            HDF5Handle space(H5Screate_simple(3, dims, NULL), &H5Sclose, "");
+            HDF5Handle plist(H5Pcreate(H5P_DATASET_CREATE), &H5Pclose, "");
+            H5Pset_chunk(plist, 3, chunks);
+            H5Pset_shuffle(plist);
+            H5Pset_deflate(plist, 4);
+            HDF5Handle dataset(H5Dcreate(h5file, "/shuffled", H5T_NATIVE_FLOAT, space,
+                                         H5P_DEFAULT, plist, H5P_DEFAULT), &H5Dclose, "");
+            H5Dwrite(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out_data.data());
+        }
+        file.open(file_name, HDF5File::OpenReadOnly);
+        shouldEqual(file.readThreads(), 0);
+
+        // reading unallocated chunks must not report HDF5 errors
+        H5E_auto2_t old_error_func = 0;
+        void * old_error_data = 0;
+        H5Eget_auto2(H5E_DEFAULT, &old_error_func, &old_error_data);
+        int error_count = 0;
+        H5Eset_auto2(H5E_DEFAULT, &countHDF5Errors, &error_count);
+
+        char const * names[] = { "/compressed", "/uncompressed", "/shuffled" };
+        for (int threads = 0; threads <= 4; threads += 4)
+        {
+            file.setReadThreads(threads);
+            shouldEqual(file.readThreads(), threads);
+            for (auto name : names)
+            {
+                MultiArray<3, float> in_data(out_data.shape());
+                file.read(name, in_data);
+                should(in_data == out_data);
+
+                // strided target
+                MultiArray<3, float> in_data_t(reverse(out_data.shape()));
+                file.read(name, in_data_t.transpose());
+                should(in_data_t.transpose() == out_data);
+
+                // block that is not aligned with the chunks
+                Shape3 block_offset(5, 9, 3), block_shape(30, 20, 17);
+                MultiArray<3, float> in_block(block_shape);
+                file.readBlock(name, block_offset, block_shape, in_block);
+                should(in_block == out_data.subarray(block_offset, block_offset + block_shape));
+
+                MultiArray<3, float> in_block_t(reverse(block_shape));
+                file.readBlock(name, block_offset, block_shape, in_block_t.transpose());
+                should(in_block_t.transpose() == out_data.subarray(block_offset, block_offset + block_shape));
+            }
+
+            MultiArray<2, TinyVector<float, 3> > in_data_tv(out_data_tv.shape());
+            file.read("/multiband", in_data_tv);
+            should(in_data_tv == out_data_tv);
+
+            MultiArray<2, TinyVector<float, 3> > in_block_tv(Shape2(40, 30));
+            file.readBlock("/multiband", Shape2(20, 10), Shape2(40, 30), in_block_tv.transpose().transpose());
+            should(in_block_tv == out_data_tv.subarray(Shape2(20, 10), Shape2(60, 40)));
+
+            // conversion to another type
+            MultiArray<3, double> in_data_d(out_data.shape());
+            file.read("/compressed", in_data_d);
+            should(in_data_d == out_data);
+
+            MultiArray<3, float> in_partial(out_data.shape());
+            file.read("/partial", in_partial);
+            should(in_partial.subarray(Shape3(16, 0, 0), Shape3(32, 16, 16)) ==
+                   out_data.subarray(Shape3(16, 0, 0), Shape3(32, 16, 16)));
+            shouldEqual(in_partial(0, 0, 0), 7.0f);
+            shouldEqual(in_partial(40, 30, 20), 7.0f);
+
+            MultiArray<3, float> in_partial_t(reverse(out_data.shape()));
+            file.read("/partial", in_partial_t.transpose());
+            should(in_partial_t.transpose() == in_partial);
+        }
+        H5Eset_auto2(H5E_DEFAULT, old_error_func, old_error_data);
+        shouldEqual(error_count, 0);
+    }
+
+    static herr_t countHDF5Errors(hid_t, void * count)
+    {
+        ++*static_cast<int *>(count);
+        return 0;
+    }
+
+    static void checkChunkCache(HDF5File const & file, std::string const & name,
+                                size_t nbytes, size_t nslots, double w0)
+    {
+        checkChunkCache(file.getDatasetHandle(name), nbytes, nslots, w0);
+    }
+
+    static void checkChunkCache(hid_t dataset, size_t nbytes, size_t nslots, double w0)
+    {
+        HDF5Handle access(H5Dget_access_plist(dataset), &H5Pclose, "");
+        size_t bytes = 0, slots = 0;
+        double policy = -1.0;
+        H5Pget_chunk_cache(access, &slots, &bytes, &policy);
+        shouldEqual(bytes, nbytes);
+        shouldEqual(slots, nslots);
+        shouldEqual(policy, w0);
+    }
+
+    void testHDF5FileChunkCache()
+    {
+        std::string file_name( "testfile_HDF5File_chunk_cache.hdf5");
+
+        MultiArray<3, float> out_data(Shape3(40, 30, 20));
+        for (int i = 0; i < out_data.size(); ++i)
+            out_data[i] = (float)i;
+        MultiArray<2, TinyVector<float, 3> > out_data_tv(Shape2(40, 30));
+
+        HDF5File file (file_name, HDF5File::New);
+        file.write("/data", out_data, Shape3(10, 10, 10), 5);
+        file.write("/multiband", out_data_tv, Shape2(10, 10), 5);
+
+        // library defaults
+        checkChunkCache(file, "/data", 1024*1024, 521, 0.75);
+
+        file.setChunkCache(8*1024*1024, 1009, 0.5);
+        checkChunkCache(file, "/data", 8*1024*1024, 1009, 0.5);
+        checkChunkCache(HDF5File(file), "/data", 8*1024*1024, 1009, 0.5);
+
+        file.setChunkCache(4*1024*1024);
+        checkChunkCache(file, "/data", 4*1024*1024, 521, 0.75);
+
+        // a z-slice touches 4*3 chunks of 10*10*10 floats
+        file.setSequentialAccess(2);
+        checkChunkCache(file, "/data", 12*4000, 1201, 1.0);
+        // an x-slice touches 3*2 chunks, but only 5 fit into the limit
+        file.setSequentialAccess(0, 20000);
+        checkChunkCache(file, "/data", 20000, 503, 1.0);
+        // the bands are axis 0 of multiband data, a y-slice touches 4 chunks of 10*10*3 floats
+        file.setSequentialAccess(2);
+        checkChunkCache(file, "/multiband", 4*1200, 401, 1.0);
+        // newly created datasets
+        file.setSequentialAccess(1);
+        checkChunkCache(file.createDataset<3, float>("/created", out_data.shape(), 0.0f, Shape3(10, 10, 10), 5),
+                        8*4000, 809, 1.0);
+
+        file.useDefaultChunkCache();
+        checkChunkCache(file, "/data", 1024*1024, 521, 0.75);
+
+        // slice-wise reading gives the same result
+        file.setSequentialAccess(2);
+        for (int z = 0; z < out_data.shape(2); ++z)
+        {
+            MultiArray<3, float> slice(Shape3(40, 30, 1));
+            file.readBlock("/data", Shape3(0, 0, z), slice.shape(), slice);
+            should(slice == out_data.subarray(Shape3(0, 0, z), Shape3(40, 30, z+1)));
+        }
+
+        // ChunkedArrayHDF5 uses the settings of its file
+        ChunkedArrayHDF5<3, float> chunked(file, "/data");
+        checkChunkCache(chunked.dataset_, 12*4000, 1201, 1.0);
+        MultiArray<3, float> in_data(out_data.shape());
+        chunked.checkoutSubarray(Shape3(), in_data);
+        should(in_data == out_data);
+    }
+
     void testHDF5FileBrowsing()
     {
         //create groups, change current group, ...
@@ -1406,6 +1586,8 @@ struct HDF5ImportExportTestSuite : public vigra::test_suite
         add(testCase(&HDF5ExportImportTest::testHDF5FileBlockAccess));
         add(testCase(&HDF5ExportImportTest::testHDF5FileChunks));
         add(testCase(&HDF5ExportImportTest::testHDF5FileCompression));
+        add(testCase(&HDF5ExportImportTest::testHDF5FileParallelChunkRead));
+        add(testCase(&HDF5ExportImportTest::testHDF5FileChunkCache));
         add(testCase(&HDF5ExportImportTest::testHDF5FileBrowsing));
         add(testCase(&HDF5ExportImportTest::testHDF5FileAttributes));
         add(testCase(&HDF5ExportImportTest::testHDF5FileTutorial));
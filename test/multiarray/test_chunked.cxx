@@ -42,6 +42,9 @@
 #ifdef HasHDF5
 #include "vigra/multi_array_chunked_hdf5.hxx"
 #endif
+#ifndef _WIN32
+#include "vigra/multi_array_chunked_mmap.hxx"
+#endif
 #include "vigra/functorexpression.hxx"
 #include "vigra/multi_math.hxx"
 #include "vigra/algorithm.hxx"
@@ -82,6 +85,12 @@ public:
 
     static const int fill_value = 42;
 
+#ifndef _WIN32
+    static const bool isMmapArray = IsSameType<Array, ChunkedArrayMmap<3, T> >::value;
+#else
+    static const bool isMmapArray = false;
+#endif
+
     ChunkedMultiArrayTest ()
         : shape(20,21,22),
           chunk_shape(8),
@@ -97,52 +106,76 @@ public:
     static ArrayPtr createArray(Shape3 const & shape,
                                 Shape3 const & /*chunk_shape*/,
                                 ChunkedArrayFull<3, T> *,
-                                std::string const & = "chunked_test.h5")
+                                std::string const & = "chunked_test.h5",
+                                int io_threads = 0)
     {
-        return ArrayPtr(new ChunkedArrayFull<3, T>(shape, ChunkedArrayOptions().fillValue(fill_value)));
+        return ArrayPtr(new ChunkedArrayFull<3, T>(shape, ChunkedArrayOptions().fillValue(fill_value)
+                                                                            .ioThreads(io_threads)));
     }
 
     static ArrayPtr createArray(Shape3 const & shape,
                                 Shape3 const & chunk_shape,
                                 ChunkedArrayLazy<3, T> *,
-                                std::string const & = "chunked_test.h5")
+                                std::string const & = "chunked_test.h5",
+                                int io_threads = 0)
     {
         return ArrayPtr(new ChunkedArrayLazy<3, T>(shape, chunk_shape,
-                                                   ChunkedArrayOptions().fillValue(fill_value)));
+                                                   ChunkedArrayOptions().fillValue(fill_value)
+                                                                        .ioThreads(io_threads)));
     }
 
     static ArrayPtr createArray(Shape3 const & shape,
                                 Shape3 const & chunk_shape,
                                 ChunkedArrayCompressed<3, T> *,
-                                std::string const & = "chunked_test.h5")
+                                std::string const & = "chunked_test.h5",
+                                int io_threads = 0)
     {
         return ArrayPtr(new ChunkedArrayCompressed<3, T>(shape, chunk_shape,
                                                          ChunkedArrayOptions().fillValue(fill_value)
-                                                                              .compression(LZ4)));
+                                                                              .compression(LZ4)
+                                                                              .ioThreads(io_threads)));
     }
 
 #ifdef HasHDF5
     static ArrayPtr createArray(Shape3 const & shape,
                                 Shape3 const & chunk_shape,
                                 ChunkedArrayHDF5<3, T> *,
-                                std::string const & name = "chunked_test.h5")
+                                std::string const & name = "chunked_test.h5",
+                                int io_threads = 0)
     {
         HDF5File hdf5_file(name, HDF5File::New);
         return ArrayPtr(new ChunkedArrayHDF5<3, T>(hdf5_file, "test", HDF5File::New,
                                                    shape, chunk_shape,
-                                                   ChunkedArrayOptions().fillValue(fill_value)));
+                                                   ChunkedArrayOptions().fillValue(fill_value)
+                                                                        .ioThreads(io_threads)));
     }
 #endif
 
     static ArrayPtr createArray(Shape3 const & shape,
                                 Shape3 const & chunk_shape,
                                 ChunkedArrayTmpFile<3, T> *,
-                                std::string const & = "chunked_test.h5")
+                                std::string const & = "chunked_test.h5",
+                                int io_threads = 0)
     {
         return ArrayPtr(new ChunkedArrayTmpFile<3, T>(shape, chunk_shape,
-                                                      ChunkedArrayOptions().fillValue(fill_value), ""));
+                                                      ChunkedArrayOptions().fillValue(fill_value)
+                                                                           .ioThreads(io_threads), ""));
     }
 
+#ifndef _WIN32
+    static ArrayPtr createArray(Shape3 const & shape,
+                                Shape3 const & chunk_shape,
+                                ChunkedArrayMmap<3, T> *,
+                                std::string const & name = "chunked_test.h5",
+                                int io_threads = 0)
+    {
+        return ArrayPtr(new ChunkedArrayMmap<3, T>(name.substr(0, name.rfind('.')) + ".vmm",
+                                                   shape, chunk_shape,
+                                                   ChunkedArrayOptions().fillValue(fill_value)
+                                                                        .ioThreads(io_threads)));
+    }
+#endif
+
     void test_construction ()
     {
         bool isFullArray = IsSameType<Array, ChunkedArrayFull<3, T> >::value;
@@ -189,7 +222,7 @@ public:
 
         // non-const iterator should allocate the array and initialize with fill_value_
         shouldEqualSequence(empty_array->begin(), empty_array->end(), empty.begin());
-        if(IsSameType<Array, ChunkedArrayTmpFile<3, T> >::value)
+        if(IsSameType<Array, ChunkedArrayTmpFile<3, T> >::value || isMmapArray)
             should(empty_array->dataBytes() >= ref.size()*sizeof(T)); // must pad to a full memory page
         else
             shouldEqual(empty_array->dataBytes(), ref.size()*sizeof(T));
@@ -408,7 +441,7 @@ public:
             shouldEqualSequence(c.begin(), c.end(), empty.begin());
 
             MultiArrayView <3, T, ChunkedArrayTag> v(empty_array->subarray(start, stop));
-            if(IsSameType<Array, ChunkedArrayTmpFile<3, T> >::value)
+            if(IsSameType<Array, ChunkedArrayTmpFile<3, T> >::value || isMmapArray)
                 should(empty_array->dataBytes() >= ref.size()*sizeof(T)); // must pad to a full memory page
             else
                 shouldEqual(empty_array->dataBytes(), ref.size()*sizeof(T));
@@ -784,6 +817,86 @@ public:
         shouldEqualSequence(a->begin(), a->end(), ref.begin());
     }
 
+    void testBackgroundIO()
+    {
+        array.reset(0); // close the file if backend is HDF5
+        ArrayPtr a = createArray(shape, chunk_shape, (Array *)0, "chunked_test.h5", 1);
+        a->setCacheMaxSize(2);
+
+        // evicted chunks are written back asynchronously
+        {
+            typename BaseArray::chunk_iterator i   = a->chunk_begin(Shape3(), shape),
+                                               end = a->chunk_end(Shape3(), shape);
+            for(; i != end; ++i)
+                *i = ref.subarray(i.chunkStart(), i.chunkStop());
+        }
+        shouldEqualSequence(a->cbegin(), a->cend(), ref.begin());
+
+        // chunks ahead of the iterator are loaded in the background
+        {
+            typename BaseArray::chunk_const_iterator i   = a->chunk_cbegin(Shape3(), shape),
+                                                     end = a->chunk_cend(Shape3(), shape);
+            for(; i != end; ++i)
+                should(*i == ref.subarray(i.chunkStart(), i.chunkStop()));
+        }
+        a->finishIO();
+
+        ChunkedArrayStatistics stats = a->statistics();
+        should(stats.prefetch_hits <= stats.prefetched);
+        if(prod(a->chunkArrayShape()) == 1)
+            return; // ChunkedArrayFull never loads anything
+
+        should(stats.write_behind > 0);
+
+        // the first chunk is asleep => an explicit prefetch must succeed
+        a->resetStatistics();
+        a->prefetchChunkAt(Shape3(1,2,3));
+        a->finishIO();
+        shouldEqual(a->statistics().prefetched, 1u);
+        shouldEqual(a->getItem(Shape3(1,2,3)), ref[Shape3(1,2,3)]);
+        stats = a->statistics();
+        shouldEqual(stats.prefetch_hits, 1u);
+        shouldEqual(stats.stalls, 0u);
+        shouldEqual(stats.prefetchHitRate(), 1.0);
+    }
+
+    void testParallelSubarray()
+    {
+        array.reset(0); // close the file if backend is HDF5
+        ArrayPtr a = createArray(shape, chunk_shape, (Array *)0);
+        a->setCacheMaxSize(2); // chunks are released while other threads still work
+        ParallelOptions parallel = ParallelOptions().numThreads(4);
+
+        Shape3 start(3, 1, 5), stop(19, 20, 22);
+        a->commitSubarray(start, ref.subarray(start, stop), parallel);
+
+        PlainArray out(stop - start);
+        a->checkoutSubarray(start, out, parallel);
+        should(out == ref.subarray(start, stop));
+
+        // the rest of the array is untouched
+        PlainArray expected(shape, T(fill_value));
+        expected.subarray(start, stop) = ref.subarray(start, stop);
+        shouldEqualSequence(a->cbegin(), a->cend(), expected.begin());
+
+        // a prefetched ROI is in memory when the read begins
+        a->setCacheMaxSize(27);
+        a->releaseChunks(Shape3(), shape);
+        a->resetStatistics();
+        a->prefetchSubarray(start, stop, parallel);
+        a->finishIO();
+        if(prod(a->chunkArrayShape()) == 1)
+            return; // ChunkedArrayFull never loads anything
+
+        ChunkedArrayStatistics stats = a->statistics();
+        shouldEqual(stats.prefetched, 27u);
+        a->checkoutSubarray(start, out, parallel);
+        should(out == ref.subarray(start, stop));
+        stats = a->statistics();
+        shouldEqual(stats.prefetch_hits, 27u);
+        shouldEqual(stats.cache_misses, 0u);
+    }
+
     // void testIsUnstrided()
     // {
         // typedef difference3_type Shape;
@@ -882,6 +995,296 @@ public:
     // }
 };
 
+    // compressed array whose write-back of evicted chunks always fails
+struct FailingChunkedArray
+: public ChunkedArrayCompressed<3, float>
+{
+    FailingChunkedArray(Shape3 const & shape, Shape3 const & chunk_shape,
+                        ChunkedArrayOptions const & options)
+    : ChunkedArrayCompressed<3, float>(shape, chunk_shape, options)
+    {}
+
+    virtual bool unloadChunk(ChunkBase<3, float> * chunk, bool destroy)
+    {
+        if(!destroy)
+            throw std::runtime_error("write-back failed");
+        return ChunkedArrayCompressed<3, float>::unloadChunk(chunk, destroy);
+    }
+};
+
+struct ChunkedMultiArrayCacheTest
+{
+    typedef ChunkedArrayCompressed<3, float> Array;
+
+    Shape3 shape, chunk_shape;
+    MultiArray<3, float> ref;
+    // the expected statistics depend on the order in which chunks are visited
+    ParallelOptions serial;
+
+    ChunkedMultiArrayCacheTest()
+    : shape(40, 8, 8),   // 5 chunks along the x-axis
+      chunk_shape(8),
+      ref(shape),
+      serial(ParallelOptions().numThreads(ParallelOptions::NoThreads))
+    {
+        linearSequence(ref.begin(), ref.end());
+    }
+
+    // read one element from each chunk in 'order'
+    void readChunks(Array & a, int const * order, int n)
+    {
+        MultiArray<3, float> tmp(Shape3(1));
+        for(int k=0; k<n; ++k)
+        {
+            Shape3 p(8*order[k]+1, 2, 3);
+            a.checkoutSubarray(p, tmp);
+            shouldEqual(tmp[0], ref[p]);
+        }
+    }
+
+    ChunkedArrayStatistics runPattern(ChunkedArrayOptions::CachePolicy policy)
+    {
+        Array a(shape, chunk_shape, ChunkedArrayOptions().cacheMax(2).cachePolicy(policy));
+        a.commitSubarray(Shape3(), ref, serial);
+        shouldEqual(a.cacheSize(), 2);
+
+        a.resetStatistics();
+        int order[] = { 0, 1, 0, 2, 0 };
+        readChunks(a, order, 5);
+        ChunkedArrayStatistics stats = a.statistics();
+        shouldEqual(a.cacheSize(), 2);
+        shouldEqualSequence(a.cbegin(), a.cend(), ref.begin());
+        return stats;
+    }
+
+    void testFIFO()
+    {
+        ChunkedArrayStatistics stats = runPattern(ChunkedArrayOptions::FIFO);
+        shouldEqual(stats.cache_hits, 1u);
+        shouldEqual(stats.cache_misses, 4u);
+        shouldEqual(stats.evictions, 4u);
+    }
+
+    void testLRU()
+    {
+        // chunk 0 is kept because it is accessed repeatedly
+        ChunkedArrayStatistics stats = runPattern(ChunkedArrayOptions::LRU);
+        shouldEqual(stats.cache_hits, 2u);
+        shouldEqual(stats.cache_misses, 3u);
+        shouldEqual(stats.evictions, 3u);
+        shouldEqualTolerance(stats.cacheHitRate(), 0.4, 1e-15);
+    }
+
+    void testClock()
+    {
+        ChunkedArrayStatistics stats = runPattern(ChunkedArrayOptions::Clock);
+        shouldEqual(stats.cache_hits + stats.cache_misses, 5u);
+        shouldEqual(stats.evictions, stats.cache_misses);
+    }
+
+    void testByteBudget()
+    {
+        // only the loaded chunks count, so the budget holds three chunks
+        std::size_t chunkBytes = prod(chunk_shape)*sizeof(float);
+        Array a(shape, chunk_shape, ChunkedArrayOptions().cachePolicy(ChunkedArrayOptions::ByteBudget)
+                                                         .cacheMaxBytes(3*chunkBytes));
+        ChunkedArray<3, float> & base = a;
+        shouldEqual(a.cacheMaxBytes(), 3*chunkBytes);
+        a.commitSubarray(Shape3(), MultiArray<3, float>(shape, 1.0f), serial);
+        shouldEqual(base.cacheBytes(), 3*chunkBytes);
+        shouldEqual(a.cacheSize(), 3);
+        shouldEqual(a.statistics().evictions, 2u);
+
+        // the same holds for chunks that don't compress, although the
+        // asleep chunks now occupy more memory in total
+        a.commitSubarray(Shape3(), ref, serial);
+        shouldEqual(base.cacheBytes(), 3*chunkBytes);
+        should(base.dataBytes() > a.cacheMaxBytes());
+        shouldEqual(a.cacheSize(), 3);
+        shouldEqualSequence(a.cbegin(), a.cend(), ref.begin());
+
+        a.releaseChunks(Shape3(), shape);
+        shouldEqual(base.cacheBytes(), 0u);
+    }
+
+    void testCompressionFilter()
+    {
+        // a smooth float signal compresses much better after shuffling
+        MultiArray<3, float> smooth(shape);
+        for(int k=0; k<smooth.size(); ++k)
+            smooth[k] = 1000.0f + 0.01f*k;
+
+        CompressionFilter filters[] = { NO_FILTER, SHUFFLE, BITSHUFFLE };
+        std::size_t bytes[3];
+        for(int f=0; f<3; ++f)
+        {
+            Array a(shape, chunk_shape, ChunkedArrayOptions().compressionFilter(filters[f]));
+            ChunkedArray<3, float> & base = a;
+            a.commitSubarray(Shape3(), smooth);
+            a.releaseChunks(Shape3(), shape);
+            bytes[f] = base.dataBytes();
+            shouldEqualSequence(a.cbegin(), a.cend(), smooth.begin());
+        }
+        should(bytes[1] < bytes[0] / 2);
+        should(bytes[2] < bytes[0] / 2);
+    }
+
+    void testWriteBehindError()
+    {
+        // errors of the background write-back are reported by finishIO()
+        FailingChunkedArray a(shape, chunk_shape, ChunkedArrayOptions().cacheMax(1).ioThreads(1));
+        a.commitSubarray(Shape3(), ref, serial);
+        bool caught = false;
+        try
+        {
+            a.finishIO();
+        }
+        catch(std::runtime_error & e)
+        {
+            caught = std::string(e.what()) == "write-back failed";
+        }
+        should(caught);
+        a.finishIO(); // the error is only reported once
+    }
+
+    static void concurrentReadsRun(Array * a, MultiArray<3, float> const * ref,
+                                   int seed, threading::atomic_long * errors)
+    {
+        MultiArray<3, float> tmp(Shape3(8));
+        for(int k=0; k<200; ++k)
+        {
+            Shape3 start(8*((seed + 3*k) % 5), 0, 0);
+            a->checkoutSubarray(start, tmp);
+            if(tmp != ref->subarray(start, start+tmp.shape()))
+                errors->fetch_add(1);
+        }
+    }
+
+    void testChunkIteratorIndexing()
+    {
+        Array a(shape, chunk_shape, ChunkedArrayOptions().cacheMax(1));
+        a.commitSubarray(Shape3(), ref, serial);
+
+        Array::chunk_iterator i = a.chunk_begin(Shape3(), shape);
+        // the views returned by operator[] must outlive the iterator
+        ChunkView<3, float> v2 = i[2], v3 = i[Shape3(3,0,0)];
+        ++i;
+        shouldEqual(i.chunkStart(), Shape3(8,0,0));
+
+        // touch all other chunks, so that unpinned chunks would be evicted
+        int order[] = { 0, 1, 4, 0, 4 };
+        readChunks(a, order, 5);
+
+        should(v2 == ref.subarray(Shape3(16,0,0), Shape3(24,8,8)));
+        should(v3 == ref.subarray(Shape3(24,0,0), Shape3(32,8,8)));
+
+        // writes through the views must reach the array
+        v2 = 2.0f;
+        v3 = 3.0f;
+        ref.subarray(Shape3(16,0,0), Shape3(24,8,8)) = 2.0f;
+        ref.subarray(Shape3(24,0,0), Shape3(32,8,8)) = 3.0f;
+        shouldEqualSequence(a.cbegin(), a.cend(), ref.begin());
+    }
+
+    void testConcurrentReads()
+    {
+        // more threads than cache slots => chunks are constantly
+        // loaded and evicted by several threads at once
+        ChunkedArrayOptions::CachePolicy policies[] = {
+            ChunkedArrayOptions::FIFO, ChunkedArrayOptions::LRU,
+            ChunkedArrayOptions::Clock, ChunkedArrayOptions::ByteBudget };
+        for(int p=0; p<4; ++p)
+        {
+            Array a(shape, chunk_shape, ChunkedArrayOptions().cacheMax(2).cachePolicy(policies[p])
+                                                             .cacheMaxBytes(2*prod(chunk_shape)*sizeof(float)));
+            a.commitSubarray(Shape3(), ref);
+            a.resetStatistics();
+
+            threading::atomic_long errors;
+            errors.store(0);
+            threading::thread t1(std::bind(concurrentReadsRun, &a, &ref, 0, &errors));
+            threading::thread t2(std::bind(concurrentReadsRun, &a, &ref, 1, &errors));
+            threading::thread t3(std::bind(concurrentReadsRun, &a, &ref, 2, &errors));
+            threading::thread t4(std::bind(concurrentReadsRun, &a, &ref, 4, &errors));
+            t1.join();
+            t2.join();
+            t3.join();
+            t4.join();
+
+            shouldEqual(errors.load(), 0);
+            ChunkedArrayStatistics stats = a.statistics();
+            shouldEqual(stats.cache_hits + stats.cache_misses, 800u);
+            shouldEqualSequence(a.cbegin(), a.cend(), ref.begin());
+        }
+    }
+};
+
+#ifndef _WIN32
+struct ChunkedArrayMmapTest
+{
+    typedef ChunkedArrayMmap<3, int> Array;
+
+    void testReopen()
+    {
+        Shape3 shape(20, 21, 22), chunk_shape(8);
+        MultiArray<3, int> ref(shape, 7);
+        MultiArrayView<3, int> written = ref.subarray(Shape3(), Shape3(16, 21, 22));
+        linearSequence(written.begin(), written.end());
+
+        {
+            Array a("mmap_test.vmm", shape, chunk_shape,
+                    ChunkedArrayOptions().fillValue(7).cacheMax(4));
+            should(!a.isReadOnly());
+            a.commitSubarray(Shape3(), written);
+            shouldEqual(a.backend(), "ChunkedArrayMmap<'mmap_test.vmm'>");
+        }
+
+        {
+            // shape, chunk shape, and fill value are restored from the file
+            Array a("mmap_test.vmm");
+            should(a.isReadOnly());
+            shouldEqual(a.shape(), shape);
+            shouldEqual(a.chunkShape(), chunk_shape);
+            // the last chunk column was never written and reads as the fill value
+            shouldEqualSequence(a.cbegin(), a.cend(), ref.begin());
+
+            try
+            {
+                a.setItem(Shape3(1,2,3), 1);
+                failTest("no exception thrown");
+            }
+            catch(vigra::ContractViolation &)
+            {}
+        }
+
+        {
+            Array a("mmap_test.vmm", Array::ReadWrite);
+            should(!a.isReadOnly());
+            a.setItem(Shape3(19, 20, 21), 1);
+            ref[Shape3(19, 20, 21)] = 1;
+        }
+
+        {
+            Array a("mmap_test.vmm");
+            shouldEqualSequence(a.cbegin(), a.cend(), ref.begin());
+        }
+
+        try
+        {
+            ChunkedArrayMmap<3, float> a("mmap_test.vmm");
+            failTest("no exception thrown");
+        }
+        catch(vigra::ContractViolation & c)
+        {
+            std::string expected("\nPrecondition violation!\nChunkedArrayMmap(): file was created with a different element type.");
+            std::string message(c.what());
+            should(0 == expected.compare(message.substr(0,expected.size())));
+        }
+        std::remove("mmap_test.vmm");
+    }
+};
+#endif
+
 // struct MultiArrayPointoperatorsTest
 // {
 
@@ -1527,6 +1930,8 @@ struct ChunkedMultiArrayTestSuite
         add( testCase( &ChunkedMultiArrayTest<Array>::test_iterator ) );
         add( testCase( &ChunkedMultiArrayTest<Array>::testChunkIterator ) );
         add( testCase( &ChunkedMultiArrayTest<Array>::testMultiThreaded ) );
+        add( testCase( &ChunkedMultiArrayTest<Array>::testBackgroundIO ) );
+        add( testCase( &ChunkedMultiArrayTest<Array>::testParallelSubarray ) );
     }
 
     template <class T>
@@ -1565,6 +1970,9 @@ struct ChunkedMultiArrayTestSuite
         testImpl<ChunkedArrayLazy<3, float> >();
         testImpl<ChunkedArrayCompressed<3, float> >();
         testImpl<ChunkedArrayTmpFile<3, float> >();
+#ifndef _WIN32
+        testImpl<ChunkedArrayMmap<3, float> >();
+#endif
 #ifdef HasHDF5
         testImpl<ChunkedArrayHDF5<3, float> >();
 #endif
@@ -1573,10 +1981,25 @@ struct ChunkedMultiArrayTestSuite
         testImpl<ChunkedArrayLazy<3, TinyVector<float, 3> > >();
         testImpl<ChunkedArrayCompressed<3, TinyVector<float, 3> > >();
         testImpl<ChunkedArrayTmpFile<3, TinyVector<float, 3> > >();
+#ifndef _WIN32
+        testImpl<ChunkedArrayMmap<3, TinyVector<float, 3> > >();
+#endif
 #ifdef HasHDF5
         testImpl<ChunkedArrayHDF5<3, TinyVector<float, 3> > >();
 #endif
 
+        add( testCase( &ChunkedMultiArrayCacheTest::testFIFO ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testLRU ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testClock ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testByteBudget ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testCompressionFilter ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testWriteBehindError ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testChunkIteratorIndexing ) );
+        add( testCase( &ChunkedMultiArrayCacheTest::testConcurrentReads ) );
+#ifndef _WIN32
+        add( testCase( &ChunkedArrayMmapTest::testReopen ) );
+#endif
+
         testSpeedImpl<unsigned char>();
         testSpeedImpl<float>();
         testSpeedImpl<double>();
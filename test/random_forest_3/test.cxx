@@ -35,9 +35,14 @@
 #include <vigra/unittest.hxx>
 #include <vigra/random_forest_3.hxx>
 #include <vigra/random.hxx>
+#include <fstream>
+#include <iterator>
 #ifdef HasHDF5
     #include <vigra/random_forest_3_hdf5_impex.hxx>
 #endif
+#ifndef _WIN32
+    #include <vigra/random_forest_3_binary_impex.hxx>
+#endif
 
 using namespace vigra;
 using namespace vigra::rf3;
@@ -206,6 +211,396 @@ struct RandomForestTests
         }
     }
 
+    void test_compiled_prediction()
+    {
+        // Create a (noisy) grid with datapoints and assign classes as in a 3x3 chessboard.
+        size_t const nx = 30;
+        size_t const ny = 30;
+
+        RandomNumberGenerator<MersenneTwister> rand;
+        MultiArray<2, double> train_x(Shape2(nx*ny, 2));
+        MultiArray<1, int> train_y(Shape1(nx*ny));
+        for (size_t y = 0; y < ny; ++y)
+        {
+            for (size_t x = 0; x < nx; ++x)
+            {
+                train_x(y*nx+x, 0) = x + 2*rand.uniform()-1;
+                train_x(y*nx+x, 1) = y + 2*rand.uniform()-1;
+                train_y(y*nx+x) = (x/10+y/10) % 2;
+            }
+        }
+
+        RandomForestOptions const options = RandomForestOptions()
+                                                   .tree_count(5)
+                                                   .bootstrap_sampling(true)
+                                                   .n_threads(1);
+        auto rf = random_forest(train_x, train_y, options);
+        should(rf.is_compiled());
+
+        // Merging invalidates the compiled layout, so that prediction walks the graph.
+        auto merged = rf;
+        merged.merge(rf);
+        should(!merged.is_compiled());
+
+        std::vector<size_t> tree_indices;
+        tree_indices.push_back(1);
+        tree_indices.push_back(7);
+        MultiArray<2, double> probs(Shape2(nx*ny, 2)), subset_probs(probs.shape());
+        MultiArray<2, int> ids(Shape2(nx*ny, 10));
+        merged.predict_probabilities(train_x, probs, 1);
+        merged.predict_probabilities(train_x, subset_probs, 1, tree_indices);
+        double const comparisons = merged.leaf_ids(train_x, ids, 1);
+
+        merged.compile();
+        should(merged.is_compiled());
+        MultiArray<2, double> compiled_probs(probs.shape());
+        MultiArray<2, int> compiled_ids(ids.shape());
+        merged.predict_probabilities(train_x, compiled_probs, 1);
+        shouldEqualSequence(compiled_probs.begin(), compiled_probs.end(), probs.begin());
+        merged.predict_probabilities(train_x, compiled_probs, 1, tree_indices);
+        shouldEqualSequence(compiled_probs.begin(), compiled_probs.end(), subset_probs.begin());
+        shouldEqual(merged.leaf_ids(train_x, compiled_ids, 1), comparisons);
+        shouldEqualSequence(compiled_ids.begin(), compiled_ids.end(), ids.begin());
+    }
+
+    void test_compiled_prediction_blocks()
+    {
+        // The compiled prediction moves blocks of rows through the trees together,
+        // check row counts that do not fill the last block and a single row.
+        size_t const nx = 30;
+        size_t const ny = 30;
+
+        RandomNumberGenerator<MersenneTwister> rand;
+        MultiArray<2, double> train_x(Shape2(nx*ny, 2));
+        MultiArray<1, int> train_y(Shape1(nx*ny));
+        for (size_t y = 0; y < ny; ++y)
+        {
+            for (size_t x = 0; x < nx; ++x)
+            {
+                train_x(y*nx+x, 0) = x + 2*rand.uniform()-1;
+                train_x(y*nx+x, 1) = y + 2*rand.uniform()-1;
+                train_y(y*nx+x) = (x/10+y/10) % 2;
+            }
+        }
+
+        RandomForestOptions const options = RandomForestOptions()
+                                                   .tree_count(5)
+                                                   .bootstrap_sampling(true)
+                                                   .n_threads(1);
+        auto compiled = random_forest(train_x, train_y, options);
+        should(compiled.is_compiled());
+        auto graph = compiled;
+        graph.merge(compiled);
+        should(!graph.is_compiled());
+        compiled = graph;
+        compiled.compile();
+        should(compiled.is_compiled());
+
+        size_t const row_counts[] = { 1, 63, 65, 130 };
+        for (size_t n : row_counts)
+        {
+            // take the rows from the middle, so that they reach different leaves
+            MultiArray<2, double> x(train_x.subarray(Shape2(400, 0), Shape2(400+n, 2)));
+
+            MultiArray<2, double> probs(Shape2(n, 2)), compiled_probs(probs.shape());
+            graph.predict_probabilities(x, probs, 1);
+            compiled.predict_probabilities(x, compiled_probs, 2);
+            shouldEqualSequence(compiled_probs.begin(), compiled_probs.end(), probs.begin());
+
+            MultiArray<1, int> labels(Shape1(x.shape(0))), compiled_labels(labels.shape());
+            graph.predict(x, labels, 1);
+            compiled.predict(x, compiled_labels, 2);
+            shouldEqualSequence(compiled_labels.begin(), compiled_labels.end(), labels.begin());
+
+            MultiArray<2, int> ids(Shape2(n, 10)), compiled_ids(ids.shape());
+            double const comparisons = graph.leaf_ids(x, ids, 1);
+            shouldEqual(compiled.leaf_ids(x, compiled_ids, 2), comparisons);
+            shouldEqualSequence(compiled_ids.begin(), compiled_ids.end(), ids.begin());
+        }
+    }
+
+    void test_histogram_training()
+    {
+        // Quantization: few distinct values get a bin each, otherwise the bins are equally populated.
+        {
+            double values[] = { 3.0, 1.0, 2.0, 1.0, 3.0, 2.0, 2.0, 1.0,
+                                0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0 };
+            MultiArray<2, double> x(Shape2(8, 2), values);
+            rf3::detail::RFBinnedFeatures<double> bins(x, 4, 2, 1);
+            shouldEqual(bins.num_bins(0), 3);
+            shouldEqual(bins.num_bins(1), 4);
+            shouldEqual(bins.histogram_size(), 14);
+            shouldEqual(bins.thresholds_[0][0], 1.5);
+            shouldEqual(bins.thresholds_[0][1], 2.5);
+            shouldEqual(bins.thresholds_[1][0], 1.5);
+            shouldEqual(bins.thresholds_[1][2], 5.5);
+            UInt8 codes0[] = { 2, 0, 1, 0, 2, 1, 1, 0 },
+                  codes1[] = { 0, 0, 1, 1, 2, 2, 3, 3 };
+            shouldEqualSequence(bins.codes_.template bind<0>(0).begin(), bins.codes_.template bind<0>(0).end(), codes0);
+            shouldEqualSequence(bins.codes_.template bind<0>(1).begin(), bins.codes_.template bind<0>(1).end(), codes1);
+        }
+
+        // Create a (noisy) grid with datapoints and assign classes as in a 4x4 chessboard.
+        size_t const nx = 100;
+        size_t const ny = 100;
+
+        RandomNumberGenerator<MersenneTwister> rand;
+        MultiArray<2, double> train_x(Shape2(nx*ny, 2));
+        MultiArray<1, int> train_y(Shape1(nx*ny));
+        for (size_t y = 0; y < ny; ++y)
+        {
+            for (size_t x = 0; x < nx; ++x)
+            {
+                train_x(y*nx+x, 0) = x + 2*rand.uniform()-1;
+                train_x(y*nx+x, 1) = y + 2*rand.uniform()-1;
+                if ((x/25+y/25) % 2 == 0)
+                    train_y(y*nx+x) = 0;
+                else
+                    train_y(y*nx+x) = 1;
+            }
+        }
+
+        RandomForestOptions const options = RandomForestOptions()
+                                                   .tree_count(10)
+                                                   .bootstrap_sampling(true)
+                                                   .histogram_bins(64)
+                                                   .n_threads(1);
+        OOBError oob;
+        auto rf = random_forest(train_x, train_y, options, create_visitor(oob));
+        should(oob.oob_err_ < 0.06);
+
+        MultiArray<1, int> pred_y(train_y.shape());
+        rf.predict(train_x, pred_y, 1);
+        size_t errors = 0;
+        for (size_t i = 0; i < (size_t)train_y.size(); ++i)
+            if (pred_y(i) != train_y(i))
+                ++errors;
+        should(errors < (size_t)train_y.size() / 20); // binning cannot fit the noise at the class borders
+
+        try
+        {
+            RandomForestOptions().histogram_bins(300);
+            failTest("no exception thrown");
+        }
+        catch(ContractViolation &)
+        {}
+    }
+
+    void test_deterministic_training()
+    {
+        // Create a (noisy) grid with datapoints and assign classes as in a 4x4 chessboard.
+        size_t const nx = 60;
+        size_t const ny = 60;
+
+        RandomNumberGenerator<MersenneTwister> rand;
+        MultiArray<2, double> train_x(Shape2(nx*ny, 4));
+        MultiArray<1, int> train_y(Shape1(nx*ny));
+        for (size_t y = 0; y < ny; ++y)
+        {
+            for (size_t x = 0; x < nx; ++x)
+            {
+                train_x(y*nx+x, 0) = x + 2*rand.uniform()-1;
+                train_x(y*nx+x, 1) = y + 2*rand.uniform()-1;
+                train_x(y*nx+x, 2) = rand.uniform();
+                train_x(y*nx+x, 3) = x + y + 2*rand.uniform()-1;
+                train_y(y*nx+x) = (x/15+y/15) % 2;
+            }
+        }
+
+        // With fewer trees than threads, the nodes of a tree are split in parallel,
+        // otherwise the trees are trained in parallel.
+        for (int tree_count = 2; tree_count <= 8; tree_count += 6)
+        for (size_t bins = 0; bins <= 64; bins += 64)
+        {
+            std::vector<MultiArray<2, int> > ids;
+            for (int n_threads = 0; n_threads <= 4; n_threads += 4)
+            {
+                RandomForestOptions const options = RandomForestOptions()
+                                                           .tree_count(tree_count)
+                                                           .histogram_bins(bins)
+                                                           .n_threads(n_threads);
+                MersenneTwister randengine(42);
+                auto rf = random_forest(train_x, train_y, options, RFStopVisiting(), randengine);
+                ids.push_back(MultiArray<2, int>(Shape2(nx*ny, tree_count)));
+                rf.leaf_ids(train_x, ids.back(), 1);
+            }
+            should(ids[0] == ids[1]);
+        }
+    }
+
+    void test_chunked_training()
+    {
+        // Create a (noisy) grid with datapoints and assign classes as in a 4x4 chessboard.
+        size_t const nx = 50;
+        size_t const ny = 50;
+
+        RandomNumberGenerator<MersenneTwister> rand;
+        MultiArray<2, double> train_x(Shape2(nx*ny, 5));
+        MultiArray<1, int> train_y(Shape1(nx*ny));
+        for (size_t y = 0; y < ny; ++y)
+        {
+            for (size_t x = 0; x < nx; ++x)
+            {
+                train_x(y*nx+x, 0) = x + 2*rand.uniform()-1;
+                train_x(y*nx+x, 1) = y + 2*rand.uniform()-1;
+                train_x(y*nx+x, 2) = rand.uniform();
+                train_x(y*nx+x, 3) = x + y + 2*rand.uniform()-1;
+                train_x(y*nx+x, 4) = x - y + 2*rand.uniform()-1;
+                train_y(y*nx+x) = (x/13+y/13) % 2;
+            }
+        }
+
+        // The chunks do not divide the array shape.
+        ChunkedArrayLazy<2, double> chunked_x(train_x.shape(), Shape2(256, 2));
+        chunked_x.commitSubarray(Shape2(), train_x);
+
+        // With all rows in the threshold sample, the bins and therefore the trees are the
+        // same as for the in-memory features. Without a number of bins, 256 bins are used.
+        for (size_t bins = 0; bins <= 32; bins += 32)
+        {
+            MersenneTwister randengine0(42);
+            auto rf0 = random_forest(train_x, train_y,
+                                     RandomForestOptions().tree_count(4).histogram_bins(bins > 0 ? bins : 256),
+                                     RFStopVisiting(), randengine0);
+            MersenneTwister randengine1(42);
+            auto rf1 = random_forest(chunked_x, train_y,
+                                     RandomForestOptions().tree_count(4).histogram_bins(bins).n_threads(2),
+                                     RFStopVisiting(), randengine1);
+            should((std::is_same<decltype(rf1), decltype(rf0)>::value));
+
+            MultiArray<2, int> ids0(Shape2(nx*ny, 4)), ids1(Shape2(nx*ny, 4));
+            rf0.leaf_ids(train_x, ids0);
+            rf1.leaf_ids(train_x, ids1);
+            should(ids0 == ids1);
+
+            MultiArray<1, int> pred(Shape1(nx*ny));
+            rf1.predict(train_x, pred);
+            size_t train_err = 0;
+            for (size_t i = 0; i < (size_t)pred.size(); ++i)
+                if (pred(i) != train_y(i))
+                    ++train_err;
+            should(train_err < (size_t)pred.size() / 20);
+        }
+    }
+
+#ifndef _WIN32
+    void test_binary_export()
+    {
+        typedef MultiArray<2, float> Features;
+        typedef MultiArray<1, UInt32> Labels;
+
+        // Create a (noisy) grid with datapoints and assign three classes.
+        size_t const nx = 40;
+        size_t const ny = 40;
+        RandomNumberGenerator<MersenneTwister> rand;
+        Features train_x(Shape2(nx*ny, 3));
+        Labels train_y(Shape1(nx*ny));
+        for (size_t y = 0; y < ny; ++y)
+        {
+            for (size_t x = 0; x < nx; ++x)
+            {
+                train_x(y*nx+x, 0) = x + 2*rand.uniform()-1;
+                train_x(y*nx+x, 1) = y + 2*rand.uniform()-1;
+                train_x(y*nx+x, 2) = rand.uniform();
+                train_y(y*nx+x) = 3 + (x/10+y/10) % 3;
+            }
+        }
+        auto rf = random_forest(train_x, train_y, RandomForestOptions().tree_count(10));
+
+        MultiArray<2, double> probs(Shape2(nx*ny, 3)), mapped_probs(Shape2(nx*ny, 3));
+        Labels pred(Shape1(nx*ny)), mapped_pred(Shape1(nx*ny));
+        rf.predict_probabilities(train_x, probs);
+        rf.predict(train_x, pred);
+
+        random_forest_export_binary(rf, "rf_out.vrf");
+        {
+            MappedRandomForest<Features, Labels> mapped("rf_out.vrf");
+            shouldEqual(mapped.num_trees(), rf.num_trees());
+            shouldEqual(mapped.num_nodes(), rf.num_nodes());
+            shouldEqual(mapped.num_classes(), 3);
+            shouldEqual(mapped.num_features(), 3);
+            shouldEqual(mapped.class_label(0), 3);
+            should(!mapped.half_thresholds());
+            mapped.predict_probabilities(train_x, mapped_probs);
+            mapped.predict(train_x, mapped_pred, 2);
+            should(mapped_probs == probs);
+            should(mapped_pred == pred);
+        }
+
+        // Half precision thresholds can only change instances close to a threshold.
+        random_forest_export_binary(rf, "rf_out_half.vrf", true);
+        {
+            MappedRandomForest<Features, Labels> mapped("rf_out_half.vrf");
+            should(mapped.half_thresholds());
+            mapped.predict(train_x, mapped_pred);
+            size_t diff = 0;
+            for (size_t i = 0; i < (size_t)pred.size(); ++i)
+                if (pred(i) != mapped_pred(i))
+                    ++diff;
+            should(diff < (size_t)pred.size() / 100);
+        }
+
+        // Wrong feature type.
+        try
+        {
+            MappedRandomForest<MultiArray<2, double>, Labels> mapped("rf_out.vrf");
+            failTest("MappedRandomForest(): no exception for wrong feature type.");
+        }
+        catch (PreconditionViolation &)
+        {}
+
+        // Corrupt files must be rejected by the constructor.
+        std::vector<char> bytes;
+        {
+            std::ifstream in("rf_out.vrf", std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        typedef rf3::detail::RFBinaryHeader Header;
+        Header header;
+        header.read(bytes.data());
+        for (int corruption = 0; corruption < 5; ++corruption)
+        {
+            std::vector<char> bad(bytes);
+            Header bad_header(header);
+            Int64 * children = reinterpret_cast<Int64 *>(&bad[header.offsets[Header::Children]]);
+            Int64 * roots = reinterpret_cast<Int64 *>(&bad[header.offsets[Header::Roots]]);
+            if (corruption == 0)
+                bad_header.offsets[Header::Responses] = header.file_size;
+            else if (corruption == 1)
+                bad_header.offsets[Header::Dims] += 4;
+            else if (corruption == 2)
+                children[roots[0]] = header.num_nodes;
+            else if (corruption == 3)
+                children[header.num_nodes - 1] = -(Int64)header.num_leaves;
+            else
+                roots[1] = -1;
+            bad_header.write(bad.data());
+            {
+                std::ofstream out("rf_out_bad.vrf", std::ios::binary | std::ios::trunc);
+                out.write(bad.data(), bad.size());
+            }
+            try
+            {
+                MappedRandomForest<Features, Labels> mapped("rf_out_bad.vrf");
+                failTest("MappedRandomForest(): no exception for corrupt file.");
+            }
+            catch (PreconditionViolation &)
+            {}
+        }
+
+        // Check the half precision conversion.
+        float const values[] = { 0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 6.1035156e-05f, 5.9604645e-08f, 1e-3f, 0.1f, 100000.0f };
+        for (auto v : values)
+        {
+            float const back = rf3::detail::rf_half_to_float(rf3::detail::rf_float_to_half(v));
+            if (std::abs(v) > 65504.0f)
+                should(std::isinf(back));
+            else
+                should(std::abs(back - v) <= std::abs(v)*1e-3f);
+        }
+    }
+#endif
+
 #ifdef HasHDF5
     void test_import()
     {
@@ -268,6 +663,14 @@ struct RandomForestTestSuite : public test_suite
         add(testCase(&RandomForestTests::test_default_rf));
         add(testCase(&RandomForestTests::test_oob_visitor));
         add(testCase(&RandomForestTests::test_var_importance_visitor));
+        add(testCase(&RandomForestTests::test_compiled_prediction));
+        add(testCase(&RandomForestTests::test_compiled_prediction_blocks));
+        add(testCase(&RandomForestTests::test_histogram_training));
+        add(testCase(&RandomForestTests::test_deterministic_training));
+        add(testCase(&RandomForestTests::test_chunked_training));
+#ifndef _WIN32
+        add(testCase(&RandomForestTests::test_binary_export));
+#endif
 #ifdef HasHDF5
         add(testCase(&RandomForestTests::test_import));
         add(testCase(&RandomForestTests::test_export));
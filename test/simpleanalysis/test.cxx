@@ -1679,6 +1679,64 @@ struct WatershedsTest
 #endif /* #if 0 */
     }
 
+    void watershedsQueueTest()
+    {
+        MultiArray<2, UInt8> img8(img);
+        Image imgr(img8);  // rounded, so that ties are the same as in img8
+        IntImage seeds(img.shape()), res(img.shape()), res2(img.shape());
+        generateWatershedSeeds(img, seeds, IndirectNeighborhood, SeedOptions().extendedMinima());
+
+        WatershedOptions options[] = {
+            WatershedOptions(),
+            WatershedOptions().keepContours(),
+            WatershedOptions().stopAtThreshold(45.0),
+            WatershedOptions().biasLabel(4, 0.8)
+        };
+
+        for(int k = 0; k < 4; ++k)
+        {
+            res = seeds;
+            int count = watershedsMultiArray(img8, res, IndirectNeighborhood, WatershedOptions(options[k]).heapQueue());
+            shouldEqual(count, 5);
+
+            // 8-bit data use a hierarchical queue by default
+            res2 = seeds;
+            shouldEqual(watershedsMultiArray(img8, res2, IndirectNeighborhood, options[k]), count);
+            should(res == res2);
+
+            // enough levels to separate all (integer) values
+            res2 = seeds;
+            shouldEqual(watershedsMultiArray(imgr, res2, IndirectNeighborhood, WatershedOptions(options[k]).hierarchicalQueue(256)), count);
+            should(res == res2);
+        }
+
+        // coarse quantization still assigns every pixel to a region
+        res = seeds;
+        shouldEqual(watershedsMultiArray(img, res, IndirectNeighborhood, WatershedOptions().hierarchicalQueue(4)), 5);
+        should(res.all());
+
+        // the biased costs exceed the range of the data, but must still be ordered after the unbiased ones
+        Image line(Shape2(7,1), 10.0);
+        line(0,0) = line(6,0) = 0.0;
+        IntImage lineSeeds(line.shape()), lineRes(line.shape());
+        lineSeeds(0,0) = 1;
+        lineSeeds(6,0) = 2;
+        WatershedOptions lineOptions[] = {
+            WatershedOptions().biasLabel(1, 2.0).heapQueue(),
+            WatershedOptions().biasLabel(1, 2.0).hierarchicalQueue(256)
+        };
+        for(int k = 0; k < 2; ++k)
+        {
+            lineRes = lineSeeds;
+            shouldEqual(watershedsMultiArray(line, lineRes, DirectNeighborhood, lineOptions[k]), 2);
+            // the seed's neighbor is labeled when it is pushed, the rest is flooded from the unbiased seed
+            shouldEqual(lineRes(0,0), 1);
+            shouldEqual(lineRes(1,0), 1);
+            for(int x = 2; x < 7; ++x)
+                shouldEqual(lineRes(x,0), 2);
+        }
+    }
+
     void watersheds4Test()
     {
         IntImage res(img.shape()), res2(img.shape());
@@ -2488,6 +2546,7 @@ struct SimpleAnalysisTestSuite
         add( testCase( &LocalMinMaxTest::plateauWithHolesTest));
         add( testCase( &WatershedsTest::watershedsTest));
         add( testCase( &WatershedsTest::watersheds4Test));
+        add( testCase( &WatershedsTest::watershedsQueueTest));
         add( testCase( &RegionGrowingTest::voronoiTest));
         add( testCase( &RegionGrowingTest::voronoiWithBorderTest));
         add( testCase( &InterestOperatorTest::cornerResponseFunctionTest));
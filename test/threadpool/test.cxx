@@ -37,7 +37,13 @@
 #include <vigra/threading.hxx>
 #include <vigra/threadpool.hxx>
 #include <vigra/timing.hxx>
+#include <vigra/union_find.hxx>
+#include <random>
 #include <numeric>
+#include <list>
+#include <sstream>
+#include <iterator>
+#include <chrono>
 
 using namespace vigra;
 
@@ -150,6 +156,183 @@ struct ThreadPoolTests
         should(caught);
     }
 
+    void test_threadpool_enqueue_from_task()
+    {
+        // tasks enqueued from within a worker go to the worker's own queue
+        // and must be picked up (or stolen) like all other tasks
+        size_t const n = 100, m = 100;
+        std::vector<int> v(n*m, 0);
+        ThreadPool pool(4);
+        for (size_t i = 0; i < n; ++i)
+        {
+            pool.enqueue(
+                [&pool, &v, i, m](size_t /*thread_id*/)
+                {
+                    for (size_t k = 0; k < m; ++k)
+                        pool.enqueue(
+                            [&v, i, k, m](size_t /*thread_id*/)
+                            {
+                                v[i*m+k] = 1;
+                            }
+                        );
+                }
+            );
+        }
+        pool.waitFinished();
+        shouldEqual(std::accumulate(v.begin(), v.end(), 0), (int)(n*m));
+    }
+
+    void test_parallel_foreach_forward_iterator()
+    {
+        size_t const n = 2000;
+        std::list<int> input(n);
+        std::iota(input.begin(), input.end(), 0);
+        std::vector<int> v_out(n, -1);
+        parallel_foreach(4, input.begin(), input.end(),
+            [&v_out](size_t /*thread_id*/, int x)
+            {
+                v_out[x] = x;
+            }
+        );
+        for (size_t i = 0; i < n; ++i)
+            shouldEqual(v_out[i], (int)i);
+    }
+
+    void test_parallel_foreach_input_iterator()
+    {
+        size_t const n = 500;
+        std::stringstream s;
+        for (size_t i = 0; i < n; ++i)
+            s << i << " ";
+        std::vector<int> v_out(n, -1);
+        parallel_foreach(4, std::istream_iterator<int>(s), std::istream_iterator<int>(),
+            [&v_out](size_t /*thread_id*/, int x)
+            {
+                v_out[x] = x;
+            }
+        );
+        for (size_t i = 0; i < n; ++i)
+            shouldEqual(v_out[i], (int)i);
+    }
+
+    void test_parallel_foreach_nested()
+    {
+        // nested parallel regions run on the workers of the enclosing pool,
+        // waiting workers execute pending tasks instead of blocking
+        size_t const n_threads = 4;
+        size_t const n = 50, m = 200;
+        std::vector<int> v(n*m, 0);
+        ThreadPool pool(n_threads);
+        parallel_foreach(pool, n,
+            [&v, m](size_t /*thread_id*/, size_t i)
+            {
+                parallel_foreach(n_threads, m,
+                    [&v, i, m](size_t thread_id, size_t k)
+                    {
+                        should(thread_id < n_threads);
+                        v[i*m+k] = (int)k;
+                    }
+                );
+            }
+        );
+        for (size_t i = 0; i < n; ++i)
+            for (size_t k = 0; k < m; ++k)
+                shouldEqual(v[i*m+k], (int)k);
+
+        // a nested region requesting fewer threads than the enclosing pool
+        // has runs sequentially, so that thread indices stay in range
+        std::vector<size_t> counts(n, 0);
+        parallel_foreach(pool, n,
+            [&counts, m](size_t /*thread_id*/, size_t i)
+            {
+                std::vector<size_t> partial(2, 0);
+                parallel_foreach(2, m,
+                    [&partial](size_t thread_id, size_t)
+                    {
+                        ++partial[thread_id];
+                    }
+                );
+                counts[i] = partial[0] + partial[1];
+            }
+        );
+        for (size_t i = 0; i < n; ++i)
+            shouldEqual(counts[i], m);
+    }
+
+    void test_parallel_foreach_nested_unrelated_task()
+    {
+        // a worker waiting for a nested region only helps with the tasks of
+        // that region: an unrelated task enqueued meanwhile must not be run
+        // inside the wait
+        static thread_local bool waiting = false;
+        ThreadPool pool(2);
+        threading::future<void> unrelated;
+        threading::mutex unrelated_mutex;
+        bool nested = false;
+
+        pool.enqueue(
+            [&](size_t /*thread_id*/)
+            {
+                waiting = true;
+                parallel_foreach(2, 2,
+                    [&](size_t /*thread_id*/, size_t)
+                    {
+                        if (waiting)
+                        {
+                            threading::this_thread::sleep_for(std::chrono::milliseconds(20));
+                            return;
+                        }
+                        {
+                            threading::lock_guard<threading::mutex> lock(unrelated_mutex);
+                            unrelated = pool.enqueue(
+                                [&nested](size_t /*thread_id*/)
+                                {
+                                    nested = waiting;
+                                }
+                            );
+                        }
+                        threading::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    }
+                );
+                waiting = false;
+            }
+        ).get();
+        pool.waitFinished();
+        {
+            threading::lock_guard<threading::mutex> lock(unrelated_mutex);
+            if (unrelated.valid())
+                unrelated.get();
+        }
+        should(!nested);
+    }
+
+    void test_parallel_foreach_nested_exception()
+    {
+        std::string exception_string = "the test exception";
+        bool caught = false;
+        try
+        {
+            parallel_foreach(4, 20,
+                [&exception_string](size_t /*thread_id*/, size_t i)
+                {
+                    parallel_foreach(4, 100,
+                        [&exception_string, i](size_t /*thread_id*/, size_t k)
+                        {
+                            if (i == 7 && k == 50)
+                                throw std::runtime_error(exception_string);
+                        }
+                    );
+                }
+            );
+        }
+        catch (std::runtime_error & ex)
+        {
+            if (ex.what() == exception_string)
+                caught = true;
+        }
+        should(caught);
+    }
+
     void test_parallel_foreach_sum()
     {
         size_t const n_threads = 4;
@@ -209,6 +392,85 @@ struct ThreadPoolTests
         shouldEqual(sum, (n*(n-1))/2);
     }
 
+    void test_parallel_reduce()
+    {
+        size_t const n = 100000;
+        std::vector<int> input(n);
+        for (size_t i = 0; i < n; ++i)
+            input[i] = i % 256;
+
+        for (int n_threads : {0, 1, 4})
+        {
+            std::vector<size_t> histogram =
+                parallel_reduce(n_threads, input.begin(), input.end(),
+                    std::vector<size_t>(256, 0),
+                    [](size_t /*thread_id*/, std::vector<size_t> & h, int x)
+                    {
+                        ++h[x];
+                    },
+                    [](std::vector<size_t> & h, std::vector<size_t> const & other)
+                    {
+                        for (size_t k = 0; k < h.size(); ++k)
+                            h[k] += other[k];
+                    }
+                );
+            shouldEqual(std::accumulate(histogram.begin(), histogram.end(), (size_t)0), n);
+            for (size_t k = 0; k < 256; ++k)
+                shouldEqual(histogram[k], n / 256 + (k < n % 256 ? 1 : 0));
+        }
+
+        ThreadPool pool(4);
+        long sum = parallel_reduce(pool, (std::ptrdiff_t)n, 0L,
+            [](size_t /*thread_id*/, long & s, std::ptrdiff_t i)
+            {
+                s += i;
+            },
+            [](long & s, long other)
+            {
+                s += other;
+            }
+        );
+        shouldEqual(sum, (long)(n*(n-1)/2));
+    }
+
+    void test_parallel_exclusive_scan()
+    {
+        size_t const n = 100003;
+        std::vector<int> input(n);
+        for (size_t i = 0; i < n; ++i)
+            input[i] = (i*7) % 13;
+        std::vector<int> expected(n);
+        int total = 5;
+        for (size_t i = 0; i < n; ++i)
+        {
+            expected[i] = total;
+            total += input[i];
+        }
+
+        for (int n_threads : {0, 1, 4})
+        {
+            std::vector<int> out(n, -1);
+            int res = parallel_exclusive_scan(n_threads, input.begin(), input.end(), out.begin(), 5);
+            shouldEqual(res, total);
+            shouldEqualSequence(out.begin(), out.end(), expected.begin());
+        }
+
+        // in-place scan with an existing pool
+        ThreadPool pool(4);
+        std::vector<int> inplace(input);
+        int res = parallel_exclusive_scan(pool, inplace.begin(), inplace.end(), inplace.begin(), 5);
+        shouldEqual(res, total);
+        shouldEqualSequence(inplace.begin(), inplace.end(), expected.begin());
+
+        // short and empty ranges
+        std::vector<int> small_out(3);
+        shouldEqual(parallel_exclusive_scan(pool, input.begin(), input.begin()+3, small_out.begin(), 0,
+                                            std::plus<int>()),
+                    input[0] + input[1] + input[2]);
+        shouldEqual(small_out[2], input[0] + input[1]);
+        shouldEqual(parallel_exclusive_scan(pool, input.begin(), input.begin(), small_out.begin(), 42), 42);
+    }
+
     void test_parallel_foreach_timing()
     {
         size_t const n_threads = 4;
@@ -231,6 +493,68 @@ struct ThreadPoolTests
         size_t const sum = std::accumulate(results.begin(), results.end(), 0);
         shouldEqual(sum, n);
     }
+    void test_concurrent_union_find()
+    {
+        size_t const n = 100000;
+        size_t const n_unions = 60000;
+        std::mt19937 rng(42);
+        std::vector<std::pair<int, int> > unions(n_unions);
+        for(size_t k = 0; k < n_unions; ++k)
+            unions[k] = std::make_pair((int)(rng() % n), (int)(rng() % n));
+
+        UnionFindArray<int> sequential(n-1);
+        for(size_t k = 0; k < n_unions; ++k)
+            sequential.makeUnion(unions[k].first, unions[k].second);
+        int sequential_max = sequential.makeContiguous();
+
+        ConcurrentUnionFindArray<int> concurrent(n);
+        shouldEqual(concurrent.size(), (int)n);
+        parallel_foreach(4, n_unions,
+            [&](size_t /*thread_id*/, size_t k)
+            {
+                concurrent.makeUnion(unions[k].first, unions[k].second);
+            }
+        );
+        // before makeContiguous(), the label is the smallest index of the set
+        for(size_t k = 0; k < n; ++k)
+            shouldEqual(concurrent.findLabel(sequential.findIndex(k)), (int)sequential.findIndex(k));
+
+        shouldEqual(concurrent.makeContiguous(4), sequential_max);
+        for(size_t k = 0; k < n; ++k)
+            shouldEqual(concurrent.findLabel(k), sequential.findLabel(k));
+    }
+
+    void test_concurrent_union_find_timing()
+    {
+        size_t const n_threads = 4;
+        size_t const n = 10000000;
+        std::mt19937 rng(42);
+        std::vector<std::pair<unsigned int, unsigned int> > unions(n);
+        for(size_t k = 0; k < n; ++k)
+            unions[k] = std::make_pair((unsigned int)(rng() % n), (unsigned int)(rng() % n));
+
+        USETICTOC;
+
+        TIC;
+        UnionFindArray<unsigned int> sequential(n-1);
+        for(size_t k = 0; k < n; ++k)
+            sequential.makeUnion(unions[k].first, unions[k].second);
+        unsigned int sequential_max = sequential.makeContiguous();
+        std::cout << "UnionFindArray took " << TOCS << std::endl;
+
+        TIC;
+        ConcurrentUnionFindArray<unsigned int> concurrent(n);
+        parallel_foreach(n_threads, n,
+            [&](size_t /*thread_id*/, size_t k)
+            {
+                concurrent.makeUnion(unions[k].first, unions[k].second);
+            }
+        );
+        unsigned int concurrent_max = concurrent.makeContiguous(n_threads);
+        std::cout << "ConcurrentUnionFindArray took " << TOCS << std::endl;
+
+        shouldEqual(concurrent_max, sequential_max);
+    }
 };
 
 struct ThreadPoolTestSuite : public test_suite
@@ -244,11 +568,21 @@ struct ThreadPoolTestSuite : public test_suite
         add(testCase(&ThreadPoolTests::test_parallel_foreach));
         add(testCase(&ThreadPoolTests::test_parallel_foreach_exception));
         add(testCase(&ThreadPoolTests::test_parallel_foreach_sum_serial));
+        add(testCase(&ThreadPoolTests::test_parallel_foreach_forward_iterator));
+        add(testCase(&ThreadPoolTests::test_parallel_foreach_input_iterator));
 #if !defined(USE_BOOST_THREAD) || \
     defined(BOOST_THREAD_PROVIDES_VARIADIC_THREAD)
+        add(testCase(&ThreadPoolTests::test_threadpool_enqueue_from_task));
+        add(testCase(&ThreadPoolTests::test_parallel_foreach_nested));
+        add(testCase(&ThreadPoolTests::test_parallel_foreach_nested_unrelated_task));
+        add(testCase(&ThreadPoolTests::test_parallel_foreach_nested_exception));
         add(testCase(&ThreadPoolTests::test_parallel_foreach_sum));
+        add(testCase(&ThreadPoolTests::test_parallel_reduce));
+        add(testCase(&ThreadPoolTests::test_parallel_exclusive_scan));
         add(testCase(&ThreadPoolTests::test_parallel_foreach_sum_auto));
         add(testCase(&ThreadPoolTests::test_parallel_foreach_timing));
+        add(testCase(&ThreadPoolTests::test_concurrent_union_find));
+        add(testCase(&ThreadPoolTests::test_concurrent_union_find_timing));
 #endif
     }
 };
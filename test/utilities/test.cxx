@@ -1279,6 +1279,112 @@ struct CompressionTest
 
         shouldEqualSequence(data.begin(), data.end(), decompressed.begin());
     }
+
+    void testZSTD()
+    {
+        ArrayVector<char> compressed;
+    #ifdef HasZSTD
+        should(isCompressionAvailable(ZSTD));
+        CompressionMethod methods[] = { ZSTD_FAST, ZSTD, ZSTD_BEST };
+        for(int k=0; k<3; ++k)
+        {
+            compress(data.begin(), data.size(), compressed, methods[k]);
+            should(compressed.size() < data.size() / 100);
+
+            ArrayVector<char> decompressed(data.size());
+
+            uncompress(compressed.begin(), compressed.size(),
+                       decompressed.begin(), decompressed.size(), methods[k]);
+
+            shouldEqualSequence(data.begin(), data.end(), decompressed.begin());
+        }
+    #else
+        should(!isCompressionAvailable(ZSTD));
+        try
+        {
+            compress(data.begin(), data.size(), compressed, ZSTD);
+            failTest("missing ZSTD did not throw exception.");
+        }
+        catch(ContractViolation & c)
+        {
+            std::string expected("\nPrecondition violation!\ncompress(): VIGRA was compiled without ZSTD compression.");
+            std::string message(c.what());
+            should(0 == expected.compare(message.substr(0,expected.size())));
+        }
+    #endif
+    }
+
+    void testShuffle()
+    {
+        // 3 elements of 4 bytes plus 2 trailing bytes
+        char source[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 },
+             expected[] = { 0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, 12, 13 },
+             filtered[14], reverted[14];
+        applyCompressionFilter(source, filtered, 14, SHUFFLE, 4);
+        shouldEqualSequence(filtered, filtered+14, expected);
+        revertCompressionFilter(filtered, reverted, 14, SHUFFLE, 4);
+        shouldEqualSequence(reverted, reverted+14, source);
+    }
+
+    void testBitshuffle()
+    {
+        // 16 elements of 2 bytes: the bit planes of the low bytes come first,
+        // each plane holding 16 bits (2 bytes)
+        ArrayVector<UInt16> source(16);
+        for(int k=0; k<16; ++k)
+            source[k] = UInt16(k == 3 ? 0x0101 : 0x8000);
+        ArrayVector<unsigned char> filtered(32);
+        applyCompressionFilter((char const *)source.data(), (char *)filtered.data(), 32, BITSHUFFLE, 2);
+        for(int plane=0; plane<16; ++plane)
+        {
+            unsigned int bits = filtered[2*plane] | (filtered[2*plane+1] << 8);
+            if(plane == 0 || plane == 8)
+                shouldEqual(bits, 1u << 3);  // only element 3 has bits 0 and 8 set
+            else if(plane == 15)
+                shouldEqual(bits, 0xffffu & ~(1u << 3));
+            else
+                shouldEqual(bits, 0u);
+        }
+
+        // round trip for all element sizes and odd lengths
+        ArrayVector<char> random(1003), tmp(1003), back(1003);
+        for(unsigned int k=0; k<random.size(); ++k)
+            random[k] = char((k*7919) ^ (k >> 3));
+        CompressionFilter filters[] = { NO_FILTER, SHUFFLE, BITSHUFFLE };
+        for(int f=0; f<3; ++f)
+        {
+            for(std::size_t elementSize=1; elementSize<=8; ++elementSize)
+            {
+                applyCompressionFilter(random.data(), tmp.data(), random.size(), filters[f], elementSize);
+                revertCompressionFilter(tmp.data(), back.data(), random.size(), filters[f], elementSize);
+                shouldEqualSequence(random.begin(), random.end(), back.begin());
+            }
+        }
+    }
+
+    void testFilteredCompression()
+    {
+        // slowly varying float data hardly compresses without a filter
+        ArrayVector<float> values(100000);
+        for(unsigned int k=0; k<values.size(); ++k)
+            values[k] = 100.0f + 0.01f*k;
+        std::size_t size = values.size()*sizeof(float);
+
+        ArrayVector<char> plain, shuffled, bitshuffled;
+        compress((char const *)values.data(), size, plain, LZ4);
+        compress((char const *)values.data(), size, shuffled, LZ4, SHUFFLE, sizeof(float));
+        compress((char const *)values.data(), size, bitshuffled, LZ4, BITSHUFFLE, sizeof(float));
+        should(shuffled.size() < plain.size() / 2);
+        should(bitshuffled.size() < plain.size() / 2);
+
+        ArrayVector<float> decompressed(values.size());
+        uncompress(bitshuffled.data(), bitshuffled.size(),
+                   (char *)decompressed.data(), size, LZ4, BITSHUFFLE, sizeof(float));
+        shouldEqualSequence(values.begin(), values.end(), decompressed.begin());
+        uncompress(shuffled.data(), shuffled.size(),
+                   (char *)decompressed.data(), size, LZ4, SHUFFLE, sizeof(float));
+        shouldEqualSequence(values.begin(), values.end(), decompressed.begin());
+    }
 };
 
 
@@ -1545,6 +1651,10 @@ struct UtilitiesTestSuite
         add( testCase( &CompressionTest::testZLIB));
         add( testCase( &CompressionTest::testLZ4));
         add( testCase( &CompressionTest::testNoCompression));
+        add( testCase( &CompressionTest::testZSTD));
+        add( testCase( &CompressionTest::testShuffle));
+        add( testCase( &CompressionTest::testBitshuffle));
+        add( testCase( &CompressionTest::testFilteredCompression));
 
         add( testCase( &AnyTest::test));
     }
@@ -40,6 +40,7 @@
 
 #include "vigra/labelvolume.hxx"
 #include "vigra/multi_labeling.hxx"
+#include "vigra/random.hxx"
 
 using namespace vigra;
 
@@ -457,6 +458,58 @@ struct VolumeLabelingTest
         shouldEqualSequence(res.begin(), res.end(), out6);
     }
 
+    template <unsigned int N, class S>
+    static void checkScanlineLabeling(MultiArrayView<N, int, S> const & data)
+    {
+        MultiArray<N, int> res(data.shape()), ref(data.shape());
+        for(int k=0; k<2; ++k)
+        {
+            NeighborhoodType neighborhood = k == 0 ? DirectNeighborhood : IndirectNeighborhood;
+            GridGraph<N, undirected_tag> graph(data.shape(), neighborhood);
+
+            int count = lemon_graph::labelGraph(graph, data, ref, std::equal_to<int>());
+            shouldEqual(labelMultiArray(data, res, neighborhood), count);
+            should(res == ref);
+
+            count = lemon_graph::labelGraphWithBackground(graph, data, ref, 1, std::equal_to<int>());
+            shouldEqual(labelMultiArrayWithBackground(data, res, neighborhood, 1), count);
+            should(res == ref);
+        }
+    }
+
+    void labelingScanlineTest()
+    {
+        // labelMultiArray() uses run-based labeling for 1D, 2D, and 3D arrays
+        // with std::equal_to, compare with the graph-based algorithm
+        RandomMT19937 random(3);
+        for(int k=0; k<50; ++k)
+        {
+            int range = 1 + k % 4;
+
+            MultiArray<1, int> a1(Shape1(1 + random.uniformInt(30)));
+            for(auto & v : a1)
+                v = random.uniformInt(range);
+            checkScanlineLabeling(a1);
+
+            MultiArray<2, int> a2(Shape2(1 + random.uniformInt(30), 1 + random.uniformInt(30)));
+            for(auto & v : a2)
+                v = random.uniformInt(range);
+            checkScanlineLabeling(a2);
+            checkScanlineLabeling(a2.transpose());
+
+            MultiArray<3, int> a3(Shape3(1 + random.uniformInt(12), 1 + random.uniformInt(12),
+                                         1 + random.uniformInt(12)));
+            for(auto & v : a3)
+                v = random.uniformInt(range);
+            checkScanlineLabeling(a3);
+            checkScanlineLabeling(a3.stridearray(Shape3(2, 1, 1)));
+        }
+
+        // empty arrays
+        MultiArray<2, int> empty, emptyRes;
+        shouldEqual(labelMultiArray(empty, emptyRes), 0);
+    }
+
     IntVolume vol1, vol2, vol3;
     DoubleVolume vol4, vol5, vol6;
 };
@@ -479,6 +532,7 @@ struct VolumeLabelingTestSuite
         add( testCase( &VolumeLabelingTest::labelingTwentySixTest3));
         add( testCase( &VolumeLabelingTest::labelingTwentySixWithBackgroundTest1));
         add( testCase( &VolumeLabelingTest::labelingAllTest));
+        add( testCase( &VolumeLabelingTest::labelingScanlineTest));
     }
 };
 